@@ -0,0 +1,230 @@
+/**
+ * @file allocation_hooks.h
+ * @brief Replacement global operator new/delete that count heap activity.
+ *
+ * Include this header in exactly one translation unit of the program to
+ * opt in; it defines the replaceable allocation functions, which must not
+ * be defined more than once. Then enable the counting per session:
+ *
+ * @code
+ * // allocation_hooks.cpp
+ * #include "allocation_hooks.h"
+ *
+ * SessionOptions options;
+ * options.trackAllocations = true;
+ * Instrumentor::get().beginSession("Session", "trace.json", options);
+ * @endcode
+ *
+ * Each allocation and free increments thread-local counters only; nothing
+ * is allocated, locked or recorded in the hooks. InstrumentationTimer reads
+ * the counters when it starts and stops and reports the allocations made
+ * while it was the innermost open timer. Memory obtained directly from
+ * malloc is not counted.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+#include "instrumentor.h"
+
+namespace instrumentation::detail
+{
+inline void *allocateRaw(std::size_t size, std::size_t alignment)
+{
+    if (size == 0)
+        size = 1;
+    if (alignment <= __STDCPP_DEFAULT_NEW_ALIGNMENT__)
+        return std::malloc(size);
+#if defined(_MSC_VER)
+    return ::_aligned_malloc(size, alignment);
+#else
+    // aligned_alloc requires the size to be a multiple of the alignment
+    return std::aligned_alloc(alignment,
+                              (size + alignment - 1) / alignment * alignment);
+#endif
+}
+
+inline void freeRaw(void *pointer, std::size_t alignment)
+{
+    if (pointer == nullptr)
+        return;
+    noteFree();
+#if defined(_MSC_VER)
+    if (alignment > __STDCPP_DEFAULT_NEW_ALIGNMENT__)
+    {
+        ::_aligned_free(pointer);
+        return;
+    }
+#else
+    (void)alignment;
+#endif
+    std::free(pointer);
+}
+
+/**
+ * @brief operator new semantics: retry through the new-handler, throw
+ * std::bad_alloc when there is none.
+ */
+inline void *allocateTracked(std::size_t size, std::size_t alignment)
+{
+    for (;;)
+    {
+        if (void *pointer = allocateRaw(size, alignment))
+        {
+            noteAllocation(size);
+            return pointer;
+        }
+        const std::new_handler handler = std::get_new_handler();
+        if (handler == nullptr)
+            throw std::bad_alloc();
+        handler();
+    }
+}
+
+inline void *allocateTrackedNoThrow(std::size_t size,
+                                    std::size_t alignment) noexcept
+{
+    try
+    {
+        return allocateTracked(size, alignment);
+    }
+    catch (...)
+    {
+        return nullptr;
+    }
+}
+
+static const bool allocationHooksRegistered = [] {
+    allocationHooksInstalled.store(true);
+    return true;
+}();
+} // namespace instrumentation::detail
+
+void *operator new(std::size_t size)
+{
+    return instrumentation::detail::allocateTracked(
+        size, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+}
+
+void *operator new[](std::size_t size)
+{
+    return instrumentation::detail::allocateTracked(
+        size, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+}
+
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept
+{
+    return instrumentation::detail::allocateTrackedNoThrow(
+        size, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+}
+
+void *operator new[](std::size_t size, const std::nothrow_t &) noexcept
+{
+    return instrumentation::detail::allocateTrackedNoThrow(
+        size, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+}
+
+void *operator new(std::size_t size, std::align_val_t alignment)
+{
+    return instrumentation::detail::allocateTracked(
+        size, static_cast<std::size_t>(alignment));
+}
+
+void *operator new[](std::size_t size, std::align_val_t alignment)
+{
+    return instrumentation::detail::allocateTracked(
+        size, static_cast<std::size_t>(alignment));
+}
+
+void *operator new(std::size_t size, std::align_val_t alignment,
+                   const std::nothrow_t &) noexcept
+{
+    return instrumentation::detail::allocateTrackedNoThrow(
+        size, static_cast<std::size_t>(alignment));
+}
+
+void *operator new[](std::size_t size, std::align_val_t alignment,
+                     const std::nothrow_t &) noexcept
+{
+    return instrumentation::detail::allocateTrackedNoThrow(
+        size, static_cast<std::size_t>(alignment));
+}
+
+void operator delete(void *pointer) noexcept
+{
+    instrumentation::detail::freeRaw(pointer,
+                                     __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+}
+
+void operator delete[](void *pointer) noexcept
+{
+    instrumentation::detail::freeRaw(pointer,
+                                     __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+}
+
+void operator delete(void *pointer, std::size_t) noexcept
+{
+    instrumentation::detail::freeRaw(pointer,
+                                     __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+}
+
+void operator delete[](void *pointer, std::size_t) noexcept
+{
+    instrumentation::detail::freeRaw(pointer,
+                                     __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+}
+
+void operator delete(void *pointer, const std::nothrow_t &) noexcept
+{
+    instrumentation::detail::freeRaw(pointer,
+                                     __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+}
+
+void operator delete[](void *pointer, const std::nothrow_t &) noexcept
+{
+    instrumentation::detail::freeRaw(pointer,
+                                     __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+}
+
+void operator delete(void *pointer, std::align_val_t alignment) noexcept
+{
+    instrumentation::detail::freeRaw(pointer,
+                                     static_cast<std::size_t>(alignment));
+}
+
+void operator delete[](void *pointer, std::align_val_t alignment) noexcept
+{
+    instrumentation::detail::freeRaw(pointer,
+                                     static_cast<std::size_t>(alignment));
+}
+
+void operator delete(void *pointer, std::size_t,
+                     std::align_val_t alignment) noexcept
+{
+    instrumentation::detail::freeRaw(pointer,
+                                     static_cast<std::size_t>(alignment));
+}
+
+void operator delete[](void *pointer, std::size_t,
+                       std::align_val_t alignment) noexcept
+{
+    instrumentation::detail::freeRaw(pointer,
+                                     static_cast<std::size_t>(alignment));
+}
+
+void operator delete(void *pointer, std::align_val_t alignment,
+                     const std::nothrow_t &) noexcept
+{
+    instrumentation::detail::freeRaw(pointer,
+                                     static_cast<std::size_t>(alignment));
+}
+
+void operator delete[](void *pointer, std::align_val_t alignment,
+                       const std::nothrow_t &) noexcept
+{
+    instrumentation::detail::freeRaw(pointer,
+                                     static_cast<std::size_t>(alignment));
+}
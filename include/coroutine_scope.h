@@ -0,0 +1,239 @@
+/**
+ * @file coroutine_scope.h
+ * @brief Scope for C++20 coroutines that separates running from suspended
+ * time.
+ *
+ * InstrumentationTimer measures wall time on one thread. A coroutine that
+ * suspends and resumes on another thread therefore gets a span that
+ * includes suspended time and ends on the wrong thread. CoroutineScope
+ * instead lives in the coroutine frame and hooks the awaits it is told
+ * about:
+ *
+ * @code
+ * Task handle(Connection &connection)
+ * {
+ *     instrumentation::CoroutineScope scope("HandleRequest");
+ *     const Request request = co_await scope.traced(connection.read());
+ *     co_await scope.traced(connection.write(process(request)));
+ * }
+ * @endcode
+ *
+ * This records:
+ * - An async track `HandleRequest` covering the whole coroutine. It holds
+ *   nested `Suspended` slices for the time spent in each traced await.
+ * - A `HandleRequest` slice on the running thread for each stretch between
+ *   suspensions, with its `slice` index as an arg.
+ * - A flow linking those slices in order, across threads.
+ *
+ * Awaits that are not wrapped with traced() count as active time.
+ */
+
+#pragma once
+
+#include <coroutine>
+#include <cstdint>
+#include <type_traits>
+#include <utility>
+
+#include "instrumentor.h"
+
+namespace instrumentation
+{
+namespace detail
+{
+/**
+ * @brief Resolve the awaiter for `value` the way co_await does.
+ */
+template <typename Awaitable> decltype(auto) getAwaiter(Awaitable &&value)
+{
+    if constexpr (requires {
+                      std::forward<Awaitable>(value).operator co_await();
+                  })
+        return std::forward<Awaitable>(value).operator co_await();
+    else if constexpr (requires {
+                           operator co_await(std::forward<Awaitable>(value));
+                       })
+        return operator co_await(std::forward<Awaitable>(value));
+    else
+        return std::forward<Awaitable>(value);
+}
+} // namespace detail
+
+/**
+ * @brief Traces one coroutine invocation. See the file documentation.
+ */
+class CoroutineScope
+{
+  public:
+    /**
+     * @brief Awaiter that reports suspension and resumption to the scope
+     * around the wrapped awaiter.
+     */
+    template <typename Awaiter> class TracedAwaiter
+    {
+      public:
+        TracedAwaiter(CoroutineScope &scope, Awaiter &&awaiter)
+            : m_scope(scope), m_awaiter(std::forward<Awaiter>(awaiter))
+        {
+        }
+
+        bool await_ready()
+        {
+            return m_awaiter.await_ready();
+        }
+
+        template <typename Promise>
+        decltype(auto) await_suspend(std::coroutine_handle<Promise> handle)
+        {
+            // Before handing the coroutine over: it may resume on another
+            // thread before the inner await_suspend returns
+            m_scope.suspending();
+            return m_awaiter.await_suspend(handle);
+        }
+
+        decltype(auto) await_resume()
+        {
+            if (m_scope.m_suspended)
+                m_scope.resumed();
+            return m_awaiter.await_resume();
+        }
+
+      private:
+        CoroutineScope &m_scope;
+        Awaiter m_awaiter;
+    };
+
+    /**
+     * @param name Name of the coroutine's slices and track. Must remain
+     *             valid for the scope's lifetime.
+     */
+    explicit CoroutineScope(EventName name)
+        : m_name(name), m_id(Instrumentor::get().nextAsyncId()),
+          m_sliceStartUs(detail::nowUs())
+    {
+        Instrumentor::get().writeAsyncEvent(m_name, m_id, AsyncPhase::Begin,
+                                            m_sliceStartUs);
+    }
+
+    CoroutineScope(const CoroutineScope &) = delete;
+    CoroutineScope &operator=(const CoroutineScope &) = delete;
+
+    /**
+     * @brief Runs when the coroutine body completes or when a suspended
+     * coroutine is destroyed.
+     */
+    ~CoroutineScope()
+    {
+        const uint64_t nowUs = detail::nowUs();
+        Instrumentor &instrumentor = Instrumentor::get();
+        if (m_suspended)
+        {
+            instrumentor.writeAsyncEvent(kSuspended, m_id, AsyncPhase::End,
+                                         nowUs);
+        }
+        else
+        {
+            writeSlice(nowUs);
+            if (m_slices > 1)
+                instrumentor.writeAsyncEvent(m_name, m_id, AsyncPhase::FlowEnd,
+                                             m_sliceStartUs);
+        }
+        instrumentor.writeAsyncEvent(m_name, m_id, AsyncPhase::End, nowUs);
+    }
+
+    /**
+     * @brief Wrap an awaitable so that its suspension is recorded.
+     *
+     * An lvalue awaiter is referenced; a temporary one is moved into the
+     * returned awaiter, which can therefore be stored and awaited later.
+     */
+    template <typename Awaitable> auto traced(Awaitable &&awaitable)
+    {
+        using Resolved =
+            decltype(detail::getAwaiter(std::forward<Awaitable>(awaitable)));
+        using Awaiter =
+            std::conditional_t<std::is_lvalue_reference_v<Resolved>, Resolved,
+                               std::remove_cvref_t<Resolved>>;
+        return TracedAwaiter<Awaiter>(
+            *this, detail::getAwaiter(std::forward<Awaitable>(awaitable)));
+    }
+
+    /**
+     * @brief End the running slice; called just before suspending.
+     */
+    void suspending()
+    {
+        const uint64_t nowUs = detail::nowUs();
+        Instrumentor &instrumentor = Instrumentor::get();
+        writeSlice(nowUs);
+        instrumentor.writeAsyncEvent(
+            m_name, m_id,
+            m_slices == 1 ? AsyncPhase::FlowStart : AsyncPhase::FlowStep,
+            m_sliceStartUs);
+        instrumentor.writeAsyncEvent(kSuspended, m_id, AsyncPhase::Begin,
+                                     nowUs);
+        m_suspendedAtUs = nowUs;
+        m_suspended = true;
+        ++m_suspensions;
+    }
+
+    /**
+     * @brief Start a new slice on the calling thread; called on resumption.
+     */
+    void resumed()
+    {
+        const uint64_t nowUs = detail::nowUs();
+        Instrumentor::get().writeAsyncEvent(kSuspended, m_id, AsyncPhase::End,
+                                            nowUs);
+        m_suspendedUs += nowUs - m_suspendedAtUs;
+        m_sliceStartUs = nowUs;
+        m_suspended = false;
+    }
+
+    uint64_t id() const
+    {
+        return m_id;
+    }
+
+    /** @brief Time spent running so far, excluding the current slice. */
+    uint64_t activeUs() const
+    {
+        return m_activeUs;
+    }
+
+    /** @brief Time spent in traced awaits so far. */
+    uint64_t suspendedUs() const
+    {
+        return m_suspendedUs;
+    }
+
+    uint32_t suspensions() const
+    {
+        return m_suspensions;
+    }
+
+  private:
+    void writeSlice(uint64_t endUs)
+    {
+        const TraceArg args[] = {{"slice", m_slices}};
+        Instrumentor::get().writeProfile(m_name, m_sliceStartUs, endUs,
+                                         detail::currentThreadId(), args, 1);
+        m_activeUs += endUs - m_sliceStartUs;
+        ++m_slices;
+    }
+
+  private:
+    static constexpr StaticString kSuspended{"Suspended"};
+
+    EventName m_name;
+    const uint64_t m_id;
+    uint64_t m_sliceStartUs;
+    uint64_t m_suspendedAtUs = 0;
+    uint64_t m_activeUs = 0;
+    uint64_t m_suspendedUs = 0;
+    uint32_t m_slices = 0;
+    uint32_t m_suspensions = 0;
+    bool m_suspended = false;
+};
+
+} // namespace instrumentation
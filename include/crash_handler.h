@@ -0,0 +1,135 @@
+/**
+ * @file crash_handler.h
+ * @brief Finalise the active trace when the process crashes.
+ *
+ * installCrashHandlers() registers handlers for fatal signals (SIGSEGV,
+ * SIGBUS, SIGFPE, SIGILL, SIGABRT) and a std::terminate handler. On a crash
+ * they call Instrumentor::finalizeAfterCrash(), which writes out the
+ * per-thread buffers and the JSON footer using only async-signal-safe
+ * operations, then restore the previous handler and re-raise the signal so
+ * the process still dies (and dumps core) exactly as it would have.
+ *
+ * Typical usage:
+ * @code
+ * instrumentation::installCrashHandlers();
+ * Instrumentor::get().beginSession("Server", "trace.json");
+ * @endcode
+ *
+ * Handlers are only available on POSIX platforms; elsewhere the functions
+ * install the terminate handler only.
+ */
+
+#pragma once
+
+#include <csignal>
+#include <cstddef>
+#include <cstdlib>
+#include <exception>
+#include <iterator>
+
+#include "instrumentor.h"
+
+#if ST_HAS_MMAP
+#include <signal.h>
+#endif
+
+namespace instrumentation
+{
+namespace detail
+{
+#if ST_HAS_MMAP
+inline constexpr int kCrashSignals[] = {SIGSEGV, SIGBUS, SIGFPE, SIGILL,
+                                        SIGABRT};
+#endif
+
+struct CrashHandlerState
+{
+#if ST_HAS_MMAP
+    struct sigaction previous[std::size(kCrashSignals)]{};
+    // Room to run the handler after a stack overflow on the installing thread
+    alignas(16) char alternateStack[64 * 1024]{};
+#endif
+    std::terminate_handler previousTerminate = nullptr;
+    bool installed = false;
+};
+
+inline CrashHandlerState &crashHandlerState()
+{
+    static CrashHandlerState state;
+    return state;
+}
+
+#if ST_HAS_MMAP
+inline void onFatalSignal(int signal)
+{
+    Instrumentor::get().finalizeAfterCrash();
+
+    // Hand the signal back to whoever handled it before us
+    CrashHandlerState &state = crashHandlerState();
+    for (std::size_t i = 0; i < std::size(kCrashSignals); ++i)
+    {
+        if (kCrashSignals[i] == signal)
+            ::sigaction(signal, &state.previous[i], nullptr);
+    }
+    ::raise(signal);
+}
+#endif
+
+[[noreturn]] inline void onTerminate()
+{
+    Instrumentor::get().finalizeAfterCrash();
+
+    const std::terminate_handler previous =
+        crashHandlerState().previousTerminate;
+    if (previous != nullptr)
+        previous();
+    std::abort();
+}
+} // namespace detail
+
+/**
+ * @brief Install the fatal signal and terminate handlers. Idempotent.
+ */
+inline void installCrashHandlers()
+{
+    detail::CrashHandlerState &state = detail::crashHandlerState();
+    if (state.installed)
+        return;
+
+#if ST_HAS_MMAP
+    stack_t stack{};
+    stack.ss_sp = state.alternateStack;
+    stack.ss_size = sizeof(state.alternateStack);
+    ::sigaltstack(&stack, nullptr);
+
+    struct sigaction action{};
+    action.sa_handler = &detail::onFatalSignal;
+    action.sa_flags = SA_ONSTACK;
+    sigemptyset(&action.sa_mask);
+    for (std::size_t i = 0; i < std::size(detail::kCrashSignals); ++i)
+        ::sigaction(detail::kCrashSignals[i], &action, &state.previous[i]);
+#endif
+
+    state.previousTerminate = std::set_terminate(&detail::onTerminate);
+    state.installed = true;
+}
+
+/**
+ * @brief Restore the handlers that were active before installation.
+ */
+inline void removeCrashHandlers()
+{
+    detail::CrashHandlerState &state = detail::crashHandlerState();
+    if (!state.installed)
+        return;
+
+#if ST_HAS_MMAP
+    for (std::size_t i = 0; i < std::size(detail::kCrashSignals); ++i)
+        ::sigaction(detail::kCrashSignals[i], &state.previous[i], nullptr);
+#endif
+
+    std::set_terminate(state.previousTerminate);
+    state.installed = false;
+}
+
+} // namespace instrumentation
@@ -0,0 +1,585 @@
+/**
+ * @file critical_path.h
+ * @brief Offline critical path analysis of operations that span threads.
+ *
+ * The latency of an operation is set by the chain of work it waited on,
+ * not by everything that ran on its behalf. CriticalPathAnalyzer loads the
+ * slices and flows of a trace and walks that chain backwards from the end
+ * of an operation:
+ * - On the current thread it moves back in time, crediting the deepest
+ *   slice at each moment (its self time).
+ * - When it reaches the point at which a slice on that thread was
+ *   released by a flow, it continues on the flow's source thread. A task
+ *   is released when it starts, a wait when the notification arrives.
+ *   Any gap between the source and the release, such as time in a queue,
+ *   is credited to `(queued)`.
+ * - It stops at the start of the operation. If it leaves the operation's
+ *   thread and the trail ends first, the rest is credited to `(untraced)`.
+ *
+ * The flows are those that TaskTrace, ProfiledThreadPool, the profiled
+ * condition variables and CoroutineScope record. A flow's source is the
+ * end of the slice it was recorded in when that slice ended before the
+ * release (e.g. the previous slice of a coroutine), otherwise the flow's own
+ * time (e.g. the enqueue inside a still running request).
+ *
+ * Operations are top-level slices. By default these are the ones that
+ * start flows without being started by one themselves, i.e. that hand
+ * work to other threads and are not such work.
+ *
+ * Unlike summarizeTrace(), the analysis keeps the slices and flows of the
+ * whole trace in memory, about 40 bytes per slice.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "trace_parser.h"
+
+namespace instrumentation
+{
+/**
+ * @brief Part of a critical path: time credited to one scope on one
+ * thread.
+ */
+struct PathSegment
+{
+    uint64_t thread = 0; ///< (pid << 32) ^ tid, see threadName()
+    double startUs = 0;
+    double endUs = 0;
+    uint32_t scope = 0; ///< name ID, see scopeName()
+};
+
+/**
+ * @brief A top-level slice analysed as an operation.
+ */
+struct Operation
+{
+    uint64_t thread = 0;
+    std::size_t slice = 0; ///< index in the thread's slices
+    uint32_t name = 0;
+    double startUs = 0;
+    double endUs = 0;
+};
+
+/**
+ * @brief Critical path of one operation, in time order.
+ */
+struct CriticalPath
+{
+    Operation operation;
+    std::vector<PathSegment> segments;
+};
+
+/**
+ * @brief Loads a trace and computes critical paths. See the file
+ * documentation.
+ */
+class CriticalPathAnalyzer
+{
+  public:
+    /// Name IDs of the pseudo scopes.
+    static constexpr uint32_t kQueued = 0;
+    static constexpr uint32_t kUntraced = 1;
+
+    CriticalPathAnalyzer()
+    {
+        intern("(queued)");
+        intern("(untraced)");
+    }
+
+    /**
+     * @brief Read the slices and flows of a trace.
+     *
+     * @return False if the trace cannot be read.
+     */
+    bool load(const std::string &path)
+    {
+        TraceParser parser;
+        if (!parser.open(path))
+            return false;
+
+        std::unordered_map<std::string, std::vector<FlowPoint>> flows;
+        std::unordered_map<uint64_t, std::vector<Slice>> open;
+        TraceEvent event;
+        std::string unescaped;
+        while (parser.next(event))
+        {
+            const uint64_t thread = (event.pid << 32) ^ event.tid;
+            switch (event.phase)
+            {
+            case 'X':
+                if (event.hasTs)
+                    m_threads[thread].slices.push_back(
+                        {event.ts, event.ts + event.dur,
+                         intern(unescape(event.name, unescaped))});
+                break;
+            case 'B':
+                if (event.hasTs)
+                    open[thread].push_back(
+                        {event.ts, event.ts,
+                         intern(unescape(event.name, unescaped))});
+                break;
+            case 'E':
+            {
+                std::vector<Slice> &stack = open[thread];
+                if (event.hasTs && !stack.empty())
+                {
+                    Slice slice = stack.back();
+                    stack.pop_back();
+                    slice.end = event.ts;
+                    m_threads[thread].slices.push_back(slice);
+                }
+                break;
+            }
+            case 's':
+            case 't':
+            case 'f':
+                if (event.hasTs && !event.id.empty())
+                    flows[std::string(event.id)].push_back(
+                        {thread, event.ts, event.phase});
+                break;
+            case 'M':
+                if (event.name == "thread_name")
+                    m_threadNames[thread] = unescape(
+                        detail::unquote(findField(event.args, "name")),
+                        unescaped);
+                break;
+            default:
+                break;
+            }
+        }
+
+        for (auto &[thread, timeline] : m_threads)
+            buildTimeline(timeline);
+        for (auto &[id, points] : flows)
+            addEdges(points);
+        for (auto &[thread, timeline] : m_threads)
+        {
+            std::sort(timeline.releases.begin(), timeline.releases.end(),
+                      [](const Release &a, const Release &b) {
+                          return a.timeUs < b.timeUs;
+                      });
+        }
+        return true;
+    }
+
+    /**
+     * @brief Top-level slices to analyse.
+     *
+     * @param name Only slices with this name; if empty, see the file
+     *             documentation.
+     */
+    std::vector<Operation> operations(std::string_view name = {}) const
+    {
+        std::vector<Operation> result;
+        for (const auto &[thread, timeline] : m_threads)
+        {
+            for (std::size_t i = 0; i < timeline.slices.size(); ++i)
+            {
+                const Slice &slice = timeline.slices[i];
+                if (slice.parent != kNoParent)
+                    continue;
+                if (name.empty() ? !slice.dispatches || slice.released
+                                 : m_names[slice.name] != name)
+                    continue;
+                result.push_back(
+                    {thread, i, slice.name, slice.start, slice.end});
+            }
+        }
+        std::sort(result.begin(), result.end(),
+                  [](const Operation &a, const Operation &b) {
+                      return a.startUs < b.startUs;
+                  });
+        return result;
+    }
+
+    /**
+     * @brief Walk the critical path of an operation. See the file
+     * documentation.
+     */
+    CriticalPath criticalPath(const Operation &operation) const
+    {
+        CriticalPath path;
+        path.operation = operation;
+        const double lowerUs = operation.startUs;
+        uint64_t thread = operation.thread;
+        double timeUs = operation.endUs;
+        std::unordered_set<std::size_t> followed;
+
+        std::vector<PathSegment> reversed;
+        while (timeUs > lowerUs)
+        {
+            const Timeline &timeline = m_threads.at(thread);
+            const Release *release =
+                latestRelease(timeline, lowerUs, timeUs, followed);
+            if (release == nullptr)
+            {
+                // Nothing released this thread: the trail ends here
+                double stopUs = lowerUs;
+                if (thread != operation.thread)
+                    stopUs = std::max(lowerUs,
+                                      outermostStart(timeline, timeUs));
+                credit(reversed, thread, timeline, stopUs, timeUs);
+                if (stopUs > lowerUs)
+                    reversed.push_back(
+                        {thread, lowerUs, stopUs, kUntraced});
+                break;
+            }
+
+            const Edge &edge = m_edges[release->edge];
+            followed.insert(release->edge);
+            credit(reversed, thread, timeline, release->timeUs, timeUs);
+            const double sourceUs = std::max(edge.sourceUs, lowerUs);
+            if (sourceUs < release->timeUs)
+                reversed.push_back(
+                    {thread, sourceUs, release->timeUs, kQueued});
+            thread = edge.sourceThread;
+            timeUs = sourceUs;
+        }
+
+        // Reverse into time order, merging neighbours with the same scope
+        for (auto it = reversed.rbegin(); it != reversed.rend(); ++it)
+        {
+            if (!path.segments.empty() &&
+                path.segments.back().thread == it->thread &&
+                path.segments.back().scope == it->scope &&
+                path.segments.back().endUs == it->startUs)
+                path.segments.back().endUs = it->endUs;
+            else
+                path.segments.push_back(*it);
+        }
+        return path;
+    }
+
+    std::string_view scopeName(uint32_t id) const
+    {
+        return id < m_names.size() ? std::string_view(m_names[id])
+                                   : std::string_view();
+    }
+
+    /** @brief Name from the thread_name metadata, or the tid. */
+    std::string threadName(uint64_t thread) const
+    {
+        const auto found = m_threadNames.find(thread);
+        if (found != m_threadNames.end() && !found->second.empty())
+            return found->second;
+        return std::to_string(thread & 0xffffffffu);
+    }
+
+  private:
+    static constexpr std::size_t kNoParent = static_cast<std::size_t>(-1);
+
+    struct Slice
+    {
+        double start;
+        double end;
+        uint32_t name;
+        bool dispatches = false; ///< top-level slice that starts a flow
+        bool released = false;   ///< top-level slice started by a flow
+        std::size_t parent = kNoParent;
+    };
+
+    /// Time during which the slice `name` was the deepest one
+    struct SelfSegment
+    {
+        double start;
+        double end;
+        uint32_t name;
+    };
+
+    struct Release
+    {
+        double timeUs;
+        std::size_t edge;
+    };
+
+    struct Timeline
+    {
+        std::vector<Slice> slices; ///< by start, longest first
+        std::vector<SelfSegment> segments;
+        std::vector<Release> releases; ///< by time
+    };
+
+    struct FlowPoint
+    {
+        uint64_t thread;
+        double timeUs;
+        char phase;
+    };
+
+    struct Edge
+    {
+        uint64_t sourceThread;
+        double sourceUs;
+    };
+
+    uint32_t intern(std::string_view name)
+    {
+        const auto found = m_ids.find(std::string(name));
+        if (found != m_ids.end())
+            return found->second;
+        const uint32_t id = static_cast<uint32_t>(m_names.size());
+        m_names.emplace_back(name);
+        m_ids.emplace(m_names.back(), id);
+        return id;
+    }
+
+    /**
+     * @brief Sort the slices, link them to their parents and derive the
+     * self time segments.
+     */
+    static void buildTimeline(Timeline &timeline)
+    {
+        std::vector<Slice> &slices = timeline.slices;
+        std::stable_sort(slices.begin(), slices.end(),
+                         [](const Slice &a, const Slice &b) {
+                             if (a.start != b.start)
+                                 return a.start < b.start;
+                             return a.end > b.end;
+                         });
+
+        std::vector<std::size_t> stack;
+        double cursor = 0;
+        const auto emit = [&](uint32_t name, double start, double end) {
+            if (end > start)
+                timeline.segments.push_back({start, end, name});
+        };
+        const auto close = [&](double untilUs) {
+            while (!stack.empty() && slices[stack.back()].end <= untilUs)
+            {
+                const Slice &top = slices[stack.back()];
+                emit(top.name, cursor, top.end);
+                cursor = std::max(cursor, top.end);
+                stack.pop_back();
+            }
+        };
+        for (std::size_t i = 0; i < slices.size(); ++i)
+        {
+            close(slices[i].start);
+            if (!stack.empty())
+            {
+                emit(slices[stack.back()].name, cursor, slices[i].start);
+                slices[i].parent = stack.back();
+            }
+            cursor = slices[i].start;
+            stack.push_back(i);
+        }
+        close(std::numeric_limits<double>::infinity());
+    }
+
+    /**
+     * @brief Index of the deepest slice on `timeline` that contains
+     * `timeUs`, or kNoParent.
+     */
+    static std::size_t sliceAt(const Timeline &timeline, double timeUs)
+    {
+        const std::vector<Slice> &slices = timeline.slices;
+        auto it = std::upper_bound(slices.begin(), slices.end(), timeUs,
+                                   [](double value, const Slice &slice) {
+                                       return value < slice.start;
+                                   });
+        if (it == slices.begin())
+            return kNoParent;
+        // The containing slice, if any, is this one or one of its ancestors
+        std::size_t index = static_cast<std::size_t>(it - slices.begin()) - 1;
+        while (index != kNoParent && slices[index].end < timeUs)
+            index = slices[index].parent;
+        return index;
+    }
+
+    static std::size_t rootOf(const Timeline &timeline, std::size_t index)
+    {
+        while (timeline.slices[index].parent != kNoParent)
+            index = timeline.slices[index].parent;
+        return index;
+    }
+
+    static double outermostStart(const Timeline &timeline, double timeUs)
+    {
+        const std::size_t index = sliceAt(timeline, timeUs);
+        if (index == kNoParent)
+            return timeUs;
+        return timeline.slices[rootOf(timeline, index)].start;
+    }
+
+    /**
+     * @brief Turn the points of one flow into edges: the start and steps
+     * are chained in order, and each end is released by the latest start or
+     * step before it.
+     *
+     * A notify_all() records one start and an end per woken waiter, so
+     * ends are never chained to each other.
+     */
+    void addEdges(std::vector<FlowPoint> &points)
+    {
+        // The start comes first whatever its time
+        const auto begins = std::stable_partition(
+            points.begin(), points.end(),
+            [](const FlowPoint &point) { return point.phase != 'f'; });
+        std::stable_sort(points.begin(), begins,
+                         [](const FlowPoint &a, const FlowPoint &b) {
+                             if ((a.phase == 's') != (b.phase == 's'))
+                                 return a.phase == 's';
+                             return a.timeUs < b.timeUs;
+                         });
+        if (begins == points.begin())
+            return;
+
+        for (auto point = points.begin() + 1; point != begins; ++point)
+            addEdge(*(point - 1), *point);
+        for (auto end = begins; end != points.end(); ++end)
+        {
+            // A wait binds its end to the start of the wait slice, which
+            // can precede the notify; that end belongs to the start
+            auto source = std::upper_bound(
+                points.begin() + 1, begins, end->timeUs,
+                [](double value, const FlowPoint &point) {
+                    return value < point.timeUs;
+                });
+            addEdge(*(source - 1), *end);
+        }
+    }
+
+    /**
+     * @brief Record that `target` was released by `source`.
+     */
+    void addEdge(const FlowPoint &source, const FlowPoint &target)
+    {
+        const auto sourceTimeline = m_threads.find(source.thread);
+        auto targetTimeline = m_threads.find(target.thread);
+        if (sourceTimeline == m_threads.end() ||
+            targetTimeline == m_threads.end())
+            return;
+        Timeline &timeline = targetTimeline->second;
+
+        // Released when the bound slice can first proceed
+        double releaseUs = target.timeUs;
+        const std::size_t bound = sliceAt(timeline, target.timeUs);
+        if (bound != kNoParent)
+        {
+            releaseUs = std::min(
+                std::max(source.timeUs, timeline.slices[bound].start),
+                timeline.slices[bound].end);
+            Slice &root = timeline.slices[rootOf(timeline, bound)];
+            root.released = root.released || root.start == releaseUs;
+        }
+
+        double sourceUs = source.timeUs;
+        const std::size_t origin =
+            sliceAt(sourceTimeline->second, source.timeUs);
+        if (origin != kNoParent)
+        {
+            std::vector<Slice> &slices = sourceTimeline->second.slices;
+            if (slices[origin].end <= releaseUs)
+                sourceUs = slices[origin].end;
+            slices[rootOf(sourceTimeline->second, origin)].dispatches = true;
+        }
+
+        m_edges.push_back({source.thread, std::min(sourceUs, releaseUs)});
+        timeline.releases.push_back({releaseUs, m_edges.size() - 1});
+    }
+
+    /**
+     * @brief Latest release in (lowerUs, timeUs] not yet followed.
+     */
+    static const Release *
+    latestRelease(const Timeline &timeline, double lowerUs, double timeUs,
+                  const std::unordered_set<std::size_t> &followed)
+    {
+        const std::vector<Release> &releases = timeline.releases;
+        auto it = std::upper_bound(releases.begin(), releases.end(), timeUs,
+                                   [](double value, const Release &release) {
+                                       return value < release.timeUs;
+                                   });
+        while (it != releases.begin())
+        {
+            --it;
+            if (it->timeUs <= lowerUs)
+                return nullptr;
+            if (!followed.contains(it->edge))
+                return &*it;
+        }
+        return nullptr;
+    }
+
+    /**
+     * @brief Append the self time segments of [startUs, endUs] on a thread
+     * to `reversed`, latest first. Gaps are untraced.
+     */
+    static void credit(std::vector<PathSegment> &reversed, uint64_t thread,
+                       const Timeline &timeline, double startUs,
+                       double endUs)
+    {
+        const std::vector<SelfSegment> &segments = timeline.segments;
+        auto it = std::lower_bound(
+            segments.begin(), segments.end(), endUs,
+            [](const SelfSegment &segment, double value) {
+                return segment.start < value;
+            });
+        double cursor = endUs;
+        while (it != segments.begin() && cursor > startUs)
+        {
+            --it;
+            if (it->end <= startUs)
+                break;
+            const double from = std::max(it->start, startUs);
+            const double to = std::min(it->end, cursor);
+            if (to < cursor)
+                reversed.push_back({thread, to, cursor, kUntraced});
+            if (to > from)
+                reversed.push_back({thread, from, to, it->name});
+            cursor = from;
+        }
+        if (cursor > startUs)
+            reversed.push_back({thread, startUs, cursor, kUntraced});
+    }
+
+    std::unordered_map<uint64_t, Timeline> m_threads;
+    std::unordered_map<uint64_t, std::string> m_threadNames;
+    std::vector<Edge> m_edges;
+    std::deque<std::string> m_names;
+    std::unordered_map<std::string, uint32_t> m_ids;
+};
+
+/**
+ * @brief Time each scope contributed to a set of critical paths.
+ */
+struct PathContribution
+{
+    uint32_t scope = 0;
+    double us = 0;
+};
+
+/**
+ * @brief Sum the time per scope over `paths`, largest first.
+ */
+inline std::vector<PathContribution>
+pathContributions(const std::vector<CriticalPath> &paths)
+{
+    std::unordered_map<uint32_t, double> totals;
+    for (const CriticalPath &path : paths)
+    {
+        for (const PathSegment &segment : path.segments)
+            totals[segment.scope] += segment.endUs - segment.startUs;
+    }
+    std::vector<PathContribution> result;
+    for (const auto &[scope, us] : totals)
+        result.push_back({scope, us});
+    std::sort(result.begin(), result.end(),
+              [](const PathContribution &a, const PathContribution &b) {
+                  return a.us > b.us;
+              });
+    return result;
+}
+
+} // namespace instrumentation
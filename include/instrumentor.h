@@ -30,12 +30,36 @@
 #pragma once
 
 #include <algorithm>
+#include <atomic>
+#include <bit>
 #include <chrono>
 #include <cstdint>
-#include <fstream>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
 #include <string>
+#include <string_view>
 #include <thread>
-#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "io_uring_trace_writer.h"
+#include "rotating_trace_writer.h"
+#include "shared_memory_trace_writer.h"
+#include "socket_trace_writer.h"
+#include "trace_compression.h"
+#include "trace_event.h"
+#include "trace_writer.h"
+
+#if defined(__linux__) || defined(__APPLE__)
+#include <pthread.h>
+#endif
+
+#if defined(__linux__)
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
 
 namespace instrumentation::detail
 {
@@ -50,6 +74,230 @@ inline uint64_t nowUs()
             std::chrono::steady_clock::now().time_since_epoch())
             .count());
 }
+
+/**
+ * @brief Query the operating system's ID of the calling thread.
+ *
+ * This is the ID shown by debuggers and tools such as `top -H` and `perf`.
+ * Platforms without one fall back to a hash of std::thread::id.
+ */
+inline uint32_t queryThreadId()
+{
+#if defined(__linux__)
+    return static_cast<uint32_t>(::syscall(SYS_gettid));
+#elif defined(__APPLE__)
+    uint64_t id = 0;
+    ::pthread_threadid_np(nullptr, &id);
+    return static_cast<uint32_t>(id);
+#else
+    return static_cast<uint32_t>(
+        std::hash<std::thread::id>{}(std::this_thread::get_id()));
+#endif
+}
+
+/**
+ * @brief ID of the calling thread used in trace events, queried once per
+ * thread.
+ */
+inline uint32_t currentThreadId()
+{
+    static thread_local const uint32_t id = queryThreadId();
+    return id;
+}
+
+/**
+ * @brief ID of the current process used as the "pid" of trace events.
+ */
+inline uint32_t currentProcessId()
+{
+#if ST_HAS_MMAP
+    return static_cast<uint32_t>(::getpid());
+#else
+    return 0;
+#endif
+}
+
+/**
+ * @brief Current wall-clock time in microseconds since the Unix epoch.
+ */
+inline uint64_t wallClockUs()
+{
+    return static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::system_clock::now().time_since_epoch())
+            .count());
+}
+
+/**
+ * @brief Name of this machine, or an empty string if it is unknown.
+ */
+inline std::string hostName()
+{
+#if ST_HAS_MMAP
+    char name[256] = {};
+    if (::gethostname(name, sizeof(name) - 1) == 0)
+        return name;
+#endif
+    return {};
+}
+
+/**
+ * @brief Name the operating system gave the calling thread, if any.
+ */
+inline std::string queryThreadName()
+{
+#if defined(__linux__) || defined(__APPLE__)
+    char name[64] = {};
+    if (::pthread_getname_np(::pthread_self(), name, sizeof(name)) == 0)
+        return name;
+#endif
+    return {};
+}
+
+/**
+ * @brief Try to lock a mutex for a bounded number of attempts.
+ *
+ * Used on the crash path where blocking on a lock held by a thread that
+ * will never release it would hang the process.
+ */
+inline bool tryLockFor(std::mutex &mutex, int attempts = 10000)
+{
+    for (int i = 0; i < attempts; ++i)
+    {
+        if (mutex.try_lock())
+            return true;
+        std::this_thread::yield();
+    }
+    return false;
+}
+
+/**
+ * @brief Coalescing state of one counter on one thread.
+ */
+struct CounterState
+{
+    const char *name = nullptr;
+    uint64_t lastEmitUs = 0;
+    uint64_t pendingUs = 0;
+    double pendingValue = 0.0;
+    bool emitted = false;
+    bool pending = false;
+};
+
+/**
+ * @brief Per-thread staging buffer of binary event records.
+ *
+ * Blocks only ever hold whole records, so finished blocks can be formatted
+ * and appended to the output independently, in any order, after the
+ * session header.
+ */
+struct ThreadBuffer
+{
+    std::mutex mutex;
+    std::string data;
+    std::string spare; // storage of the last handed-over block, for reuse
+    std::vector<CounterState> counters;
+    std::vector<EventName> openScopes; // "B" events still waiting for "E"
+    std::string threadName;
+    bool threadNameRecorded = false; // in the current session
+    uint64_t generation = 0;
+    uint32_t threadId = 0;
+    std::atomic<bool> threadExited{false};
+};
+
+/**
+ * @brief Heap activity counted by the allocation hooks (allocation_hooks.h).
+ */
+struct AllocationStats
+{
+    uint64_t allocations;
+    uint64_t bytes;
+    uint64_t frees;
+};
+
+/**
+ * @brief Allocation counters of one thread.
+ *
+ * Constant-initialised and trivially destructible, so the hooks can update
+ * it at any point in the thread's life without allocating.
+ */
+struct ThreadAllocations
+{
+    AllocationStats total;
+    uint32_t paused; ///< non-zero while the profiler itself allocates
+};
+
+constinit inline thread_local ThreadAllocations threadAllocations{};
+
+/**
+ * @brief Set by allocation_hooks.h when the replacement operators are
+ * linked in.
+ */
+inline std::atomic<bool> allocationHooksInstalled{false};
+
+inline void noteAllocation(std::size_t size)
+{
+    ThreadAllocations &counters = threadAllocations;
+    if (counters.paused != 0)
+        return;
+    ++counters.total.allocations;
+    counters.total.bytes += size;
+}
+
+inline void noteFree()
+{
+    ThreadAllocations &counters = threadAllocations;
+    if (counters.paused == 0)
+        ++counters.total.frees;
+}
+
+/**
+ * @brief Keeps the profiler's own allocations out of the counters while in
+ * scope.
+ */
+struct AllocationPause
+{
+    AllocationPause()
+    {
+        ++threadAllocations.paused;
+    }
+
+    AllocationPause(const AllocationPause &) = delete;
+    AllocationPause &operator=(const AllocationPause &) = delete;
+
+    ~AllocationPause()
+    {
+        --threadAllocations.paused;
+    }
+};
+
+/**
+ * @brief Everything the recording path needs about the calling thread.
+ *
+ * Set up once per thread on first use, so recording an event only loads a
+ * thread-local pointer instead of looking up the thread's ID and buffer.
+ */
+struct ThreadContext
+{
+    ThreadBuffer *buffer = nullptr;
+    uint32_t threadId = 0;
+    uint32_t depth = 0;      ///< open InstrumentationTimers on this thread
+    uint64_t generation = 0; ///< session the buffer was last prepared for
+
+    /// Nesting levels with per-level bookkeeping; deeper timers skip it
+    static constexpr uint32_t kMaxDepth = 64;
+
+    /// Allocations of finished child scopes, per nesting level, so each
+    /// timer can report only its own
+    AllocationStats childAllocations[kMaxDepth]{};
+    const char *allocationCounter = nullptr; ///< interned counter name
+    uint64_t reportedBytes = 0;
+
+    /// Overhead of the finished descendants of the open timer at each
+    /// nesting level and of the buffer hand-offs inside it, when
+    /// compensating overhead
+    double childOverheadNs[kMaxDepth]{};
+};
 } // namespace instrumentation::detail
 
 struct ProfileResult
@@ -64,6 +312,94 @@ struct InstrumentationSession
     std::string name;
 };
 
+/**
+ * @brief Visibility of an instant event ("s" field of a "ph":"i" event).
+ */
+enum class InstantScope
+{
+    Thread,  ///< marker on the recording thread's track
+    Process, ///< line across all tracks of the process
+    Global,  ///< line across the whole trace
+};
+
+/**
+ * @brief How InstrumentationTimer scopes are written to the trace.
+ */
+enum class ScopeEvents
+{
+    Complete, ///< one "X" event when the scope ends
+    BeginEnd, ///< "B" when the scope starts and "E" when it ends
+};
+
+/**
+ * @brief Phase of an async or flow event, as written to the "ph" field.
+ *
+ * Async begin/end pairs draw a slice on a track keyed by ID that is
+ * independent of threads; flow start/step/end draw arrows between the
+ * slices enclosing each point on the threads where they are recorded.
+ */
+enum class AsyncPhase : char
+{
+    Begin = 'b',
+    End = 'e',
+    FlowStart = 's',
+    FlowStep = 't',
+    FlowEnd = 'f',
+};
+
+/**
+ * @brief Options controlling how a session is written.
+ */
+struct SessionOptions
+{
+    /// File backend used for the trace output
+    instrumentation::OutputBackend backend =
+        instrumentation::OutputBackend::Stream;
+
+    /// Open the file with O_DIRECT (io_uring backend only)
+    bool directIo = false;
+
+    /// Compress the output; the matching extension is appended to the path
+    instrumentation::Compression compression =
+        instrumentation::Compression::None;
+
+    /// Perform file writes on a background writer thread (always on when
+    /// compressing or rotating)
+    bool asyncWrite = false;
+
+    /// What instrumented threads do when the writer thread is 64 MiB behind:
+    /// wait for it, or drop the block. Dropped blocks are reported by a
+    /// global `Dropped events` instant at the end of the trace.
+    instrumentation::QueueFullPolicy writerQueueFull =
+        instrumentation::QueueFullPolicy::Wait;
+
+    /// Continue in `name.N.json` once a file exceeds these limits
+    instrumentation::RotationPolicy rotation{};
+
+    /// Write scopes as begin/end pairs so long-running scopes show up (in
+    /// rotated files and crash traces) before they finish
+    ScopeEvents scopeEvents = ScopeEvents::Complete;
+
+    /// Count heap allocations per thread and attribute them to the innermost
+    /// open timer. Needs the hooks from allocation_hooks.h to be linked in.
+    bool trackAllocations = false;
+
+    /// Size in bytes at which a per-thread buffer is handed to the writer
+    std::size_t bufferSize = 64 * 1024;
+
+    /// Emit at most one sample per counter (and thread) per interval; the
+    /// latest value in between is kept and written at the next opportunity.
+    /// Zero records every update.
+    std::chrono::microseconds counterInterval{0};
+
+    /// Report the duration of each timer minus the overhead of the nested
+    /// InstrumentationTimers, as measured at beginSession(), as its
+    /// `compensated_dur_us` arg, so dense children do not inflate their
+    /// parents. Timestamps and durations stay as measured, so children
+    /// stay inside their parents and events keep their order.
+    bool compensateOverhead = false;
+};
+
 class Instrumentor
 {
   public:
@@ -82,6 +418,45 @@ class Instrumentor
         return instance;
     }
 
+    Instrumentor(const Instrumentor &) = delete;
+    Instrumentor &operator=(const Instrumentor &) = delete;
+
+    /**
+     * @brief Get the calling thread's recording context.
+     *
+     * The first call on a thread queries its ID and registers its buffer;
+     * after that this is a single thread-local load. Once the thread's
+     * buffer has been flushed at thread exit, e.g. in the destructor of a
+     * later thread_local, a context without a buffer is returned and events
+     * are no longer recorded.
+     */
+    static instrumentation::detail::ThreadContext &threadContext()
+    {
+        if (s_threadContext == nullptr) [[unlikely]]
+        {
+            if (s_threadExited)
+            {
+                // Trivially destructible, so it outlives the handle
+                static thread_local instrumentation::detail::ThreadContext
+                    exited{};
+                exited.threadId = instrumentation::detail::currentThreadId();
+                return exited;
+            }
+            static thread_local ThreadBufferHandle handle;
+            s_threadContext = &handle.context;
+        }
+        return *s_threadContext;
+    }
+
+    /**
+     * @brief The calling thread's recording context if it has been set up,
+     * without setting it up.
+     */
+    static instrumentation::detail::ThreadContext *existingThreadContext()
+    {
+        return s_threadContext;
+    }
+
     /**
      * @brief Begin a new instrumentation session.
      *
@@ -89,147 +464,944 @@ class Instrumentor
      * contents, writes the trace JSON header, and initializes session state.
      *
      * If a session is already active, it is ended automatically before starting
-     * the new one.
+     * the new one. If the requested backend cannot open the file the session
+     * falls back to the stream backend.
+     *
+     * When compression is requested the codec's extension (`.gz`/`.zst`) is
+     * appended to `filepath` unless it is already present. With a rotation
+     * policy, later files are written to `filepath` with a sequence number
+     * inserted before `.json`. With the socket backend `filepath` is the
+     * consumer's socket address, with the shared memory backend the segment
+     * name; compression and rotation are ignored for both.
      *
      * @param name     Human-readable name for the instrumentation session.
      * @param filepath Path to the output JSON file. Defaults to "results.json".
+     * @param options  Output backend, compression and buffering options.
      */
     void beginSession(const std::string &name,
-                      const std::string &filepath = "results.json")
+                      const std::string &filepath = "results.json",
+                      const SessionOptions &options = {})
     {
+        std::unique_lock<std::shared_mutex> lock(m_sessionMutex);
 
-        std::lock_guard<std::mutex> lock(m_mutex);
-
-        if (m_currentSessionActive)
+        if (m_currentSessionActive.load(std::memory_order_relaxed))
         {
             endSessionLocked();
         }
 
-        m_outputStream.open(
-            filepath, std::ios::out |
-                          std::ios::trunc); // Open the file for output, and
-                                            // truncate it if it already exists
+        const bool fileOutput =
+            options.backend != instrumentation::OutputBackend::Socket &&
+            options.backend != instrumentation::OutputBackend::SharedMemory;
+        const instrumentation::Compression compression =
+            fileOutput
+                ? instrumentation::availableCompression(options.compression)
+                : instrumentation::Compression::None;
+        const std::string path = outputPath(filepath, compression);
 
-        writeHeader();
         m_session = InstrumentationSession{name};
-        m_currentSessionActive = true;
-        m_profileCount = 0;
-        m_sessionStartUs = instrumentation::detail::nowUs(); // start baseline
+        m_scopeOverheadNs.store(measureScopeOverheadNs(),
+                                std::memory_order_relaxed);
+        m_compensateOverhead.store(options.compensateOverhead,
+                                   std::memory_order_relaxed);
+        const uint64_t startUs = instrumentation::detail::nowUs();
+        m_processId = instrumentation::detail::currentProcessId();
+        const std::string header = makeHeader(startUs);
+
+        m_writer = createWriter(options, options.backend, compression, header,
+                                startUs, m_processId);
+        if (!m_writer->open(path))
+        {
+            m_writer =
+                createWriter(options, instrumentation::OutputBackend::Stream,
+                             compression, header, startUs, m_processId);
+            m_writer->open(path);
+        }
+
+        m_bufferSize.store(std::max<std::size_t>(options.bufferSize, 1),
+                           std::memory_order_relaxed);
+        m_counterIntervalUs.store(std::max<int64_t>(
+                                      options.counterInterval.count(), 0),
+                                  std::memory_order_relaxed);
+        m_beginEndScopes.store(options.scopeEvents == ScopeEvents::BeginEnd,
+                               std::memory_order_relaxed);
+        m_trackAllocations.store(
+            options.trackAllocations &&
+                instrumentation::detail::allocationHooksInstalled.load(),
+            std::memory_order_relaxed);
+        m_generation.fetch_add(1, std::memory_order_relaxed);
+        m_sessionStartUs.store(startUs,
+                               std::memory_order_relaxed); // start baseline
+        m_currentSessionActive.store(true, std::memory_order_release);
     }
 
     /**
      * @brief End the current instrumentation session.
      *
-     * Writes the trace JSON footer, closes the output file, and resets all
-     * session state. If no session is active, this function has no effect.
+     * Flushes all per-thread buffers, writes the trace JSON footer, closes the
+     * output file, and resets all session state. If no session is active,
+     * this function has no effect.
      */
     void endSession()
     {
-        std::lock_guard<std::mutex> lock(m_mutex);
+        std::unique_lock<std::shared_mutex> lock(m_sessionMutex);
         endSessionLocked();
     }
 
     /**
      * @brief Write a profiling result as a trace event.
      *
-     * Serializes the given profiling result as a JSON trace event and appends
-     * it to the active session’s output stream.
+     * Serializes the given profiling result as a JSON trace event into the
+     * calling thread's buffer. Full buffers are handed to the output backend
+     * as a single block, so the hot path never touches the file or any
+     * lock shared with other threads.
      *
      * Timestamps are converted to be relative to the session start time. If no
      * session is currently active, this function returns without doing
      * anything.
      *
-     * The output stream is flushed after writing to ensure the event is emitted
-     * immediately.
-     *
      * @param result Profiling result containing timing, thread, and name data.
      */
-    void writeProfile(ProfileResult result)
+    void writeProfile(const ProfileResult &result)
+    {
+        // The name is copied, as the result may not outlive the block
+        record([&](instrumentation::detail::ThreadBuffer &buffer) {
+            instrumentation::detail::appendRecord(
+                buffer.data,
+                {instrumentation::detail::RecordKind::Complete, 'X', 0,
+                 result.threadId, result.startUs, result.endUs, nullptr},
+                result.name);
+        });
+    }
+
+    /**
+     * @brief Write a complete scope event without building a ProfileResult.
+     *
+     * This is the path used by InstrumentationTimer. The name and arguments
+     * are copied into the buffer as raw values; they are formatted by the
+     * writer.
+     *
+     * @param name     Scope name, copied unless it is a StaticString.
+     * @param args     Typed arguments attached to the event.
+     * @param argCount Number of entries in `args`.
+     */
+    void writeProfile(instrumentation::EventName name, uint64_t startUs,
+                      uint64_t endUs, uint32_t threadId,
+                      const instrumentation::TraceArg *args = nullptr,
+                      uint8_t argCount = 0)
+    {
+        record([&](instrumentation::detail::ThreadBuffer &buffer) {
+            instrumentation::detail::appendNamedRecord(
+                buffer.data,
+                {instrumentation::detail::RecordKind::Complete, 'X', argCount,
+                 threadId, startUs, endUs, nullptr},
+                name, args);
+        });
+    }
+
+    /**
+     * @brief Whether a session is recording events on the calling thread.
+     */
+    bool sessionActive() const
+    {
+        return m_currentSessionActive.load(std::memory_order_acquire) ||
+               s_calibrating;
+    }
+
+    /**
+     * @brief Steady clock time the current session started at, 0 if none.
+     */
+    uint64_t sessionStartUs() const
+    {
+        return m_sessionStartUs.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Whether the current session writes scopes as "B"/"E" pairs.
+     */
+    bool beginEndScopes() const
+    {
+        return m_beginEndScopes.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Whether the current session attributes heap allocations to
+     * scopes.
+     */
+    bool trackingAllocations() const
+    {
+        return m_trackAllocations.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Whether the current session subtracts the overhead of nested
+     * timers from their parents, see SessionOptions::compensateOverhead.
+     */
+    bool compensatingOverhead() const
+    {
+        return m_compensateOverhead.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Overhead of one InstrumentationTimer in nanoseconds, as
+     * measured when the last session began.
+     */
+    double scopeOverheadNs() const
+    {
+        return m_scopeOverheadNs.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Record the start of a scope ("ph":"B").
+     *
+     * The scope stays open on the calling thread until writeScopeEnd() is
+     * called for it. Scopes still open when the session ends are closed at
+     * that point, so every "B" in the output has a matching "E".
+     *
+     * @param name Scope name, copied unless it is a StaticString. Must stay
+     *             valid until writeScopeEnd(), which matches it by pointer.
+     * @return Session generation the begin was recorded in, to be passed to
+     *         writeScopeEnd(); 0 if no session is active.
+     */
+    uint64_t writeScopeBegin(instrumentation::EventName name, uint64_t timeUs)
+    {
+        uint64_t generation = 0;
+        record([&](instrumentation::detail::ThreadBuffer &buffer) {
+            instrumentation::detail::appendNamedRecord(
+                buffer.data,
+                {instrumentation::detail::RecordKind::Scope, 'B', 0,
+                 buffer.threadId, timeUs, 0, nullptr},
+                name);
+            buffer.openScopes.push_back(name);
+            generation = buffer.generation;
+        });
+        return generation;
+    }
+
+    /**
+     * @brief Record the end of a scope opened with writeScopeBegin()
+     * ("ph":"E").
+     *
+     * Ignored if the begin belonged to an earlier session, which has
+     * already closed it. Scopes opened inside this one and still open are
+     * ended first and begun again at `timeUs`, so the "E" closes the right
+     * slice in viewers.
+     */
+    void writeScopeEnd(instrumentation::EventName name, uint64_t timeUs,
+                       uint64_t generation,
+                       const instrumentation::TraceArg *args = nullptr,
+                       uint8_t argCount = 0)
+    {
+        record([&](instrumentation::detail::ThreadBuffer &buffer) {
+            if (buffer.generation != generation)
+                return;
+            // Usually the innermost scope; search in case scopes end out
+            // of order
+            const auto open = std::find_if(
+                buffer.openScopes.rbegin(), buffer.openScopes.rend(),
+                [&](const instrumentation::EventName &scope) {
+                    return scope.text == name.text;
+                });
+            if (open == buffer.openScopes.rend())
+                return;
+            const auto scopeRecord = [&](char phase, uint8_t count) {
+                return instrumentation::detail::EventRecord{
+                    instrumentation::detail::RecordKind::Scope, phase, count,
+                    buffer.threadId, timeUs, 0, nullptr};
+            };
+            for (auto inner = buffer.openScopes.rbegin(); inner != open;
+                 ++inner)
+                instrumentation::detail::appendNamedRecord(
+                    buffer.data, scopeRecord('E', 0), *inner);
+            instrumentation::detail::appendNamedRecord(
+                buffer.data, scopeRecord('E', argCount), name, args);
+            for (auto inner = open.base(); inner != buffer.openScopes.end();
+                 ++inner)
+                instrumentation::detail::appendNamedRecord(
+                    buffer.data, scopeRecord('B', 0), *inner);
+            buffer.openScopes.erase(std::next(open).base());
+        });
+    }
+
+    /**
+     * @brief Record a point-in-time marker ("ph":"i").
+     *
+     * Instant events use the same per-thread buffer as scope timers and
+     * counters.
+     *
+     * @param name  Marker name, copied unless it is a StaticString.
+     * @param scope Whether the marker belongs to the thread, the process or
+     *              the whole trace.
+     */
+    void writeInstant(instrumentation::EventName name,
+                      InstantScope scope = InstantScope::Thread)
+    {
+        const uint64_t nowUs = instrumentation::detail::nowUs();
+        record([&](instrumentation::detail::ThreadBuffer &buffer) {
+            static constexpr char kScopes[] = {'t', 'p', 'g'};
+            instrumentation::detail::appendNamedRecord(
+                buffer.data,
+                {instrumentation::detail::RecordKind::Instant,
+                 kScopes[static_cast<std::size_t>(scope)], 0, buffer.threadId,
+                 nowUs, 0, nullptr},
+                name);
+        });
+    }
+
+    /**
+     * @brief Record an async ("b"/"e") or flow ("s"/"t"/"f") event.
+     *
+     * Events belonging to the same operation share `id`; the calls may come
+     * from different threads. Flow events bind to the slice enclosing them
+     * on the recording thread.
+     *
+     * @param name  Operation name; begin and end must use the same name.
+     *              Copied unless it is a StaticString.
+     * @param id    64-bit ID linking the events, see nextAsyncId().
+     * @param phase Which event to record.
+     */
+    void writeAsyncEvent(instrumentation::EventName name, uint64_t id,
+                         AsyncPhase phase)
+    {
+        writeAsyncEvent(name, id, phase, instrumentation::detail::nowUs());
+    }
+
+    /**
+     * @brief Record an async or flow event at an earlier time, e.g. to bind
+     * a flow to a slice that is recorded once it has finished.
+     */
+    void writeAsyncEvent(instrumentation::EventName name, uint64_t id,
+                         AsyncPhase phase, uint64_t timeUs)
+    {
+        record([&](instrumentation::detail::ThreadBuffer &buffer) {
+            instrumentation::detail::appendNamedRecord(
+                buffer.data,
+                {instrumentation::detail::RecordKind::Async,
+                 static_cast<char>(phase), 0, buffer.threadId, timeUs, id,
+                 nullptr},
+                name);
+        });
+    }
+
+    /**
+     * @brief Allocate a process-unique ID for async and flow events.
+     */
+    uint64_t nextAsyncId()
+    {
+        return m_nextAsyncId.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Name the calling thread in the trace.
+     *
+     * The name is written as "thread_name" metadata in the current session
+     * and again in every later session the thread records events in.
+     * Threads that are never named use the name the operating system
+     * reports for them, if any.
+     */
+    void setThreadName(std::string_view name)
     {
-        std::lock_guard<std::mutex> lock(m_mutex);
-        
-        if (!m_currentSessionActive)
+        instrumentation::detail::ThreadBuffer *buffer = threadContext().buffer;
+        if (buffer == nullptr)
+            return;
         {
+            std::lock_guard<std::mutex> lock(buffer->mutex);
+            buffer->threadName = name;
+            buffer->threadNameRecorded = false;
+        }
+        record([](instrumentation::detail::ThreadBuffer &) {});
+    }
+
+    /**
+     * @brief Record a sample of a counter track ("ph":"C").
+     *
+     * Samples go through the calling thread's buffer like scope events.
+     * With SessionOptions::counterInterval set, updates arriving within the
+     * interval only replace the pending value; it is written when the
+     * interval has elapsed at the next update or when the session ends.
+     *
+     * @param name  Counter name. Must remain valid for the session; updates
+     *              are coalesced per name pointer.
+     * @param value Counter value.
+     */
+    void writeCounter(const char *name, double value)
+    {
+        const uint64_t nowUs = instrumentation::detail::nowUs();
+        record([&](instrumentation::detail::ThreadBuffer &buffer) {
+            const uint64_t intervalUs = static_cast<uint64_t>(
+                m_counterIntervalUs.load(std::memory_order_relaxed));
+            if (intervalUs == 0)
+            {
+                appendCounter(buffer.data, name, nowUs, value,
+                              buffer.threadId);
+                return;
+            }
+
+            instrumentation::detail::CounterState &state =
+                counterState(buffer, name);
+            if (state.emitted && nowUs - state.lastEmitUs < intervalUs)
+            {
+                state.pendingValue = value;
+                state.pendingUs = nowUs;
+                state.pending = true;
+                return;
+            }
+
+            appendCounter(buffer.data, name, nowUs, value, buffer.threadId);
+            state.lastEmitUs = nowUs;
+            state.emitted = true;
+            state.pending = false;
+        });
+    }
+
+    /**
+     * @brief Flush buffered events and terminate the trace after a crash.
+     *
+     * Intended to be called from a fatal signal handler or terminate
+     * handler (see crash_handler.h). Only async-signal-safe operations are
+     * used: locks are only ever try-locked and are left held, nothing is
+     * allocated or freed, and data reaches the file through the writers'
+     * emergency paths. Every per-thread buffer that can be locked is written
+     * out, scopes still open on it are ended at the time of the crash, and
+     * the JSON footer follows, so the file stays loadable.
+     *
+     * The session is over afterwards and the process is expected to
+     * terminate. Calling this more than once has no effect.
+     */
+    void finalizeAfterCrash()
+    {
+        if (m_crashFinalized.exchange(true))
             return;
+        if (!m_currentSessionActive.exchange(false))
+            return;
+
+        instrumentation::TraceWriter *writer = m_writer.get();
+        if (writer == nullptr)
+            return;
+
+        const uint64_t generation =
+            m_generation.load(std::memory_order_relaxed);
+        const uint64_t nowUs = instrumentation::detail::nowUs();
+        if (instrumentation::detail::tryLockFor(m_buffersMutex))
+        {
+            for (const auto &buffer : m_buffers)
+            {
+                // The buffer stays locked so its owner cannot modify it
+                if (!instrumentation::detail::tryLockFor(buffer->mutex))
+                    continue;
+                if (buffer->generation != generation)
+                    continue;
+                if (!buffer->data.empty())
+                    writer->emergencyWrite(buffer->data.data(),
+                                           buffer->data.size());
+                // End open scopes at the crash, one record at a time
+                for (auto open = buffer->openScopes.rbegin();
+                     open != buffer->openScopes.rend(); ++open)
+                {
+                    const instrumentation::detail::EventRecord end{
+                        instrumentation::detail::RecordKind::Scope, 'E', 0,
+                        buffer->threadId, nowUs, 0, open->text};
+                    writer->emergencyWrite(
+                        reinterpret_cast<const char *>(&end), sizeof(end));
+                }
+            }
         }
+        writer->emergencyClose();
+    }
 
-        // make timestamps relative to session start
-        result.startUs -= m_sessionStartUs;
-        result.endUs -= m_sessionStartUs;
+  private:
+    /**
+     * @brief Owns the calling thread's context, registers its buffer with
+     * the Instrumentor and flushes it when the thread exits.
+     */
+    struct ThreadBufferHandle
+    {
+        std::shared_ptr<instrumentation::detail::ThreadBuffer> buffer;
+        instrumentation::detail::ThreadContext context;
 
-        if (m_profileCount++ > 0)
+        ThreadBufferHandle()
+            : buffer(std::make_shared<instrumentation::detail::ThreadBuffer>())
         {
-            m_outputStream << ", ";
+            buffer->threadId = instrumentation::detail::currentThreadId();
+            buffer->threadName = instrumentation::detail::queryThreadName();
+            context.buffer = buffer.get();
+            context.threadId = buffer->threadId;
+            Instrumentor::get().registerBuffer(buffer);
         }
 
-        std::replace(result.name.begin(), result.name.end(), '"', '\'');
+        ThreadBufferHandle(const ThreadBufferHandle &) = delete;
+        ThreadBufferHandle &operator=(const ThreadBufferHandle &) = delete;
 
-        m_outputStream << "{";
-        m_outputStream << "\"dur\":" << (result.endUs - result.startUs) << ",";
-        m_outputStream << "\"cat\":\"function\",";
-        m_outputStream << "\"name\":\"" << result.name << "\",";
-        m_outputStream << "\"ph\":\"X\",";
-        m_outputStream << "\"pid\":0,";
-        m_outputStream << "\"tid\":" << result.threadId << ",";
-        m_outputStream << "\"ts\":" << result.startUs;
-        m_outputStream << "}";
-        m_outputStream.flush();
-    }
+        ~ThreadBufferHandle()
+        {
+            Instrumentor::get().flushBuffer(*buffer);
+            buffer->threadExited.store(true, std::memory_order_release);
+            s_threadContext = nullptr;
+            s_threadExited = true;
+        }
+    };
 
-  private:
     Instrumentor()
-        : m_session{}, m_currentSessionActive(false), m_outputStream(),
-          m_profileCount(0), m_sessionStartUs(0)
+        : m_session{}, m_currentSessionActive(false), m_sessionStartUs(0)
+    {
+    }
+
+    /**
+     * @brief Create the file writer for the requested backend.
+     *
+     * Backends that are unavailable on the current platform fall back to a
+     * StreamTraceWriter.
+     */
+    static std::unique_ptr<instrumentation::TraceWriter>
+    createFileWriter(instrumentation::OutputBackend backend, bool directIo,
+                     uint64_t sessionStartUs)
+    {
+        switch (backend)
+        {
+        case instrumentation::OutputBackend::Socket:
+#if ST_HAS_UNIX_SOCKET
+            return std::make_unique<instrumentation::SocketTraceWriter>(
+                sessionStartUs);
+#else
+            break;
+#endif
+        case instrumentation::OutputBackend::MappedFile:
+#if ST_HAS_MMAP
+            return std::make_unique<instrumentation::MappedTraceWriter>();
+#else
+            break;
+#endif
+        case instrumentation::OutputBackend::IoUring:
+#if ST_HAS_IO_URING
+            return std::make_unique<instrumentation::IoUringTraceWriter>(
+                directIo);
+#else
+            break;
+#endif
+        case instrumentation::OutputBackend::SharedMemory: // see createWriter
+        case instrumentation::OutputBackend::Stream:
+            break;
+        }
+        (void)directIo;
+        (void)sessionStartUs;
+        return std::make_unique<instrumentation::StreamTraceWriter>();
+    }
+
+    /**
+     * @brief Build the writer chain for a session: file backend, optional
+     * compression, framing/rotation, JSON formatting of the event records,
+     * and the background writer thread in front of all of them.
+     *
+     * The shared memory backend replaces the whole chain, as the collector
+     * process does the formatting and writing.
+     */
+    static std::unique_ptr<instrumentation::TraceWriter>
+    createWriter(const SessionOptions &options,
+                 instrumentation::OutputBackend backend,
+                 instrumentation::Compression compression,
+                 const std::string &header, uint64_t sessionStartUs,
+                 uint32_t processId)
+    {
+#if ST_HAS_SHARED_MEMORY
+        if (backend == instrumentation::OutputBackend::SharedMemory)
+            return std::make_unique<instrumentation::SharedMemoryTraceWriter>(
+                header, sessionStartUs, processId);
+#endif
+
+        const bool directIo = options.directIo;
+        auto factory = [backend, directIo, compression, sessionStartUs] {
+            return instrumentation::makeCompressedWriter(
+                createFileWriter(backend, directIo, sessionStartUs),
+                compression);
+        };
+
+        // A stream has no files to rotate
+        const instrumentation::RotationPolicy rotation =
+            backend == instrumentation::OutputBackend::Socket
+                ? instrumentation::RotationPolicy{}
+                : options.rotation;
+
+        auto rotating = std::make_unique<instrumentation::RotatingTraceWriter>(
+            factory, header, "]}", rotation);
+        instrumentation::RotatingTraceWriter &files = *rotating;
+        auto json = std::make_unique<instrumentation::JsonTraceWriter>(
+            std::move(rotating), sessionStartUs, processId);
+        if (rotation.enabled())
+        {
+            // Every file names its threads and closes its own scopes. The
+            // async writer below makes the JSON writer single-threaded.
+            instrumentation::JsonTraceWriter &formatter = *json;
+            formatter.trackContinuation();
+            files.setContinuation(
+                [&formatter](std::string &closing, std::string &opening) {
+                    formatter.appendContinuation(closing, opening);
+                });
+        }
+        std::unique_ptr<instrumentation::TraceWriter> writer = std::move(json);
+
+        if (options.asyncWrite || rotation.enabled() ||
+            compression != instrumentation::Compression::None)
+        {
+            auto async = std::make_unique<instrumentation::AsyncTraceWriter>(
+                std::move(writer),
+                instrumentation::AsyncTraceWriter::kDefaultMaxQueuedBytes,
+                options.writerQueueFull);
+            async->setDropReport(dropReport);
+            writer = std::move(async);
+        }
+        return writer;
+    }
+
+    /**
+     * @brief Record block for AsyncTraceWriter: a global instant at the end
+     * of the trace, so a trace with gaps says so.
+     */
+    static std::string dropReport(uint64_t blocks, uint64_t bytes)
+    {
+        const instrumentation::TraceArg args[] = {{"blocks", blocks},
+                                                  {"bytes", bytes}};
+        std::string block;
+        instrumentation::detail::appendRecord(
+            block,
+            {instrumentation::detail::RecordKind::Instant, 'g', 2, 0,
+             instrumentation::detail::nowUs(), 0, "Dropped events"},
+            args);
+        return block;
+    }
+
+    /**
+     * @brief Append the compression extension to a path if it is missing.
+     */
+    static std::string outputPath(const std::string &filepath,
+                                  instrumentation::Compression compression)
+    {
+        const std::string extension =
+            instrumentation::compressionExtension(compression);
+        if (extension.empty() || filepath.ends_with(extension))
+            return filepath;
+        return filepath + extension;
+    }
+
+    void registerBuffer(
+        std::shared_ptr<instrumentation::detail::ThreadBuffer> buffer)
+    {
+        std::lock_guard<std::mutex> lock(m_buffersMutex);
+        m_buffers.push_back(std::move(buffer));
+    }
+
+    /**
+     * @brief Append an event record to the calling thread's buffer and hand
+     * the buffer to the writer once it is full.
+     *
+     * `format` is called with the buffer locked.
+     */
+    template <typename Format> void record(Format &&format)
+    {
+        if (!sessionActive())
+        {
+            return;
+        }
+
+        const instrumentation::detail::AllocationPause pause;
+        instrumentation::detail::ThreadContext &context = threadContext();
+        if (context.buffer == nullptr) [[unlikely]]
+            return; // the thread is exiting
+        instrumentation::detail::ThreadBuffer &buffer = *context.buffer;
+        std::string block;
+        uint64_t generation = 0;
+        {
+            std::lock_guard<std::mutex> lock(buffer.mutex);
+            const uint64_t current =
+                m_generation.load(std::memory_order_relaxed);
+            if (context.generation != current)
+            {
+                // Leftovers from an earlier session were already flushed
+                buffer.data.clear();
+                buffer.counters.clear();
+                buffer.openScopes.clear();
+                buffer.threadNameRecorded = false;
+                buffer.generation = current;
+                context.generation = current;
+            }
+
+            if (!buffer.threadNameRecorded)
+            {
+                if (!buffer.threadName.empty())
+                    instrumentation::detail::appendRecord(
+                        buffer.data,
+                        {instrumentation::detail::RecordKind::ThreadName, 'M',
+                         0, buffer.threadId, 0, 0, nullptr},
+                        buffer.threadName);
+                buffer.threadNameRecorded = true;
+            }
+
+            format(buffer);
+
+            const std::size_t bufferSize =
+                m_bufferSize.load(std::memory_order_relaxed);
+            if (buffer.data.size() < bufferSize)
+                return;
+
+            block = std::move(buffer.data);
+            buffer.data = std::move(buffer.spare);
+            buffer.data.clear();
+            buffer.data.reserve(bufferSize + 256);
+            generation = buffer.generation;
+        }
+
+        if (m_compensateOverhead.load(std::memory_order_relaxed) &&
+            context.depth > 0 &&
+            context.depth < instrumentation::detail::ThreadContext::kMaxDepth)
+        {
+            // Charged to the innermost open timer like a child's overhead
+            const uint64_t commitStartUs = instrumentation::detail::nowUs();
+            commitBlock(block, generation);
+            const uint64_t commitUs =
+                instrumentation::detail::nowUs() - commitStartUs;
+            context.childOverheadNs[context.depth] +=
+                1000.0 * static_cast<double>(commitUs);
+        }
+        else
+        {
+            commitBlock(block, generation);
+        }
+
+        // Give the storage back so steady-state recording never allocates
+        std::lock_guard<std::mutex> lock(buffer.mutex);
+        if (buffer.spare.capacity() < block.capacity())
+            buffer.spare = std::move(block);
+    }
+
+    /**
+     * @brief Measure what one InstrumentationTimer costs the scope enclosing
+     * it, in nanoseconds, by running real timers on the calling thread.
+     *
+     * Called by beginSession() before the session starts. The timers go
+     * through the full recording path of a plain session in a calibration
+     * generation of their own, which the session then discards. Only the
+     * calling thread records meanwhile; other threads still see no session
+     * (see s_calibrating). Handing a full buffer to the writer is rarer and
+     * far costlier, so it is timed where it happens instead (see record()).
+     * The fastest of several rounds is kept, so preemption does not inflate
+     * it.
+     */
+    double measureScopeOverheadNs();
+
+    static instrumentation::detail::CounterState &
+    counterState(instrumentation::detail::ThreadBuffer &buffer,
+                 const char *name)
+    {
+        for (auto &state : buffer.counters)
+        {
+            if (state.name == name)
+                return state;
+        }
+        buffer.counters.push_back({});
+        buffer.counters.back().name = name;
+        return buffer.counters.back();
+    }
+
+    /**
+     * @brief Write out coalesced counter values that are still pending.
+     *
+     * Assumes the buffer's mutex is held.
+     */
+    void flushPendingCounters(instrumentation::detail::ThreadBuffer &buffer)
+    {
+        for (auto &state : buffer.counters)
+        {
+            if (!state.pending)
+                continue;
+            appendCounter(buffer.data, state.name, state.pendingUs,
+                          state.pendingValue, buffer.threadId);
+            state.pending = false;
+        }
+    }
+
+    /**
+     * @brief Hand whatever the buffer holds to the writer.
+     */
+    void flushBuffer(instrumentation::detail::ThreadBuffer &buffer)
+    {
+        std::string block;
+        uint64_t generation = 0;
+        {
+            std::lock_guard<std::mutex> lock(buffer.mutex);
+            if (buffer.generation ==
+                m_generation.load(std::memory_order_relaxed))
+                flushPendingCounters(buffer);
+            block.swap(buffer.data);
+            generation = buffer.generation;
+        }
+        commitBlock(block, generation);
+    }
+
+    /**
+     * @brief Append a finished block to the output if it still belongs to
+     * the active session.
+     */
+    void commitBlock(const std::string &block, uint64_t generation)
     {
+        if (block.empty())
+            return;
+
+        std::shared_lock<std::shared_mutex> lock(m_sessionMutex);
+        if (!m_currentSessionActive.load(std::memory_order_relaxed) ||
+            generation != m_generation.load(std::memory_order_relaxed))
+        {
+            return;
+        }
+        m_writer->write(block.data(), block.size());
     }
-    
+
     /**
-     * @brief locked helpers (assume m_mutex is held)
+     * @brief Record a counter ("C") sample.
+     */
+    static void appendCounter(std::string &out, const char *name,
+                              uint64_t timeUs, double value, uint32_t threadId)
+    {
+        instrumentation::detail::appendRecord(
+            out, {instrumentation::detail::RecordKind::Counter, 'C', 0,
+                  threadId, timeUs, std::bit_cast<uint64_t>(value), name});
+    }
+
+    /**
+     * @brief locked helpers (assume m_sessionMutex is held exclusively)
      */
     void endSessionLocked()
     {
-        if (!m_currentSessionActive)
+        if (!m_currentSessionActive.load(std::memory_order_relaxed))
             return;
 
-        writeFooter();
-        m_outputStream.close();
-        m_currentSessionActive = false;
-        m_profileCount = 0;
-        m_sessionStartUs = 0;
+        m_currentSessionActive.store(false, std::memory_order_release);
+        flushBuffersLocked();
+        m_writer->close(); // writes the footer
+        m_writer.reset();
+        m_sessionStartUs.store(0, std::memory_order_relaxed);
     }
 
     /**
-     * @brief Write the opening JSON header for the trace output.
+     * @brief Write out every thread's pending events and drop buffers whose
+     * thread has exited.
      *
-     * Writes the initial JSON fields and flushes the output stream so that
-     * consumers can begin reading the trace data immediately.
+     * Scopes that are still open are ended here, innermost first, so the
+     * trace never holds a "B" without its "E".
      */
-    void writeHeader()
+    void flushBuffersLocked()
     {
-        m_outputStream << "{\"otherData\": {},\"traceEvents\":[";
-        m_outputStream.flush();
+        const uint64_t generation =
+            m_generation.load(std::memory_order_relaxed);
+        const uint64_t nowUs = instrumentation::detail::nowUs();
+
+        std::lock_guard<std::mutex> buffersLock(m_buffersMutex);
+        for (const auto &buffer : m_buffers)
+        {
+            std::lock_guard<std::mutex> lock(buffer->mutex);
+            if (buffer->generation == generation)
+            {
+                flushPendingCounters(*buffer);
+                for (auto open = buffer->openScopes.rbegin();
+                     open != buffer->openScopes.rend(); ++open)
+                    instrumentation::detail::appendNamedRecord(
+                        buffer->data,
+                        {instrumentation::detail::RecordKind::Scope, 'E', 0,
+                         buffer->threadId, nowUs, 0, nullptr},
+                        *open);
+            }
+            if (buffer->generation == generation && !buffer->data.empty())
+                m_writer->write(buffer->data.data(), buffer->data.size());
+            buffer->data.clear();
+            buffer->counters.clear();
+            buffer->openScopes.clear();
+        }
+
+        m_buffers.erase(
+            std::remove_if(m_buffers.begin(), m_buffers.end(),
+                           [](const auto &buffer) {
+                               return buffer->threadExited.load(
+                                   std::memory_order_acquire);
+                           }),
+            m_buffers.end());
     }
 
     /**
-     * @brief Write the closing JSON footer for the trace output.
+     * @brief Build the opening JSON header for the trace output.
+     *
+     * Holds the initial JSON fields followed by a `process_name` metadata
+     * event carrying the session name. Having a first event in place lets
+     * every subsequent event carry its own leading separator. The header is
+     * repeated at the start of every rotated file and each file is closed
+     * with `]}`.
      *
-     * Closes the `traceEvents` array and the root JSON object, then flushes
-     * the output stream to ensure all buffered data is written.
+     * A `trace_clock_anchor` metadata event follows. It records the host,
+     * and the steady and wall clock times that timestamp 0 corresponds to,
+     * so that trace_merge can align the files of several processes.
+     *
+     * An `instrumentation_overhead` metadata event records the measured
+     * cost of one scope and whether it was subtracted from parent scopes.
      */
-    void writeFooter()
+    std::string makeHeader(uint64_t sessionStartUs) const
     {
-        m_outputStream << "]}";
-        m_outputStream.flush();
+        std::string header = "{\"otherData\": {},\"traceEvents\":[";
+        header += "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":";
+        instrumentation::detail::appendUint(header, m_processId);
+        header += ",\"tid\":0,\"args\":{\"name\":\"";
+        instrumentation::detail::appendSanitized(header, m_session.name);
+        header += "\"}}";
+
+        header += ", {\"name\":\"trace_clock_anchor\",\"ph\":\"M\","
+                  "\"pid\":";
+        instrumentation::detail::appendUint(header, m_processId);
+        header += ",\"tid\":0,\"args\":{\"host\":\"";
+        instrumentation::detail::appendSanitized(
+            header, instrumentation::detail::hostName());
+        header += "\",\"steady_us\":";
+        instrumentation::detail::appendUint(header, sessionStartUs);
+        header += ",\"wall_us\":";
+        instrumentation::detail::appendUint(
+            header, instrumentation::detail::wallClockUs());
+        header += "}}";
+
+        header += ", {\"name\":\"instrumentation_overhead\",\"ph\":\"M\","
+                  "\"pid\":";
+        instrumentation::detail::appendUint(header, m_processId);
+        header += ",\"tid\":0,\"args\":{\"scope_ns\":";
+        instrumentation::detail::appendDouble(
+            header, m_scopeOverheadNs.load(std::memory_order_relaxed));
+        header += ",\"compensated\":";
+        instrumentation::detail::appendUint(
+            header, m_compensateOverhead.load(std::memory_order_relaxed));
+        header += "}}";
+        return header;
     }
 
   private:
-    std::mutex m_mutex;
+    std::shared_mutex m_sessionMutex;
 
     InstrumentationSession m_session{};
-    bool m_currentSessionActive{false};
-    std::ofstream m_outputStream;
-    int m_profileCount = 0;
-    uint64_t m_sessionStartUs = 0;
+    std::atomic<bool> m_currentSessionActive{false};
+    std::unique_ptr<instrumentation::TraceWriter> m_writer;
+    std::atomic<uint64_t> m_sessionStartUs{0};
+    std::atomic<uint64_t> m_generation{0};
+    std::atomic<std::size_t> m_bufferSize{64 * 1024};
+    std::atomic<int64_t> m_counterIntervalUs{0};
+    std::atomic<bool> m_beginEndScopes{false};
+    std::atomic<bool> m_trackAllocations{false};
+    std::atomic<bool> m_compensateOverhead{false};
+    std::atomic<double> m_scopeOverheadNs{0};
+    std::atomic<uint64_t> m_nextAsyncId{1};
+    uint32_t m_processId = 0;
+    std::atomic<bool> m_crashFinalized{false};
+
+    std::mutex m_buffersMutex;
+    std::vector<std::shared_ptr<instrumentation::detail::ThreadBuffer>>
+        m_buffers;
+
+    // Constant-initialised, so reading them needs no thread-local init guard
+    static inline thread_local instrumentation::detail::ThreadContext
+        *s_threadContext = nullptr;
+    static inline thread_local bool s_threadExited = false;
+    // Set while measureScopeOverheadNs() records on this thread only
+    static inline thread_local bool s_calibrating = false;
 };
 
 class InstrumentationTimer
@@ -245,15 +1417,66 @@ class InstrumentationTimer
      *
      * Records the start time immediately upon construction. The timer will
      * automatically emit a profiling result when destroyed unless it is
-     * explicitly stopped earlier.
+     * explicitly stopped earlier. In sessions using ScopeEvents::BeginEnd
+     * the begin event is recorded here as well.
+     *
+     * @param name Name of the scope being profiled. Must remain valid for
+     * the timer's lifetime; it is copied when the event is recorded. Pass
+     * an instrumentation::StaticString for literals and interned strings to
+     * record only the pointer.
+     */
+    explicit InstrumentationTimer(instrumentation::EventName name)
+        : m_name(name), m_context(nullptr), m_stopped(false),
+          m_trackAllocations(false), m_compensateOverhead(false),
+          m_argCount(0), m_startUs(instrumentation::detail::nowUs()),
+          m_beginGeneration(0)
+    {
+        Instrumentor &instrumentor = Instrumentor::get();
+        if (!instrumentor.sessionActive())
+            return; // nothing to set up outside a session
+
+        m_context = &Instrumentor::threadContext();
+        ++m_context->depth;
+        m_compensateOverhead = instrumentor.compensatingOverhead();
+        if (m_compensateOverhead &&
+            m_context->depth <
+                instrumentation::detail::ThreadContext::kMaxDepth)
+            m_context->childOverheadNs[m_context->depth] = 0;
+        if (instrumentor.beginEndScopes())
+            m_beginGeneration = instrumentor.writeScopeBegin(m_name, m_startUs);
+
+        m_trackAllocations = instrumentor.trackingAllocations();
+        if (m_trackAllocations)
+        {
+            if (m_context->depth <
+                instrumentation::detail::ThreadContext::kMaxDepth)
+                m_context->childAllocations[m_context->depth] = {};
+            m_allocationStart =
+                instrumentation::detail::threadAllocations.total;
+        }
+    }
+
+    /**
+     * @brief Start a timer with arguments given as key/value pairs.
      *
-     * @param name Name of the scope being profiled. Must remain valid for the
-     * timer's lifetime.
+     * @code
+     * InstrumentationTimer timer("HandleRequest", "id", requestId,
+     *                            "bytes", size);
+     * @endcode
+     *
+     * Values are integers, floating point values or strings. String values
+     * must remain valid for the timer's lifetime, as they are copied when
+     * the event is recorded. Keys must be literals or interned strings. At
+     * most kMaxArgs arguments are kept.
      */
-    explicit InstrumentationTimer(const char *name)
-        : m_name(name), m_stopped(false),
-          m_startUs(instrumentation::detail::nowUs())
+    template <typename Value, typename... Rest>
+    InstrumentationTimer(instrumentation::EventName name, const char *key,
+                         Value value, Rest... rest)
+        : InstrumentationTimer(name)
     {
+        static_assert(sizeof...(Rest) % 2 == 0,
+                      "Arguments must be given as key/value pairs");
+        addArgs(key, value, rest...);
     }
 
     /**
@@ -265,12 +1488,33 @@ class InstrumentationTimer
             stop();
     }
 
+    /**
+     * @brief Attach an argument to the event, e.g. a result size that is
+     * only known at the end of the scope. Arguments beyond kMaxArgs are
+     * ignored.
+     */
+    template <typename Value> void arg(const char *key, Value value)
+    {
+        if (m_argCount < kMaxArgs)
+            m_args[m_argCount++] = instrumentation::TraceArg(key, value);
+    }
+
     /**
      * @brief Stop the timer and record the profiling result.
      *
      * Captures the end time, computes the duration, and submits the profiling
      * data to the global Instrumentor. Calling this function more than once
      * has no effect after the first call.
+     *
+     * When the session tracks allocations, the heap allocations made while
+     * this was the innermost open timer are attached as the `allocs`,
+     * `alloc_bytes` and `frees` args, and the thread's allocated-bytes
+     * counter is updated.
+     *
+     * When the session compensates overhead and timers finished inside
+     * this one, the duration minus their overhead and that of the buffer
+     * hand-offs among them is attached as the `compensated_dur_us` arg. The
+     * event itself keeps its measured times.
      */
     void stop()
     {
@@ -279,18 +1523,279 @@ class InstrumentationTimer
             return;
         }
 
+        m_stopped = true;
+
         const uint64_t endUs = instrumentation::detail::nowUs();
+        // The nesting bookkeeping belongs to the thread that started the
+        // timer; a timer finishing on another thread, e.g. in a coroutine
+        // resumed elsewhere, leaves it alone
+        if (m_context != nullptr &&
+            m_context == Instrumentor::existingThreadContext())
+        {
+            if (m_compensateOverhead)
+                compensateOverhead(endUs);
+            if (m_trackAllocations)
+                recordAllocations();
+            --m_context->depth;
+        }
 
-        // Thread IDs are hashed to a 32-bit value for trace compatibility
-        const uint32_t threadId = static_cast<uint32_t>(
-            std::hash<std::thread::id>{}(std::this_thread::get_id()));
+        // A timer started before the session would end before it began
+        Instrumentor &instrumentor = Instrumentor::get();
+        if (m_context == nullptr || !instrumentor.sessionActive() ||
+            m_startUs < instrumentor.sessionStartUs())
+            return;
+        if (m_beginGeneration != 0)
+            instrumentor.writeScopeEnd(m_name, endUs, m_beginGeneration,
+                                       m_args, m_argCount);
+        else
+            instrumentor.writeProfile(m_name, m_startUs, endUs,
+                                      Instrumentor::threadContext().threadId,
+                                      m_args, m_argCount);
+    }
 
-        Instrumentor::get().writeProfile({m_name, m_startUs, endUs, threadId});
-        m_stopped = true;
+    static constexpr uint8_t kMaxArgs = 4;
+
+  private:
+    template <typename Value, typename... Rest>
+    void addArgs(const char *key, Value value, Rest... rest)
+    {
+        arg(key, value);
+        if constexpr (sizeof...(Rest) > 0)
+            addArgs(rest...);
+    }
+
+    /**
+     * @brief Attach the duration without the overhead of the finished
+     * descendants, and charge this timer's overhead and theirs to the
+     * parent level.
+     */
+    void compensateOverhead(uint64_t endUs)
+    {
+        using instrumentation::detail::ThreadContext;
+
+        const uint32_t level = m_context->depth;
+        if (level >= ThreadContext::kMaxDepth)
+            return;
+        const double overheadNs = m_context->childOverheadNs[level];
+        if (level >= 2)
+            m_context->childOverheadNs[level - 1] +=
+                overheadNs + Instrumentor::get().scopeOverheadNs();
+
+        const uint64_t overheadUs =
+            static_cast<uint64_t>(overheadNs / 1000.0 + 0.5);
+        if (overheadUs == 0)
+            return;
+        const uint64_t durationUs = endUs - m_startUs;
+        m_args[m_argCount++] = {"compensated_dur_us",
+                                durationUs - std::min(overheadUs, durationUs)};
+    }
+
+    /**
+     * @brief Attach this scope's own allocations (excluding those of child
+     * timers) and report them to the parent level.
+     */
+    void recordAllocations()
+    {
+        using instrumentation::detail::AllocationStats;
+        using instrumentation::detail::ThreadContext;
+
+        const AllocationStats &total =
+            instrumentation::detail::threadAllocations.total;
+        const AllocationStats inclusive{
+            total.allocations - m_allocationStart.allocations,
+            total.bytes - m_allocationStart.bytes,
+            total.frees - m_allocationStart.frees};
+
+        AllocationStats self = inclusive;
+        const uint32_t level = m_context->depth;
+        if (level < ThreadContext::kMaxDepth)
+        {
+            const AllocationStats &children =
+                m_context->childAllocations[level];
+            self.allocations -=
+                std::min(self.allocations, children.allocations);
+            self.bytes -= std::min(self.bytes, children.bytes);
+            self.frees -= std::min(self.frees, children.frees);
+        }
+        if (level >= 2 && level - 1 < ThreadContext::kMaxDepth)
+        {
+            AllocationStats &parent = m_context->childAllocations[level - 1];
+            parent.allocations += inclusive.allocations;
+            parent.bytes += inclusive.bytes;
+            parent.frees += inclusive.frees;
+        }
+
+        m_args[m_argCount++] = {"allocs", self.allocations};
+        m_args[m_argCount++] = {"alloc_bytes", self.bytes};
+        m_args[m_argCount++] = {"frees", self.frees};
+
+        if (total.bytes != m_context->reportedBytes)
+        {
+            if (m_context->allocationCounter == nullptr)
+            {
+                const instrumentation::detail::AllocationPause pause;
+                m_context->allocationCounter = instrumentation::internString(
+                    "Allocated bytes (tid " +
+                    std::to_string(m_context->threadId) + ")");
+            }
+            m_context->reportedBytes = total.bytes;
+            Instrumentor::get().writeCounter(m_context->allocationCounter,
+                                             static_cast<double>(total.bytes));
+        }
     }
 
   private:
-    const char *m_name;
+    static constexpr uint8_t kAllocationArgs = 3;
+    static constexpr uint8_t kCompensationArgs = 1;
+
+    instrumentation::EventName m_name;
+    instrumentation::detail::ThreadContext *m_context;
     bool m_stopped;
+    bool m_trackAllocations;
+    bool m_compensateOverhead;
+    uint8_t m_argCount;
     uint64_t m_startUs;
-};
\ No newline at end of file
+    uint64_t m_beginGeneration; // session the "B" went to, 0 if none
+    instrumentation::detail::AllocationStats m_allocationStart;
+    // Left uninitialised; room for the compensation and allocation args
+    // after the user's
+    instrumentation::TraceArg
+        m_args[kMaxArgs + kCompensationArgs + kAllocationArgs];
+};
+
+/**
+ * @brief RAII handle for an operation that crosses threads.
+ *
+ * Construction records an async begin and a flow start on the creating
+ * thread. The handle can be moved to whichever thread continues the work;
+ * step() marks each hand-over with a flow step, and destruction (or stop())
+ * records the flow end and async end on the thread that finishes it. In the
+ * viewer the operation appears as one slice spanning its full latency, with
+ * arrows through the per-thread scopes that worked on it, so queueing delay
+ * between stages is visible.
+ *
+ * @code
+ * AsyncInstrumentationTimer request("Request");
+ * queue.push([request = std::move(request)]() mutable {
+ *     request.step();
+ *     handle();
+ * }); // ends when the lambda is destroyed
+ * @endcode
+ */
+class AsyncInstrumentationTimer
+{
+  public:
+    AsyncInstrumentationTimer(const AsyncInstrumentationTimer &) = delete;
+    AsyncInstrumentationTimer &
+    operator=(const AsyncInstrumentationTimer &) = delete;
+
+    /**
+     * @param name Name of the operation. Must remain valid for the
+     *             handle's lifetime.
+     * @param id   ID linking the events; a fresh one is allocated by default.
+     */
+    explicit AsyncInstrumentationTimer(
+        instrumentation::EventName name,
+        uint64_t id = Instrumentor::get().nextAsyncId())
+        : m_name(name), m_id(id), m_stopped(false)
+    {
+        Instrumentor::get().writeAsyncEvent(m_name, m_id, AsyncPhase::Begin);
+        Instrumentor::get().writeAsyncEvent(m_name, m_id,
+                                            AsyncPhase::FlowStart);
+    }
+
+    AsyncInstrumentationTimer(AsyncInstrumentationTimer &&other) noexcept
+        : m_name(other.m_name), m_id(other.m_id), m_stopped(other.m_stopped)
+    {
+        other.m_stopped = true;
+    }
+
+    AsyncInstrumentationTimer &
+    operator=(AsyncInstrumentationTimer &&other) noexcept
+    {
+        if (this != &other)
+        {
+            stop();
+            m_name = other.m_name;
+            m_id = other.m_id;
+            m_stopped = other.m_stopped;
+            other.m_stopped = true;
+        }
+        return *this;
+    }
+
+    ~AsyncInstrumentationTimer()
+    {
+        stop();
+    }
+
+    /**
+     * @brief Mark that the operation continues on the calling thread.
+     */
+    void step()
+    {
+        if (!m_stopped)
+            Instrumentor::get().writeAsyncEvent(m_name, m_id,
+                                                AsyncPhase::FlowStep);
+    }
+
+    /**
+     * @brief End the operation on the calling thread. Calling this more than
+     * once has no effect after the first call.
+     */
+    void stop()
+    {
+        if (m_stopped)
+            return;
+        Instrumentor::get().writeAsyncEvent(m_name, m_id, AsyncPhase::FlowEnd);
+        Instrumentor::get().writeAsyncEvent(m_name, m_id, AsyncPhase::End);
+        m_stopped = true;
+    }
+
+    uint64_t id() const
+    {
+        return m_id;
+    }
+
+  private:
+    instrumentation::EventName m_name;
+    uint64_t m_id;
+    bool m_stopped;
+};
+
+inline double Instrumentor::measureScopeOverheadNs()
+{
+    constexpr int kRounds = 5;
+    constexpr int kScopesPerRound = 1000;
+
+    // Nothing is handed to the writer and no option adds work to the timers
+    m_bufferSize.store(std::numeric_limits<std::size_t>::max(),
+                       std::memory_order_relaxed);
+    m_beginEndScopes.store(false, std::memory_order_relaxed);
+    m_trackAllocations.store(false, std::memory_order_relaxed);
+    m_compensateOverhead.store(false, std::memory_order_relaxed);
+    m_generation.fetch_add(1, std::memory_order_relaxed);
+    // Only this thread records; the others still see no session
+    s_calibrating = true;
+
+    instrumentation::detail::ThreadBuffer *buffer = threadContext().buffer;
+    double best = std::numeric_limits<double>::infinity();
+    for (int round = 0; round < kRounds; ++round)
+    {
+        const auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < kScopesPerRound; ++i)
+            InstrumentationTimer timer(
+                instrumentation::StaticString("calibration"));
+        const std::chrono::duration<double, std::nano> elapsed =
+            std::chrono::steady_clock::now() - start;
+        best = std::min(best, elapsed.count() / kScopesPerRound);
+
+        if (buffer == nullptr)
+            continue;
+        std::lock_guard<std::mutex> lock(buffer->mutex);
+        buffer->data.clear();
+    }
+
+    s_calibrating = false;
+    return best;
+}
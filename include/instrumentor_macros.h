@@ -12,9 +12,16 @@
  *
  * The macros support:
  * - Beginning and ending profiling sessions
- * - Scoped timing via RAII
+ * - Finalising the trace when the process crashes
+ * - Scoped timing via RAII, optionally with typed arguments; names are
+ *   copied when the scope is recorded, except with ST_PROFILE_SCOPE_STATIC
  * - Automatic function-level profiling using compiler-specific function
  *   signature macros
+ * - Naming threads in the trace
+ * - Counter tracks for plotting values such as queue depths
+ * - Instant markers scoped to the thread, the process or the whole trace
+ * - Async slices and flow arrows for work that hops between threads (see
+ *   also AsyncInstrumentationTimer)
  *
  * Typical usage:
  * @code
@@ -25,8 +32,16 @@
  *     loadAssets();
  * }
  *
+ * {
+ *     ST_PROFILE_SCOPE_ARGS("HandleRequest", "id", requestId, "bytes", size);
+ *     handle();
+ * }
+ *
  * ST_PROFILE_FUNCTION(); // Profiles the current function
  *
+ * ST_PROFILE_COUNTER("QueueDepth", queue.size());
+ * ST_PROFILE_INSTANT("CacheEviction");
+ *
  * ST_PROFILE_END_SESSION();
  * @endcode
  *
@@ -37,6 +52,7 @@
 #pragma once
 
 // Include the profiler types
+#include "crash_handler.h"
 #include "instrumentor.h"
 
 // Config toggle to turn profiling on/off
@@ -62,16 +78,69 @@
 
 #define ST_PROFILE_END_SESSION() ::Instrumentor::get().endSession()
 
+#define ST_PROFILE_INSTALL_CRASH_HANDLERS()                                    \
+    ::instrumentation::installCrashHandlers()
+
 #define ST_PROFILE_SCOPE(name)                                                 \
     ::InstrumentationTimer ST_CONCAT(_st_timer_, __LINE__)(name)
 
-#define ST_PROFILE_FUNCTION() ST_PROFILE_SCOPE(ST_FUNC_SIG)
+#define ST_PROFILE_SCOPE_STATIC(name)                                          \
+    ::InstrumentationTimer ST_CONCAT(_st_timer_, __LINE__)(                    \
+        ::instrumentation::StaticString(name))
+
+#define ST_PROFILE_SCOPE_ARGS(name, ...)                                       \
+    ::InstrumentationTimer ST_CONCAT(_st_timer_, __LINE__)(name, __VA_ARGS__)
+
+#define ST_PROFILE_FUNCTION() ST_PROFILE_SCOPE_STATIC(ST_FUNC_SIG)
+
+#define ST_PROFILE_THREAD_NAME(name) ::Instrumentor::get().setThreadName(name)
+
+#define ST_PROFILE_COUNTER(name, value)                                        \
+    ::Instrumentor::get().writeCounter((name), static_cast<double>(value))
+
+#define ST_PROFILE_INSTANT(name)                                               \
+    ::Instrumentor::get().writeInstant((name), ::InstantScope::Thread)
+
+#define ST_PROFILE_INSTANT_PROCESS(name)                                       \
+    ::Instrumentor::get().writeInstant((name), ::InstantScope::Process)
+
+#define ST_PROFILE_INSTANT_GLOBAL(name)                                        \
+    ::Instrumentor::get().writeInstant((name), ::InstantScope::Global)
+
+#define ST_PROFILE_ASYNC_BEGIN(name, id)                                       \
+    ::Instrumentor::get().writeAsyncEvent((name), (id), ::AsyncPhase::Begin)
+
+#define ST_PROFILE_ASYNC_END(name, id)                                         \
+    ::Instrumentor::get().writeAsyncEvent((name), (id), ::AsyncPhase::End)
+
+#define ST_PROFILE_FLOW_START(name, id)                                        \
+    ::Instrumentor::get().writeAsyncEvent((name), (id),                        \
+                                          ::AsyncPhase::FlowStart)
+
+#define ST_PROFILE_FLOW_STEP(name, id)                                         \
+    ::Instrumentor::get().writeAsyncEvent((name), (id), ::AsyncPhase::FlowStep)
+
+#define ST_PROFILE_FLOW_END(name, id)                                          \
+    ::Instrumentor::get().writeAsyncEvent((name), (id), ::AsyncPhase::FlowEnd)
 
 #else
 
 #define ST_PROFILE_BEGIN_SESSION(name, filepath) ((void)0)
 #define ST_PROFILE_END_SESSION() ((void)0)
+#define ST_PROFILE_INSTALL_CRASH_HANDLERS() ((void)0)
 #define ST_PROFILE_SCOPE(name) ((void)0)
+#define ST_PROFILE_SCOPE_STATIC(name) ((void)0)
+#define ST_PROFILE_SCOPE_ARGS(name, ...) ((void)0)
 #define ST_PROFILE_FUNCTION() ((void)0)
+#define ST_PROFILE_THREAD_NAME(name) ((void)0)
+#define ST_PROFILE_COUNTER(name, value) ((void)0)
+#define ST_PROFILE_INSTANT(name) ((void)0)
+#define ST_PROFILE_INSTANT_PROCESS(name) ((void)0)
+#define ST_PROFILE_INSTANT_GLOBAL(name) ((void)0)
+#define ST_PROFILE_ASYNC_BEGIN(name, id) ((void)0)
+#define ST_PROFILE_ASYNC_END(name, id) ((void)0)
+#define ST_PROFILE_FLOW_START(name, id) ((void)0)
+#define ST_PROFILE_FLOW_STEP(name, id) ((void)0)
+#define ST_PROFILE_FLOW_END(name, id) ((void)0)
 
 #endif
@@ -0,0 +1,528 @@
+/**
+ * @file io_uring_trace_writer.h
+ * @brief Asynchronous trace writer built on Linux io_uring.
+ *
+ * Blocks handed to the writer are copied into large, page aligned staging
+ * buffers. Each full buffer is submitted as a single write and several
+ * buffers can be in flight at once, so the calling thread only waits on the
+ * disk when every buffer is still queued. The file may optionally be opened
+ * with `O_DIRECT` to bypass the page cache for very large captures.
+ *
+ * The ring is driven through the raw `io_uring_setup`/`io_uring_enter`
+ * syscalls, so no liburing dependency is needed. When io_uring is not
+ * available (old kernel, seccomp policy, non-Linux platform) `open` fails
+ * and the Instrumentor falls back to the stream writer.
+ */
+
+#pragma once
+
+#include "trace_writer.h"
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#include <sys/syscall.h>
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+#define ST_HAS_IO_URING 1
+#endif
+#endif
+
+#ifndef ST_HAS_IO_URING
+#define ST_HAS_IO_URING 0
+#endif
+
+#if ST_HAS_IO_URING
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+namespace instrumentation
+{
+class IoUringTraceWriter final : public TraceWriter
+{
+  public:
+    static constexpr std::size_t kDefaultBufferSize = 1024u * 1024u;
+    static constexpr unsigned kDefaultQueueDepth = 8;
+
+    /**
+     * @param directIo    Open the file with O_DIRECT when the filesystem
+     *                    supports it.
+     * @param bufferSize  Size of each staging buffer; rounded up to a whole
+     *                    number of pages.
+     * @param queueDepth  Number of staging buffers, i.e. writes in flight.
+     */
+    explicit IoUringTraceWriter(bool directIo = false,
+                                std::size_t bufferSize = kDefaultBufferSize,
+                                unsigned queueDepth = kDefaultQueueDepth)
+        : m_directIo(directIo),
+          m_bufferSize(roundUp(bufferSize == 0 ? kDefaultBufferSize
+                                               : bufferSize)),
+          m_queueDepth(queueDepth < 2 ? 2 : queueDepth)
+    {
+    }
+
+    IoUringTraceWriter(const IoUringTraceWriter &) = delete;
+    IoUringTraceWriter &operator=(const IoUringTraceWriter &) = delete;
+
+    ~IoUringTraceWriter() override
+    {
+        close();
+    }
+
+    bool open(const std::string &path) override
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        closeLocked();
+
+        const int flags = O_WRONLY | O_CREAT | O_TRUNC;
+        if (m_directIo)
+            m_fd = ::open(path.c_str(), flags | O_DIRECT, 0644);
+        if (m_fd < 0) // O_DIRECT is refused by e.g. tmpfs
+            m_fd = ::open(path.c_str(), flags, 0644);
+        if (m_fd < 0)
+            return false;
+
+        if (!setupRing() || !allocateBuffers())
+        {
+            closeLocked();
+            return false;
+        }
+        return true;
+    }
+
+    void write(const char *data, std::size_t size) override
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_ringFd < 0)
+            return;
+
+        while (size > 0)
+        {
+            Buffer &buffer = m_buffers[m_current];
+            const std::size_t chunk =
+                std::min(size, m_bufferSize - buffer.used);
+            std::memcpy(buffer.data + buffer.used, data, chunk);
+            buffer.used += chunk;
+            data += chunk;
+            size -= chunk;
+
+            if (buffer.used == m_bufferSize)
+                rotateBufferLocked();
+        }
+    }
+
+    void close() override
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        closeLocked();
+    }
+
+    bool isOpen() const override
+    {
+        return m_fd >= 0;
+    }
+
+    /**
+     * @brief Rewrite every in-flight buffer and the staging buffer with
+     * pwrite, then append `data` after them.
+     *
+     * Kernel-side requests may be cancelled when the process dies, so the
+     * in-flight data is written again synchronously; identical bytes at a
+     * fixed offset make this idempotent.
+     */
+    void emergencyWrite(const char *data, std::size_t size) override
+    {
+        if (m_fd < 0 || m_buffers.empty())
+            return;
+
+        if (!m_emergency)
+        {
+            m_emergency = true;
+            const int flags = ::fcntl(m_fd, F_GETFL);
+            if (flags >= 0 && (flags & O_DIRECT))
+                ::fcntl(m_fd, F_SETFL, flags & ~O_DIRECT);
+
+            for (const Buffer &buffer : m_buffers)
+            {
+                if (buffer.inFlight)
+                    detail::pwriteAll(m_fd, buffer.data, buffer.iov.iov_len,
+                                      buffer.offset);
+            }
+            const Buffer &staging = m_buffers[m_current];
+            detail::pwriteAll(m_fd, staging.data, staging.used, m_fileOffset);
+            m_emergencyOffset = m_fileOffset + staging.used;
+        }
+
+        detail::pwriteAll(m_fd, data, size, m_emergencyOffset);
+        m_emergencyOffset += size;
+    }
+
+    void emergencyClose() override
+    {
+        if (m_fd < 0)
+            return;
+        emergencyWrite(nullptr, 0);
+        if (::ftruncate(m_fd, static_cast<off_t>(m_emergencyOffset)) != 0)
+        {
+            // Nothing else to do on the crash path
+        }
+    }
+
+  private:
+    struct Buffer
+    {
+        char *data = nullptr;
+        std::size_t used = 0;
+        uint64_t offset = 0;
+        bool inFlight = false;
+        iovec iov{};
+    };
+
+    static constexpr std::size_t kAlignment = 4096;
+
+    static std::size_t roundUp(std::size_t size)
+    {
+        return (size + kAlignment - 1) / kAlignment * kAlignment;
+    }
+
+    static int ioUringSetup(unsigned entries, io_uring_params *params)
+    {
+        return static_cast<int>(
+            ::syscall(__NR_io_uring_setup, entries, params));
+    }
+
+    static int ioUringEnter(int fd, unsigned toSubmit, unsigned minComplete,
+                            unsigned flags)
+    {
+        return static_cast<int>(::syscall(__NR_io_uring_enter, fd, toSubmit,
+                                          minComplete, flags, nullptr, 0));
+    }
+
+    /**
+     * @brief Create the ring and map the submission/completion queues.
+     */
+    bool setupRing()
+    {
+        io_uring_params params{};
+        m_ringFd = ioUringSetup(m_queueDepth, &params);
+        if (m_ringFd < 0)
+            return false;
+
+        m_sqRingSize =
+            params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        m_cqRingSize =
+            params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        const bool singleMmap = (params.features & IORING_FEAT_SINGLE_MMAP);
+        if (singleMmap)
+            m_sqRingSize = m_cqRingSize =
+                std::max(m_sqRingSize, m_cqRingSize);
+
+        m_sqRing = ::mmap(nullptr, m_sqRingSize, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_POPULATE, m_ringFd,
+                          IORING_OFF_SQ_RING);
+        if (m_sqRing == MAP_FAILED)
+        {
+            m_sqRing = nullptr;
+            return false;
+        }
+
+        if (singleMmap)
+        {
+            m_cqRing = m_sqRing;
+        }
+        else
+        {
+            m_cqRing = ::mmap(nullptr, m_cqRingSize, PROT_READ | PROT_WRITE,
+                              MAP_SHARED | MAP_POPULATE, m_ringFd,
+                              IORING_OFF_CQ_RING);
+            if (m_cqRing == MAP_FAILED)
+            {
+                m_cqRing = nullptr;
+                return false;
+            }
+        }
+
+        m_sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+        void *sqes = ::mmap(nullptr, m_sqesSize, PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_POPULATE, m_ringFd,
+                            IORING_OFF_SQES);
+        if (sqes == MAP_FAILED)
+            return false;
+        m_sqes = static_cast<io_uring_sqe *>(sqes);
+
+        char *sq = static_cast<char *>(m_sqRing);
+        char *cq = static_cast<char *>(m_cqRing);
+        m_sqTail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+        m_sqMask = *reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+        m_sqArray = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+        m_cqHead = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+        m_cqTail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+        m_cqMask = *reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+        m_cqes = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+        return true;
+    }
+
+    bool allocateBuffers()
+    {
+        m_buffers.assign(m_queueDepth, Buffer{});
+        for (Buffer &buffer : m_buffers)
+        {
+            buffer.data = static_cast<char *>(
+                std::aligned_alloc(kAlignment, m_bufferSize));
+            if (buffer.data == nullptr)
+                return false;
+        }
+        m_current = 0;
+        m_fileOffset = 0;
+        m_inFlight = 0;
+        m_unsubmitted = 0;
+        m_broken = false;
+        m_emergency = false;
+        m_emergencyOffset = 0;
+        return true;
+    }
+
+    /**
+     * @brief Queue a write of the first `length` bytes of a buffer.
+     */
+    void submitLocked(std::size_t index, std::size_t length)
+    {
+        Buffer &buffer = m_buffers[index];
+        buffer.offset = m_fileOffset;
+        buffer.inFlight = true;
+        buffer.iov.iov_base = buffer.data;
+        buffer.iov.iov_len = length;
+        m_fileOffset += length;
+
+        const unsigned tail = *m_sqTail;
+        const unsigned slot = tail & m_sqMask;
+        io_uring_sqe &sqe = m_sqes[slot];
+        std::memset(&sqe, 0, sizeof(sqe));
+        sqe.opcode = IORING_OP_WRITEV;
+        sqe.fd = m_fd;
+        sqe.addr = reinterpret_cast<uint64_t>(&buffer.iov);
+        sqe.len = 1;
+        sqe.off = buffer.offset;
+        sqe.user_data = index;
+        m_sqArray[slot] = slot;
+        std::atomic_ref<unsigned>(*m_sqTail).store(tail + 1,
+                                                   std::memory_order_release);
+        ++m_inFlight;
+        ++m_unsubmitted;
+
+        enterLocked(0);
+    }
+
+    /**
+     * @brief Push queued submissions to the kernel and optionally wait for
+     * `minComplete` completions.
+     *
+     * If the ring stops working the in-flight buffers are written
+     * synchronously instead. Rewriting bytes the kernel may already have
+     * written is harmless because every buffer has a fixed file offset.
+     */
+    void enterLocked(unsigned minComplete)
+    {
+        const unsigned flags = minComplete > 0 ? IORING_ENTER_GETEVENTS : 0;
+        for (;;)
+        {
+            const int ret =
+                ioUringEnter(m_ringFd, m_unsubmitted, minComplete, flags);
+            if (ret >= 0)
+            {
+                m_unsubmitted -= std::min(m_unsubmitted,
+                                          static_cast<unsigned>(ret));
+                return;
+            }
+            if (errno != EINTR && errno != EAGAIN && errno != EBUSY)
+                break;
+        }
+
+        m_broken = true;
+        m_unsubmitted = 0;
+        for (std::size_t i = 0; i < m_buffers.size(); ++i)
+        {
+            if (m_buffers[i].inFlight)
+                completeLocked(i, 0);
+        }
+    }
+
+    /**
+     * @brief Consume completions, waiting for at least `minComplete`.
+     */
+    void reapLocked(unsigned minComplete)
+    {
+        if (m_broken)
+            return;
+        if (minComplete > 0)
+            enterLocked(minComplete);
+        if (m_broken)
+            return;
+
+        unsigned head = *m_cqHead;
+        const unsigned tail = std::atomic_ref<unsigned>(*m_cqTail).load(
+            std::memory_order_acquire);
+        while (head != tail)
+        {
+            const io_uring_cqe &cqe = m_cqes[head & m_cqMask];
+            completeLocked(static_cast<std::size_t>(cqe.user_data), cqe.res);
+            ++head;
+        }
+        std::atomic_ref<unsigned>(*m_cqHead).store(head,
+                                                   std::memory_order_release);
+    }
+
+    /**
+     * @brief Retire a buffer, finishing short or failed writes synchronously.
+     */
+    void completeLocked(std::size_t index, int result)
+    {
+        Buffer &buffer = m_buffers[index];
+        if (!buffer.inFlight)
+            return;
+        const std::size_t length = buffer.iov.iov_len;
+        std::size_t written = result > 0 ? static_cast<std::size_t>(result) : 0;
+
+        if (written < length)
+        {
+            // The remainder is no longer aligned, so drop O_DIRECT for it
+            const int flags = ::fcntl(m_fd, F_GETFL);
+            if (flags >= 0 && (flags & O_DIRECT))
+                ::fcntl(m_fd, F_SETFL, flags & ~O_DIRECT);
+
+            while (written < length)
+            {
+                const ssize_t n = ::pwrite(
+                    m_fd, buffer.data + written, length - written,
+                    static_cast<off_t>(buffer.offset + written));
+                if (n <= 0 && errno != EINTR)
+                    break;
+                if (n > 0)
+                    written += static_cast<std::size_t>(n);
+            }
+        }
+
+        buffer.inFlight = false;
+        buffer.used = 0;
+        --m_inFlight;
+    }
+
+    /**
+     * @brief Submit the current buffer and move on to a free one.
+     */
+    void rotateBufferLocked()
+    {
+        submitLocked(m_current, m_buffers[m_current].used);
+
+        reapLocked(0);
+        for (;;)
+        {
+            for (std::size_t i = 0; i < m_buffers.size(); ++i)
+            {
+                if (!m_buffers[i].inFlight)
+                {
+                    m_current = i;
+                    return;
+                }
+            }
+            reapLocked(1);
+        }
+    }
+
+    /**
+     * @brief Write the tail, wait for all writes and release the ring.
+     *
+     * With O_DIRECT the tail is padded to the alignment and the file is
+     * truncated back to its real length afterwards.
+     */
+    void closeLocked()
+    {
+        if (m_ringFd >= 0 && !m_buffers.empty())
+        {
+            Buffer &tail = m_buffers[m_current];
+            const std::size_t used = tail.used;
+            if (used > 0)
+            {
+                const std::size_t padded = roundUp(used);
+                std::memset(tail.data + used, 0, padded - used);
+                const uint64_t finalSize = m_fileOffset + used;
+                submitLocked(m_current, padded);
+                while (m_inFlight > 0)
+                    reapLocked(1);
+                if (::ftruncate(m_fd, static_cast<off_t>(finalSize)) != 0)
+                {
+                    // Padding stays in the file; nothing else to do
+                }
+            }
+            while (m_inFlight > 0)
+                reapLocked(1);
+        }
+
+        for (Buffer &buffer : m_buffers)
+            std::free(buffer.data);
+        m_buffers.clear();
+
+        if (m_sqes != nullptr)
+            ::munmap(m_sqes, m_sqesSize);
+        if (m_cqRing != nullptr && m_cqRing != m_sqRing)
+            ::munmap(m_cqRing, m_cqRingSize);
+        if (m_sqRing != nullptr)
+            ::munmap(m_sqRing, m_sqRingSize);
+        m_sqes = nullptr;
+        m_cqRing = nullptr;
+        m_sqRing = nullptr;
+
+        if (m_ringFd >= 0)
+            ::close(m_ringFd);
+        if (m_fd >= 0)
+            ::close(m_fd);
+        m_ringFd = -1;
+        m_fd = -1;
+    }
+
+  private:
+    bool m_directIo;
+    std::size_t m_bufferSize;
+    unsigned m_queueDepth;
+
+    std::mutex m_mutex;
+    int m_fd = -1;
+    int m_ringFd = -1;
+
+    void *m_sqRing = nullptr;
+    void *m_cqRing = nullptr;
+    std::size_t m_sqRingSize = 0;
+    std::size_t m_cqRingSize = 0;
+    std::size_t m_sqesSize = 0;
+    io_uring_sqe *m_sqes = nullptr;
+    unsigned *m_sqTail = nullptr;
+    unsigned *m_sqArray = nullptr;
+    unsigned m_sqMask = 0;
+    unsigned *m_cqHead = nullptr;
+    unsigned *m_cqTail = nullptr;
+    unsigned m_cqMask = 0;
+    io_uring_cqe *m_cqes = nullptr;
+
+    std::vector<Buffer> m_buffers;
+    std::size_t m_current = 0;
+    uint64_t m_fileOffset = 0;
+    unsigned m_inFlight = 0;
+    unsigned m_unsubmitted = 0;
+    bool m_broken = false;
+
+    bool m_emergency = false;
+    uint64_t m_emergencyOffset = 0;
+};
+} // namespace instrumentation
+
+#endif // ST_HAS_IO_URING
@@ -0,0 +1,332 @@
+/**
+ * @file profiled_condition_variable.h
+ * @brief Condition variable and future wrappers that explain blocked time.
+ *
+ * ProfiledConditionVariable (over std::condition_variable) and
+ * ProfiledConditionVariableAny (over std::condition_variable_any, for use
+ * with e.g. ProfiledMutex) have the standard interface. Each wait that
+ * actually blocks is recorded as a `Wait: <name>` span with these args:
+ * - `wake_latency_us`: time from the notify that ended the wait to the
+ *   waiter running again, which is the scheduling latency.
+ * - `spurious`: number of wakeups that did not satisfy the wait.
+ *
+ * A notify that finds threads waiting is recorded as a zero-length
+ * `Notify: <name>` slice on the notifying thread. That slice starts a flow
+ * that ends at the wait it woke, so the viewer draws an arrow from the
+ * notifier to the waiter. Notifies without waiters are only counted.
+ *
+ * A wakeup counts as spurious when the predicate is still false afterwards
+ * or, for waits without a predicate, when no notify happened during the
+ * wait. When several waiters are woken by one notify_all they all link to
+ * the same notify.
+ *
+ * profiledWait() records the time a thread blocks on a std::future or
+ * std::shared_future.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <future>
+#include <mutex>
+#include <string>
+
+#include "instrumentor.h"
+#include "profiled_mutex.h"
+
+namespace instrumentation
+{
+/**
+ * @brief Aggregate statistics of one profiled condition variable.
+ */
+struct WaitStats
+{
+    uint64_t waits = 0;    ///< waits that blocked
+    uint64_t notifies = 0; ///< notify_one and notify_all calls
+    uint64_t spuriousWakeups = 0;
+    uint64_t timeouts = 0;
+    uint64_t waitUs = 0; ///< total time spent blocked
+    uint64_t wakeLatencyUs = 0; ///< total notify-to-wake latency
+    uint64_t maxWakeLatencyUs = 0;
+};
+
+/**
+ * @brief Condition variable wrapper that records waits, notifies and the
+ * latency between them. See the file documentation.
+ *
+ * @tparam ConditionVariable std::condition_variable or
+ *                           std::condition_variable_any.
+ */
+template <typename ConditionVariable> class BasicProfiledConditionVariable
+{
+  public:
+    /**
+     * @param name Used in the trace span and flow names.
+     */
+    explicit BasicProfiledConditionVariable(
+        const char *name = "condition_variable")
+        : m_waitName(internString(std::string("Wait: ") + name)),
+          m_notifyName(internString(std::string("Notify: ") + name)),
+          m_flowName(internString(name))
+    {
+    }
+
+    BasicProfiledConditionVariable(const BasicProfiledConditionVariable &) =
+        delete;
+    BasicProfiledConditionVariable &
+    operator=(const BasicProfiledConditionVariable &) = delete;
+
+    void notify_one()
+    {
+        announce();
+        m_condition.notify_one();
+    }
+
+    void notify_all()
+    {
+        announce();
+        m_condition.notify_all();
+    }
+
+    template <typename Lock> void wait(Lock &lock)
+    {
+        Wait pending(*this);
+        m_condition.wait(lock);
+        if (m_sequence.load(std::memory_order_acquire) == pending.sequence)
+            ++pending.spurious;
+    }
+
+    template <typename Lock, typename Predicate>
+    void wait(Lock &lock, Predicate predicate)
+    {
+        if (predicate())
+            return;
+        Wait pending(*this);
+        for (;;)
+        {
+            m_condition.wait(lock);
+            if (predicate())
+                return;
+            ++pending.spurious;
+        }
+    }
+
+    template <typename Lock, typename Clock, typename Duration>
+    std::cv_status
+    wait_until(Lock &lock,
+               const std::chrono::time_point<Clock, Duration> &deadline)
+    {
+        Wait pending(*this);
+        const std::cv_status status = m_condition.wait_until(lock, deadline);
+        if (status == std::cv_status::timeout)
+            pending.timedOut = true;
+        else if (m_sequence.load(std::memory_order_acquire) ==
+                 pending.sequence)
+            ++pending.spurious;
+        return status;
+    }
+
+    template <typename Lock, typename Clock, typename Duration,
+              typename Predicate>
+    bool wait_until(Lock &lock,
+                    const std::chrono::time_point<Clock, Duration> &deadline,
+                    Predicate predicate)
+    {
+        if (predicate())
+            return true;
+        Wait pending(*this);
+        for (;;)
+        {
+            const std::cv_status status =
+                m_condition.wait_until(lock, deadline);
+            if (predicate())
+                return true;
+            if (status == std::cv_status::timeout)
+            {
+                pending.timedOut = true;
+                return false;
+            }
+            ++pending.spurious;
+        }
+    }
+
+    template <typename Lock, typename Rep, typename Period>
+    std::cv_status wait_for(Lock &lock,
+                            const std::chrono::duration<Rep, Period> &timeout)
+    {
+        return wait_until(lock, std::chrono::steady_clock::now() + timeout);
+    }
+
+    template <typename Lock, typename Rep, typename Period, typename Predicate>
+    bool wait_for(Lock &lock, const std::chrono::duration<Rep, Period> &timeout,
+                  Predicate predicate)
+    {
+        return wait_until(lock, std::chrono::steady_clock::now() + timeout,
+                          std::move(predicate));
+    }
+
+    WaitStats stats() const
+    {
+        WaitStats stats;
+        stats.waits = m_waits.load(std::memory_order_relaxed);
+        stats.notifies = m_sequence.load(std::memory_order_relaxed);
+        stats.spuriousWakeups = m_spurious.load(std::memory_order_relaxed);
+        stats.timeouts = m_timeouts.load(std::memory_order_relaxed);
+        stats.waitUs = m_waitUs.load(std::memory_order_relaxed);
+        stats.wakeLatencyUs = m_wakeLatencyUs.load(std::memory_order_relaxed);
+        stats.maxWakeLatencyUs =
+            m_maxWakeLatencyUs.load(std::memory_order_relaxed);
+        return stats;
+    }
+
+  private:
+    /**
+     * @brief One blocking wait; records its span when it goes out of scope.
+     */
+    struct Wait
+    {
+        explicit Wait(BasicProfiledConditionVariable &owner)
+            : owner(owner), startUs(detail::nowUs()),
+              sequence(owner.m_sequence.load(std::memory_order_acquire))
+        {
+            owner.m_waiting.fetch_add(1, std::memory_order_acq_rel);
+        }
+
+        Wait(const Wait &) = delete;
+        Wait &operator=(const Wait &) = delete;
+
+        ~Wait()
+        {
+            owner.finishWait(*this);
+        }
+
+        BasicProfiledConditionVariable &owner;
+        const uint64_t startUs;
+        const uint64_t sequence; ///< notifies before the wait began
+        uint64_t spurious = 0;
+        bool timedOut = false;
+    };
+
+    /**
+     * @brief Record a notify and start the flow to whoever it wakes. A
+     * notify without waiters starts no flow; its id stays 0.
+     */
+    void announce()
+    {
+        const uint64_t nowUs = detail::nowUs();
+        uint64_t id = 0;
+        if (m_waiting.load(std::memory_order_acquire) != 0)
+        {
+            Instrumentor &instrumentor = Instrumentor::get();
+            id = instrumentor.nextAsyncId();
+            instrumentor.writeProfile(StaticString(m_notifyName), nowUs,
+                                      nowUs, detail::currentThreadId());
+            instrumentor.writeAsyncEvent(StaticString(m_flowName), id,
+                                         AsyncPhase::FlowStart, nowUs);
+        }
+
+        std::lock_guard<std::mutex> lock(m_notifyMutex);
+        m_lastNotify = {nowUs, id};
+        m_sequence.fetch_add(1, std::memory_order_release);
+    }
+
+    void finishWait(const Wait &pending)
+    {
+        const uint64_t endUs = detail::nowUs();
+        m_waiting.fetch_sub(1, std::memory_order_acq_rel);
+        LastNotify lastNotify;
+        bool notified;
+        {
+            std::lock_guard<std::mutex> lock(m_notifyMutex);
+            lastNotify = m_lastNotify;
+            notified = m_sequence.load(std::memory_order_acquire) !=
+                       pending.sequence;
+        }
+
+        m_waits.fetch_add(1, std::memory_order_relaxed);
+        m_waitUs.fetch_add(endUs - pending.startUs, std::memory_order_relaxed);
+        m_spurious.fetch_add(pending.spurious, std::memory_order_relaxed);
+        if (pending.timedOut)
+            m_timeouts.fetch_add(1, std::memory_order_relaxed);
+
+        Instrumentor &instrumentor = Instrumentor::get();
+        const uint32_t threadId = detail::currentThreadId();
+        if (!notified || pending.timedOut)
+        {
+            const TraceArg args[] = {{"spurious", pending.spurious},
+                                     {"timed_out", pending.timedOut ? 1 : 0}};
+            instrumentor.writeProfile(StaticString(m_waitName),
+                                      pending.startUs, endUs, threadId, args,
+                                      2);
+            return;
+        }
+
+        const uint64_t notifyUs = std::max(lastNotify.us, pending.startUs);
+        const uint64_t latencyUs = endUs - std::min(notifyUs, endUs);
+        m_wakeLatencyUs.fetch_add(latencyUs, std::memory_order_relaxed);
+        detail::atomicMax(m_maxWakeLatencyUs, latencyUs);
+
+        const TraceArg args[] = {{"wake_latency_us", latencyUs},
+                                 {"spurious", pending.spurious}};
+        instrumentor.writeProfile(StaticString(m_waitName), pending.startUs,
+                                  endUs, threadId, args, 2);
+        // Bound to the wait span through its start time
+        if (lastNotify.id != 0)
+            instrumentor.writeAsyncEvent(StaticString(m_flowName),
+                                         lastNotify.id, AsyncPhase::FlowEnd,
+                                         pending.startUs);
+    }
+
+  private:
+    ConditionVariable m_condition;
+    const char *m_waitName;
+    const char *m_notifyName;
+    const char *m_flowName;
+
+    /**
+     * @brief Time and flow id of the latest notify, read as a pair.
+     */
+    struct LastNotify
+    {
+        uint64_t us = 0;
+        uint64_t id = 0; ///< 0 when the notify started no flow
+    };
+
+    std::atomic<uint64_t> m_sequence{0};
+    std::atomic<uint32_t> m_waiting{0}; ///< threads inside a wait
+    std::mutex m_notifyMutex;           ///< guards m_lastNotify
+    LastNotify m_lastNotify;
+
+    std::atomic<uint64_t> m_waits{0};
+    std::atomic<uint64_t> m_spurious{0};
+    std::atomic<uint64_t> m_timeouts{0};
+    std::atomic<uint64_t> m_waitUs{0};
+    std::atomic<uint64_t> m_wakeLatencyUs{0};
+    std::atomic<uint64_t> m_maxWakeLatencyUs{0};
+};
+
+using ProfiledConditionVariable =
+    BasicProfiledConditionVariable<std::condition_variable>;
+using ProfiledConditionVariableAny =
+    BasicProfiledConditionVariable<std::condition_variable_any>;
+
+/**
+ * @brief Block until `future` is ready, recording the blocked time as a
+ * span named `name`. Nothing is recorded if the future is already ready.
+ */
+template <typename Future> void profiledWait(const Future &future,
+                                             const char *name)
+{
+    if (future.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+        return;
+    const uint64_t startUs = detail::nowUs();
+    future.wait();
+    Instrumentor::get().writeProfile(name, startUs, detail::nowUs(),
+                                     detail::currentThreadId());
+}
+
+} // namespace instrumentation
@@ -0,0 +1,312 @@
+/**
+ * @file profiled_mutex.h
+ * @brief Mutex wrappers that expose lock contention in the trace.
+ *
+ * ProfiledMutex and ProfiledSharedMutex are drop-in replacements for
+ * std::mutex and std::shared_mutex and work with std::lock_guard,
+ * std::unique_lock, std::scoped_lock and std::shared_lock:
+ *
+ * @code
+ * instrumentation::ProfiledMutex queueMutex("QueueMutex");
+ * std::lock_guard<instrumentation::ProfiledMutex> lock(queueMutex);
+ * @endcode
+ *
+ * An acquisition first tries the lock. Only when that fails is the wait
+ * timed. It is then recorded as a `Wait: <name>` span on the waiting
+ * thread, with the ID of the thread that held the lock as the `owner` arg.
+ * It also updates a `Contentions: <name>` counter track. The uncontended
+ * path costs a try-lock, a thread-local load and two relaxed atomic
+ * updates.
+ *
+ * Hold times need a clock read on every acquisition and release, so they
+ * are only measured when enabled per lock. Exclusive holds that kept
+ * another thread waiting are then recorded as `Hold: <name>` spans.
+ * Aggregate numbers for a lock are available from stats().
+ *
+ * Note that std::condition_variable only accepts std::mutex; use
+ * ProfiledConditionVariableAny (profiled_condition_variable.h) or
+ * std::condition_variable_any with these wrappers.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+
+#include "instrumentor.h"
+
+namespace instrumentation
+{
+/**
+ * @brief Aggregate statistics of one profiled lock.
+ */
+struct LockStats
+{
+    uint64_t acquisitions = 0; ///< exclusive and shared
+    uint64_t contentions = 0;  ///< acquisitions that had to wait
+    uint64_t waitUs = 0;       ///< total time spent waiting
+    uint64_t maxWaitUs = 0;
+    uint64_t holdUs = 0; ///< total exclusive hold time, if tracked
+    uint64_t maxHoldUs = 0;
+};
+
+namespace detail
+{
+inline void atomicMax(std::atomic<uint64_t> &target, uint64_t value)
+{
+    uint64_t current = target.load(std::memory_order_relaxed);
+    while (current < value &&
+           !target.compare_exchange_weak(current, value,
+                                         std::memory_order_relaxed))
+    {
+    }
+}
+
+/**
+ * @brief Contention bookkeeping shared by the profiled lock types.
+ */
+class LockProfile
+{
+  public:
+    LockProfile(const char *name, bool trackHoldTime)
+        : m_waitName(internString(std::string("Wait: ") + name)),
+          m_holdName(internString(std::string("Hold: ") + name)),
+          m_counterName(internString(std::string("Contentions: ") + name)),
+          m_trackHoldTime(trackHoldTime)
+    {
+    }
+
+    /**
+     * @brief Acquire through `tryLock`, falling back to a timed `lock`.
+     */
+    template <typename TryLock, typename Lock>
+    void acquire(TryLock &&tryLock, Lock &&lock)
+    {
+        if (!tryLock())
+            waitFor(lock);
+        m_acquisitions.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void countAcquisition()
+    {
+        m_acquisitions.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Called with the exclusive lock held.
+     */
+    void acquiredExclusive()
+    {
+        m_owner.store(currentThreadId(), std::memory_order_relaxed);
+        if (m_trackHoldTime)
+            m_holdStartUs = nowUs();
+    }
+
+    /**
+     * @brief Called with the exclusive lock still held, just before
+     * releasing it.
+     */
+    void releasingExclusive()
+    {
+        m_owner.store(0, std::memory_order_relaxed);
+        if (!m_trackHoldTime)
+            return;
+
+        const uint64_t endUs = nowUs();
+        const uint64_t holdUs = endUs - m_holdStartUs;
+        m_holdUs.fetch_add(holdUs, std::memory_order_relaxed);
+        atomicMax(m_maxHoldUs, holdUs);
+        // Threads still blocked now were blocked by this hold
+        if (m_waiters.load(std::memory_order_relaxed) > 0)
+        {
+            Instrumentor::get().writeProfile(StaticString(m_holdName),
+                                             m_holdStartUs, endUs,
+                                             currentThreadId());
+        }
+    }
+
+    LockStats stats() const
+    {
+        LockStats stats;
+        stats.acquisitions = m_acquisitions.load(std::memory_order_relaxed);
+        stats.contentions = m_contentions.load(std::memory_order_relaxed);
+        stats.waitUs = m_waitUs.load(std::memory_order_relaxed);
+        stats.maxWaitUs = m_maxWaitUs.load(std::memory_order_relaxed);
+        stats.holdUs = m_holdUs.load(std::memory_order_relaxed);
+        stats.maxHoldUs = m_maxHoldUs.load(std::memory_order_relaxed);
+        return stats;
+    }
+
+  private:
+    template <typename Lock> void waitFor(Lock &lock)
+    {
+        const uint32_t owner = m_owner.load(std::memory_order_relaxed);
+        m_waiters.fetch_add(1, std::memory_order_relaxed);
+        const uint64_t startUs = nowUs();
+        lock();
+        m_waiters.fetch_sub(1, std::memory_order_relaxed);
+        const uint64_t endUs = nowUs();
+
+        const uint64_t waitUs = endUs - startUs;
+        const uint64_t contentions =
+            m_contentions.fetch_add(1, std::memory_order_relaxed) + 1;
+        m_waitUs.fetch_add(waitUs, std::memory_order_relaxed);
+        atomicMax(m_maxWaitUs, waitUs);
+
+        Instrumentor &instrumentor = Instrumentor::get();
+        const TraceArg args[] = {{"owner", owner}};
+        instrumentor.writeProfile(StaticString(m_waitName), startUs, endUs,
+                                  currentThreadId(), args, 1);
+        instrumentor.writeCounter(m_counterName,
+                                  static_cast<double>(contentions));
+    }
+
+  private:
+    const char *m_waitName;
+    const char *m_holdName;
+    const char *m_counterName;
+    const bool m_trackHoldTime;
+
+    std::atomic<uint32_t> m_owner{0};
+    std::atomic<uint32_t> m_waiters{0}; // threads blocked in waitFor()
+    uint64_t m_holdStartUs = 0; // only touched by the exclusive owner
+
+    std::atomic<uint64_t> m_acquisitions{0};
+    std::atomic<uint64_t> m_contentions{0};
+    std::atomic<uint64_t> m_waitUs{0};
+    std::atomic<uint64_t> m_maxWaitUs{0};
+    std::atomic<uint64_t> m_holdUs{0};
+    std::atomic<uint64_t> m_maxHoldUs{0};
+};
+} // namespace detail
+
+/**
+ * @brief std::mutex that records contention in the trace.
+ */
+class ProfiledMutex
+{
+  public:
+    /**
+     * @param name          Used in the trace span and counter names.
+     * @param trackHoldTime Also measure how long the lock is held.
+     */
+    explicit ProfiledMutex(const char *name = "mutex",
+                           bool trackHoldTime = false)
+        : m_profile(name, trackHoldTime)
+    {
+    }
+
+    ProfiledMutex(const ProfiledMutex &) = delete;
+    ProfiledMutex &operator=(const ProfiledMutex &) = delete;
+
+    void lock()
+    {
+        m_profile.acquire([this] { return m_mutex.try_lock(); },
+                          [this] { m_mutex.lock(); });
+        m_profile.acquiredExclusive();
+    }
+
+    bool try_lock()
+    {
+        if (!m_mutex.try_lock())
+            return false;
+        m_profile.countAcquisition();
+        m_profile.acquiredExclusive();
+        return true;
+    }
+
+    void unlock()
+    {
+        m_profile.releasingExclusive();
+        m_mutex.unlock();
+    }
+
+    LockStats stats() const
+    {
+        return m_profile.stats();
+    }
+
+  private:
+    std::mutex m_mutex;
+    detail::LockProfile m_profile;
+};
+
+/**
+ * @brief std::shared_mutex that records contention in the trace.
+ *
+ * Shared and exclusive waits are both recorded; hold times (when enabled)
+ * cover exclusive ownership only.
+ */
+class ProfiledSharedMutex
+{
+  public:
+    /**
+     * @param name          Used in the trace span and counter names.
+     * @param trackHoldTime Also measure how long the lock is held
+     *                      exclusively.
+     */
+    explicit ProfiledSharedMutex(const char *name = "shared_mutex",
+                                 bool trackHoldTime = false)
+        : m_profile(name, trackHoldTime)
+    {
+    }
+
+    ProfiledSharedMutex(const ProfiledSharedMutex &) = delete;
+    ProfiledSharedMutex &operator=(const ProfiledSharedMutex &) = delete;
+
+    void lock()
+    {
+        m_profile.acquire([this] { return m_mutex.try_lock(); },
+                          [this] { m_mutex.lock(); });
+        m_profile.acquiredExclusive();
+    }
+
+    bool try_lock()
+    {
+        if (!m_mutex.try_lock())
+            return false;
+        m_profile.countAcquisition();
+        m_profile.acquiredExclusive();
+        return true;
+    }
+
+    void unlock()
+    {
+        m_profile.releasingExclusive();
+        m_mutex.unlock();
+    }
+
+    void lock_shared()
+    {
+        m_profile.acquire([this] { return m_mutex.try_lock_shared(); },
+                          [this] { m_mutex.lock_shared(); });
+    }
+
+    bool try_lock_shared()
+    {
+        if (!m_mutex.try_lock_shared())
+            return false;
+        m_profile.countAcquisition();
+        return true;
+    }
+
+    void unlock_shared()
+    {
+        m_mutex.unlock_shared();
+    }
+
+    LockStats stats() const
+    {
+        return m_profile.stats();
+    }
+
+  private:
+    std::shared_mutex m_mutex;
+    detail::LockProfile m_profile;
+};
+
+} // namespace instrumentation
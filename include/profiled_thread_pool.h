@@ -0,0 +1,399 @@
+/**
+ * @file profiled_thread_pool.h
+ * @brief Task-level tracing for thread pools: how long each task waited in
+ * a queue and how long it ran.
+ *
+ * TaskTrace is the hook for an existing scheduler. Create one when a task
+ * is enqueued and keep it with the task. Call start() when a worker picks
+ * the task up and finish() when it returns:
+ *
+ * @code
+ * queue.push({std::move(work), instrumentation::TaskTrace("Parse")});
+ * // on the worker
+ * task.trace.start();
+ * task.work();
+ * task.trace.finish();
+ * @endcode
+ *
+ * The task is recorded as a slice on the worker thread with its queue wait
+ * as the `queue_us` arg. A flow arrow leads to it from the slice that was
+ * open on the submitting thread at enqueue time.
+ *
+ * ProfiledThreadPool is a small work-stealing pool built on TaskTrace.
+ * Each worker owns a deque: it runs its own tasks newest first and steals
+ * the oldest task of another worker when its own deque is empty. It also
+ * records:
+ * - the source worker of stolen tasks as the `stolen_from` arg and as a
+ *   `Steal` marker on the thief,
+ * - `Idle` slices while a worker has nothing to do,
+ * - a `Queue depth: <pool> worker <n>` counter per worker.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <initializer_list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "instrumentor.h"
+
+namespace instrumentation
+{
+/**
+ * @brief Enqueue, start and finish times of one task. See the file
+ * documentation.
+ */
+class TaskTrace
+{
+  public:
+    /** @brief Empty trace; start() and finish() record nothing. */
+    TaskTrace() = default;
+
+    /**
+     * @brief Mark the task as enqueued now.
+     *
+     * @param name Task name. Must remain valid until finish().
+     */
+    explicit TaskTrace(const char *name)
+        : m_name(name), m_id(Instrumentor::get().nextAsyncId()),
+          m_enqueueUs(detail::nowUs())
+    {
+        Instrumentor::get().writeAsyncEvent(m_name, m_id, AsyncPhase::FlowStart,
+                                            m_enqueueUs);
+    }
+
+    /** @brief Mark the task as started on the calling thread. */
+    void start()
+    {
+        m_startUs = detail::nowUs();
+    }
+
+    /**
+     * @brief Record the task, which ran on the calling thread.
+     *
+     * @param args Up to three args added after `queue_us`.
+     */
+    void finish(std::initializer_list<TraceArg> args = {})
+    {
+        if (m_name == nullptr)
+            return;
+        m_finishUs = detail::nowUs();
+
+        TraceArg allArgs[4] = {{"queue_us", queueUs()}};
+        uint8_t argCount = 1;
+        for (const TraceArg &arg : args)
+        {
+            if (argCount == 4)
+                break;
+            allArgs[argCount++] = arg;
+        }
+
+        Instrumentor &instrumentor = Instrumentor::get();
+        instrumentor.writeProfile(m_name, m_startUs, m_finishUs,
+                                  detail::currentThreadId(), allArgs,
+                                  argCount);
+        instrumentor.writeAsyncEvent(m_name, m_id, AsyncPhase::FlowEnd,
+                                     m_startUs);
+    }
+
+    /** @brief Time between enqueue and start. */
+    uint64_t queueUs() const
+    {
+        return m_startUs - m_enqueueUs;
+    }
+
+    /** @brief Time between start and finish. */
+    uint64_t runUs() const
+    {
+        return m_finishUs - m_startUs;
+    }
+
+  private:
+    const char *m_name = nullptr;
+    uint64_t m_id = 0;
+    uint64_t m_enqueueUs = 0;
+    uint64_t m_startUs = 0;
+    uint64_t m_finishUs = 0;
+};
+
+/**
+ * @brief Aggregate statistics of a ProfiledThreadPool.
+ */
+struct ThreadPoolStats
+{
+    uint64_t tasks = 0;  ///< finished tasks
+    uint64_t steals = 0; ///< tasks run by a worker other than their owner
+    uint64_t queueUs = 0; ///< total time tasks spent queued
+    uint64_t runUs = 0;   ///< total time tasks spent running
+    uint64_t idleUs = 0;  ///< total time workers spent idle
+};
+
+/**
+ * @brief Work-stealing thread pool that traces its tasks. See the file
+ * documentation.
+ */
+class ProfiledThreadPool
+{
+  public:
+    /**
+     * @param workers Number of worker threads.
+     * @param name    Used in the worker thread and counter names.
+     */
+    explicit ProfiledThreadPool(
+        std::size_t workers = std::thread::hardware_concurrency(),
+        const char *name = "pool")
+    {
+        if (workers == 0)
+            workers = 1;
+        m_workers.reserve(workers);
+        for (std::size_t i = 0; i < workers; ++i)
+        {
+            auto worker = std::make_unique<Worker>();
+            worker->threadName =
+                std::string(name) + " worker " + std::to_string(i);
+            worker->depthCounter =
+                internString("Queue depth: " + worker->threadName);
+            m_workers.push_back(std::move(worker));
+        }
+        for (std::size_t i = 0; i < workers; ++i)
+            m_workers[i]->thread = std::thread([this, i] { run(i); });
+    }
+
+    ProfiledThreadPool(const ProfiledThreadPool &) = delete;
+    ProfiledThreadPool &operator=(const ProfiledThreadPool &) = delete;
+
+    /**
+     * @brief Finish all submitted tasks, then stop the workers.
+     */
+    ~ProfiledThreadPool()
+    {
+        wait();
+        {
+            std::lock_guard<std::mutex> lock(m_idleMutex);
+            m_stopping = true;
+        }
+        m_wake.notify_all();
+        for (const std::unique_ptr<Worker> &worker : m_workers)
+            worker->thread.join();
+    }
+
+    /**
+     * @brief Queue a task. Tasks submitted from a worker go to that
+     * worker's own deque, others are distributed round-robin. Tasks must
+     * not throw.
+     *
+     * @param name     Task name. Must remain valid until the task has run.
+     * @param function Callable taking no arguments.
+     */
+    template <typename Function>
+    void submit(const char *name, Function &&function)
+    {
+        const std::size_t index =
+            s_currentPool == this
+                ? s_workerIndex
+                : m_nextWorker.fetch_add(1, std::memory_order_relaxed) %
+                      m_workers.size();
+        Worker &worker = *m_workers[index];
+
+        m_unfinished.fetch_add(1, std::memory_order_relaxed);
+        std::size_t depth = 0;
+        {
+            std::lock_guard<std::mutex> lock(worker.mutex);
+            worker.queue.push_back(
+                {std::function<void()>(std::forward<Function>(function)),
+                 TaskTrace(name)});
+            depth = worker.queue.size();
+        }
+        Instrumentor::get().writeCounter(worker.depthCounter,
+                                         static_cast<double>(depth));
+        {
+            std::lock_guard<std::mutex> lock(m_idleMutex);
+            ++m_queued;
+        }
+        m_wake.notify_one();
+    }
+
+    /**
+     * @brief Block until every task submitted so far has finished. Must
+     * not be called from a worker.
+     */
+    void wait()
+    {
+        std::unique_lock<std::mutex> lock(m_idleMutex);
+        m_done.wait(lock, [this] {
+            return m_unfinished.load(std::memory_order_acquire) == 0;
+        });
+    }
+
+    std::size_t workerCount() const
+    {
+        return m_workers.size();
+    }
+
+    ThreadPoolStats stats() const
+    {
+        ThreadPoolStats stats;
+        stats.tasks = m_tasks.load(std::memory_order_relaxed);
+        stats.steals = m_steals.load(std::memory_order_relaxed);
+        stats.queueUs = m_queueUs.load(std::memory_order_relaxed);
+        stats.runUs = m_runUs.load(std::memory_order_relaxed);
+        stats.idleUs = m_idleUs.load(std::memory_order_relaxed);
+        return stats;
+    }
+
+  private:
+    struct Task
+    {
+        std::function<void()> function;
+        TaskTrace trace;
+    };
+
+    struct Worker
+    {
+        std::mutex mutex;
+        std::deque<Task> queue;
+        std::string threadName;
+        const char *depthCounter = nullptr;
+        std::thread thread;
+    };
+
+    /**
+     * @brief Take a task from the back (own deque) or the front (stealing)
+     * of a worker's deque.
+     */
+    bool take(std::size_t index, bool fromBack, Task &task)
+    {
+        Worker &worker = *m_workers[index];
+        std::size_t depth = 0;
+        {
+            std::lock_guard<std::mutex> lock(worker.mutex);
+            if (worker.queue.empty())
+                return false;
+            if (fromBack)
+            {
+                task = std::move(worker.queue.back());
+                worker.queue.pop_back();
+            }
+            else
+            {
+                task = std::move(worker.queue.front());
+                worker.queue.pop_front();
+            }
+            depth = worker.queue.size();
+        }
+        {
+            std::lock_guard<std::mutex> lock(m_idleMutex);
+            --m_queued;
+        }
+        Instrumentor::get().writeCounter(worker.depthCounter,
+                                         static_cast<double>(depth));
+        return true;
+    }
+
+    void run(std::size_t index)
+    {
+        s_currentPool = this;
+        s_workerIndex = index;
+        Instrumentor::get().setThreadName(m_workers[index]->threadName);
+
+        for (;;)
+        {
+            Task task;
+            if (take(index, true, task))
+            {
+                execute(task, {{"worker", index}});
+                continue;
+            }
+
+            bool stolen = false;
+            for (std::size_t offset = 1; offset < m_workers.size(); ++offset)
+            {
+                const std::size_t victim = (index + offset) % m_workers.size();
+                if (take(victim, false, task))
+                {
+                    Instrumentor::get().writeInstant(StaticString("Steal"));
+                    m_steals.fetch_add(1, std::memory_order_relaxed);
+                    execute(task, {{"worker", index}, {"stolen_from", victim}});
+                    stolen = true;
+                    break;
+                }
+            }
+            if (stolen)
+                continue;
+
+            if (!idle())
+                return;
+        }
+    }
+
+    /**
+     * @brief Sleep until there is queued work. Returns false when the pool
+     * is stopping.
+     */
+    bool idle()
+    {
+        const uint64_t startUs = detail::nowUs();
+        bool running = true;
+        {
+            std::unique_lock<std::mutex> lock(m_idleMutex);
+            m_wake.wait(lock,
+                        [this] { return m_stopping || m_queued > 0; });
+            running = m_queued > 0;
+        }
+        const uint64_t endUs = detail::nowUs();
+        if (endUs > startUs)
+        {
+            m_idleUs.fetch_add(endUs - startUs, std::memory_order_relaxed);
+            Instrumentor::get().writeProfile(StaticString("Idle"), startUs,
+                                             endUs, detail::currentThreadId());
+        }
+        return running;
+    }
+
+    void execute(Task &task, std::initializer_list<TraceArg> args)
+    {
+        task.trace.start();
+        task.function();
+        task.trace.finish(args);
+
+        m_tasks.fetch_add(1, std::memory_order_relaxed);
+        m_queueUs.fetch_add(task.trace.queueUs(), std::memory_order_relaxed);
+        m_runUs.fetch_add(task.trace.runUs(), std::memory_order_relaxed);
+        if (m_unfinished.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        {
+            std::lock_guard<std::mutex> lock(m_idleMutex);
+            m_done.notify_all();
+        }
+    }
+
+  private:
+    static inline thread_local ProfiledThreadPool *s_currentPool = nullptr;
+    static inline thread_local std::size_t s_workerIndex = 0;
+
+    std::vector<std::unique_ptr<Worker>> m_workers;
+    std::atomic<std::size_t> m_nextWorker{0};
+
+    std::mutex m_idleMutex;
+    std::condition_variable m_wake; ///< work was queued or pool stops
+    std::condition_variable m_done; ///< all tasks finished
+    std::size_t m_queued = 0;       ///< tasks in deques, under m_idleMutex
+    bool m_stopping = false;
+    std::atomic<std::size_t> m_unfinished{0};
+
+    std::atomic<uint64_t> m_tasks{0};
+    std::atomic<uint64_t> m_steals{0};
+    std::atomic<uint64_t> m_queueUs{0};
+    std::atomic<uint64_t> m_runUs{0};
+    std::atomic<uint64_t> m_idleUs{0};
+};
+
+} // namespace instrumentation
@@ -0,0 +1,232 @@
+/**
+ * @file rotating_trace_writer.h
+ * @brief Trace file framing and size/time based rotation.
+ *
+ * RotatingTraceWriter sits at the top of every session's writer chain. It
+ * writes the JSON header when a file is opened and the footer when it is
+ * closed, so every file it produces is a complete trace on its own.
+ *
+ * With a rotation policy it also starts a new file once the current one has
+ * received `maxBytes` of (uncompressed) trace data or has been open for
+ * `maxDuration`. Rotation only happens between blocks, and blocks always
+ * hold whole events, so no event is split across files. The age limit is
+ * checked when a block arrives: an idle session keeps its file open past
+ * `maxDuration` and rotates with the next block. Files after the
+ * first are named by inserting the sequence number before `.json`, e.g.
+ * `trace.json`, `trace.1.json`, `trace.2.json`. A continuation callback
+ * can end the old file and start the new one with extra events; the
+ * Instrumentor uses it to close scopes that are still open (B events) and
+ * reopen them in the next file along with the thread names.
+ *
+ * Rotation is not thread-safe; the Instrumentor runs a rotating writer
+ * behind an AsyncTraceWriter so rotation happens on the writer thread.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+
+#include "trace_writer.h"
+
+namespace instrumentation
+{
+/**
+ * @brief When to close the current file and continue in a new one.
+ *
+ * A zero value disables the corresponding limit. Both limits are checked
+ * when trace data arrives, so an idle file is rotated by its next block.
+ */
+struct RotationPolicy
+{
+    std::size_t maxBytes = 0;
+    std::chrono::seconds maxDuration{0};
+
+    bool enabled() const
+    {
+        return maxBytes > 0 || maxDuration.count() > 0;
+    }
+};
+
+/**
+ * @brief Path of the `index`-th file of a rotated session.
+ *
+ * Index 0 is the path itself; later indices are inserted before the last
+ * `.json` (or appended when there is none).
+ */
+inline std::string rotatedPath(const std::string &path, std::size_t index)
+{
+    if (index == 0)
+        return path;
+
+    std::string suffix = ".";
+    suffix += std::to_string(index);
+    const std::size_t json = path.rfind(".json");
+    if (json == std::string::npos)
+        return path + suffix;
+    return path.substr(0, json) + suffix + path.substr(json);
+}
+
+class RotatingTraceWriter final : public TraceWriter
+{
+  public:
+    using WriterFactory = std::function<std::unique_ptr<TraceWriter>()>;
+    /// Appends the events that end the old file to its first argument and
+    /// those that start the new file to its second.
+    using Continuation = std::function<void(std::string &, std::string &)>;
+
+    /**
+     * @param factory Creates the writer chain for each file.
+     * @param header  Written at the start of every file.
+     * @param footer  Written at the end of every file.
+     * @param policy  Rotation limits; default never rotates.
+     */
+    RotatingTraceWriter(WriterFactory factory, std::string header,
+                        std::string footer, RotationPolicy policy = {})
+        : m_factory(std::move(factory)), m_header(std::move(header)),
+          m_footer(std::move(footer)), m_policy(policy)
+    {
+    }
+
+    RotatingTraceWriter(const RotatingTraceWriter &) = delete;
+    RotatingTraceWriter &operator=(const RotatingTraceWriter &) = delete;
+
+    ~RotatingTraceWriter() override
+    {
+        close();
+    }
+
+    bool open(const std::string &path) override
+    {
+        close();
+        m_basePath = path;
+        m_index = 0;
+        return openCurrent();
+    }
+
+    void write(const char *data, std::size_t size) override
+    {
+        if (!m_current)
+            return;
+
+        if (m_policy.enabled())
+        {
+            if (shouldRotate())
+                rotate();
+            m_bytes += size;
+        }
+        m_current->write(data, size);
+    }
+
+    void close() override
+    {
+        if (!m_current)
+            return;
+        m_current->write(m_footer.data(), m_footer.size());
+        m_current->close();
+        m_current.reset();
+    }
+
+    bool isOpen() const override
+    {
+        return m_current != nullptr;
+    }
+
+    void emergencyWrite(const char *data, std::size_t size) override
+    {
+        if (m_current)
+            m_current->emergencyWrite(data, size);
+    }
+
+    /**
+     * @brief Terminate the current file with the footer; no rotation.
+     */
+    void emergencyClose() override
+    {
+        if (!m_current)
+            return;
+        m_current->emergencyWrite(m_footer.data(), m_footer.size());
+        m_current->emergencyClose();
+    }
+
+    /**
+     * @brief Called on the writing thread at every rotation.
+     */
+    void setContinuation(Continuation continuation)
+    {
+        m_continuation = std::move(continuation);
+    }
+
+    /**
+     * @brief Number of files started so far in this session.
+     */
+    std::size_t fileCount() const
+    {
+        return m_index + 1;
+    }
+
+  private:
+    bool openCurrent()
+    {
+        m_current = m_factory();
+        if (!m_current || !m_current->open(rotatedPath(m_basePath, m_index)))
+        {
+            m_current.reset();
+            return false;
+        }
+        m_current->write(m_header.data(), m_header.size());
+        m_bytes = m_header.size();
+        m_emptyBytes = m_bytes;
+        m_openedAt = std::chrono::steady_clock::now();
+        return true;
+    }
+
+    bool shouldRotate() const
+    {
+        if (m_bytes <= m_emptyBytes)
+            return false; // never leave an empty file behind
+        if (m_policy.maxBytes > 0 && m_bytes >= m_policy.maxBytes)
+            return true;
+        return m_policy.maxDuration.count() > 0 &&
+               std::chrono::steady_clock::now() - m_openedAt >=
+                   m_policy.maxDuration;
+    }
+
+    void rotate()
+    {
+        std::string closing;
+        std::string opening;
+        if (m_continuation)
+            m_continuation(closing, opening);
+        if (!closing.empty())
+            m_current->write(closing.data(), closing.size());
+        close();
+        ++m_index;
+        if (openCurrent() && !opening.empty())
+        {
+            m_current->write(opening.data(), opening.size());
+            m_bytes += opening.size();
+            m_emptyBytes = m_bytes;
+        }
+    }
+
+  private:
+    WriterFactory m_factory;
+    std::string m_header;
+    std::string m_footer;
+    RotationPolicy m_policy;
+    Continuation m_continuation;
+
+    std::unique_ptr<TraceWriter> m_current;
+    std::string m_basePath;
+    std::size_t m_index = 0;
+    std::size_t m_bytes = 0;
+    std::size_t m_emptyBytes = 0; ///< header and continuation events
+    std::chrono::steady_clock::time_point m_openedAt{};
+};
+
+} // namespace instrumentation
@@ -0,0 +1,704 @@
+/**
+ * @file shared_memory_trace_writer.h
+ * @brief Out-of-process trace collection through POSIX shared memory.
+ *
+ * With `SessionOptions::backend = OutputBackend::SharedMemory` the session
+ * path names a shared memory segment (e.g. "/st_trace"). The instrumented
+ * process only copies its binary event records into a ring buffer in that
+ * segment. A separate collector process, usually the `trace_collector`
+ * tool, formats them as JSON and writes the file:
+ *
+ * @code
+ * $ trace_collector /st_trace trace.json &
+ * SessionOptions options;
+ * options.backend = instrumentation::OutputBackend::SharedMemory;
+ * Instrumentor::get().beginSession("Server", "/st_trace", options);
+ * @endcode
+ *
+ * Records refer to names and string arguments by pointer. Each pointer is
+ * therefore published once, with its text, before the first records that
+ * use it. The collector swaps the pointers for its own copies before it
+ * formats the records.
+ *
+ * Per-thread blocks go into one ring in order. The producer never waits
+ * for the collector: blocks that do not fit are dropped and counted in the
+ * segment header, and the collector ends the trace with a global
+ * `Dropped events` marker carrying the totals. Because the ring is shared
+ * memory, everything written before a crash is still there for the
+ * collector.
+ *
+ * The producer bumps a heartbeat counter in the segment header while the
+ * segment is open. A collector treats a producer whose heartbeat has not
+ * moved for a while (SharedTraceCollector::kDefaultProducerTimeout) as
+ * gone and finishes the trace; this also covers a crash. A producer stopped
+ * for longer, e.g. in a debugger, looks gone too.
+ *
+ * The collector removes the segment when it has drained it. A producer
+ * removes a stale segment of the same name when it starts a session.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "trace_event.h"
+#include "trace_writer.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define ST_HAS_SHARED_MEMORY 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#define ST_HAS_SHARED_MEMORY 0
+#endif
+
+namespace instrumentation
+{
+#if ST_HAS_SHARED_MEMORY
+
+/**
+ * @brief Layout of the start of a trace segment; the ring follows it.
+ *
+ * Positions only grow. The producer owns `writePosition` and the collector
+ * owns `readPosition`. Each one is published with release ordering after
+ * the bytes it covers.
+ */
+struct SharedTraceHeader
+{
+    static constexpr uint32_t kMagic = 0x53545452; // "STTR"
+    static constexpr uint32_t kVersion = 2;
+
+    std::atomic<uint32_t> magic; ///< set last, once the header is valid
+    uint32_t version;
+    uint64_t capacity; ///< ring size in bytes
+    uint64_t sessionStartUs;
+    uint32_t processId;
+    std::atomic<uint32_t> closed; ///< set after the last write
+    std::atomic<uint64_t> heartbeat; ///< bumped while the producer lives
+
+    alignas(64) std::atomic<uint64_t> writePosition;
+    alignas(64) std::atomic<uint64_t> readPosition;
+    std::atomic<uint64_t> droppedRecords;
+    std::atomic<uint64_t> droppedBytes;
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free,
+              "The shared ring needs address-free atomics");
+
+/**
+ * @brief Message kinds in the ring. Each message is a
+ * SharedMessageHeader followed by `size` payload bytes.
+ */
+enum class SharedMessageType : uint32_t
+{
+    Text = 1,    ///< JSON copied to the output as is (the trace header)
+    String = 2,  ///< 64-bit pointer value followed by the text it points to
+    Records = 3, ///< block of binary event records
+};
+
+struct SharedMessageHeader
+{
+    uint32_t type;
+    uint32_t size;
+};
+
+namespace detail
+{
+inline std::string sharedMemoryName(const std::string &path)
+{
+    return path.starts_with('/') ? path : "/" + path;
+}
+
+/**
+ * @brief Byte ring in a mapped segment, addressed by ever-growing
+ * positions.
+ */
+struct SharedRing
+{
+    SharedTraceHeader *header = nullptr;
+    char *data = nullptr;
+
+    void copyIn(uint64_t position, const void *source, std::size_t size) const
+    {
+        const std::size_t offset =
+            static_cast<std::size_t>(position % header->capacity);
+        const std::size_t first =
+            std::min<std::size_t>(size, header->capacity - offset);
+        std::memcpy(data + offset, source, first);
+        std::memcpy(data, static_cast<const char *>(source) + first,
+                    size - first);
+    }
+
+    void copyOut(uint64_t position, void *target, std::size_t size) const
+    {
+        const std::size_t offset =
+            static_cast<std::size_t>(position % header->capacity);
+        const std::size_t first =
+            std::min<std::size_t>(size, header->capacity - offset);
+        std::memcpy(target, data + offset, first);
+        std::memcpy(static_cast<char *>(target) + first, data, size - first);
+    }
+};
+} // namespace detail
+
+/**
+ * @brief Producer side: copies blocks of binary records into a shared
+ * memory ring. See the file documentation.
+ */
+class SharedMemoryTraceWriter final : public TraceWriter
+{
+  public:
+    static constexpr std::size_t kDefaultCapacity = 32u * 1024u * 1024u;
+    static constexpr std::chrono::milliseconds kHeartbeatInterval{100};
+
+    /**
+     * @param header         JSON written at the start of the trace.
+     * @param sessionStartUs Subtracted from record timestamps.
+     * @param processId      Written as the "pid" of every event.
+     * @param capacity       Ring size in bytes.
+     */
+    SharedMemoryTraceWriter(std::string header, uint64_t sessionStartUs,
+                            uint32_t processId,
+                            std::size_t capacity = kDefaultCapacity)
+        : m_header(std::move(header)), m_sessionStartUs(sessionStartUs),
+          m_processId(processId), m_capacity(capacity)
+    {
+    }
+
+    SharedMemoryTraceWriter(const SharedMemoryTraceWriter &) = delete;
+    SharedMemoryTraceWriter &
+    operator=(const SharedMemoryTraceWriter &) = delete;
+
+    ~SharedMemoryTraceWriter() override
+    {
+        close();
+    }
+
+    /**
+     * @brief Create the segment named `path`, replacing a stale one.
+     */
+    bool open(const std::string &path) override
+    {
+        close();
+
+        const std::string name = detail::sharedMemoryName(path);
+        ::shm_unlink(name.c_str());
+        const int fd =
+            ::shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+        if (fd < 0)
+            return false;
+
+        const std::size_t size = sizeof(SharedTraceHeader) + m_capacity;
+        void *mapping = MAP_FAILED;
+        if (::ftruncate(fd, static_cast<off_t>(size)) == 0)
+            mapping = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                             fd, 0);
+        ::close(fd);
+        if (mapping == MAP_FAILED)
+        {
+            ::shm_unlink(name.c_str());
+            return false;
+        }
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_mapping = mapping;
+        m_mappingSize = size;
+        m_ring.header = new (mapping) SharedTraceHeader{};
+        m_ring.data = static_cast<char *>(mapping) + sizeof(SharedTraceHeader);
+        m_ring.header->version = SharedTraceHeader::kVersion;
+        m_ring.header->capacity = m_capacity;
+        m_ring.header->sessionStartUs = m_sessionStartUs;
+        m_ring.header->processId = m_processId;
+        m_ring.header->magic.store(SharedTraceHeader::kMagic,
+                                   std::memory_order_release);
+        m_writePosition = 0;
+        m_published.clear();
+
+        append(SharedMessageType::Text, m_header.data(), m_header.size());
+        publish();
+
+        m_stopHeartbeat = false;
+        m_heartbeat =
+            std::thread([this, header = m_ring.header] { beat(header); });
+        return true;
+    }
+
+    /**
+     * @brief Copy a block of records, and the strings it is the first to
+     * use, into the ring. Drops the block if the ring is too full.
+     */
+    void write(const char *data, std::size_t size) override
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_mapping == nullptr)
+            return;
+
+        m_newStrings.clear();
+        std::size_t needed = sizeof(SharedMessageHeader) + size;
+        const std::size_t records = detail::forEachStringPointer(
+            std::string_view(data, size),
+            [&](std::size_t, const char *text) {
+                if (m_published.insert(text).second)
+                {
+                    m_newStrings.push_back(text);
+                    needed += sizeof(SharedMessageHeader) + sizeof(uint64_t) +
+                              std::strlen(text);
+                }
+            });
+
+        if (needed > freeSpace())
+        {
+            for (const char *text : m_newStrings)
+                m_published.erase(text);
+            drop(records, size);
+            return;
+        }
+        for (const char *text : m_newStrings)
+            appendString(text);
+        append(SharedMessageType::Records, data, size);
+        publish();
+    }
+
+    /**
+     * @brief Mark the trace as complete and unmap the segment. The segment
+     * stays until the collector has drained it.
+     */
+    void close() override
+    {
+        // The heartbeat thread uses the mapping, so it stops first
+        {
+            std::lock_guard<std::mutex> heartbeatLock(m_heartbeatMutex);
+            m_stopHeartbeat = true;
+        }
+        m_heartbeatWake.notify_one();
+        if (m_heartbeat.joinable())
+            m_heartbeat.join();
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_mapping == nullptr)
+            return;
+        m_ring.header->closed.store(1, std::memory_order_release);
+        ::munmap(m_mapping, m_mappingSize);
+        m_mapping = nullptr;
+        m_ring = detail::SharedRing{};
+    }
+
+    bool isOpen() const override
+    {
+        return m_mapping != nullptr;
+    }
+
+    /**
+     * @brief Crash path: like write(), but without the published-string
+     * set, so every string is sent again and nothing is allocated.
+     */
+    void emergencyWrite(const char *data, std::size_t size) override
+    {
+        if (!freeze())
+            return;
+
+        const std::string_view block(data, size);
+        std::size_t needed = sizeof(SharedMessageHeader) + size;
+        const std::size_t records = detail::forEachStringPointer(
+            block, [&](std::size_t, const char *text) {
+                needed += sizeof(SharedMessageHeader) + sizeof(uint64_t) +
+                          std::strlen(text);
+            });
+        if (needed > freeSpace())
+        {
+            drop(records, size);
+            return;
+        }
+        detail::forEachStringPointer(block,
+                                     [this](std::size_t, const char *text) {
+                                         appendString(text);
+                                     });
+        append(SharedMessageType::Records, data, size);
+        publish();
+    }
+
+    void emergencyClose() override
+    {
+        if (freeze())
+            m_ring.header->closed.store(1, std::memory_order_release);
+    }
+
+  private:
+    /**
+     * @brief Heartbeat thread: bump the counter until close() stops it.
+     */
+    void beat(SharedTraceHeader *header)
+    {
+        std::unique_lock<std::mutex> lock(m_heartbeatMutex);
+        while (!m_heartbeatWake.wait_for(lock, kHeartbeatInterval,
+                                         [this] { return m_stopHeartbeat; }))
+            header->heartbeat.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    std::size_t freeSpace() const
+    {
+        const uint64_t read =
+            m_ring.header->readPosition.load(std::memory_order_acquire);
+        return static_cast<std::size_t>(m_capacity - (m_writePosition - read));
+    }
+
+    void append(SharedMessageType type, const char *data, std::size_t size)
+    {
+        const SharedMessageHeader header{static_cast<uint32_t>(type),
+                                         static_cast<uint32_t>(size)};
+        m_ring.copyIn(m_writePosition, &header, sizeof(header));
+        m_ring.copyIn(m_writePosition + sizeof(header), data, size);
+        m_writePosition += sizeof(header) + size;
+    }
+
+    void appendString(const char *text)
+    {
+        const std::size_t length = std::strlen(text);
+        const SharedMessageHeader header{
+            static_cast<uint32_t>(SharedMessageType::String),
+            static_cast<uint32_t>(sizeof(uint64_t) + length)};
+        const uint64_t key = reinterpret_cast<uintptr_t>(text);
+        m_ring.copyIn(m_writePosition, &header, sizeof(header));
+        m_ring.copyIn(m_writePosition + sizeof(header), &key, sizeof(key));
+        m_ring.copyIn(m_writePosition + sizeof(header) + sizeof(key), text,
+                      length);
+        m_writePosition += sizeof(header) + sizeof(key) + length;
+    }
+
+    void publish()
+    {
+        m_ring.header->writePosition.store(m_writePosition,
+                                           std::memory_order_release);
+    }
+
+    void drop(std::size_t records, std::size_t size)
+    {
+        m_ring.header->droppedRecords.fetch_add(records,
+                                                std::memory_order_relaxed);
+        m_ring.header->droppedBytes.fetch_add(size, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Take the ring over for the crash path with bounded try-locks;
+     * the mutex stays locked.
+     */
+    bool freeze()
+    {
+        if (m_frozenByCaller)
+            return true;
+        for (int attempt = 0; attempt < 100000; ++attempt)
+        {
+            if (m_mutex.try_lock())
+            {
+                m_frozenByCaller = m_mapping != nullptr;
+                if (!m_frozenByCaller)
+                    m_mutex.unlock();
+                return m_frozenByCaller;
+            }
+            std::this_thread::yield();
+        }
+        return false;
+    }
+
+  private:
+    const std::string m_header;
+    const uint64_t m_sessionStartUs;
+    const uint32_t m_processId;
+    const std::size_t m_capacity;
+
+    std::mutex m_mutex;
+    void *m_mapping = nullptr;
+    std::size_t m_mappingSize = 0;
+    detail::SharedRing m_ring;
+    uint64_t m_writePosition = 0;
+    std::unordered_set<const char *> m_published;
+    std::vector<const char *> m_newStrings;
+    bool m_frozenByCaller = false;
+
+    std::mutex m_heartbeatMutex;
+    std::condition_variable m_heartbeatWake;
+    bool m_stopHeartbeat = false;
+    std::thread m_heartbeat;
+};
+
+/**
+ * @brief Totals of one collected session.
+ */
+struct SharedCollectStats
+{
+    uint64_t bytes = 0;   ///< JSON written to the output
+    uint64_t records = 0; ///< records formatted
+    uint64_t droppedRecords = 0;
+    uint64_t droppedBytes = 0;
+};
+
+/**
+ * @brief Collector side: drains a trace segment and writes it as trace
+ * JSON.
+ */
+class SharedTraceCollector
+{
+  public:
+    static constexpr std::chrono::milliseconds kDefaultProducerTimeout{2000};
+
+    /**
+     * @param producerTimeout Time without a heartbeat after which the
+     *                        producer counts as gone.
+     */
+    explicit SharedTraceCollector(
+        std::chrono::milliseconds producerTimeout = kDefaultProducerTimeout)
+        : m_producerTimeout(producerTimeout)
+    {
+    }
+
+    SharedTraceCollector(const SharedTraceCollector &) = delete;
+    SharedTraceCollector &operator=(const SharedTraceCollector &) = delete;
+
+    ~SharedTraceCollector()
+    {
+        detach();
+    }
+
+    /**
+     * @brief Map the segment named `path`.
+     *
+     * @return False if it does not exist (yet) or is not a trace segment.
+     */
+    bool attach(const std::string &path)
+    {
+        detach();
+        const std::string name = detail::sharedMemoryName(path);
+        const int fd = ::shm_open(name.c_str(), O_RDWR, 0);
+        if (fd < 0)
+            return false;
+
+        struct stat info;
+        void *mapping = MAP_FAILED;
+        if (::fstat(fd, &info) == 0 &&
+            static_cast<std::size_t>(info.st_size) > sizeof(SharedTraceHeader))
+            mapping = ::mmap(nullptr, static_cast<std::size_t>(info.st_size),
+                             PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (mapping == MAP_FAILED)
+            return false;
+
+        auto *header = static_cast<SharedTraceHeader *>(mapping);
+        if (header->magic.load(std::memory_order_acquire) !=
+                SharedTraceHeader::kMagic ||
+            header->version != SharedTraceHeader::kVersion)
+        {
+            ::munmap(mapping, static_cast<std::size_t>(info.st_size));
+            return false;
+        }
+
+        m_name = name;
+        m_mapping = mapping;
+        m_mappingSize = static_cast<std::size_t>(info.st_size);
+        m_ring.header = header;
+        m_ring.data = static_cast<char *>(mapping) + sizeof(SharedTraceHeader);
+        m_finished = false;
+        m_strings.clear();
+        m_stats = SharedCollectStats{};
+        m_lastHeartbeat = header->heartbeat.load(std::memory_order_relaxed);
+        m_lastHeartbeatAt = std::chrono::steady_clock::now();
+        return true;
+    }
+
+    /**
+     * @brief Format everything the producer has published so far to `out`.
+     *
+     * Once the producer has closed the session, or its heartbeat has
+     * stopped without closing it, and everything has been read, the footer
+     * is written, the segment removed and finished() becomes true.
+     *
+     * @return Number of ring bytes consumed.
+     */
+    std::size_t poll(std::ostream &out)
+    {
+        if (m_mapping == nullptr || m_finished)
+            return 0;
+
+        // Read `closed` first: once set, writePosition is final
+        const bool closed =
+            m_ring.header->closed.load(std::memory_order_acquire) != 0 ||
+            !producerAlive();
+        const uint64_t end =
+            m_ring.header->writePosition.load(std::memory_order_acquire);
+        uint64_t position =
+            m_ring.header->readPosition.load(std::memory_order_relaxed);
+        const uint64_t start = position;
+
+        while (end - position >= sizeof(SharedMessageHeader))
+        {
+            SharedMessageHeader message;
+            m_ring.copyOut(position, &message, sizeof(message));
+            m_payload.resize(message.size);
+            m_ring.copyOut(position + sizeof(message), m_payload.data(),
+                           m_payload.size());
+            position += sizeof(message) + message.size;
+            // Hand the space back before the slower formatting
+            m_ring.header->readPosition.store(position,
+                                              std::memory_order_release);
+            handle(static_cast<SharedMessageType>(message.type), out);
+        }
+
+        if (closed)
+        {
+            m_stats.droppedRecords =
+                m_ring.header->droppedRecords.load(std::memory_order_relaxed);
+            m_stats.droppedBytes =
+                m_ring.header->droppedBytes.load(std::memory_order_relaxed);
+            if (m_stats.droppedRecords > 0)
+                write(out, dropMarker());
+            out << "]}";
+            m_stats.bytes += 2;
+            m_finished = true;
+            ::shm_unlink(m_name.c_str());
+        }
+        out.flush();
+        return static_cast<std::size_t>(position - start);
+    }
+
+    bool finished() const
+    {
+        return m_finished;
+    }
+
+    SharedCollectStats stats() const
+    {
+        return m_stats;
+    }
+
+    void detach()
+    {
+        if (m_mapping != nullptr)
+            ::munmap(m_mapping, m_mappingSize);
+        m_mapping = nullptr;
+        m_ring = detail::SharedRing{};
+    }
+
+  private:
+    /**
+     * @brief False once the heartbeat has not moved for the producer
+     * timeout. Unlike probing the process id, this survives pid reuse and
+     * pid namespaces.
+     */
+    bool producerAlive()
+    {
+        const uint64_t heartbeat =
+            m_ring.header->heartbeat.load(std::memory_order_relaxed);
+        const auto now = std::chrono::steady_clock::now();
+        if (heartbeat != m_lastHeartbeat)
+        {
+            m_lastHeartbeat = heartbeat;
+            m_lastHeartbeatAt = now;
+            return true;
+        }
+        return now - m_lastHeartbeatAt < m_producerTimeout;
+    }
+
+    /**
+     * @brief Global instant at collection time with the producer's drop
+     * totals, as the socket transport writes it.
+     */
+    std::string dropMarker() const
+    {
+        const uint64_t startUs = m_ring.header->sessionStartUs;
+        const uint64_t nowUs = static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now().time_since_epoch())
+                .count());
+        return ",{\"name\":\"Dropped events\",\"ph\":\"i\",\"s\":\"g\","
+               "\"pid\":" +
+               std::to_string(m_ring.header->processId) +
+               ",\"tid\":0,\"ts\":" +
+               std::to_string(nowUs > startUs ? nowUs - startUs : 0) +
+               ",\"args\":{\"events\":" +
+               std::to_string(m_stats.droppedRecords) +
+               ",\"bytes\":" + std::to_string(m_stats.droppedBytes) + "}}";
+    }
+
+    void handle(SharedMessageType type, std::ostream &out)
+    {
+        switch (type)
+        {
+        case SharedMessageType::Text:
+            write(out, m_payload);
+            break;
+        case SharedMessageType::String:
+        {
+            if (m_payload.size() < sizeof(uint64_t))
+                break;
+            uint64_t key = 0;
+            std::memcpy(&key, m_payload.data(), sizeof(key));
+            m_strings[key] = m_payload.substr(sizeof(key));
+            break;
+        }
+        case SharedMessageType::Records:
+        {
+            // Point the records at this process's copies of their strings
+            m_stats.records += detail::forEachStringPointer(
+                m_payload, [this](std::size_t offset, const char *text) {
+                    const auto found =
+                        m_strings.find(reinterpret_cast<uintptr_t>(text));
+                    const char *local =
+                        found != m_strings.end() ? found->second.c_str() : "?";
+                    std::memcpy(m_payload.data() + offset, &local,
+                                sizeof(local));
+                });
+
+            m_text.clear();
+            const std::string_view block(m_payload);
+            for (std::size_t offset = 0; offset < block.size();)
+                offset = detail::formatRecord(
+                    block, offset, m_ring.header->sessionStartUs,
+                    m_ring.header->processId, m_text);
+            write(out, m_text);
+            break;
+        }
+        }
+    }
+
+    void write(std::ostream &out, const std::string &text)
+    {
+        out.write(text.data(), static_cast<std::streamsize>(text.size()));
+        m_stats.bytes += text.size();
+    }
+
+  private:
+    std::string m_name;
+    void *m_mapping = nullptr;
+    std::size_t m_mappingSize = 0;
+    detail::SharedRing m_ring;
+    bool m_finished = false;
+    std::unordered_map<uint64_t, std::string> m_strings;
+    std::string m_payload;
+    std::string m_text;
+    SharedCollectStats m_stats;
+
+    std::chrono::milliseconds m_producerTimeout;
+    uint64_t m_lastHeartbeat = 0;
+    std::chrono::steady_clock::time_point m_lastHeartbeatAt{};
+};
+
+#endif // ST_HAS_SHARED_MEMORY
+
+} // namespace instrumentation
@@ -0,0 +1,599 @@
+/**
+ * @file socket_trace_writer.h
+ * @brief Live streaming of a session to another process over a Unix domain
+ * socket.
+ *
+ * With `SessionOptions::backend = OutputBackend::Socket` the session path
+ * is the address of a listening socket instead of a file. This is usually
+ * the `trace_consumer` tool:
+ *
+ * @code
+ * $ trace_consumer /tmp/trace.sock live.json &
+ * SessionOptions options;
+ * options.backend = instrumentation::OutputBackend::Socket;
+ * Instrumentor::get().beginSession("Live", "/tmp/trace.sock", options);
+ * @endcode
+ *
+ * Each block handed to the writer is sent as one frame as soon as the
+ * sender thread gets to it, so the consumer's file grows while the session
+ * runs. Blocks are whole batches of events, already formatted, because the
+ * binary records refer to names in the producer's memory.
+ *
+ * Instrumented threads never wait for the consumer. When more than
+ * `maxQueuedBytes` are waiting to be sent, further blocks are dropped and
+ * counted. The counts are sent to the consumer, which records them as a
+ * `Dropped events` marker. If the consumer goes away, the rest of the
+ * session is dropped the same way.
+ *
+ * Compression and rotation do not apply to streamed sessions.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <thread>
+
+#include "trace_writer.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define ST_HAS_UNIX_SOCKET 1
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#else
+#define ST_HAS_UNIX_SOCKET 0
+#endif
+
+namespace instrumentation
+{
+/**
+ * @brief Frame kinds of the trace stream protocol.
+ *
+ * Every frame starts with a StreamFrameHeader in host byte order, followed
+ * by `size` payload bytes.
+ */
+enum class StreamFrameType : uint32_t
+{
+    Data = 1,    ///< trace JSON to append to the output
+    Dropped = 2, ///< a StreamDropReport
+};
+
+struct StreamFrameHeader
+{
+    uint32_t type;
+    uint32_t size;
+};
+
+/**
+ * @brief Events the producer dropped since its previous report.
+ */
+struct StreamDropReport
+{
+    uint64_t events;
+    uint64_t bytes;
+    uint64_t timeUs; ///< time of the first drop, relative to session start
+};
+
+#if ST_HAS_UNIX_SOCKET
+
+namespace detail
+{
+/**
+ * @brief send(2) the whole range without raising SIGPIPE.
+ *
+ * Async-signal-safe.
+ *
+ * @return False if the peer is gone or another error occurred.
+ */
+inline bool sendAll(int fd, const char *data, std::size_t size)
+{
+#if defined(MSG_NOSIGNAL)
+    constexpr int kFlags = MSG_NOSIGNAL;
+#else
+    constexpr int kFlags = 0; // SO_NOSIGPIPE is set on the socket instead
+#endif
+    while (size > 0)
+    {
+        const ssize_t sent = ::send(fd, data, size, kFlags);
+        if (sent < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        data += sent;
+        size -= static_cast<std::size_t>(sent);
+    }
+    return true;
+}
+
+/**
+ * @brief recv(2) exactly `size` bytes.
+ *
+ * @return False on end of stream or error.
+ */
+inline bool receiveAll(int fd, char *data, std::size_t size)
+{
+    while (size > 0)
+    {
+        const ssize_t received = ::recv(fd, data, size, 0);
+        if (received < 0 && errno == EINTR)
+            continue;
+        if (received <= 0)
+            return false;
+        data += received;
+        size -= static_cast<std::size_t>(received);
+    }
+    return true;
+}
+
+inline bool sendFrame(int fd, StreamFrameType type, const char *data,
+                      std::size_t size)
+{
+    const StreamFrameHeader header{static_cast<uint32_t>(type),
+                                   static_cast<uint32_t>(size)};
+    return sendAll(fd, reinterpret_cast<const char *>(&header),
+                   sizeof(header)) &&
+           sendAll(fd, data, size);
+}
+
+/**
+ * @brief Fill a socket address for `path`.
+ *
+ * @return False if the path does not fit.
+ */
+inline bool socketAddress(const std::string &path, sockaddr_un &address)
+{
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (path.empty() || path.size() >= sizeof(address.sun_path))
+        return false;
+    std::memcpy(address.sun_path, path.data(), path.size());
+    return true;
+}
+
+/**
+ * @brief Number of trace events in a block of formatted JSON.
+ */
+inline uint64_t countEvents(const char *data, std::size_t size)
+{
+    static constexpr std::string_view kPhase = "\"ph\":\"";
+    const std::string_view text(data, size);
+    uint64_t events = 0;
+    for (std::size_t at = text.find(kPhase); at != std::string_view::npos;
+         at = text.find(kPhase, at + kPhase.size()))
+        ++events;
+    return events;
+}
+} // namespace detail
+
+/**
+ * @brief Writer that streams blocks to a listening Unix domain socket. See
+ * the file documentation.
+ */
+class SocketTraceWriter final : public TraceWriter
+{
+  public:
+    static constexpr std::size_t kDefaultMaxQueuedBytes = 16u * 1024u * 1024u;
+
+    /**
+     * @param sessionStartUs Steady clock time the drop reports are relative
+     *                       to.
+     * @param maxQueuedBytes Unsent bytes above which blocks are dropped.
+     */
+    explicit SocketTraceWriter(
+        uint64_t sessionStartUs = 0,
+        std::size_t maxQueuedBytes = kDefaultMaxQueuedBytes)
+        : m_sessionStartUs(sessionStartUs), m_maxQueuedBytes(maxQueuedBytes)
+    {
+    }
+
+    SocketTraceWriter(const SocketTraceWriter &) = delete;
+    SocketTraceWriter &operator=(const SocketTraceWriter &) = delete;
+
+    ~SocketTraceWriter() override
+    {
+        close();
+    }
+
+    /**
+     * @brief Connect to the consumer listening at `path`.
+     */
+    bool open(const std::string &path) override
+    {
+        close();
+
+        sockaddr_un address;
+        if (!detail::socketAddress(path, address))
+            return false;
+        const int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0)
+            return false;
+#if defined(SO_NOSIGPIPE)
+        const int enable = 1;
+        ::setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &enable, sizeof(enable));
+#endif
+        if (::connect(fd, reinterpret_cast<const sockaddr *>(&address),
+                      sizeof(address)) != 0)
+        {
+            ::close(fd);
+            return false;
+        }
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_fd = fd;
+        m_queue.clear();
+        m_queuedBytes = 0;
+        m_pendingDrop = StreamDropReport{0, 0, 0};
+        m_droppedEvents.store(0, std::memory_order_relaxed);
+        m_droppedBytes.store(0, std::memory_order_relaxed);
+        m_broken = false;
+        m_stopping = false;
+        m_frozen.store(false, std::memory_order_relaxed);
+        m_open.store(true, std::memory_order_release);
+        m_thread = std::thread([this] { run(); });
+        return true;
+    }
+
+    /**
+     * @brief Queue a block for sending, or drop it if the queue is full.
+     * Never waits for the consumer.
+     */
+    void write(const char *data, std::size_t size) override
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_open.load(std::memory_order_relaxed))
+            return;
+        if (m_broken || m_queuedBytes + size > m_maxQueuedBytes)
+        {
+            drop(data, size);
+            return;
+        }
+        m_queue.emplace_back(data, size);
+        m_queuedBytes += size;
+        m_dataAvailable.notify_one();
+    }
+
+    /**
+     * @brief Send everything still queued and disconnect.
+     */
+    void close() override
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (!m_open.load(std::memory_order_relaxed))
+                return;
+            m_stopping = true;
+        }
+        m_dataAvailable.notify_one();
+        if (m_thread.joinable())
+            m_thread.join();
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        ::close(m_fd);
+        m_fd = -1;
+        m_open.store(false, std::memory_order_release);
+    }
+
+    bool isOpen() const override
+    {
+        return m_open.load(std::memory_order_acquire);
+    }
+
+    /** @brief Events dropped in this session. */
+    uint64_t droppedEvents() const
+    {
+        return m_droppedEvents.load(std::memory_order_relaxed);
+    }
+
+    /** @brief Bytes dropped in this session. */
+    uint64_t droppedBytes() const
+    {
+        return m_droppedBytes.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Stop the sender thread between frames, then send the still
+     * queued blocks and `data` directly.
+     */
+    void emergencyWrite(const char *data, std::size_t size) override
+    {
+        if (!freeze() || m_broken)
+            return;
+
+        // Blocks are left in the queue; freeing them is not signal-safe
+        for (; m_emergencyFlushed < m_queue.size(); ++m_emergencyFlushed)
+        {
+            const std::string &block = m_queue[m_emergencyFlushed];
+            if (!detail::sendFrame(m_fd, StreamFrameType::Data, block.data(),
+                                   block.size()))
+                return;
+        }
+        detail::sendFrame(m_fd, StreamFrameType::Data, data, size);
+    }
+
+    void emergencyClose() override
+    {
+        if (freeze())
+            ::shutdown(m_fd, SHUT_WR);
+    }
+
+  private:
+    /**
+     * @brief Count a dropped block. Called with m_mutex held.
+     */
+    void drop(const char *data, std::size_t size)
+    {
+        const uint64_t events = detail::countEvents(data, size);
+        if (m_pendingDrop.bytes == 0)
+        {
+            m_pendingDrop.timeUs =
+                static_cast<uint64_t>(
+                    std::chrono::duration_cast<std::chrono::microseconds>(
+                        std::chrono::steady_clock::now().time_since_epoch())
+                        .count()) -
+                m_sessionStartUs;
+        }
+        m_pendingDrop.events += events;
+        m_pendingDrop.bytes += size;
+        m_droppedEvents.fetch_add(events, std::memory_order_relaxed);
+        m_droppedBytes.fetch_add(size, std::memory_order_relaxed);
+    }
+
+    void run()
+    {
+        for (;;)
+        {
+            std::string block;
+            StreamDropReport report{0, 0, 0};
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_dataAvailable.wait(lock, [this] {
+                    return !m_queue.empty() || m_pendingDrop.bytes > 0 ||
+                           m_stopping ||
+                           m_frozen.load(std::memory_order_relaxed);
+                });
+                if (m_frozen.load(std::memory_order_relaxed))
+                    return; // handed over to the crash path
+                if (m_broken ||
+                    (m_queue.empty() && m_pendingDrop.bytes == 0))
+                    return; // nothing left that can be sent
+
+                std::swap(report, m_pendingDrop);
+                if (!m_queue.empty())
+                {
+                    block = std::move(m_queue.front());
+                    m_queue.pop_front();
+                    m_queuedBytes -= block.size();
+                }
+                m_writing.store(true, std::memory_order_relaxed);
+            }
+
+            bool sent = true;
+            if (report.bytes > 0)
+                sent = detail::sendFrame(
+                    m_fd, StreamFrameType::Dropped,
+                    reinterpret_cast<const char *>(&report), sizeof(report));
+            if (sent && !block.empty())
+                sent = detail::sendFrame(m_fd, StreamFrameType::Data,
+                                         block.data(), block.size());
+
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_writing.store(false, std::memory_order_relaxed);
+            if (!sent)
+            {
+                // The consumer is gone: everything from here on is dropped
+                m_broken = true;
+                drop(block.data(), block.size());
+                for (const std::string &queued : m_queue)
+                    drop(queued.data(), queued.size());
+                m_queue.clear();
+                m_queuedBytes = 0;
+            }
+        }
+    }
+
+    /**
+     * @brief Take the socket over from the sender thread for the crash
+     * path. Same approach as AsyncTraceWriter::freeze().
+     */
+    bool freeze()
+    {
+        if (m_frozenByCaller)
+            return true;
+
+        m_frozen.store(true, std::memory_order_relaxed);
+        for (int attempt = 0; attempt < 100000; ++attempt)
+        {
+            if (m_mutex.try_lock())
+            {
+                if (!m_writing.load(std::memory_order_relaxed))
+                {
+                    m_frozenByCaller = m_open.load(std::memory_order_relaxed);
+                    if (!m_frozenByCaller)
+                        m_mutex.unlock();
+                    return m_frozenByCaller;
+                }
+                m_mutex.unlock();
+            }
+            std::this_thread::yield();
+        }
+        return false;
+    }
+
+  private:
+    const uint64_t m_sessionStartUs;
+    const std::size_t m_maxQueuedBytes;
+    int m_fd = -1;
+
+    std::mutex m_mutex;
+    std::condition_variable m_dataAvailable;
+    std::deque<std::string> m_queue;
+    std::size_t m_queuedBytes = 0;
+    StreamDropReport m_pendingDrop{0, 0, 0};
+    bool m_broken = false;
+    std::atomic<bool> m_open{false}; ///< written under m_mutex
+    bool m_stopping = false;
+    std::thread m_thread;
+
+    std::atomic<uint64_t> m_droppedEvents{0};
+    std::atomic<uint64_t> m_droppedBytes{0};
+
+    std::atomic<bool> m_writing{false};
+    std::atomic<bool> m_frozen{false};
+    bool m_frozenByCaller = false;
+    std::size_t m_emergencyFlushed = 0;
+};
+
+/**
+ * @brief Totals of one received stream.
+ */
+struct StreamReceiveStats
+{
+    uint64_t bytes = 0; ///< trace bytes written to the output
+    uint64_t droppedEvents = 0;
+    uint64_t droppedBytes = 0;
+};
+
+/**
+ * @brief Consumer side of the stream: listens on a socket and writes the
+ * trace of each connecting session to an output stream.
+ */
+class TraceStreamReceiver
+{
+  public:
+    TraceStreamReceiver() = default;
+    TraceStreamReceiver(const TraceStreamReceiver &) = delete;
+    TraceStreamReceiver &operator=(const TraceStreamReceiver &) = delete;
+
+    ~TraceStreamReceiver()
+    {
+        if (m_fd >= 0)
+        {
+            ::close(m_fd);
+            ::unlink(m_path.c_str());
+        }
+    }
+
+    /**
+     * @brief Listen at `path`, replacing a stale socket file.
+     */
+    bool listen(const std::string &path)
+    {
+        sockaddr_un address;
+        if (m_fd >= 0 || !detail::socketAddress(path, address))
+            return false;
+        ::unlink(path.c_str());
+
+        const int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0)
+            return false;
+        if (::bind(fd, reinterpret_cast<const sockaddr *>(&address),
+                   sizeof(address)) != 0 ||
+            ::listen(fd, 1) != 0)
+        {
+            ::close(fd);
+            return false;
+        }
+        m_fd = fd;
+        m_path = path;
+        return true;
+    }
+
+    /**
+     * @brief Accept one session and copy its trace to `out` until the
+     * producer disconnects. The output is flushed after every frame and
+     * always ends with a valid footer.
+     */
+    StreamReceiveStats receive(std::ostream &out)
+    {
+        StreamReceiveStats stats;
+        const int fd = ::accept(m_fd, nullptr, nullptr);
+        if (fd < 0)
+            return stats;
+
+        std::string payload;
+        std::string tail; // last two bytes written, to detect the footer
+        auto emit = [&](const std::string &text) {
+            out.write(text.data(), static_cast<std::streamsize>(text.size()));
+            stats.bytes += text.size();
+            tail = (tail + text).substr(
+                std::max<std::size_t>(tail.size() + text.size(), 2) - 2);
+        };
+
+        // Drops reported before the header arrived wait for it
+        StreamDropReport unwritten{0, 0, 0};
+        StreamFrameHeader header;
+        while (detail::receiveAll(fd, reinterpret_cast<char *>(&header),
+                                  sizeof(header)))
+        {
+            payload.resize(header.size);
+            if (!detail::receiveAll(fd, payload.data(), payload.size()))
+                break;
+
+            if (header.type == static_cast<uint32_t>(StreamFrameType::Data))
+            {
+                emit(payload);
+            }
+            else if (header.type ==
+                         static_cast<uint32_t>(StreamFrameType::Dropped) &&
+                     payload.size() == sizeof(StreamDropReport))
+            {
+                StreamDropReport report;
+                std::memcpy(&report, payload.data(), sizeof(report));
+                stats.droppedEvents += report.events;
+                stats.droppedBytes += report.bytes;
+                if (unwritten.bytes == 0)
+                    unwritten.timeUs = report.timeUs;
+                unwritten.events += report.events;
+                unwritten.bytes += report.bytes;
+            }
+
+            if (unwritten.bytes > 0 && stats.bytes > 0 && tail != "]}")
+            {
+                emit(dropMarker(unwritten));
+                unwritten = StreamDropReport{0, 0, 0};
+            }
+            out.flush();
+        }
+        ::close(fd);
+
+        // The producer crashed or dropped its footer
+        if (stats.bytes > 0 && tail != "]}")
+        {
+            out << "]}";
+            out.flush();
+        }
+        return stats;
+    }
+
+  private:
+    static std::string dropMarker(const StreamDropReport &report)
+    {
+        return ",{\"name\":\"Dropped events\",\"ph\":\"i\",\"s\":\"g\","
+               "\"pid\":0,\"tid\":0,\"ts\":" +
+               std::to_string(report.timeUs) + ",\"args\":{\"events\":" +
+               std::to_string(report.events) +
+               ",\"bytes\":" + std::to_string(report.bytes) + "}}";
+    }
+
+  private:
+    int m_fd = -1;
+    std::string m_path;
+};
+
+#endif // ST_HAS_UNIX_SOCKET
+
+} // namespace instrumentation
@@ -0,0 +1,373 @@
+/**
+ * @file trace_compression.h
+ * @brief Streaming compression decorators for trace writers.
+ *
+ * The decorators compress everything written to them and forward the
+ * compressed stream to an inner TraceWriter. zstd is used when the build
+ * defines `ST_HAVE_ZSTD`, gzip (zlib) when it defines `ST_HAVE_ZLIB`; the
+ * CMake build sets these when the libraries are found. Both formats can be
+ * opened directly by Perfetto.
+ *
+ * Compression is CPU heavy, so the Instrumentor always runs these behind an
+ * AsyncTraceWriter. The decorators themselves are not thread-safe.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <climits>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "trace_writer.h"
+
+#if defined(ST_HAVE_ZLIB)
+#include <zlib.h>
+#endif
+
+#if defined(ST_HAVE_ZSTD)
+#include <zstd.h>
+#endif
+
+namespace instrumentation
+{
+/**
+ * @brief Compression applied to the trace output.
+ */
+enum class Compression
+{
+    None,
+    Gzip, ///< `.json.gz`, requires zlib
+    Zstd, ///< `.json.zst`, requires zstd; falls back to gzip
+};
+
+/**
+ * @brief Map a requested compression to the best one available in this
+ * build.
+ */
+inline Compression availableCompression(Compression requested)
+{
+#if defined(ST_HAVE_ZSTD)
+    if (requested == Compression::Zstd)
+        return Compression::Zstd;
+#endif
+#if defined(ST_HAVE_ZLIB)
+    if (requested != Compression::None)
+        return Compression::Gzip;
+#endif
+    (void)requested;
+    return Compression::None;
+}
+
+/**
+ * @brief File extension appended to the trace path for a compression.
+ */
+inline const char *compressionExtension(Compression compression)
+{
+    switch (compression)
+    {
+    case Compression::Gzip:
+        return ".gz";
+    case Compression::Zstd:
+        return ".zst";
+    case Compression::None:
+        break;
+    }
+    return "";
+}
+
+#if defined(ST_HAVE_ZLIB)
+
+/**
+ * @brief Gzip-compresses the stream with zlib's deflate.
+ */
+class GzipTraceWriter final : public TraceWriter
+{
+  public:
+    explicit GzipTraceWriter(std::unique_ptr<TraceWriter> inner,
+                             int level = Z_DEFAULT_COMPRESSION)
+        : m_inner(std::move(inner)), m_level(level), m_out(kChunkSize)
+    {
+    }
+
+    GzipTraceWriter(const GzipTraceWriter &) = delete;
+    GzipTraceWriter &operator=(const GzipTraceWriter &) = delete;
+
+    ~GzipTraceWriter() override
+    {
+        close();
+    }
+
+    bool open(const std::string &path) override
+    {
+        close();
+        if (!m_inner->open(path))
+            return false;
+
+        m_stream = z_stream{};
+        // 15 window bits + 16 selects the gzip container
+        if (deflateInit2(&m_stream, m_level, Z_DEFLATED, 15 + 16, 8,
+                         Z_DEFAULT_STRATEGY) != Z_OK)
+        {
+            m_inner->close();
+            return false;
+        }
+        m_active = true;
+        return true;
+    }
+
+    void write(const char *data, std::size_t size) override
+    {
+        if (!m_active)
+            return;
+
+        while (size > 0)
+        {
+            const std::size_t chunk =
+                std::min<std::size_t>(size, static_cast<std::size_t>(UINT_MAX));
+            m_stream.next_in =
+                reinterpret_cast<Bytef *>(const_cast<char *>(data));
+            m_stream.avail_in = static_cast<uInt>(chunk);
+            deflateAll(Z_NO_FLUSH, false);
+            data += chunk;
+            size -= chunk;
+        }
+    }
+
+    void close() override
+    {
+        if (!m_active)
+            return;
+
+        m_stream.next_in = nullptr;
+        m_stream.avail_in = 0;
+        deflateAll(Z_FINISH, false);
+        deflateEnd(&m_stream);
+        m_active = false;
+        m_inner->close();
+    }
+
+    bool isOpen() const override
+    {
+        return m_active;
+    }
+
+    /**
+     * @brief deflate only works on the stream and output buffer that were
+     * allocated at open, so it is safe to keep compressing on the crash path.
+     */
+    void emergencyWrite(const char *data, std::size_t size) override
+    {
+        if (!m_active)
+            return;
+        m_stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data));
+        m_stream.avail_in = static_cast<uInt>(
+            std::min<std::size_t>(size, static_cast<std::size_t>(UINT_MAX)));
+        deflateAll(Z_NO_FLUSH, true);
+    }
+
+    void emergencyClose() override
+    {
+        if (!m_active)
+            return;
+        m_stream.next_in = nullptr;
+        m_stream.avail_in = 0;
+        deflateAll(Z_FINISH, true);
+        m_active = false;
+        m_inner->emergencyClose();
+    }
+
+  private:
+    static constexpr std::size_t kChunkSize = 256 * 1024;
+
+    void deflateAll(int flush, bool emergency)
+    {
+        int status = Z_OK;
+        do
+        {
+            m_stream.next_out = reinterpret_cast<Bytef *>(m_out.data());
+            m_stream.avail_out = static_cast<uInt>(m_out.size());
+            status = deflate(&m_stream, flush);
+            const std::size_t produced = m_out.size() - m_stream.avail_out;
+            if (produced > 0 && emergency)
+                m_inner->emergencyWrite(m_out.data(), produced);
+            else if (produced > 0)
+                m_inner->write(m_out.data(), produced);
+        } while (status == Z_OK &&
+                 (m_stream.avail_out == 0 ||
+                  (flush == Z_FINISH && status != Z_STREAM_END)));
+    }
+
+  private:
+    std::unique_ptr<TraceWriter> m_inner;
+    int m_level;
+    std::vector<char> m_out;
+    z_stream m_stream{};
+    bool m_active = false;
+};
+
+#endif // ST_HAVE_ZLIB
+
+#if defined(ST_HAVE_ZSTD)
+
+/**
+ * @brief Compresses the stream into a single zstd frame.
+ */
+class ZstdTraceWriter final : public TraceWriter
+{
+  public:
+    explicit ZstdTraceWriter(std::unique_ptr<TraceWriter> inner,
+                             int level = 3)
+        : m_inner(std::move(inner)), m_level(level),
+          m_out(ZSTD_CStreamOutSize())
+    {
+    }
+
+    ZstdTraceWriter(const ZstdTraceWriter &) = delete;
+    ZstdTraceWriter &operator=(const ZstdTraceWriter &) = delete;
+
+    ~ZstdTraceWriter() override
+    {
+        close();
+        ZSTD_freeCCtx(m_context);
+    }
+
+    bool open(const std::string &path) override
+    {
+        close();
+        if (!m_inner->open(path))
+            return false;
+
+        if (m_context == nullptr)
+            m_context = ZSTD_createCCtx();
+        if (m_context == nullptr ||
+            ZSTD_isError(ZSTD_CCtx_reset(m_context,
+                                         ZSTD_reset_session_only)) ||
+            ZSTD_isError(ZSTD_CCtx_setParameter(
+                m_context, ZSTD_c_compressionLevel, m_level)))
+        {
+            m_inner->close();
+            return false;
+        }
+        m_active = true;
+        return true;
+    }
+
+    void write(const char *data, std::size_t size) override
+    {
+        if (!m_active)
+            return;
+
+        ZSTD_inBuffer in{data, size, 0};
+        while (in.pos < in.size)
+            compress(in, ZSTD_e_continue, false);
+    }
+
+    void close() override
+    {
+        if (!m_active)
+            return;
+
+        ZSTD_inBuffer in{nullptr, 0, 0};
+        while (compress(in, ZSTD_e_end, false) != 0)
+        {
+        }
+        m_active = false;
+        m_inner->close();
+    }
+
+    bool isOpen() const override
+    {
+        return m_active;
+    }
+
+    /**
+     * @brief The context's buffers are allocated by the first compression
+     * call, so continuing the frame on the crash path does not allocate.
+     */
+    void emergencyWrite(const char *data, std::size_t size) override
+    {
+        if (!m_active)
+            return;
+        ZSTD_inBuffer in{data, size, 0};
+        while (in.pos < in.size)
+            compress(in, ZSTD_e_continue, true);
+    }
+
+    void emergencyClose() override
+    {
+        if (!m_active)
+            return;
+        ZSTD_inBuffer in{nullptr, 0, 0};
+        while (compress(in, ZSTD_e_end, true) != 0)
+        {
+        }
+        m_active = false;
+        m_inner->emergencyClose();
+    }
+
+  private:
+    /**
+     * @return Bytes zstd still has to flush (0 once a frame is complete).
+     */
+    std::size_t compress(ZSTD_inBuffer &in, ZSTD_EndDirective mode,
+                         bool emergency)
+    {
+        ZSTD_outBuffer out{m_out.data(), m_out.size(), 0};
+        const std::size_t remaining =
+            ZSTD_compressStream2(m_context, &out, &in, mode);
+        if (out.pos > 0 && emergency)
+            m_inner->emergencyWrite(m_out.data(), out.pos);
+        else if (out.pos > 0)
+            m_inner->write(m_out.data(), out.pos);
+        if (ZSTD_isError(remaining))
+        {
+            in.pos = in.size; // drop the rest rather than spin
+            return 0;
+        }
+        return remaining;
+    }
+
+  private:
+    std::unique_ptr<TraceWriter> m_inner;
+    int m_level;
+    std::vector<char> m_out;
+    ZSTD_CCtx *m_context = nullptr;
+    bool m_active = false;
+};
+
+#endif // ST_HAVE_ZSTD
+
+/**
+ * @brief Wrap `inner` in the decorator for `compression`.
+ *
+ * `compression` should already have been passed through
+ * availableCompression(); unavailable codecs return `inner` unchanged.
+ */
+inline std::unique_ptr<TraceWriter>
+makeCompressedWriter(std::unique_ptr<TraceWriter> inner,
+                     Compression compression)
+{
+    switch (compression)
+    {
+    case Compression::Zstd:
+#if defined(ST_HAVE_ZSTD)
+        return std::make_unique<ZstdTraceWriter>(std::move(inner));
+#else
+        break;
+#endif
+    case Compression::Gzip:
+#if defined(ST_HAVE_ZLIB)
+        return std::make_unique<GzipTraceWriter>(std::move(inner));
+#else
+        break;
+#endif
+    case Compression::None:
+        break;
+    }
+    return inner;
+}
+
+} // namespace instrumentation
@@ -0,0 +1,382 @@
+/**
+ * @file trace_diff.h
+ * @brief Compare the per-scope statistics of two traces.
+ *
+ * diffSummaries() takes the summaries of a baseline and a candidate trace
+ * (see trace_summary.h) and classifies every scope:
+ * - `regression` or `improvement` when the inclusive duration, the self
+ *   time or the call rate changed significantly and by at least
+ *   DiffOptions::minChange; any regression wins over improvements,
+ * - `added` or `removed` when the scope only occurs in one trace,
+ * - `unchanged` otherwise, including scopes with too few calls to judge.
+ *
+ * Durations and self times are compared with a two-sided Mann-Whitney U
+ * test on their histograms, which makes no assumption about the shape of
+ * the distributions. Values that share a histogram bucket count as ties.
+ * Call counts are compared with a binomial test that expects them to split
+ * in proportion to the lengths of the traces. The direction of a change
+ * is the sign of the test statistic; a relative change of the mean that
+ * disagrees with it leaves the scope unchanged.
+ *
+ * diffToJson() writes the result for CI jobs.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "trace_event.h"
+#include "trace_summary.h"
+
+namespace instrumentation
+{
+/**
+ * @brief Options for diffSummaries().
+ */
+struct DiffOptions
+{
+    double alpha = 0.01;     ///< significance level of the test
+    double minChange = 0.05; ///< smallest relative change that counts
+    uint64_t minCalls = 20;  ///< calls needed in both traces to judge
+};
+
+/**
+ * @brief Classification of one scope. See the file documentation.
+ */
+enum class DiffVerdict
+{
+    Unchanged,
+    Regression,
+    Improvement,
+    Added,
+    Removed,
+};
+
+inline const char *diffVerdictName(DiffVerdict verdict)
+{
+    switch (verdict)
+    {
+    case DiffVerdict::Regression:
+        return "regression";
+    case DiffVerdict::Improvement:
+        return "improvement";
+    case DiffVerdict::Added:
+        return "added";
+    case DiffVerdict::Removed:
+        return "removed";
+    case DiffVerdict::Unchanged:
+        break;
+    }
+    return "unchanged";
+}
+
+/**
+ * @brief Statistics of one scope in one of the compared traces.
+ */
+struct ScopeSample
+{
+    uint64_t calls = 0;
+    double meanUs = 0; ///< mean inclusive duration
+    double selfUs = 0; ///< total self time
+    double p50Us = 0;
+    double p90Us = 0;
+    double p99Us = 0;
+};
+
+/**
+ * @brief Comparison of one scope.
+ */
+struct ScopeDiff
+{
+    std::string name;
+    DiffVerdict verdict = DiffVerdict::Unchanged;
+    ScopeSample base;
+    ScopeSample candidate;
+    double change = 0; ///< relative change of the mean duration
+    double pValue = 1;
+    double selfChange = 0; ///< relative change of the mean self time
+    double selfPValue = 1;
+    double callsChange = 0; ///< relative change of the call rate
+    double callsPValue = 1;
+};
+
+/**
+ * @brief Result of diffSummaries().
+ */
+struct TraceDiff
+{
+    std::vector<ScopeDiff> scopes; ///< baseline order, then added scopes
+    uint32_t regressions = 0;
+    uint32_t improvements = 0;
+};
+
+/**
+ * @brief Outcome of a two-sided significance test.
+ */
+struct SignificanceTest
+{
+    double pValue = 1;
+    double z = 0; ///< > 0 when the second sample tends to be larger
+};
+
+/**
+ * @brief Mann-Whitney U test between the values in two histograms. The
+ * p-value is 1 if either is empty or all values tie.
+ */
+inline SignificanceTest mannWhitney(const DurationHistogram &a,
+                                    const DurationHistogram &b)
+{
+    const double na = static_cast<double>(a.count());
+    const double nb = static_cast<double>(b.count());
+    if (na == 0 || nb == 0)
+        return {};
+
+    // Rank sum of `a`; each bucket is one group of ties
+    const std::vector<uint64_t> &bucketsA = a.buckets();
+    const std::vector<uint64_t> &bucketsB = b.buckets();
+    const std::size_t buckets = std::max(bucketsA.size(), bucketsB.size());
+    double ranked = 0;
+    double rankSumA = 0;
+    double tieTerm = 0;
+    for (std::size_t i = 0; i < buckets; ++i)
+    {
+        const double countA =
+            i < bucketsA.size() ? static_cast<double>(bucketsA[i]) : 0;
+        const double countB =
+            i < bucketsB.size() ? static_cast<double>(bucketsB[i]) : 0;
+        const double ties = countA + countB;
+        if (ties == 0)
+            continue;
+        rankSumA += countA * (ranked + (ties + 1) / 2);
+        tieTerm += ties * ties * ties - ties;
+        ranked += ties;
+    }
+
+    const double n = na + nb;
+    const double u = rankSumA - na * (na + 1) / 2;
+    const double mean = na * nb / 2;
+    const double variance =
+        na * nb / 12 * ((n + 1) - tieTerm / (n * (n - 1)));
+    if (variance <= 0)
+        return {};
+    // `u` counts the pairs in which the value from `a` is larger
+    const double z = (mean - u) / std::sqrt(variance);
+    return {std::erfc(std::abs(z) / std::sqrt(2.0)), z};
+}
+
+/**
+ * @brief Binomial test of whether `countA` and `countB` split in the
+ * proportion `shareA` : 1 - `shareA`, using the normal approximation.
+ */
+inline SignificanceTest countTest(uint64_t countA, uint64_t countB,
+                                  double shareA)
+{
+    const double n = static_cast<double>(countA + countB);
+    const double variance = n * shareA * (1 - shareA);
+    if (variance <= 0)
+        return {};
+    const double z =
+        (static_cast<double>(countB) - n * (1 - shareA)) / std::sqrt(variance);
+    return {std::erfc(std::abs(z) / std::sqrt(2.0)), z};
+}
+
+namespace detail
+{
+inline ScopeSample sampleOf(const ScopeSummary &scope)
+{
+    ScopeSample sample;
+    sample.calls = scope.calls;
+    sample.meanUs =
+        scope.calls > 0 ? scope.inclusiveUs / static_cast<double>(scope.calls)
+                        : 0;
+    sample.selfUs = scope.selfUs;
+    sample.p50Us = scope.durations.percentile(0.5);
+    sample.p90Us = scope.durations.percentile(0.9);
+    sample.p99Us = scope.durations.percentile(0.99);
+    return sample;
+}
+
+inline double relativeChange(double base, double candidate)
+{
+    return base > 0 ? candidate / base - 1 : 0;
+}
+
+/**
+ * @brief 1 for a significant increase, -1 for a significant decrease and
+ * 0 otherwise. The direction comes from the test statistic.
+ */
+inline int judge(const SignificanceTest &test, double change,
+                 const DiffOptions &options)
+{
+    if (test.pValue >= options.alpha || std::abs(change) < options.minChange)
+        return 0;
+    if (test.z > 0 && change > 0)
+        return 1;
+    if (test.z < 0 && change < 0)
+        return -1;
+    return 0;
+}
+
+inline void appendSample(std::string &out, const ScopeSample &sample)
+{
+    out += "{\"calls\":";
+    appendUint(out, sample.calls);
+    out += ",\"mean_us\":";
+    appendDouble(out, sample.meanUs);
+    out += ",\"self_us\":";
+    appendDouble(out, sample.selfUs);
+    out += ",\"p50_us\":";
+    appendDouble(out, sample.p50Us);
+    out += ",\"p90_us\":";
+    appendDouble(out, sample.p90Us);
+    out += ",\"p99_us\":";
+    appendDouble(out, sample.p99Us);
+    out += '}';
+}
+} // namespace detail
+
+/**
+ * @brief Compare two trace summaries. See the file documentation.
+ */
+inline TraceDiff diffSummaries(const TraceSummary &base,
+                               const TraceSummary &candidate,
+                               const DiffOptions &options = {})
+{
+    std::unordered_map<std::string_view, const ScopeSummary *> candidates;
+    for (const ScopeSummary &scope : candidate.scopes)
+    {
+        if (scope.calls > 0)
+            candidates.emplace(scope.name, &scope);
+    }
+
+    // Share of the calls expected in the baseline if the rate is unchanged
+    const double baseUs = base.endUs - base.startUs;
+    const double candidateUs = candidate.endUs - candidate.startUs;
+    const double baseShare = baseUs > 0 && candidateUs > 0
+                                 ? baseUs / (baseUs + candidateUs)
+                                 : 0.5;
+
+    TraceDiff diff;
+    for (const ScopeSummary &scope : base.scopes)
+    {
+        if (scope.calls == 0)
+            continue;
+        ScopeDiff entry;
+        entry.name = scope.name;
+        entry.base = detail::sampleOf(scope);
+
+        const auto found = candidates.find(scope.name);
+        if (found == candidates.end())
+        {
+            entry.verdict = DiffVerdict::Removed;
+            diff.scopes.push_back(std::move(entry));
+            continue;
+        }
+        const ScopeSummary &other = *found->second;
+        candidates.erase(found);
+        entry.candidate = detail::sampleOf(other);
+        entry.change =
+            detail::relativeChange(entry.base.meanUs, entry.candidate.meanUs);
+        entry.selfChange = detail::relativeChange(
+            entry.base.selfUs / static_cast<double>(entry.base.calls),
+            entry.candidate.selfUs /
+                static_cast<double>(entry.candidate.calls));
+        entry.callsChange = detail::relativeChange(
+            static_cast<double>(entry.base.calls) * (1 - baseShare),
+            static_cast<double>(entry.candidate.calls) * baseShare);
+
+        if (scope.calls >= options.minCalls &&
+            other.calls >= options.minCalls)
+        {
+            const SignificanceTest durations =
+                mannWhitney(scope.durations, other.durations);
+            const SignificanceTest selfTimes =
+                mannWhitney(scope.selfDurations, other.selfDurations);
+            const SignificanceTest calls =
+                countTest(scope.calls, other.calls, baseShare);
+            entry.pValue = durations.pValue;
+            entry.selfPValue = selfTimes.pValue;
+            entry.callsPValue = calls.pValue;
+
+            const int directions[] = {
+                detail::judge(durations, entry.change, options),
+                detail::judge(selfTimes, entry.selfChange, options),
+                detail::judge(calls, entry.callsChange, options)};
+            if (std::find(std::begin(directions), std::end(directions), 1) !=
+                std::end(directions))
+                entry.verdict = DiffVerdict::Regression;
+            else if (std::find(std::begin(directions), std::end(directions),
+                               -1) != std::end(directions))
+                entry.verdict = DiffVerdict::Improvement;
+        }
+        if (entry.verdict == DiffVerdict::Regression)
+            ++diff.regressions;
+        else if (entry.verdict == DiffVerdict::Improvement)
+            ++diff.improvements;
+        diff.scopes.push_back(std::move(entry));
+    }
+
+    for (const ScopeSummary &scope : candidate.scopes)
+    {
+        if (scope.calls == 0 || !candidates.contains(scope.name))
+            continue;
+        ScopeDiff entry;
+        entry.name = scope.name;
+        entry.verdict = DiffVerdict::Added;
+        entry.candidate = detail::sampleOf(scope);
+        diff.scopes.push_back(std::move(entry));
+    }
+    return diff;
+}
+
+/**
+ * @brief Machine-readable form of a diff: the counts of regressions and
+ * improvements and one object per scope.
+ */
+inline std::string diffToJson(const TraceDiff &diff)
+{
+    std::string out = "{\"regressions\":";
+    detail::appendUint(out, diff.regressions);
+    out += ",\"improvements\":";
+    detail::appendUint(out, diff.improvements);
+    out += ",\"scopes\":[";
+    for (std::size_t i = 0; i < diff.scopes.size(); ++i)
+    {
+        const ScopeDiff &scope = diff.scopes[i];
+        if (i > 0)
+            out += ",\n";
+        out += "{\"name\":\"";
+        detail::appendSanitized(out, scope.name);
+        out += "\",\"verdict\":\"";
+        out += diffVerdictName(scope.verdict);
+        out += "\",\"change\":";
+        detail::appendDouble(out, scope.change);
+        out += ",\"p_value\":";
+        detail::appendDouble(out, scope.pValue);
+        out += ",\"self_change\":";
+        detail::appendDouble(out, scope.selfChange);
+        out += ",\"self_p_value\":";
+        detail::appendDouble(out, scope.selfPValue);
+        out += ",\"calls_change\":";
+        detail::appendDouble(out, scope.callsChange);
+        out += ",\"calls_p_value\":";
+        detail::appendDouble(out, scope.callsPValue);
+        out += ",\"base\":";
+        detail::appendSample(out, scope.base);
+        out += ",\"candidate\":";
+        detail::appendSample(out, scope.candidate);
+        out += '}';
+    }
+    out += "]}";
+    return out;
+}
+
+} // namespace instrumentation
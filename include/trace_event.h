@@ -0,0 +1,828 @@
+/**
+ * @file trace_event.h
+ * @brief Binary event records and their conversion to trace JSON.
+ *
+ * Instrumented threads do not format JSON. Each event is appended to the
+ * thread's buffer as a fixed-size EventRecord, followed by its typed
+ * arguments copied as raw values, so recording an event costs a handful of
+ * word copies. JsonTraceWriter sits in the writer chain and turns blocks of
+ * records into Chrome trace JSON; when the session uses a background writer
+ * thread, that is where the formatting happens.
+ *
+ * Names and string arguments are copied into the buffer when the event is
+ * recorded, as the block may be formatted long after the recording scope
+ * has ended. Strings that live until the process exits (literals and the
+ * results of internString()) can be passed as StaticString instead, which
+ * stores only the pointer.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <charconv>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "trace_writer.h"
+
+namespace instrumentation
+{
+/**
+ * @brief Type of a TraceArg value.
+ */
+enum class ArgType : uint8_t
+{
+    Int,
+    UInt,
+    Double,
+    String,       ///< copied into the buffer when the event is recorded
+    StaticString, ///< stored as a pointer
+};
+
+/**
+ * @brief A string that lives until the process exits: a literal or the
+ * result of internString(). Events store it as a pointer instead of copying
+ * it.
+ */
+struct StaticString
+{
+    const char *text;
+
+    explicit constexpr StaticString(const char *value) noexcept : text(value)
+    {
+    }
+};
+
+/**
+ * @brief Name of an event. A plain `const char *` is copied when the event
+ * is recorded; a StaticString is stored as a pointer.
+ */
+struct EventName
+{
+    const char *text;
+    bool isStatic;
+
+    EventName(const char *value) noexcept : text(value), isStatic(false)
+    {
+    }
+
+    EventName(StaticString value) noexcept : text(value.text), isStatic(true)
+    {
+    }
+};
+
+/**
+ * @brief A typed key/value pair attached to an event ("args" in the JSON).
+ *
+ * Integers, floating point values and strings are accepted. String values
+ * only need to stay valid until the event is recorded, as they are copied
+ * then; StaticString values are not copied. Keys are not copied and must be
+ * literals or interned strings.
+ */
+struct TraceArg
+{
+    const char *key;
+    ArgType type;
+    uint64_t bits; // value, reinterpreted according to `type`
+
+    TraceArg() = default; // trivial, so unused argument slots cost nothing
+
+    template <typename T>
+    TraceArg(const char *argKey, T value) : key(argKey), type(), bits()
+    {
+        if constexpr (std::is_same_v<T, const char *> ||
+                      std::is_same_v<T, char *>)
+        {
+            type = ArgType::String;
+            bits = reinterpret_cast<uintptr_t>(value);
+        }
+        else if constexpr (std::is_same_v<T, StaticString>)
+        {
+            type = ArgType::StaticString;
+            bits = reinterpret_cast<uintptr_t>(value.text);
+        }
+        else if constexpr (std::is_floating_point_v<T>)
+        {
+            type = ArgType::Double;
+            bits = std::bit_cast<uint64_t>(static_cast<double>(value));
+        }
+        else if constexpr (std::is_integral_v<T> && std::is_signed_v<T>)
+        {
+            type = ArgType::Int;
+            bits = static_cast<uint64_t>(static_cast<int64_t>(value));
+        }
+        else if constexpr (std::is_integral_v<T>)
+        {
+            type = ArgType::UInt;
+            bits = static_cast<uint64_t>(value);
+        }
+        else
+        {
+            static_assert(std::is_integral_v<T>,
+                          "Event arguments must be integers, floating point "
+                          "values, string literals or interned strings");
+        }
+    }
+};
+
+/**
+ * @brief Return a copy of `text` that lives until the process exits.
+ *
+ * Equal strings share one copy. Use this for string arguments and names
+ * built at runtime; interning takes a global lock, so do it once rather
+ * than on every event.
+ */
+inline const char *internString(std::string_view text)
+{
+    static std::mutex mutex;
+    static std::unordered_set<std::string> strings;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    return strings.emplace(text).first->c_str();
+}
+
+namespace detail
+{
+/**
+ * @brief Append the decimal representation of an unsigned integer.
+ */
+inline void appendUint(std::string &out, uint64_t value)
+{
+    char digits[24];
+    const auto res = std::to_chars(digits, digits + sizeof(digits), value);
+    out.append(digits, res.ptr);
+}
+
+/**
+ * @brief Append the decimal representation of a signed integer.
+ */
+inline void appendInt(std::string &out, int64_t value)
+{
+    char digits[24];
+    const auto res = std::to_chars(digits, digits + sizeof(digits), value);
+    out.append(digits, res.ptr);
+}
+
+/**
+ * @brief Append an integer as a quoted hexadecimal JSON string. Used for
+ * 64-bit IDs, which JSON numbers cannot represent exactly.
+ */
+inline void appendHexId(std::string &out, uint64_t value)
+{
+    char digits[24];
+    const auto res = std::to_chars(digits, digits + sizeof(digits), value, 16);
+    out += "\"0x";
+    out.append(digits, res.ptr);
+    out += '"';
+}
+
+/**
+ * @brief Append the shortest decimal representation of a double. Values
+ * JSON cannot represent (NaN, infinities) are written as 0.
+ */
+inline void appendDouble(std::string &out, double value)
+{
+    if (!std::isfinite(value))
+        value = 0.0;
+    char digits[32];
+    const auto res = std::to_chars(digits, digits + sizeof(digits), value);
+    out.append(digits, res.ptr);
+}
+
+/**
+ * @brief Append a string as JSON string contents, escaping double quotes,
+ * backslashes and control characters.
+ */
+inline void appendSanitized(std::string &out, std::string_view text)
+{
+    static constexpr char kHex[] = "0123456789abcdef";
+    std::size_t plain = 0; // start of the run not yet appended
+    for (std::size_t i = 0; i < text.size(); ++i)
+    {
+        const unsigned char c = static_cast<unsigned char>(text[i]);
+        if (c != '"' && c != '\\' && c >= 0x20)
+            continue;
+        out.append(text.data() + plain, i - plain);
+        plain = i + 1;
+        switch (c)
+        {
+        case '"':
+            out += "\\\"";
+            break;
+        case '\\':
+            out += "\\\\";
+            break;
+        case '\n':
+            out += "\\n";
+            break;
+        case '\r':
+            out += "\\r";
+            break;
+        case '\t':
+            out += "\\t";
+            break;
+        default:
+            out += "\\u00";
+            out += kHex[c >> 4];
+            out += kHex[c & 0xf];
+            break;
+        }
+    }
+    out.append(text.data() + plain, text.size() - plain);
+}
+
+/**
+ * @brief Kind of event held by an EventRecord.
+ */
+enum class RecordKind : uint8_t
+{
+    Complete,   ///< "X": timeUs = start, value = end
+    Scope,      ///< "B"/"E": phase character
+    Instant,    ///< "i": phase = scope character
+    Counter,    ///< "C": value = bits of the double sample
+    Async,      ///< "b"/"e"/"s"/"t"/"f": phase character, value = ID
+    ThreadName, ///< "M" thread_name metadata, name stored inline
+};
+
+/**
+ * @brief Fixed-size header of one event in a per-thread buffer.
+ *
+ * Followed by `argCount` TraceArg values, then, when `name` is null, by the
+ * name itself, and then by the value of each ArgType::String argument in
+ * order. Copied strings are stored as a 32-bit length and their bytes.
+ * Records are copied in and out with memcpy, so they need no alignment
+ * inside the buffer.
+ */
+struct EventRecord
+{
+    RecordKind kind;
+    char phase;
+    uint8_t argCount;
+    uint32_t threadId;
+    uint64_t timeUs;
+    uint64_t value;
+    const char *name;
+};
+
+static_assert(std::is_trivially_copyable_v<EventRecord>);
+static_assert(std::is_trivially_copyable_v<TraceArg>);
+
+/**
+ * @brief Append a string as a 32-bit length and its bytes.
+ */
+inline void appendCopiedString(std::string &out, std::string_view text)
+{
+    const uint32_t length = static_cast<uint32_t>(text.size());
+    out.append(reinterpret_cast<const char *>(&length), sizeof(length));
+    out.append(text.data(), length);
+}
+
+/**
+ * @brief Read a string written by appendCopiedString() at `offset`.
+ *
+ * @return Offset after it, or npos if it is incomplete.
+ */
+inline std::size_t readCopiedString(std::string_view block, std::size_t offset,
+                                    std::string_view &text)
+{
+    uint32_t length = 0;
+    if (block.size() - offset < sizeof(length))
+        return std::string_view::npos;
+    std::memcpy(&length, block.data() + offset, sizeof(length));
+    offset += sizeof(length);
+    if (block.size() - offset < length)
+        return std::string_view::npos;
+    text = block.substr(offset, length);
+    return offset + length;
+}
+
+/**
+ * @brief Append a record, its arguments and, when `copyName` is set or the
+ * record has no name, a copy of `name`.
+ */
+inline void appendRecordWithName(std::string &out, EventRecord record,
+                                 const TraceArg *args, std::string_view name,
+                                 bool copyName)
+{
+    copyName = copyName || record.name == nullptr;
+    if (copyName)
+        record.name = nullptr; // the name follows the arguments
+    out.append(reinterpret_cast<const char *>(&record), sizeof(record));
+    bool copiedArgs = false;
+    for (uint8_t i = 0; i < record.argCount; ++i)
+    {
+        TraceArg arg = args[i];
+        if (arg.type == ArgType::String)
+        {
+            arg.bits = 0; // the value follows the record
+            copiedArgs = true;
+        }
+        out.append(reinterpret_cast<const char *>(&arg), sizeof(arg));
+    }
+    if (copyName)
+        appendCopiedString(out, name);
+    if (!copiedArgs)
+        return;
+    for (uint8_t i = 0; i < record.argCount; ++i)
+    {
+        if (args[i].type != ArgType::String)
+            continue;
+        const char *text = reinterpret_cast<const char *>(
+            static_cast<uintptr_t>(args[i].bits));
+        appendCopiedString(out, text != nullptr ? text : "");
+    }
+}
+
+/**
+ * @brief Append a record and its arguments to a buffer. `record.name` must
+ * be a static string.
+ */
+inline void appendRecord(std::string &out, const EventRecord &record,
+                         const TraceArg *args = nullptr)
+{
+    appendRecordWithName(out, record, args, {}, false);
+}
+
+/**
+ * @brief Append a record whose name is copied into the buffer, for names
+ * that do not outlive the call.
+ */
+inline void appendRecord(std::string &out, const EventRecord &record,
+                         std::string_view name, const TraceArg *args = nullptr)
+{
+    appendRecordWithName(out, record, args, name, true);
+}
+
+/**
+ * @brief Append a record named `name`, copying the name unless it is
+ * static.
+ */
+inline void appendNamedRecord(std::string &out, EventRecord record,
+                              EventName name, const TraceArg *args = nullptr)
+{
+    if (name.isStatic)
+    {
+        record.name = name.text;
+        appendRecord(out, record, args);
+    }
+    else
+    {
+        appendRecord(out, record,
+                     name.text != nullptr ? name.text : std::string_view(),
+                     args);
+    }
+}
+
+/**
+ * @brief Call `visit(offset, pointer)` for every string pointer in a block
+ * of records: names, argument keys and string argument values. `offset` is
+ * the position of the pointer's bytes in `block`.
+ *
+ * @return Number of complete records in the block.
+ */
+template <typename Visit>
+std::size_t forEachStringPointer(std::string_view block, Visit &&visit)
+{
+    std::size_t records = 0;
+    std::size_t offset = 0;
+    while (block.size() - offset >= sizeof(EventRecord))
+    {
+        EventRecord record;
+        std::memcpy(&record, block.data() + offset, sizeof(record));
+        const std::size_t recordOffset = offset;
+        offset += sizeof(record);
+        if (block.size() - offset < sizeof(TraceArg) * record.argCount)
+            break;
+
+        if (record.name != nullptr)
+            visit(recordOffset + offsetof(EventRecord, name), record.name);
+        uint8_t copiedArgs = 0;
+        for (uint8_t i = 0; i < record.argCount;
+             ++i, offset += sizeof(TraceArg))
+        {
+            TraceArg arg;
+            std::memcpy(&arg, block.data() + offset, sizeof(arg));
+            if (arg.key != nullptr)
+                visit(offset + offsetof(TraceArg, key), arg.key);
+            if (arg.type == ArgType::StaticString && arg.bits != 0)
+                visit(offset + offsetof(TraceArg, bits),
+                      reinterpret_cast<const char *>(
+                          static_cast<uintptr_t>(arg.bits)));
+            if (arg.type == ArgType::String)
+                ++copiedArgs;
+        }
+
+        // Skip the copied name and argument values
+        const uint32_t copied = copiedArgs + (record.name == nullptr ? 1u : 0u);
+        std::string_view text;
+        for (uint32_t i = 0; i < copied && offset != std::string_view::npos;
+             ++i)
+            offset = readCopiedString(block, offset, text);
+        if (offset == std::string_view::npos)
+            break;
+        ++records;
+    }
+    return records;
+}
+
+/**
+ * @brief One record decoded from a block. The strings point into the block.
+ */
+struct RecordView
+{
+    EventRecord record;
+    std::string_view name;
+    std::size_t argsOffset = 0;   ///< first TraceArg
+    std::size_t copiedOffset = 0; ///< first copied argument value
+};
+
+/**
+ * @brief Decode the record at `offset` in `block`.
+ *
+ * @return Offset of the next record, or `std::string_view::npos` if the
+ *         record at `offset` is incomplete.
+ */
+inline std::size_t readRecord(std::string_view block, std::size_t offset,
+                              RecordView &view)
+{
+    EventRecord &record = view.record;
+    if (block.size() - offset < sizeof(record))
+        return std::string_view::npos;
+    std::memcpy(&record, block.data() + offset, sizeof(record));
+    offset += sizeof(record);
+
+    const std::size_t argBytes = sizeof(TraceArg) * record.argCount;
+    if (block.size() - offset < argBytes)
+        return std::string_view::npos;
+    view.argsOffset = offset;
+    offset += argBytes;
+
+    view.name = {};
+    if (record.name != nullptr)
+        view.name = record.name;
+    else
+        offset = readCopiedString(block, offset, view.name);
+
+    // Copied argument values follow in order; find the end of the record
+    view.copiedOffset = offset;
+    for (uint8_t i = 0; i < record.argCount && offset != std::string_view::npos;
+         ++i)
+    {
+        TraceArg arg;
+        std::memcpy(&arg, block.data() + view.argsOffset + i * sizeof(arg),
+                    sizeof(arg));
+        std::string_view text;
+        if (arg.type == ArgType::String)
+            offset = readCopiedString(block, offset, text);
+    }
+    return offset;
+}
+
+/**
+ * @brief Append the JSON for the record at `offset` in `block`, prefixed
+ * with its separator.
+ *
+ * Only appends to `out`, so it does not allocate while `out` has spare
+ * capacity.
+ *
+ * @return Offset of the next record, or `block.size()` if the record at
+ *         `offset` is incomplete.
+ */
+inline std::size_t formatRecord(std::string_view block, std::size_t offset,
+                                uint64_t sessionStartUs, uint32_t processId,
+                                std::string &out)
+{
+    RecordView view;
+    offset = readRecord(block, offset, view);
+    if (offset == std::string_view::npos)
+        return block.size();
+    const EventRecord &record = view.record;
+    const std::string_view name = view.name;
+    const std::size_t argsOffset = view.argsOffset;
+
+    if (record.kind == RecordKind::ThreadName)
+    {
+        out += ", {\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":";
+        appendUint(out, processId);
+        out += ",\"tid\":";
+        appendUint(out, record.threadId);
+        out += ",\"args\":{\"name\":\"";
+        appendSanitized(out, name);
+        out += "\"}}";
+        return offset;
+    }
+
+    const uint64_t ts = record.timeUs - sessionStartUs;
+    switch (record.kind)
+    {
+    case RecordKind::Complete:
+        out += ", {\"dur\":";
+        appendUint(out, record.value - record.timeUs);
+        out += ",\"cat\":\"function\",\"name\":\"";
+        appendSanitized(out, name);
+        out += "\",\"ph\":\"X\"";
+        break;
+    case RecordKind::Scope:
+        out += ", {\"cat\":\"function\",\"name\":\"";
+        appendSanitized(out, name);
+        out += "\",\"ph\":\"";
+        out += record.phase;
+        out += '"';
+        break;
+    case RecordKind::Instant:
+        out += ", {\"cat\":\"instant\",\"name\":\"";
+        appendSanitized(out, name);
+        out += "\",\"ph\":\"i\",\"s\":\"";
+        out += record.phase;
+        out += '"';
+        break;
+    case RecordKind::Counter:
+        out += ", {\"cat\":\"counter\",\"name\":\"";
+        appendSanitized(out, name);
+        out += "\",\"ph\":\"C\"";
+        break;
+    case RecordKind::Async:
+    {
+        const bool flow = record.phase != 'b' && record.phase != 'e';
+        out += flow ? ", {\"cat\":\"flow\",\"name\":\""
+                    : ", {\"cat\":\"async\",\"name\":\"";
+        appendSanitized(out, name);
+        out += "\",\"ph\":\"";
+        out += record.phase;
+        out += "\",\"id\":";
+        appendHexId(out, record.value);
+        if (flow)
+            out += ",\"bp\":\"e\"";
+        break;
+    }
+    case RecordKind::ThreadName:
+        break;
+    }
+
+    out += ",\"pid\":";
+    appendUint(out, processId);
+    out += ",\"tid\":";
+    appendUint(out, record.threadId);
+    out += ",\"ts\":";
+    appendUint(out, ts);
+
+    if (record.kind == RecordKind::Counter)
+    {
+        out += ",\"args\":{\"value\":";
+        appendDouble(out, std::bit_cast<double>(record.value));
+        out += '}';
+    }
+    else if (record.argCount > 0)
+    {
+        out += ",\"args\":{";
+        std::size_t copied = view.copiedOffset;
+        for (uint8_t i = 0; i < record.argCount; ++i)
+        {
+            TraceArg arg;
+            std::memcpy(&arg, block.data() + argsOffset + i * sizeof(arg),
+                        sizeof(arg));
+            if (i > 0)
+                out += ',';
+            out += '"';
+            appendSanitized(out, arg.key != nullptr ? arg.key : "");
+            out += "\":";
+            switch (arg.type)
+            {
+            case ArgType::Int:
+                appendInt(out, static_cast<int64_t>(arg.bits));
+                break;
+            case ArgType::UInt:
+                appendUint(out, arg.bits);
+                break;
+            case ArgType::Double:
+                appendDouble(out, std::bit_cast<double>(arg.bits));
+                break;
+            case ArgType::String:
+            {
+                std::string_view text;
+                copied = readCopiedString(block, copied, text);
+                out += '"';
+                appendSanitized(out, text);
+                out += '"';
+                break;
+            }
+            case ArgType::StaticString:
+            {
+                const char *text = reinterpret_cast<const char *>(
+                    static_cast<uintptr_t>(arg.bits));
+                out += '"';
+                appendSanitized(out, text != nullptr ? text : "");
+                out += '"';
+                break;
+            }
+            }
+        }
+        out += '}';
+    }
+    out += '}';
+    return offset;
+}
+} // namespace detail
+
+/**
+ * @brief Decorator that converts blocks of binary event records into trace
+ * JSON before passing them on.
+ *
+ * Blocks must contain whole records, which is how the Instrumentor hands
+ * over its per-thread buffers. `write` is thread-safe as long as the inner
+ * writer is.
+ */
+class JsonTraceWriter final : public TraceWriter
+{
+  public:
+    /**
+     * @param inner          Receives the JSON text.
+     * @param sessionStartUs Subtracted from record timestamps.
+     * @param processId      Written as the "pid" of every event.
+     */
+    JsonTraceWriter(std::unique_ptr<TraceWriter> inner, uint64_t sessionStartUs,
+                    uint32_t processId = 0)
+        : m_inner(std::move(inner)), m_sessionStartUs(sessionStartUs),
+          m_processId(processId)
+    {
+    }
+
+    JsonTraceWriter(const JsonTraceWriter &) = delete;
+    JsonTraceWriter &operator=(const JsonTraceWriter &) = delete;
+
+    ~JsonTraceWriter() override
+    {
+        close();
+    }
+
+    bool open(const std::string &path) override
+    {
+        // The crash path formats into this buffer and must not allocate
+        m_emergencyText.reserve(kEmergencyCapacity);
+        return m_inner->open(path);
+    }
+
+    void write(const char *data, std::size_t size) override
+    {
+        // Local, so concurrent producers can format in parallel. Not
+        // thread_local: blocks are also written from thread-exit flushes.
+        std::string text;
+        text.reserve(size * 2);
+        const std::string_view block(data, size);
+        for (std::size_t offset = 0; offset < block.size();)
+            offset = detail::formatRecord(block, offset, m_sessionStartUs,
+                                          m_processId, text);
+        if (!text.empty())
+            m_inner->write(text.data(), text.size());
+        // After the write: a rotation inside it must not see this block
+        if (m_trackContinuation)
+            track(block);
+    }
+
+    /**
+     * @brief Remember thread names and open B scopes so that
+     * appendContinuation() can carry them into another file. Call before
+     * the first write; `write` must then only be called from one thread.
+     */
+    void trackContinuation()
+    {
+        m_trackContinuation = true;
+    }
+
+    /**
+     * @brief Append the events that end the current file (an E for every
+     * open scope) to `closing`, and those that start the next one (the
+     * thread names and the scopes reopened) to `opening`. Both use the
+     * latest timestamp written so far.
+     */
+    void appendContinuation(std::string &closing, std::string &opening) const
+    {
+        const uint64_t ts =
+            m_lastUs > m_sessionStartUs ? m_lastUs - m_sessionStartUs : 0;
+        for (const auto &[threadId, name] : m_threadNames)
+        {
+            opening += ", {\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":";
+            detail::appendUint(opening, m_processId);
+            opening += ",\"tid\":";
+            detail::appendUint(opening, threadId);
+            opening += ",\"args\":{\"name\":\"";
+            detail::appendSanitized(opening, name);
+            opening += "\"}}";
+        }
+        for (const auto &[threadId, scopes] : m_openScopes)
+        {
+            for (auto scope = scopes.rbegin(); scope != scopes.rend(); ++scope)
+                appendScopeEvent(closing, *scope, 'E', threadId, ts);
+            for (const std::string &scope : scopes)
+                appendScopeEvent(opening, scope, 'B', threadId, ts);
+        }
+    }
+
+    void close() override
+    {
+        m_inner->close();
+    }
+
+    bool isOpen() const override
+    {
+        return m_inner->isOpen();
+    }
+
+    void emergencyWrite(const char *data, std::size_t size) override
+    {
+        const std::string_view block(data, size);
+        for (std::size_t offset = 0; offset < block.size();)
+        {
+            offset = detail::formatRecord(block, offset, m_sessionStartUs,
+                                          m_processId, m_emergencyText);
+            if (m_emergencyText.size() >= kEmergencyCapacity / 2)
+                flushEmergencyText();
+        }
+        flushEmergencyText();
+    }
+
+    void emergencyClose() override
+    {
+        m_inner->emergencyClose();
+    }
+
+  private:
+    static constexpr std::size_t kEmergencyCapacity = 256 * 1024;
+
+    void track(std::string_view block)
+    {
+        detail::RecordView view;
+        for (std::size_t offset = 0; offset < block.size();)
+        {
+            offset = detail::readRecord(block, offset, view);
+            if (offset == std::string_view::npos)
+                return;
+            const detail::EventRecord &record = view.record;
+            if (record.kind == detail::RecordKind::ThreadName)
+            {
+                m_threadNames[record.threadId] = view.name;
+                continue;
+            }
+            m_lastUs = std::max(m_lastUs, record.kind ==
+                                                  detail::RecordKind::Complete
+                                              ? record.value
+                                              : record.timeUs);
+            if (record.kind != detail::RecordKind::Scope)
+                continue;
+            std::vector<std::string> &scopes = m_openScopes[record.threadId];
+            if (record.phase == 'B')
+                scopes.emplace_back(view.name);
+            else if (!scopes.empty())
+                scopes.pop_back();
+        }
+    }
+
+    void appendScopeEvent(std::string &out, std::string_view name,
+                          char phase, uint32_t threadId, uint64_t ts) const
+    {
+        out += ", {\"cat\":\"function\",\"name\":\"";
+        detail::appendSanitized(out, name);
+        out += "\",\"ph\":\"";
+        out += phase;
+        out += "\",\"pid\":";
+        detail::appendUint(out, m_processId);
+        out += ",\"tid\":";
+        detail::appendUint(out, threadId);
+        out += ",\"ts\":";
+        detail::appendUint(out, ts);
+        out += '}';
+    }
+
+    void flushEmergencyText()
+    {
+        if (!m_emergencyText.empty())
+            m_inner->emergencyWrite(m_emergencyText.data(),
+                                    m_emergencyText.size());
+        m_emergencyText.clear();
+    }
+
+  private:
+    std::unique_ptr<TraceWriter> m_inner;
+    uint64_t m_sessionStartUs;
+    uint32_t m_processId;
+    std::string m_emergencyText;
+
+    bool m_trackContinuation = false;
+    uint64_t m_lastUs = 0; ///< latest record time written
+    std::map<uint32_t, std::string> m_threadNames;
+    std::map<uint32_t, std::vector<std::string>> m_openScopes;
+};
+
+} // namespace instrumentation
@@ -0,0 +1,405 @@
+/**
+ * @file trace_merge.h
+ * @brief Merge the traces of several processes into one timeline.
+ *
+ * Every session starts with a `trace_clock_anchor` metadata event holding
+ * the host name and the steady and wall clock times of timestamp 0.
+ * mergeTraces() uses it to shift each input onto a common time base:
+ * - the steady clock when all inputs come from the same host,
+ * - the wall clock otherwise, which is only as accurate as the hosts'
+ *   clock synchronisation.
+ * Inputs without an anchor are merged unshifted.
+ *
+ * The inputs are read as streams with TraceEventReader and k-way merged by
+ * timestamp, so memory use depends on the number of inputs and the reorder
+ * window, not on the file sizes. Events within one file are only roughly
+ * in order (slices are written when they end, threads flush in batches);
+ * each input is sorted through a window of `reorderWindow` events. Events
+ * that arrive too late for their window are still written, out of order,
+ * and counted in MergeStats::lateEvents. Events without a timestamp,
+ * such as thread_name metadata, are never counted as late.
+ *
+ * While merging:
+ * - process IDs that occur in more than one input are replaced with fresh
+ *   ones, so every input keeps its own process tracks,
+ * - async and flow IDs get the input index in their top bits, so arrows
+ *   and async tracks do not connect across processes,
+ * - the anchor events are dropped, as their times no longer apply.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "trace_event.h"
+#include "trace_parser.h"
+#include "trace_reader.h"
+
+namespace instrumentation
+{
+/**
+ * @brief Options for mergeTraces().
+ */
+struct MergeOptions
+{
+    /// Events per input held back for sorting. Larger windows tolerate
+    /// more disorder at the cost of memory.
+    std::size_t reorderWindow = 8192;
+};
+
+/**
+ * @brief Result of mergeTraces().
+ */
+struct MergeStats
+{
+    uint64_t events = 0;         ///< events written
+    uint64_t lateEvents = 0;     ///< events written out of order
+    uint32_t inputs = 0;         ///< inputs merged
+    uint32_t failedInputs = 0;   ///< inputs that could not be read
+    uint32_t unanchored = 0;     ///< inputs without a clock anchor
+    uint32_t remappedPids = 0;   ///< process IDs replaced to avoid clashes
+    bool steadyClock = false;    ///< aligned on the steady clock
+};
+
+namespace detail
+{
+/// Number of anchor-less events read while looking for the anchor.
+inline constexpr std::size_t kAnchorSearchEvents = 64;
+
+/// First process ID handed out when pids clash.
+inline constexpr uint64_t kFirstRemappedPid = 10'000'000;
+
+/// Async and flow IDs are shifted into the bits above this.
+inline constexpr unsigned kInputIdShift = 48;
+
+/**
+ * @brief Clock anchor of one input.
+ */
+struct ClockAnchor
+{
+    std::string host;
+    uint64_t steadyUs = 0;
+    uint64_t wallUs = 0;
+};
+
+inline bool parseAnchor(std::string_view event, ClockAnchor &anchor)
+{
+    if (unquote(findField(event, "name")) != "trace_clock_anchor")
+        return false;
+    const std::string_view args = findField(event, "args");
+    anchor.host = unquote(findField(args, "host"));
+    return parseUint(findField(args, "steady_us"), anchor.steadyUs) &&
+           parseUint(findField(args, "wall_us"), anchor.wallUs);
+}
+
+/**
+ * @brief One event held in a reorder window.
+ */
+struct PendingEvent
+{
+    double ts;
+    uint64_t sequence;
+    std::string text;
+};
+
+/**
+ * @brief Heap order for PendingEvent: earliest first, then read order.
+ */
+inline bool laterEvent(const PendingEvent &a, const PendingEvent &b)
+{
+    if (a.ts != b.ts)
+        return a.ts > b.ts;
+    return a.sequence > b.sequence;
+}
+
+/**
+ * @brief One input of a merge: the reader, its clock offset and pid
+ * mapping, and its reorder window.
+ */
+struct MergeInput
+{
+    TraceEventReader reader;
+    std::vector<std::string> prefix; ///< events read during anchor search
+    std::size_t prefixIndex = 0;
+    bool anchored = false;
+    ClockAnchor anchor;
+
+    double offsetUs = 0;
+    uint64_t idBits = 0;
+    std::unordered_map<uint64_t, uint64_t> pids;
+
+    std::vector<PendingEvent> window; ///< min-heap under laterEvent
+    uint64_t sequence = 0;
+    double lastTs = -std::numeric_limits<double>::infinity();
+
+    bool readRaw(std::string &event)
+    {
+        if (prefixIndex < prefix.size())
+        {
+            event = std::move(prefix[prefixIndex++]);
+            if (prefixIndex == prefix.size())
+            {
+                prefix.clear();
+                prefixIndex = 0;
+            }
+            return true;
+        }
+        return reader.next(event);
+    }
+};
+
+/**
+ * @brief Shared state of a merge: process IDs in use across all inputs.
+ */
+class PidAllocator
+{
+  public:
+    /**
+     * @brief Output pid for `pid` of `input`. The first input to use a pid
+     * keeps it; later ones get a fresh one.
+     */
+    uint64_t map(MergeInput &input, uint64_t pid, MergeStats &stats)
+    {
+        const auto found = input.pids.find(pid);
+        if (found != input.pids.end())
+            return found->second;
+
+        uint64_t mapped = pid;
+        if (!m_used.insert(pid).second)
+        {
+            while (!m_used.insert(m_next).second)
+                ++m_next;
+            mapped = m_next++;
+            ++stats.remappedPids;
+        }
+        input.pids.emplace(pid, mapped);
+        return mapped;
+    }
+
+  private:
+    std::unordered_set<uint64_t> m_used;
+    uint64_t m_next = kFirstRemappedPid;
+};
+
+/**
+ * @brief Rewrite one event for the merged output.
+ *
+ * @return False if the event is dropped.
+ */
+inline bool prepareEvent(MergeInput &input, std::string &event,
+                         PidAllocator &pids, MergeStats &stats,
+                         PendingEvent &pending)
+{
+    if (unquote(findField(event, "ph")) == "M" &&
+        unquote(findField(event, "name")) == "trace_clock_anchor")
+        return false;
+
+    uint64_t pid = 0;
+    if (parseUint(findField(event, "pid"), pid))
+    {
+        const uint64_t mapped = pids.map(input, pid, stats);
+        if (mapped != pid)
+        {
+            std::string text;
+            appendUint(text, mapped);
+            event = replaceField(event, "pid", text);
+        }
+    }
+
+    const std::string_view id = unquote(findField(event, "id"));
+    uint64_t idValue = 0;
+    if (input.idBits != 0 && id.starts_with("0x") &&
+        std::from_chars(id.data() + 2, id.data() + id.size(), idValue, 16)
+                .ec == std::errc())
+    {
+        std::string text;
+        appendHexId(text, idValue | input.idBits);
+        event = replaceField(event, "id", text);
+    }
+
+    // Metadata and other events without a time sort first
+    double ts = -std::numeric_limits<double>::infinity();
+    if (parseDouble(findField(event, "ts"), ts) && input.offsetUs != 0)
+    {
+        ts += input.offsetUs;
+        std::string text;
+        appendDouble(text, ts);
+        event = replaceField(event, "ts", text);
+    }
+
+    pending.ts = ts;
+    pending.sequence = input.sequence++;
+    pending.text = std::move(event);
+    return true;
+}
+
+/**
+ * @brief Read events into the input's window until it is full or the
+ * input is exhausted.
+ */
+inline void fillWindow(MergeInput &input, std::size_t windowSize,
+                       PidAllocator &pids, MergeStats &stats)
+{
+    std::string event;
+    while (input.window.size() < windowSize && input.readRaw(event))
+    {
+        PendingEvent pending;
+        if (!prepareEvent(input, event, pids, stats, pending))
+            continue;
+        input.window.push_back(std::move(pending));
+        std::push_heap(input.window.begin(), input.window.end(), laterEvent);
+    }
+}
+} // namespace detail
+
+/**
+ * @brief Merge trace files into one trace written to `out`. See the file
+ * documentation.
+ *
+ * @param paths   Input traces, plain or `.gz`.
+ * @param out     Receives the merged Chrome trace JSON.
+ * @param options Merge settings.
+ * @return Statistics of the merge. Inputs that cannot be read are skipped
+ *         and counted in MergeStats::failedInputs.
+ */
+inline MergeStats mergeTraces(const std::vector<std::string> &paths,
+                              std::ostream &out,
+                              const MergeOptions &options = {})
+{
+    MergeStats stats;
+    const std::size_t windowSize = std::max<std::size_t>(
+        options.reorderWindow, 1);
+
+    // Open the inputs and look for their anchors
+    std::vector<std::unique_ptr<detail::MergeInput>> inputs;
+    for (const std::string &path : paths)
+    {
+        auto input = std::make_unique<detail::MergeInput>();
+        if (!input->reader.open(path))
+        {
+            ++stats.failedInputs;
+            continue;
+        }
+        std::string event;
+        while (input->prefix.size() < detail::kAnchorSearchEvents &&
+               input->reader.next(event))
+        {
+            if (detail::parseAnchor(event, input->anchor))
+            {
+                input->anchored = true;
+                break;
+            }
+            input->prefix.push_back(std::move(event));
+        }
+        if (!input->anchored)
+            ++stats.unanchored;
+        inputs.push_back(std::move(input));
+    }
+    stats.inputs = static_cast<uint32_t>(inputs.size());
+
+    // The steady clock is only comparable between processes on one host
+    const std::string *host = nullptr;
+    stats.steadyClock = true;
+    for (const auto &input : inputs)
+    {
+        if (!input->anchored)
+            continue;
+        if (host == nullptr)
+            host = &input->anchor.host;
+        if (input->anchor.host.empty() || input->anchor.host != *host)
+            stats.steadyClock = false;
+    }
+    if (host == nullptr)
+        stats.steadyClock = false;
+    uint64_t baseUs = std::numeric_limits<uint64_t>::max();
+    for (const auto &input : inputs)
+    {
+        if (input->anchored)
+            baseUs = std::min(baseUs, stats.steadyClock
+                                          ? input->anchor.steadyUs
+                                          : input->anchor.wallUs);
+    }
+    for (std::size_t i = 0; i < inputs.size(); ++i)
+    {
+        detail::MergeInput &input = *inputs[i];
+        if (input.anchored)
+        {
+            const uint64_t anchorUs = stats.steadyClock ? input.anchor.steadyUs
+                                                        : input.anchor.wallUs;
+            input.offsetUs = static_cast<double>(anchorUs - baseUs);
+        }
+        if (inputs.size() > 1)
+            input.idBits = static_cast<uint64_t>(i + 1)
+                           << detail::kInputIdShift;
+    }
+
+    // k-way merge over the heads of the inputs' windows
+    detail::PidAllocator pids;
+    struct Head
+    {
+        double ts;
+        std::size_t input;
+    };
+    const auto laterHead = [](const Head &a, const Head &b) {
+        if (a.ts != b.ts)
+            return a.ts > b.ts;
+        return a.input > b.input;
+    };
+    std::vector<Head> heads;
+    for (std::size_t i = 0; i < inputs.size(); ++i)
+    {
+        detail::fillWindow(*inputs[i], windowSize, pids, stats);
+        if (!inputs[i]->window.empty())
+            heads.push_back({inputs[i]->window.front().ts, i});
+    }
+    std::make_heap(heads.begin(), heads.end(), laterHead);
+
+    out << "{\"otherData\": {},\"traceEvents\":[";
+    while (!heads.empty())
+    {
+        std::pop_heap(heads.begin(), heads.end(), laterHead);
+        const std::size_t index = heads.back().input;
+        heads.pop_back();
+
+        detail::MergeInput &input = *inputs[index];
+        std::pop_heap(input.window.begin(), input.window.end(),
+                      detail::laterEvent);
+        detail::PendingEvent event = std::move(input.window.back());
+        input.window.pop_back();
+
+        // Events without a time (metadata) may appear anywhere in a file
+        if (!std::isinf(event.ts))
+        {
+            if (event.ts < input.lastTs)
+                ++stats.lateEvents;
+            else
+                input.lastTs = event.ts;
+        }
+        if (stats.events++ > 0)
+            out << ",\n";
+        out << event.text;
+
+        detail::fillWindow(input, windowSize, pids, stats);
+        if (!input.window.empty())
+        {
+            heads.push_back({input.window.front().ts, index});
+            std::push_heap(heads.begin(), heads.end(), laterHead);
+        }
+    }
+    out << "]}";
+    return stats;
+}
+
+} // namespace instrumentation
@@ -0,0 +1,392 @@
+/**
+ * @file trace_parser.h
+ * @brief Incremental parser for the traces Instrumentor writes, for
+ * offline analysis tools.
+ *
+ * Events are parsed one at a time from a TraceEventReader, so memory use
+ * is constant however large the file is. Two interfaces are offered:
+ *
+ * @code
+ * // Pull: the caller asks for the next event
+ * instrumentation::TraceParser parser;
+ * parser.open("results.json");
+ * instrumentation::TraceEvent event;
+ * while (parser.next(event))
+ *     use(event);
+ *
+ * // Push (SAX style): the handler is called for every event
+ * instrumentation::parseTrace("results.json",
+ *                             [](const instrumentation::TraceEvent &event) {
+ *                                 use(event);
+ *                             });
+ * @endcode
+ *
+ * TraceEvent holds views into the reader's buffer. They are only valid
+ * until the next event is parsed; copy what has to be kept. String fields
+ * are the raw JSON contents without quotes, escapes included; names with
+ * quotes, backslashes or control characters are written escaped, so decode
+ * them with unescape() before showing or comparing them.
+ */
+
+#pragma once
+
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <system_error>
+
+#include "trace_reader.h"
+
+namespace instrumentation
+{
+namespace detail
+{
+inline bool parseUint(std::string_view text, uint64_t &value)
+{
+    const auto res =
+        std::from_chars(text.data(), text.data() + text.size(), value);
+    return res.ec == std::errc() && res.ptr == text.data() + text.size();
+}
+
+inline bool parseDouble(std::string_view text, double &value)
+{
+    const auto res =
+        std::from_chars(text.data(), text.data() + text.size(), value);
+    return res.ec == std::errc() && res.ptr == text.data() + text.size();
+}
+
+/**
+ * @brief Parse a JSON number, taking the fast path for integers.
+ */
+inline bool parseNumber(std::string_view text, double &value)
+{
+    uint64_t integer = 0;
+    if (parseUint(text, integer))
+    {
+        value = static_cast<double>(integer);
+        return true;
+    }
+    return parseDouble(text, value);
+}
+
+/**
+ * @brief Contents of a quoted JSON string value, or an empty view.
+ */
+inline std::string_view unquote(std::string_view value)
+{
+    if (value.size() < 2 || value.front() != '"' || value.back() != '"')
+        return {};
+    return value.substr(1, value.size() - 2);
+}
+} // namespace detail
+
+/**
+ * @brief The fields of one trace event. See the file documentation for
+ * the lifetime of the views.
+ */
+struct TraceEvent
+{
+    std::string_view text; ///< the whole event object
+    std::string_view name;
+    std::string_view cat;
+    std::string_view id;   ///< contents of a string ID, or a numeric ID
+    std::string_view args; ///< raw `args` object, empty if absent
+    char phase = 0;        ///< `ph`
+    char scope = 0;        ///< `s` of instant events
+    uint64_t pid = 0;
+    uint64_t tid = 0;
+    double ts = 0;  ///< microseconds
+    double dur = 0; ///< microseconds, `X` events only
+    bool hasTs = false;
+    bool hasDur = false;
+};
+
+namespace detail
+{
+inline void appendUtf8(std::string &out, uint32_t code)
+{
+    if (code < 0x80)
+        out += static_cast<char>(code);
+    else if (code < 0x800)
+    {
+        out += static_cast<char>(0xc0 | (code >> 6));
+        out += static_cast<char>(0x80 | (code & 0x3f));
+    }
+    else if (code < 0x10000)
+    {
+        out += static_cast<char>(0xe0 | (code >> 12));
+        out += static_cast<char>(0x80 | ((code >> 6) & 0x3f));
+        out += static_cast<char>(0x80 | (code & 0x3f));
+    }
+    else
+    {
+        out += static_cast<char>(0xf0 | (code >> 18));
+        out += static_cast<char>(0x80 | ((code >> 12) & 0x3f));
+        out += static_cast<char>(0x80 | ((code >> 6) & 0x3f));
+        out += static_cast<char>(0x80 | (code & 0x3f));
+    }
+}
+
+/**
+ * @brief The code unit of the `\uXXXX` escape at `text[at]`, if any.
+ */
+inline bool parseUnicodeEscape(std::string_view text, std::size_t at,
+                               uint32_t &unit)
+{
+    if (at + 6 > text.size() || text[at] != '\\' || text[at + 1] != 'u')
+        return false;
+    const char *digits = text.data() + at + 2;
+    const auto res = std::from_chars(digits, digits + 4, unit, 16);
+    return res.ec == std::errc() && res.ptr == digits + 4;
+}
+} // namespace detail
+
+/**
+ * @brief Decode the escapes in the contents of a JSON string.
+ *
+ * @param raw     String contents as held by TraceEvent.
+ * @param storage Receives the decoded string if `raw` has escapes.
+ * @return `raw` itself when it has no escapes, otherwise a view of
+ *         `storage`. `\uXXXX` escapes are decoded to UTF-8; a `\u`
+ *         without four hex digits is kept as it is.
+ */
+inline std::string_view unescape(std::string_view raw, std::string &storage)
+{
+    const std::size_t slash = raw.find('\\');
+    if (slash == std::string_view::npos)
+        return raw;
+
+    storage.assign(raw.substr(0, slash));
+    std::size_t i = slash;
+    while (i < raw.size())
+    {
+        if (raw[i] != '\\' || i + 1 == raw.size())
+        {
+            storage += raw[i++];
+            continue;
+        }
+        const char c = raw[i + 1];
+        i += 2;
+        switch (c)
+        {
+        case 'b':
+            storage += '\b';
+            break;
+        case 'f':
+            storage += '\f';
+            break;
+        case 'n':
+            storage += '\n';
+            break;
+        case 'r':
+            storage += '\r';
+            break;
+        case 't':
+            storage += '\t';
+            break;
+        case 'u':
+        {
+            uint32_t unit = 0;
+            if (!detail::parseUnicodeEscape(raw, i - 2, unit))
+            {
+                storage += "\\u";
+                break;
+            }
+            i += 4;
+            uint32_t low = 0;
+            if (unit >= 0xd800 && unit < 0xdc00 &&
+                detail::parseUnicodeEscape(raw, i, low) && low >= 0xdc00 &&
+                low < 0xe000)
+            {
+                unit = 0x10000 + ((unit - 0xd800) << 10) + (low - 0xdc00);
+                i += 6;
+            }
+            detail::appendUtf8(storage, unit);
+            break;
+        }
+        default: // '"', '\\', '/' and unknown escapes
+            storage += c;
+            break;
+        }
+    }
+    return storage;
+}
+
+namespace detail
+{
+/**
+ * @brief Parse the event object at the start of `text` into `event`.
+ *
+ * @return As scanFields(): the object's length, npos if it is incomplete
+ *         or kMalformed.
+ */
+inline std::size_t scanEvent(std::string_view text, TraceEvent &event)
+{
+    event = TraceEvent{};
+    const std::size_t length = scanFields(text, [&](std::string_view key,
+                                                    std::string_view value) {
+        if (key.empty())
+            return true;
+        switch (key[0])
+        {
+        case 'a':
+            if (key == "args")
+                event.args = value;
+            break;
+        case 'c':
+            if (key == "cat")
+                event.cat = unquote(value);
+            break;
+        case 'd':
+            if (key == "dur")
+                event.hasDur = parseNumber(value, event.dur);
+            break;
+        case 'i':
+            if (key == "id")
+                event.id = value.starts_with('"') ? unquote(value) : value;
+            break;
+        case 'n':
+            if (key == "name")
+                event.name = unquote(value);
+            break;
+        case 'p':
+            if (key == "ph")
+            {
+                const std::string_view phase = unquote(value);
+                event.phase = phase.empty() ? '\0' : phase[0];
+            }
+            else if (key == "pid")
+                parseUint(value, event.pid);
+            break;
+        case 's':
+            if (key == "s")
+            {
+                const std::string_view scope = unquote(value);
+                event.scope = scope.empty() ? '\0' : scope[0];
+            }
+            break;
+        case 't':
+            if (key == "ts")
+                event.hasTs = parseNumber(value, event.ts);
+            else if (key == "tid")
+                parseUint(value, event.tid);
+            break;
+        default:
+            break;
+        }
+        return true;
+    });
+    if (length != std::string_view::npos && length != kMalformed)
+        event.text = text.substr(0, length);
+    return length;
+}
+} // namespace detail
+
+/**
+ * @brief Parse the fields of one event object in a single pass.
+ *
+ * @return False if `text` is not a complete JSON object.
+ */
+inline bool parseEvent(std::string_view text, TraceEvent &event)
+{
+    const std::size_t length = detail::scanEvent(text, event);
+    return length != std::string_view::npos && length != detail::kMalformed;
+}
+
+/**
+ * @brief Pull parser over the events of a trace file. See the file
+ * documentation.
+ */
+class TraceParser
+{
+  public:
+    /**
+     * @param chunkSize Bytes read from the file at a time.
+     */
+    explicit TraceParser(
+        std::size_t chunkSize = TraceEventReader::kChunkSize)
+        : m_reader(chunkSize)
+    {
+    }
+
+    /**
+     * @brief Open a trace, plain or `.gz`.
+     *
+     * @return False if it cannot be read or has no `traceEvents`.
+     */
+    bool open(const std::string &path)
+    {
+        m_events = 0;
+        m_malformed = 0;
+        return m_reader.open(path);
+    }
+
+    /**
+     * @brief Parse the next event. Malformed events are skipped and
+     * counted.
+     *
+     * @return False at the end of the trace.
+     */
+    bool next(TraceEvent &event)
+    {
+        // Splits and parses each event in the same pass
+        bool malformed = false;
+        const auto scan = [&](std::string_view text) {
+            std::size_t length = detail::scanEvent(text, event);
+            malformed = length == detail::kMalformed;
+            if (malformed)
+                length = detail::jsonValueLength(text);
+            return length;
+        };
+
+        std::string_view text;
+        while (m_reader.next(text, scan))
+        {
+            if (!malformed)
+            {
+                ++m_events;
+                return true;
+            }
+            ++m_malformed;
+        }
+        return false;
+    }
+
+    /** @brief Events returned so far. */
+    uint64_t events() const
+    {
+        return m_events;
+    }
+
+    /** @brief Events skipped because they could not be parsed. */
+    uint64_t malformed() const
+    {
+        return m_malformed;
+    }
+
+  private:
+    TraceEventReader m_reader;
+    uint64_t m_events = 0;
+    uint64_t m_malformed = 0;
+};
+
+/**
+ * @brief Call `handler(const TraceEvent &)` for every event of a trace.
+ *
+ * @return Number of events, or -1 if the trace cannot be read.
+ */
+template <typename Handler>
+inline int64_t parseTrace(const std::string &path, Handler &&handler)
+{
+    TraceParser parser;
+    if (!parser.open(path))
+        return -1;
+    TraceEvent event;
+    while (parser.next(event))
+        handler(static_cast<const TraceEvent &>(event));
+    return static_cast<int64_t>(parser.events());
+}
+
+} // namespace instrumentation
@@ -0,0 +1,539 @@
+/**
+ * @file trace_reader.h
+ * @brief Streaming access to the events of a trace file.
+ *
+ * TraceEventReader reads a trace in fixed-size chunks and returns the
+ * elements of its `traceEvents` array one at a time as raw JSON text.
+ * Memory use is therefore bounded by the largest single event, whatever
+ * the size of the file. Files ending in `.gz` are decompressed on the fly
+ * when zlib is available.
+ *
+ * forEachField(), findField() and replaceField() work on the top-level
+ * fields of one event's text without parsing the rest of it. Scanning for
+ * quotes and brackets uses SSE2 where available, 16 bytes at a time.
+ */
+
+#pragma once
+
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <string_view>
+
+#if defined(ST_HAVE_ZLIB)
+#include <zlib.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64)
+#define ST_HAS_SSE2 1
+#include <emmintrin.h>
+#else
+#define ST_HAS_SSE2 0
+#endif
+
+namespace instrumentation
+{
+namespace detail
+{
+/**
+ * @brief Sequential reader over a plain or gzip compressed file.
+ */
+class TraceInputFile
+{
+  public:
+    TraceInputFile() = default;
+    TraceInputFile(const TraceInputFile &) = delete;
+    TraceInputFile &operator=(const TraceInputFile &) = delete;
+
+    ~TraceInputFile()
+    {
+        close();
+    }
+
+    bool open(const std::string &path)
+    {
+        close();
+#if defined(ST_HAVE_ZLIB)
+        if (path.ends_with(".gz"))
+        {
+            m_gzip = ::gzopen(path.c_str(), "rb");
+            return m_gzip != nullptr;
+        }
+#endif
+        m_file = std::fopen(path.c_str(), "rb");
+        return m_file != nullptr;
+    }
+
+    /**
+     * @return Number of bytes read; 0 at the end of the file or on error.
+     */
+    std::size_t read(char *data, std::size_t size)
+    {
+#if defined(ST_HAVE_ZLIB)
+        if (m_gzip != nullptr)
+        {
+            const int count =
+                ::gzread(m_gzip, data, static_cast<unsigned>(size));
+            return count > 0 ? static_cast<std::size_t>(count) : 0;
+        }
+#endif
+        return m_file != nullptr ? std::fread(data, 1, size, m_file) : 0;
+    }
+
+    void close()
+    {
+#if defined(ST_HAVE_ZLIB)
+        if (m_gzip != nullptr)
+            ::gzclose(m_gzip);
+        m_gzip = nullptr;
+#endif
+        if (m_file != nullptr)
+            std::fclose(m_file);
+        m_file = nullptr;
+    }
+
+  private:
+    std::FILE *m_file = nullptr;
+#if defined(ST_HAVE_ZLIB)
+    gzFile m_gzip = nullptr;
+#endif
+};
+
+inline bool isJsonSpace(char c)
+{
+    return c == ' ' || c == '\n' || c == '\r' || c == '\t';
+}
+
+#if ST_HAS_SSE2
+/**
+ * @brief Bit mask of the bytes in the 16 bytes at `data` that equal one of
+ * `targets`.
+ */
+template <char... Targets> inline unsigned matchBytes(const char *data)
+{
+    const __m128i chunk =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(data));
+    __m128i matches = _mm_setzero_si128();
+    ((matches = _mm_or_si128(matches,
+                             _mm_cmpeq_epi8(chunk, _mm_set1_epi8(Targets)))),
+     ...);
+    return static_cast<unsigned>(_mm_movemask_epi8(matches));
+}
+#endif
+
+/**
+ * @brief Offset of the first of `Targets` in `text` at or after `from`, or
+ * `text.size()`. Scans 16 bytes at a time with SSE2.
+ */
+template <char... Targets>
+inline std::size_t findAny(std::string_view text, std::size_t from)
+{
+#if ST_HAS_SSE2
+    while (from + 16 <= text.size())
+    {
+        const unsigned mask = matchBytes<Targets...>(text.data() + from);
+        if (mask != 0)
+            return from + static_cast<std::size_t>(std::countr_zero(mask));
+        from += 16;
+    }
+#endif
+    while (from < text.size() && ((text[from] != Targets) && ...))
+        ++from;
+    return from;
+}
+
+/**
+ * @brief Offset just past the closing quote of the string whose contents
+ * start at `from`, or npos if it is incomplete.
+ */
+inline std::size_t skipString(std::string_view text, std::size_t from)
+{
+    for (;;)
+    {
+        from = findAny<'"', '\\'>(text, from);
+        if (from >= text.size())
+            return std::string_view::npos;
+        if (text[from] == '"')
+            return from + 1;
+        from += 2; // escaped character
+    }
+}
+
+/**
+ * @brief Length of the JSON value at the start of `text`, or npos if it
+ * is incomplete.
+ */
+inline std::size_t jsonValueLength(std::string_view text)
+{
+    if (text.empty())
+        return std::string_view::npos;
+
+    if (text[0] == '"')
+        return skipString(text, 1);
+
+    if (text[0] == '{' || text[0] == '[')
+    {
+        int depth = 0;
+        bool inString = false;
+        std::size_t escapedUntil = 0; // first position not escaped
+        const auto step = [&](std::size_t i) {
+            if (i < escapedUntil)
+                return false;
+            const char c = text[i];
+            if (inString)
+            {
+                if (c == '\\')
+                    escapedUntil = i + 2;
+                else if (c == '"')
+                    inString = false;
+                return false;
+            }
+            if (c == '"')
+                inString = true;
+            else if (c == '{' || c == '[')
+                ++depth;
+            else if (c == '}' || c == ']')
+                return --depth == 0;
+            return false;
+        };
+
+        std::size_t block = 0;
+#if ST_HAS_SSE2
+        // Visit only the bytes that can change the state
+        for (; block + 16 <= text.size(); block += 16)
+        {
+            unsigned mask =
+                matchBytes<'"', '\\', '{', '}', '[', ']'>(text.data() + block);
+            while (mask != 0)
+            {
+                const std::size_t i =
+                    block + static_cast<std::size_t>(std::countr_zero(mask));
+                mask &= mask - 1;
+                if (step(i))
+                    return i + 1;
+            }
+        }
+#endif
+        for (std::size_t i = block; i < text.size(); ++i)
+        {
+            if (step(i))
+                return i + 1;
+        }
+        return std::string_view::npos;
+    }
+
+    // Number, true, false or null: runs until a delimiter
+    for (std::size_t i = 0; i < text.size(); ++i)
+    {
+        const char c = text[i];
+        if (c == ',' || c == '}' || c == ']' || isJsonSpace(c))
+            return i;
+    }
+    return std::string_view::npos;
+}
+} // namespace detail
+
+namespace detail
+{
+/// scanFields() result for malformed objects.
+inline constexpr std::size_t kMalformed = 0;
+
+/**
+ * @brief Walk the top-level fields of the JSON object at the start of
+ * `object`, calling `visit(key, value)` for each until it returns false.
+ *
+ * @return Length of the object, npos if it is incomplete, or kMalformed if
+ *         it is malformed or `visit` stopped early.
+ */
+template <typename Visitor>
+inline std::size_t scanFields(std::string_view object, Visitor &&visit)
+{
+    std::size_t i = 0;
+    while (i < object.size() && isJsonSpace(object[i]))
+        ++i;
+    if (i >= object.size())
+        return std::string_view::npos;
+    if (object[i] != '{')
+        return kMalformed;
+    ++i;
+    for (;;)
+    {
+        while (i < object.size() &&
+               (isJsonSpace(object[i]) || object[i] == ','))
+            ++i;
+        if (i >= object.size())
+            return std::string_view::npos;
+        if (object[i] == '}')
+            return i + 1;
+        if (object[i] != '"')
+            return kMalformed;
+
+        const std::size_t keyEnd = skipString(object, i + 1);
+        if (keyEnd == std::string_view::npos)
+            return keyEnd;
+        const std::string_view key = object.substr(i + 1, keyEnd - i - 2);
+        i = keyEnd;
+        while (i < object.size() &&
+               (isJsonSpace(object[i]) || object[i] == ':'))
+            ++i;
+
+        const std::size_t valueLength = jsonValueLength(object.substr(i));
+        if (valueLength == std::string_view::npos)
+            return valueLength;
+        if (valueLength == 0)
+            return kMalformed;
+        if (!visit(key, object.substr(i, valueLength)))
+            return kMalformed;
+        i += valueLength;
+    }
+}
+} // namespace detail
+
+/**
+ * @brief Call `visit(key, value)` for each top-level field of a JSON
+ * object, in order, until it returns false. `key` is the raw key without
+ * quotes, `value` the raw value text.
+ *
+ * @return False if the object is malformed or incomplete.
+ */
+template <typename Visitor>
+inline bool forEachField(std::string_view object, Visitor &&visit)
+{
+    bool stopped = false;
+    const std::size_t length = detail::scanFields(
+        object, [&](std::string_view key, std::string_view value) {
+            stopped = !visit(key, value);
+            return !stopped;
+        });
+    return stopped ||
+           (length != std::string_view::npos && length != detail::kMalformed);
+}
+
+/**
+ * @brief Raw text of the top-level field `key` of a JSON object, e.g.
+ * `123` or `"X"` (with quotes). Empty if the field does not exist.
+ */
+inline std::string_view findField(std::string_view object, std::string_view key)
+{
+    std::string_view found;
+    forEachField(object, [&](std::string_view name, std::string_view value) {
+        if (name != key)
+            return true;
+        found = value;
+        return false;
+    });
+    return found;
+}
+
+/**
+ * @brief Copy of `object` with the value of its top-level field `key`
+ * replaced by `value`. Returns `object` unchanged if the field is missing.
+ */
+inline std::string replaceField(std::string_view object, std::string_view key,
+                                std::string_view value)
+{
+    const std::string_view current = findField(object, key);
+    if (current.empty())
+        return std::string(object);
+    const std::size_t offset =
+        static_cast<std::size_t>(current.data() - object.data());
+    std::string result;
+    result.reserve(object.size() + value.size());
+    result.append(object.substr(0, offset));
+    result.append(value);
+    result.append(object.substr(offset + current.size()));
+    return result;
+}
+
+/**
+ * @brief Reads the `traceEvents` of a trace file one event at a time. See
+ * the file documentation.
+ */
+class TraceEventReader
+{
+  public:
+    static constexpr std::size_t kChunkSize = 1u << 20;
+
+    /**
+     * @param chunkSize Bytes read from the file at a time.
+     */
+    explicit TraceEventReader(std::size_t chunkSize = kChunkSize)
+        : m_chunkSize(chunkSize > 0 ? chunkSize : 1)
+    {
+    }
+
+    /**
+     * @brief Open a trace and position the reader at its first event.
+     *
+     * @return False if the file cannot be read or has no `traceEvents`.
+     */
+    bool open(const std::string &path)
+    {
+        m_buffer.clear();
+        m_position = 0;
+        m_endOfFile = false;
+        m_inEvents = false;
+        if (!m_input.open(path))
+            return false;
+        m_inEvents = seekEvents();
+        return m_inEvents;
+    }
+
+    /**
+     * @brief Read the next event into `event`.
+     *
+     * @return False at the end of the array. A truncated file ends at its
+     *         last complete event.
+     */
+    bool next(std::string &event)
+    {
+        std::string_view view;
+        if (!next(view))
+            return false;
+        event.assign(view);
+        return true;
+    }
+
+    /**
+     * @brief Read the next event without copying it. `event` points into
+     * the reader's buffer and is valid until the next call.
+     */
+    bool next(std::string_view &event)
+    {
+        return next(event, [](std::string_view text) {
+            return detail::jsonValueLength(text);
+        });
+    }
+
+    /**
+     * @brief Read the next event, letting `scan` find its end.
+     *
+     * `scan` receives the unread text starting at the event. It returns the
+     * event's length, or npos if the event is incomplete, in which case more
+     * of the file is read and `scan` runs again. This lets a parser split
+     * and parse events in the same pass.
+     */
+    template <typename Scan> bool next(std::string_view &event, Scan &&scan)
+    {
+        if (!m_inEvents)
+            return false;
+        if (!skipSpaceAnd(',') || m_buffer[m_position] == ']')
+            return m_inEvents = false;
+
+        std::size_t length = std::string_view::npos;
+        while ((length = scan(std::string_view(m_buffer).substr(
+                    m_position))) == std::string_view::npos)
+        {
+            if (!refill())
+                return m_inEvents = false;
+        }
+        if (length == 0)
+            return m_inEvents = false; // not a value: stop rather than spin
+        event = std::string_view(m_buffer).substr(m_position, length);
+        m_position += length;
+        return true;
+    }
+
+  private:
+    /**
+     * @brief Append the next chunk, discarding consumed text first.
+     */
+    bool refill()
+    {
+        if (m_endOfFile)
+            return false;
+        if (m_position > 0)
+        {
+            m_buffer.erase(0, m_position);
+            m_position = 0;
+        }
+        const std::size_t size = m_buffer.size();
+        m_buffer.resize(size + m_chunkSize);
+        const std::size_t count = m_input.read(m_buffer.data() + size,
+                                               m_chunkSize);
+        m_buffer.resize(size + count);
+        if (count == 0)
+            m_endOfFile = true;
+        return count > 0;
+    }
+
+    /**
+     * @brief Skip whitespace and `skipped` characters.
+     *
+     * @return False if the file ends first.
+     */
+    bool skipSpaceAnd(char skipped)
+    {
+        for (;;)
+        {
+            while (m_position < m_buffer.size() &&
+                   (detail::isJsonSpace(m_buffer[m_position]) ||
+                    m_buffer[m_position] == skipped))
+                ++m_position;
+            if (m_position < m_buffer.size())
+                return true;
+            if (!refill())
+                return false;
+        }
+    }
+
+    /**
+     * @brief Read the top-level object up to the `[` of `traceEvents`.
+     */
+    bool seekEvents()
+    {
+        if (!skipSpaceAnd(' ') || m_buffer[m_position] != '{')
+            return false;
+        ++m_position;
+
+        for (;;)
+        {
+            if (!skipSpaceAnd(',') || m_buffer[m_position] != '"')
+                return false;
+
+            // Key followed by ':'
+            std::size_t length = std::string_view::npos;
+            while ((length = detail::jsonValueLength(
+                        std::string_view(m_buffer).substr(m_position))) ==
+                   std::string_view::npos)
+            {
+                if (!refill())
+                    return false;
+            }
+            const std::string key =
+                m_buffer.substr(m_position + 1, length - 2);
+            m_position += length;
+            if (!skipSpaceAnd(':'))
+                return false;
+
+            if (key == "traceEvents")
+            {
+                if (m_buffer[m_position] != '[')
+                    return false;
+                ++m_position;
+                return true;
+            }
+
+            while ((length = detail::jsonValueLength(
+                        std::string_view(m_buffer).substr(m_position))) ==
+                   std::string_view::npos)
+            {
+                if (!refill())
+                    return false;
+            }
+            m_position += length;
+        }
+    }
+
+  private:
+    detail::TraceInputFile m_input;
+    std::size_t m_chunkSize;
+    std::string m_buffer;
+    std::size_t m_position = 0;
+    bool m_endOfFile = false;
+    bool m_inEvents = false;
+};
+
+} // namespace instrumentation
@@ -0,0 +1,118 @@
+/**
+ * @file trace_repair.h
+ * @brief Make truncated trace files loadable again.
+ *
+ * A process that is killed before `endSession` (or before the crash handler
+ * could run, e.g. SIGKILL) leaves a trace without its `]}` footer and
+ * possibly with a half-written last event. The memory-mapped backend can
+ * also leave zero padding from preallocation at the end of the file.
+ *
+ * repairTrace() strips trailing padding, cuts the text back to the end of
+ * the last complete event in `traceEvents` and closes the JSON again.
+ * Complete traces are returned unchanged.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace instrumentation
+{
+/**
+ * @brief Return a loadable version of a possibly truncated trace.
+ */
+inline std::string repairTrace(std::string_view text)
+{
+    // Zero padding left behind by a preallocated file
+    while (!text.empty() && (text.back() == '\0' || text.back() == ' ' ||
+                             text.back() == '\n' || text.back() == '\r'))
+        text.remove_suffix(1);
+
+    std::vector<char> stack;
+    bool inString = false;
+    bool escaped = false;
+    std::size_t eventsOpen = std::string_view::npos; // just after '['
+    std::size_t lastEventEnd = std::string_view::npos;
+
+    for (std::size_t i = 0; i < text.size(); ++i)
+    {
+        const char c = text[i];
+        if (inString)
+        {
+            if (escaped)
+                escaped = false;
+            else if (c == '\\')
+                escaped = true;
+            else if (c == '"')
+                inString = false;
+            continue;
+        }
+
+        switch (c)
+        {
+        case '"':
+            inString = true;
+            break;
+        case '{':
+        case '[':
+            stack.push_back(c);
+            if (c == '[' && stack.size() == 2 &&
+                eventsOpen == std::string_view::npos)
+                eventsOpen = i + 1;
+            break;
+        case '}':
+        case ']':
+            if (stack.empty())
+                return std::string(text.substr(0, i));
+            stack.pop_back();
+            // An event object closed directly inside the traceEvents array
+            if (c == '}' && stack.size() == 2 && stack.back() == '[')
+                lastEventEnd = i + 1;
+            if (stack.empty())
+                return std::string(text.substr(0, i + 1)); // already complete
+            break;
+        default:
+            break;
+        }
+    }
+
+    if (eventsOpen == std::string_view::npos)
+        return "{\"otherData\": {},\"traceEvents\":[]}";
+
+    const std::size_t keep =
+        lastEventEnd != std::string_view::npos ? lastEventEnd : eventsOpen;
+    std::string repaired(text.substr(0, keep));
+    repaired += "]}";
+    return repaired;
+}
+
+/**
+ * @brief Repair an uncompressed trace file in place.
+ * @return True if the file could be read and rewritten.
+ */
+inline bool repairTraceFile(const std::string &path)
+{
+    std::string text;
+    {
+        std::ifstream in(path, std::ios::in | std::ios::binary);
+        if (!in)
+            return false;
+        text.assign(std::istreambuf_iterator<char>(in),
+                    std::istreambuf_iterator<char>());
+    }
+
+    const std::string repaired = repairTrace(text);
+    if (repaired == text)
+        return true;
+
+    std::ofstream out(path, std::ios::out | std::ios::trunc | std::ios::binary);
+    out << repaired;
+    return static_cast<bool>(out);
+}
+
+} // namespace instrumentation
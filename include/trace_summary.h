@@ -0,0 +1,676 @@
+/**
+ * @file trace_summary.h
+ * @brief Per-scope statistics of a trace: calls, inclusive and self time,
+ * and duration percentiles.
+ *
+ * summarizeTrace() reads a trace once. It rebuilds the nesting of the `X`
+ * slices and `B`/`E` pairs of every thread to derive self time, i.e.
+ * inclusive time minus the time of direct children.
+ *
+ * Instrumentor writes each thread's slices in the order they end, so
+ * children arrive before their parent. Each thread therefore only keeps
+ * the slices that are still waiting for a parent. The work is a pipeline:
+ * - the calling thread splits the file into chunks of whole events,
+ * - parsing threads parse chunks in parallel,
+ * - nesting workers, each of which owns a share of the trace's threads,
+ *   process every chunk's slices in file order.
+ * A fixed number of chunks is in flight at a time, so memory does not grow
+ * with the file.
+ *
+ * Durations are kept in log-scale histograms with 32 buckets per power of
+ * two. Percentiles are therefore accurate to about 3%, and memory does not
+ * depend on the number of events. Inclusive time of recursive scopes counts
+ * every level of the recursion.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <semaphore>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "trace_parser.h"
+
+namespace instrumentation
+{
+/**
+ * @brief Log-scale histogram of durations in microseconds.
+ */
+class DurationHistogram
+{
+  public:
+    static constexpr unsigned kSubBits = 5;
+    static constexpr uint64_t kSubBuckets = uint64_t{1} << kSubBits;
+
+    void add(double us)
+    {
+        const std::size_t index = bucketOf(toUint(us));
+        if (index >= m_counts.size())
+            m_counts.resize(index + 1, 0);
+        ++m_counts[index];
+        ++m_count;
+    }
+
+    void merge(const DurationHistogram &other)
+    {
+        if (other.m_counts.size() > m_counts.size())
+            m_counts.resize(other.m_counts.size(), 0);
+        for (std::size_t i = 0; i < other.m_counts.size(); ++i)
+            m_counts[i] += other.m_counts[i];
+        m_count += other.m_count;
+    }
+
+    uint64_t count() const
+    {
+        return m_count;
+    }
+
+    /** @brief Count per bucket, in increasing order of duration. */
+    const std::vector<uint64_t> &buckets() const
+    {
+        return m_counts;
+    }
+
+    /**
+     * @brief Approximate duration below which `fraction` (0 to 1) of the
+     * values fall. 0 if the histogram is empty.
+     */
+    double percentile(double fraction) const
+    {
+        if (m_count == 0)
+            return 0;
+        const double target =
+            std::clamp(fraction, 0.0, 1.0) * static_cast<double>(m_count);
+        uint64_t seen = 0;
+        for (std::size_t i = 0; i < m_counts.size(); ++i)
+        {
+            seen += m_counts[i];
+            if (m_counts[i] > 0 && static_cast<double>(seen) >= target)
+                return (static_cast<double>(lowerBound(i)) +
+                        static_cast<double>(lowerBound(i + 1) - 1)) /
+                       2;
+        }
+        return static_cast<double>(lowerBound(m_counts.size() - 1));
+    }
+
+  private:
+    static uint64_t toUint(double us)
+    {
+        return us > 0 ? static_cast<uint64_t>(us + 0.5) : 0;
+    }
+
+    /// Values below kSubBuckets get a bucket each.
+    static std::size_t bucketOf(uint64_t value)
+    {
+        if (value < kSubBuckets)
+            return static_cast<std::size_t>(value);
+        const unsigned exponent =
+            static_cast<unsigned>(std::bit_width(value)) - 1;
+        const uint64_t sub =
+            (value >> (exponent - kSubBits)) & (kSubBuckets - 1);
+        return static_cast<std::size_t>(
+            kSubBuckets + (exponent - kSubBits) * kSubBuckets + sub);
+    }
+
+    static uint64_t lowerBound(std::size_t index)
+    {
+        if (index < kSubBuckets)
+            return index;
+        const uint64_t exponent = (index - kSubBuckets) / kSubBuckets;
+        const uint64_t sub = (index - kSubBuckets) % kSubBuckets;
+        return (kSubBuckets + sub) << exponent;
+    }
+
+  private:
+    std::vector<uint64_t> m_counts;
+    uint64_t m_count = 0;
+};
+
+/**
+ * @brief Statistics of all slices with one name.
+ */
+struct ScopeSummary
+{
+    std::string name;
+    uint64_t calls = 0;
+    double inclusiveUs = 0;
+    double selfUs = 0;
+    DurationHistogram durations;     ///< inclusive duration per call
+    DurationHistogram selfDurations; ///< self time per call
+};
+
+/**
+ * @brief Result of summarizeTrace().
+ */
+struct TraceSummary
+{
+    std::vector<ScopeSummary> scopes; ///< in order of first appearance
+    uint64_t events = 0;              ///< events in the trace
+    uint64_t slices = 0;              ///< slices summarized
+    uint32_t threads = 0;             ///< threads with slices
+    double startUs = 0;               ///< earliest slice start
+    double endUs = 0;                 ///< latest slice end
+};
+
+/**
+ * @brief Options for summarizeTrace().
+ */
+struct SummaryOptions
+{
+    /// Threads that rebuild the nesting. 0 uses the hardware concurrency.
+    unsigned workers = 0;
+};
+
+namespace detail
+{
+/// Slices waiting for a parent on one thread before the oldest are
+/// combined. Only a parent starting inside the combined range would miss
+/// them as children.
+inline constexpr std::size_t kMaxPendingSlices = std::size_t{1} << 20;
+
+/// Bytes of event text parsed as one unit of work.
+inline constexpr std::size_t kChunkBytes = std::size_t{1} << 20;
+
+/// Chunks being parsed or nested at a time, per worker.
+inline constexpr std::ptrdiff_t kChunksInFlightPerWorker = 4;
+
+/**
+ * @brief One slice event as passed from the parser to a worker.
+ */
+struct SliceEvent
+{
+    uint64_t thread;
+    double start;
+    double end; ///< `X` events only
+    uint32_t name;
+    char phase;
+};
+
+/**
+ * @brief Rebuilds the nesting of the threads assigned to one worker.
+ */
+class SliceNester
+{
+  public:
+    void process(const SliceEvent &event)
+    {
+        ThreadState &thread = m_threads[event.thread];
+        switch (event.phase)
+        {
+        case 'X':
+            complete(thread, event.name, event.start, event.end);
+            break;
+        case 'B':
+            thread.open.push_back({event.start, event.name});
+            break;
+        case 'E':
+            if (!thread.open.empty())
+            {
+                const OpenSlice open = thread.open.back();
+                thread.open.pop_back();
+                complete(thread, open.name, open.start, event.start);
+            }
+            break;
+        default:
+            break;
+        }
+    }
+
+    std::size_t threadCount() const
+    {
+        return m_threads.size();
+    }
+
+    /** @brief Statistics indexed by name ID; names are not filled in. */
+    std::vector<ScopeSummary> &scopes()
+    {
+        return m_scopes;
+    }
+
+  private:
+    struct PendingSlice
+    {
+        double start;
+        double end;
+        double durationUs; ///< less than end - start once combined
+    };
+
+    struct OpenSlice
+    {
+        double start;
+        uint32_t name;
+    };
+
+    struct ThreadState
+    {
+        std::vector<PendingSlice> pending; ///< ordered by end
+        std::vector<OpenSlice> open;       ///< `B` without `E`
+    };
+
+    void complete(ThreadState &thread, uint32_t name, double start,
+                  double end)
+    {
+        const double duration = end > start ? end - start : 0;
+
+        // Slices that ended earlier and lie within this one are its
+        // direct children
+        double childUs = 0;
+        while (!thread.pending.empty() &&
+               thread.pending.back().start >= start &&
+               thread.pending.back().end <= end)
+        {
+            childUs += thread.pending.back().durationUs;
+            thread.pending.pop_back();
+        }
+        thread.pending.push_back({start, end, duration});
+        if (thread.pending.size() > kMaxPendingSlices)
+            combineOldest(thread.pending);
+
+        if (name >= m_scopes.size())
+            m_scopes.resize(name + 1);
+        ScopeSummary &scope = m_scopes[name];
+        ++scope.calls;
+        scope.inclusiveUs += duration;
+        const double selfUs = std::max(duration - childUs, 0.0);
+        scope.selfUs += selfUs;
+        scope.durations.add(duration);
+        scope.selfDurations.add(selfUs);
+    }
+
+    static void combineOldest(std::vector<PendingSlice> &pending)
+    {
+        const std::size_t half = pending.size() / 2;
+        PendingSlice combined{pending.front().start, pending[half - 1].end,
+                              0};
+        for (std::size_t i = 0; i < half; ++i)
+            combined.durationUs += pending[i].durationUs;
+        pending.erase(pending.begin(),
+                      pending.begin() + static_cast<std::ptrdiff_t>(half));
+        pending.insert(pending.begin(), combined);
+    }
+
+  private:
+    std::unordered_map<uint64_t, ThreadState> m_threads;
+    std::vector<ScopeSummary> m_scopes;
+};
+
+/**
+ * @brief Unbounded queue between the stages of summarizeTrace().
+ */
+template <typename T> class WorkQueue
+{
+  public:
+    void push(T &&item)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_items.push_back(std::move(item));
+        }
+        m_ready.notify_one();
+    }
+
+    /**
+     * @return False once the queue is closed and empty.
+     */
+    bool pop(T &item)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_ready.wait(lock, [this] { return m_closed || !m_items.empty(); });
+        if (m_items.empty())
+            return false;
+        item = std::move(m_items.front());
+        m_items.pop_front();
+        return true;
+    }
+
+    void close()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_closed = true;
+        }
+        m_ready.notify_all();
+    }
+
+  private:
+    std::mutex m_mutex;
+    std::condition_variable m_ready;
+    std::deque<T> m_items;
+    bool m_closed = false;
+};
+
+/**
+ * @brief Held by everything derived from one chunk; gives the chunk's slot
+ * back when the last of it has been processed.
+ */
+class ChunkToken
+{
+  public:
+    explicit ChunkToken(std::counting_semaphore<> &slots) : m_slots(slots)
+    {
+    }
+
+    ChunkToken(const ChunkToken &) = delete;
+    ChunkToken &operator=(const ChunkToken &) = delete;
+
+    ~ChunkToken()
+    {
+        m_slots.release();
+    }
+
+  private:
+    std::counting_semaphore<> &m_slots;
+};
+
+/**
+ * @brief Consecutive events of the trace, copied out of the reader.
+ */
+struct EventChunk
+{
+    uint64_t sequence = 0;
+    std::string text;
+    std::vector<std::size_t> ends; ///< end offset of each event in `text`
+    std::shared_ptr<ChunkToken> token;
+};
+
+/**
+ * @brief The slices of one chunk that belong to one nesting worker.
+ */
+struct SliceBatch
+{
+    uint64_t sequence = 0;
+    std::vector<SliceEvent> slices;
+    std::shared_ptr<ChunkToken> token;
+};
+
+/**
+ * @brief A SliceNester on its own thread. Batches may arrive in any order
+ * and are processed in chunk order, which keeps every thread's slices in
+ * the order they were written.
+ */
+class NestingWorker
+{
+  public:
+    NestingWorker() : m_thread([this] { run(); })
+    {
+    }
+
+    NestingWorker(const NestingWorker &) = delete;
+    NestingWorker &operator=(const NestingWorker &) = delete;
+
+    ~NestingWorker()
+    {
+        finish();
+    }
+
+    void push(SliceBatch &&batch)
+    {
+        m_batches.push(std::move(batch));
+    }
+
+    /** @brief Process the remaining batches and stop the thread. */
+    void finish()
+    {
+        m_batches.close();
+        if (m_thread.joinable())
+            m_thread.join();
+    }
+
+    SliceNester &nester()
+    {
+        return m_nester;
+    }
+
+  private:
+    void run()
+    {
+        SliceBatch batch;
+        while (m_batches.pop(batch))
+        {
+            const uint64_t sequence = batch.sequence;
+            m_waiting.emplace(sequence, std::move(batch));
+            for (auto next = m_waiting.begin();
+                 next != m_waiting.end() && next->first == m_nextSequence;
+                 next = m_waiting.erase(next), ++m_nextSequence)
+            {
+                for (const SliceEvent &slice : next->second.slices)
+                    m_nester.process(slice);
+            }
+        }
+    }
+
+  private:
+    SliceNester m_nester;
+    WorkQueue<SliceBatch> m_batches;
+    std::map<uint64_t, SliceBatch> m_waiting; ///< ahead of m_nextSequence
+    uint64_t m_nextSequence = 0;
+    std::thread m_thread; ///< last: starts once the rest is constructed
+};
+
+/**
+ * @brief Assigns dense IDs to slice names; shared by the parsing threads.
+ */
+class NameTable
+{
+  public:
+    /**
+     * @return The name's ID and a view of the stored name.
+     */
+    std::pair<uint32_t, std::string_view> intern(std::string_view name)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        const auto found = m_ids.find(name);
+        if (found != m_ids.end())
+            return {found->second, found->first};
+        const std::string &stored = m_names.emplace_back(name);
+        const uint32_t id = static_cast<uint32_t>(m_names.size() - 1);
+        m_ids.emplace(stored, id);
+        return {id, stored};
+    }
+
+    /** @brief Names by ID; only call once the parsing threads are done. */
+    const std::deque<std::string> &names() const
+    {
+        return m_names;
+    }
+
+  private:
+    std::mutex m_mutex;
+    std::deque<std::string> m_names; ///< stable storage for the keys
+    std::unordered_map<std::string_view, uint32_t> m_ids;
+};
+
+/**
+ * @brief Per-thread cache in front of the shared NameTable.
+ */
+class NameCache
+{
+  public:
+    explicit NameCache(NameTable &table) : m_table(table)
+    {
+    }
+
+    uint32_t intern(std::string_view name)
+    {
+        const auto found = m_ids.find(name);
+        if (found != m_ids.end())
+            return found->second;
+        const auto [id, stored] = m_table.intern(name);
+        m_ids.emplace(stored, id);
+        return id;
+    }
+
+  private:
+    NameTable &m_table;
+    std::unordered_map<std::string_view, uint32_t> m_ids;
+};
+
+/**
+ * @brief What one parsing thread saw.
+ */
+struct ParseTotals
+{
+    double startUs = std::numeric_limits<double>::infinity();
+    double endUs = -std::numeric_limits<double>::infinity();
+};
+
+/**
+ * @brief Parse chunks and hand each thread's slices to its nesting
+ * worker.
+ */
+inline void parseChunks(WorkQueue<EventChunk> &chunks,
+                        std::vector<std::unique_ptr<NestingWorker>> &nesting,
+                        NameTable &names, ParseTotals &totals)
+{
+    NameCache cache(names);
+    EventChunk chunk;
+    TraceEvent event;
+    std::string unescaped;
+    while (chunks.pop(chunk))
+    {
+        std::vector<std::vector<SliceEvent>> slices(nesting.size());
+        std::size_t begin = 0;
+        for (const std::size_t end : chunk.ends)
+        {
+            const std::string_view text =
+                std::string_view(chunk.text).substr(begin, end - begin);
+            begin = end;
+            if (!parseEvent(text, event) || !event.hasTs ||
+                (event.phase != 'X' && event.phase != 'B' &&
+                 event.phase != 'E'))
+                continue;
+
+            SliceEvent slice{(event.pid << 32) ^ event.tid, event.ts,
+                             event.ts, 0, event.phase};
+            if (event.phase != 'E')
+                slice.name = cache.intern(unescape(event.name, unescaped));
+            if (event.phase == 'X')
+                slice.end = event.ts + event.dur;
+            totals.startUs = std::min(totals.startUs, slice.start);
+            totals.endUs = std::max(totals.endUs, slice.end);
+            slices[std::hash<uint64_t>{}(slice.thread) % nesting.size()]
+                .push_back(slice);
+        }
+
+        // Every worker gets every sequence number, even if empty
+        for (std::size_t i = 0; i < nesting.size(); ++i)
+            nesting[i]->push(
+                {chunk.sequence, std::move(slices[i]), chunk.token});
+        chunk = EventChunk{};
+    }
+}
+} // namespace detail
+
+/**
+ * @brief Summarize a trace file. See the file documentation.
+ *
+ * @return False if the trace cannot be read.
+ */
+inline bool summarizeTrace(const std::string &path, TraceSummary &summary,
+                           const SummaryOptions &options = {})
+{
+    TraceEventReader reader;
+    if (!reader.open(path))
+        return false;
+
+    unsigned workerCount = options.workers != 0
+                               ? options.workers
+                               : std::thread::hardware_concurrency();
+    workerCount = std::max(workerCount, 1u);
+
+    // Pipeline: this thread splits the events into chunks, parsing threads
+    // turn chunks into slices, nesting workers each own a share of the
+    // trace's threads
+    std::counting_semaphore<> slots(detail::kChunksInFlightPerWorker *
+                                    static_cast<std::ptrdiff_t>(workerCount));
+    detail::NameTable names;
+    detail::WorkQueue<detail::EventChunk> chunks;
+    std::vector<std::unique_ptr<detail::NestingWorker>> nesting;
+    std::vector<detail::ParseTotals> totals(workerCount);
+    std::vector<std::thread> parsers;
+    for (unsigned i = 0; i < workerCount; ++i)
+        nesting.push_back(std::make_unique<detail::NestingWorker>());
+    for (unsigned i = 0; i < workerCount; ++i)
+    {
+        parsers.emplace_back([&, i] {
+            detail::parseChunks(chunks, nesting, names, totals[i]);
+        });
+    }
+
+    summary = TraceSummary{};
+    detail::EventChunk chunk;
+    uint64_t sequence = 0;
+    const auto dispatch = [&] {
+        slots.acquire();
+        chunk.sequence = sequence++;
+        chunk.token = std::make_shared<detail::ChunkToken>(slots);
+        chunks.push(std::move(chunk));
+        chunk = detail::EventChunk{};
+    };
+    std::string_view event;
+    while (reader.next(event))
+    {
+        chunk.text.append(event);
+        chunk.ends.push_back(chunk.text.size());
+        ++summary.events;
+        if (chunk.text.size() >= detail::kChunkBytes)
+            dispatch();
+    }
+    if (!chunk.ends.empty())
+        dispatch();
+
+    chunks.close();
+    for (std::thread &parser : parsers)
+        parser.join();
+
+    // Merge the workers' statistics, indexed by name ID
+    summary.scopes.resize(names.names().size());
+    for (const std::unique_ptr<detail::NestingWorker> &worker : nesting)
+    {
+        worker->finish();
+        detail::SliceNester &nester = worker->nester();
+        summary.threads += static_cast<uint32_t>(nester.threadCount());
+        const std::vector<ScopeSummary> &scopes = nester.scopes();
+        for (std::size_t id = 0; id < scopes.size(); ++id)
+        {
+            ScopeSummary &total = summary.scopes[id];
+            // Only completed slices: X events and E events that ended a B
+            summary.slices += scopes[id].calls;
+            total.calls += scopes[id].calls;
+            total.inclusiveUs += scopes[id].inclusiveUs;
+            total.selfUs += scopes[id].selfUs;
+            total.durations.merge(scopes[id].durations);
+            total.selfDurations.merge(scopes[id].selfDurations);
+        }
+    }
+    for (std::size_t id = 0; id < summary.scopes.size(); ++id)
+        summary.scopes[id].name = names.names()[id];
+
+    summary.startUs = std::numeric_limits<double>::infinity();
+    summary.endUs = -std::numeric_limits<double>::infinity();
+    for (const detail::ParseTotals &part : totals)
+    {
+        summary.startUs = std::min(summary.startUs, part.startUs);
+        summary.endUs = std::max(summary.endUs, part.endUs);
+    }
+    if (summary.slices == 0)
+        summary.startUs = summary.endUs = 0;
+    return true;
+}
+
+} // namespace instrumentation
@@ -0,0 +1,731 @@
+/**
+ * @file trace_writer.h
+ * @brief Output backends used by the Instrumentor to persist trace data.
+ *
+ * A TraceWriter receives blocks of trace data and appends them to a file.
+ * Writers must accept concurrent calls to `write` because per-thread buffers
+ * hand their finished blocks over directly from the instrumented threads.
+ *
+ * Backends provided here:
+ * - StreamTraceWriter: portable `std::FILE` based writer.
+ * - MappedTraceWriter: preallocates the output file and copies blocks
+ *   straight into a shared memory mapping, growing it by remapping. No write
+ *   syscalls are issued on the hot path and the kernel writes the pages back
+ *   asynchronously.
+ *
+ * The io_uring backend lives in io_uring_trace_writer.h, the socket
+ * streaming backend in socket_trace_writer.h, the shared memory transport
+ * in shared_memory_trace_writer.h and the compressing decorators in
+ * trace_compression.h. JsonTraceWriter (trace_event.h) turns the
+ * Instrumentor's binary event records into JSON, and AsyncTraceWriter moves
+ * any writer chain onto a dedicated writer thread.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdio>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <utility>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define ST_HAS_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#else
+#define ST_HAS_MMAP 0
+#endif
+
+namespace instrumentation
+{
+/**
+ * @brief Selects the file backend used for a session.
+ */
+enum class OutputBackend
+{
+    Stream,       ///< std::FILE, available everywhere
+    MappedFile,   ///< preallocated + mmap'd file (POSIX only)
+    IoUring,      ///< batched asynchronous writes via io_uring (Linux only)
+    Socket,       ///< live stream to a Unix domain socket (POSIX only)
+    SharedMemory, ///< binary records to a collector process (POSIX only)
+};
+
+/**
+ * @brief Abstract sink for formatted trace data.
+ */
+class TraceWriter
+{
+  public:
+    virtual ~TraceWriter() = default;
+
+    /**
+     * @brief Open (and truncate) the file at the given path.
+     * @return True if the file is ready for writing.
+     */
+    virtual bool open(const std::string &path) = 0;
+
+    /**
+     * @brief Append bytes to the output. Safe to call from multiple threads.
+     */
+    virtual void write(const char *data, std::size_t size) = 0;
+
+    /**
+     * @brief Flush outstanding data and close the file.
+     */
+    virtual void close() = 0;
+
+    virtual bool isOpen() const = 0;
+
+    /**
+     * @brief Crash path: append bytes using only async-signal-safe
+     * operations.
+     *
+     * Called from a fatal signal handler while other threads may still be
+     * running; implementations must not allocate or take blocking locks.
+     * Writers without a safe path drop the data.
+     */
+    virtual void emergencyWrite(const char *data, std::size_t size)
+    {
+        (void)data;
+        (void)size;
+    }
+
+    /**
+     * @brief Crash path: make whatever has been written durable and
+     * well-formed, using only async-signal-safe operations.
+     */
+    virtual void emergencyClose()
+    {
+    }
+};
+
+namespace detail
+{
+#if ST_HAS_MMAP
+/**
+ * @brief write(2) the whole range, retrying on partial writes.
+ *
+ * Async-signal-safe.
+ */
+inline void writeAll(int fd, const char *data, std::size_t size)
+{
+    while (size > 0)
+    {
+        const ssize_t n = ::write(fd, data, size);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return;
+        data += n;
+        size -= static_cast<std::size_t>(n);
+    }
+}
+
+/**
+ * @brief pwrite(2) the whole range, retrying on partial writes.
+ *
+ * Async-signal-safe.
+ */
+inline void pwriteAll(int fd, const char *data, std::size_t size,
+                      uint64_t offset)
+{
+    while (size > 0)
+    {
+        const ssize_t n = ::pwrite(fd, data, size, static_cast<off_t>(offset));
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return;
+        data += n;
+        size -= static_cast<std::size_t>(n);
+        offset += static_cast<uint64_t>(n);
+    }
+}
+#endif
+} // namespace detail
+
+/**
+ * @brief Writer backed by a C stdio stream.
+ *
+ * Writes are serialised with a mutex; each block is flushed so the file is
+ * readable while the session is still running. Because nothing stays in the
+ * stdio buffer between blocks, the crash path can append to the underlying
+ * descriptor directly.
+ */
+class StreamTraceWriter final : public TraceWriter
+{
+  public:
+    StreamTraceWriter() = default;
+    StreamTraceWriter(const StreamTraceWriter &) = delete;
+    StreamTraceWriter &operator=(const StreamTraceWriter &) = delete;
+
+    ~StreamTraceWriter() override
+    {
+        close();
+    }
+
+    bool open(const std::string &path) override
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        closeLocked();
+        m_file = std::fopen(path.c_str(), "wb");
+#if ST_HAS_MMAP
+        m_fd = m_file != nullptr ? ::fileno(m_file) : -1;
+#endif
+        m_open.store(m_file != nullptr, std::memory_order_release);
+        return m_file != nullptr;
+    }
+
+    void write(const char *data, std::size_t size) override
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_file == nullptr)
+            return;
+        std::fwrite(data, 1, size, m_file);
+        std::fflush(m_file);
+    }
+
+    void close() override
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        closeLocked();
+    }
+
+    bool isOpen() const override
+    {
+        return m_open.load(std::memory_order_acquire);
+    }
+
+#if ST_HAS_MMAP
+    void emergencyWrite(const char *data, std::size_t size) override
+    {
+        if (m_fd >= 0)
+            detail::writeAll(m_fd, data, size);
+    }
+
+    void emergencyClose() override
+    {
+        if (m_fd >= 0)
+            ::fsync(m_fd);
+    }
+#endif
+
+  private:
+    void closeLocked()
+    {
+        if (m_file != nullptr)
+            std::fclose(m_file);
+        m_file = nullptr;
+        m_fd = -1;
+        m_open.store(false, std::memory_order_release);
+    }
+
+  private:
+    std::mutex m_mutex;
+    std::FILE *m_file = nullptr;
+    int m_fd = -1;
+    std::atomic<bool> m_open{false}; ///< written under m_mutex
+};
+
+/**
+ * @brief What AsyncTraceWriter::write does when its queue is full.
+ */
+enum class QueueFullPolicy
+{
+    Wait, ///< wait until the writer thread has made room
+    Drop, ///< drop and count the block; never blocks the caller
+};
+
+/**
+ * @brief Decorator that performs all writes on a dedicated writer thread.
+ *
+ * `write` copies the block into a queue and returns; the writer thread
+ * drains the queue into the wrapped writer. This keeps expensive stages
+ * such as compression off the instrumented threads. The inner writer only
+ * ever sees a single thread, so it does not need to be thread-safe.
+ *
+ * The queue is bounded by `maxQueuedBytes` so memory does not grow without
+ * limit. Once the writer thread falls that far behind, producers wait for
+ * room, or with QueueFullPolicy::Drop further blocks are dropped and
+ * counted. A drop report set with setDropReport() then records the loss at
+ * the end of the output.
+ */
+class AsyncTraceWriter final : public TraceWriter
+{
+  public:
+    static constexpr std::size_t kDefaultMaxQueuedBytes = 64u * 1024u * 1024u;
+
+    /**
+     * @param inner          Receives the blocks on the writer thread.
+     * @param maxQueuedBytes Queued bytes at which `policy` applies.
+     * @param policy         Drop blocks or wait when the queue is full.
+     */
+    explicit AsyncTraceWriter(
+        std::unique_ptr<TraceWriter> inner,
+        std::size_t maxQueuedBytes = kDefaultMaxQueuedBytes,
+        QueueFullPolicy policy = QueueFullPolicy::Wait)
+        : m_inner(std::move(inner)), m_maxQueuedBytes(maxQueuedBytes),
+          m_policy(policy)
+    {
+    }
+
+    AsyncTraceWriter(const AsyncTraceWriter &) = delete;
+    AsyncTraceWriter &operator=(const AsyncTraceWriter &) = delete;
+
+    ~AsyncTraceWriter() override
+    {
+        close();
+    }
+
+    bool open(const std::string &path) override
+    {
+        close();
+        if (!m_inner->open(path))
+            return false;
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_queue.clear();
+        m_queuedBytes = 0;
+        m_droppedBlocks.store(0, std::memory_order_relaxed);
+        m_droppedBytes.store(0, std::memory_order_relaxed);
+        m_stopping = false;
+        m_frozen.store(false, std::memory_order_relaxed);
+        m_open.store(true, std::memory_order_release);
+        m_thread = std::thread([this] { run(); });
+        return true;
+    }
+
+    /**
+     * @brief Queue a block for the writer thread. When the queue is full
+     * the caller waits, or the block is dropped with QueueFullPolicy::Drop.
+     */
+    void write(const char *data, std::size_t size) override
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        if (!m_open.load(std::memory_order_relaxed))
+            return;
+        if (m_policy == QueueFullPolicy::Drop)
+        {
+            if (m_queuedBytes >= m_maxQueuedBytes && !m_stopping)
+            {
+                m_droppedBlocks.fetch_add(1, std::memory_order_relaxed);
+                m_droppedBytes.fetch_add(size, std::memory_order_relaxed);
+                return;
+            }
+        }
+        else
+        {
+            m_spaceAvailable.wait(lock, [this] {
+                return m_queuedBytes < m_maxQueuedBytes || m_stopping;
+            });
+        }
+        m_queue.emplace_back(data, size);
+        m_queuedBytes += size;
+        m_dataAvailable.notify_one();
+    }
+
+    /// Returns the block to write after the others when `blocks` blocks
+    /// of `bytes` bytes in total were dropped.
+    using DropReport = std::function<std::string(uint64_t, uint64_t)>;
+
+    /**
+     * @brief Set what close() writes if blocks were dropped. Call before
+     * open().
+     */
+    void setDropReport(DropReport report)
+    {
+        m_dropReport = std::move(report);
+    }
+
+    /**
+     * @brief Drain the queue, stop the writer thread, write the drop report
+     * if blocks were dropped and close the inner writer.
+     */
+    void close() override
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (!m_open.load(std::memory_order_relaxed))
+                return;
+            m_stopping = true;
+        }
+        m_dataAvailable.notify_one();
+        m_spaceAvailable.notify_all();
+        if (m_thread.joinable())
+            m_thread.join();
+
+        if (m_dropReport && droppedBlocks() > 0)
+        {
+            const std::string report =
+                m_dropReport(droppedBlocks(), droppedBytes());
+            m_inner->write(report.data(), report.size());
+        }
+        m_inner->close();
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_open.store(false, std::memory_order_release);
+    }
+
+    bool isOpen() const override
+    {
+        return m_open.load(std::memory_order_acquire);
+    }
+
+    /** @brief Blocks dropped because the queue was full. */
+    uint64_t droppedBlocks() const
+    {
+        return m_droppedBlocks.load(std::memory_order_relaxed);
+    }
+
+    /** @brief Bytes dropped because the queue was full. */
+    uint64_t droppedBytes() const
+    {
+        return m_droppedBytes.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Stop the writer thread at a block boundary, then write the
+     * still queued blocks and `data` straight to the inner writer.
+     */
+    void emergencyWrite(const char *data, std::size_t size) override
+    {
+        if (!freeze())
+            return;
+
+        // Blocks are left in the queue; freeing them is not signal-safe
+        for (; m_emergencyFlushed < m_queue.size(); ++m_emergencyFlushed)
+        {
+            const std::string &block = m_queue[m_emergencyFlushed];
+            m_inner->emergencyWrite(block.data(), block.size());
+        }
+        m_inner->emergencyWrite(data, size);
+    }
+
+    void emergencyClose() override
+    {
+        if (freeze())
+            m_inner->emergencyClose();
+    }
+
+  private:
+    void run()
+    {
+        for (;;)
+        {
+            std::string block;
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_dataAvailable.wait(lock, [this] {
+                    return !m_queue.empty() || m_stopping ||
+                           m_frozen.load(std::memory_order_relaxed);
+                });
+                if (m_queue.empty() ||
+                    m_frozen.load(std::memory_order_relaxed))
+                    return; // drained, or handed over to the crash path
+                block = std::move(m_queue.front());
+                m_queue.pop_front();
+                m_writing.store(true, std::memory_order_relaxed);
+            }
+
+            m_inner->write(block.data(), block.size());
+
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_writing.store(false, std::memory_order_relaxed);
+                m_queuedBytes -= block.size();
+            }
+            m_spaceAvailable.notify_all();
+        }
+    }
+
+    /**
+     * @brief Take the queue over from the writer thread for the crash path.
+     *
+     * Waits (bounded) until the writer thread is between blocks and then
+     * keeps the queue mutex locked for good, so the caller has exclusive
+     * access to the queue and the inner writer. Only try-lock and yield are
+     * used, never a blocking wait.
+     *
+     * @return False if the writer thread could not be stopped in time.
+     */
+    bool freeze()
+    {
+        if (m_frozenByCaller)
+            return true;
+
+        m_frozen.store(true, std::memory_order_relaxed);
+        for (int attempt = 0; attempt < 100000; ++attempt)
+        {
+            if (m_mutex.try_lock())
+            {
+                if (!m_writing.load(std::memory_order_relaxed))
+                {
+                    m_frozenByCaller = true;
+                    return true;
+                }
+                m_mutex.unlock();
+            }
+            std::this_thread::yield();
+        }
+        return false;
+    }
+
+  private:
+    std::unique_ptr<TraceWriter> m_inner;
+    std::size_t m_maxQueuedBytes;
+    QueueFullPolicy m_policy;
+    DropReport m_dropReport;
+
+    std::mutex m_mutex;
+    std::condition_variable m_dataAvailable;
+    std::condition_variable m_spaceAvailable;
+    std::deque<std::string> m_queue;
+    std::size_t m_queuedBytes = 0;
+    std::atomic<uint64_t> m_droppedBlocks{0};
+    std::atomic<uint64_t> m_droppedBytes{0};
+    std::atomic<bool> m_open{false}; ///< written under m_mutex
+    bool m_stopping = false;
+    std::thread m_thread;
+
+    std::atomic<bool> m_writing{false};
+    std::atomic<bool> m_frozen{false};
+    bool m_frozenByCaller = false;
+    std::size_t m_emergencyFlushed = 0;
+};
+
+#if ST_HAS_MMAP
+
+/**
+ * @brief Writer that copies blocks directly into a memory mapped file.
+ *
+ * The file is preallocated in chunks of `chunkSize` bytes and mapped with
+ * `MAP_SHARED`. Each `write` reserves its byte range with a single atomic
+ * add, so concurrent writers only contend when the mapping has to grow.
+ * Growing takes an exclusive lock, extends the file by another chunk and
+ * remaps it. If the mapping cannot grow, the bytes go to the file with
+ * pwrite instead. On close the file is truncated to the number of bytes
+ * written.
+ */
+class MappedTraceWriter final : public TraceWriter
+{
+  public:
+    static constexpr std::size_t kDefaultChunkSize = 64u * 1024u * 1024u;
+
+    explicit MappedTraceWriter(std::size_t chunkSize = kDefaultChunkSize)
+        : m_chunkSize(chunkSize == 0 ? kDefaultChunkSize : chunkSize)
+    {
+    }
+
+    MappedTraceWriter(const MappedTraceWriter &) = delete;
+    MappedTraceWriter &operator=(const MappedTraceWriter &) = delete;
+
+    ~MappedTraceWriter() override
+    {
+        close();
+    }
+
+    bool open(const std::string &path) override
+    {
+        std::unique_lock<std::shared_mutex> lock(m_mapMutex);
+        closeLocked();
+
+        m_fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (m_fd < 0)
+            return false;
+
+        m_size.store(0, std::memory_order_relaxed);
+        if (!growLocked(m_chunkSize))
+        {
+            closeLocked();
+            return false;
+        }
+        m_open.store(true, std::memory_order_release);
+        return true;
+    }
+
+    void write(const char *data, std::size_t size) override
+    {
+        if (size == 0)
+            return;
+
+        const std::size_t offset =
+            m_size.fetch_add(size, std::memory_order_relaxed);
+
+        {
+            std::shared_lock<std::shared_mutex> lock(m_mapMutex);
+            if (m_base != nullptr && offset + size <= m_capacity)
+            {
+                std::memcpy(m_base + offset, data, size);
+                return;
+            }
+        }
+
+        std::unique_lock<std::shared_mutex> lock(m_mapMutex);
+        if (m_fd < 0)
+            return;
+        if (growLocked(offset + size))
+            std::memcpy(m_base + offset, data, size);
+        else
+            // The offset is already reserved; leaving it empty would put a
+            // hole of NULs in the middle of the trace
+            detail::pwriteAll(m_fd, data, size, offset);
+    }
+
+    void close() override
+    {
+        std::unique_lock<std::shared_mutex> lock(m_mapMutex);
+        closeLocked();
+    }
+
+    bool isOpen() const override
+    {
+        return m_open.load(std::memory_order_acquire);
+    }
+
+    /**
+     * @brief Copy into the mapping when it has room, otherwise pwrite past
+     * its end. The mapping is never resized on this path.
+     */
+    void emergencyWrite(const char *data, std::size_t size) override
+    {
+        if (m_fd < 0 || size == 0)
+            return;
+
+        const std::size_t offset =
+            m_size.fetch_add(size, std::memory_order_relaxed);
+        if (m_base != nullptr && offset + size <= m_capacity)
+            std::memcpy(m_base + offset, data, size);
+        else
+            detail::pwriteAll(m_fd, data, size, offset);
+    }
+
+    /**
+     * @brief Trim the preallocated tail. Dirty pages of the shared mapping
+     * are written back by the kernel even after the process dies.
+     */
+    void emergencyClose() override
+    {
+        if (m_fd < 0)
+            return;
+        const std::size_t size = m_size.load(std::memory_order_relaxed);
+        if (::ftruncate(m_fd, static_cast<off_t>(size)) != 0)
+        {
+            // Padding stays in the file; readers strip trailing NULs
+        }
+    }
+
+  private:
+    /**
+     * @brief Ensure the mapping covers at least `required` bytes.
+     *
+     * Assumes m_mapMutex is held exclusively.
+     */
+    bool growLocked(std::size_t required)
+    {
+        if (m_base != nullptr && required <= m_capacity)
+            return true;
+
+        std::size_t capacity = m_capacity;
+        while (capacity < required)
+            capacity += m_chunkSize;
+
+        if (!preallocate(capacity))
+            return false;
+
+        void *mapped = MAP_FAILED;
+#if defined(__linux__)
+        if (m_base != nullptr)
+        {
+            mapped = ::mremap(m_base, m_capacity, capacity, MREMAP_MAYMOVE);
+            // A failed mremap leaves the old mapping in place
+            if (mapped == MAP_FAILED)
+                return false;
+        }
+        else
+#endif
+        {
+            if (m_base != nullptr)
+                ::munmap(m_base, m_capacity);
+            m_base = nullptr;
+            mapped = ::mmap(nullptr, capacity, PROT_READ | PROT_WRITE,
+                            MAP_SHARED, m_fd, 0);
+        }
+
+        if (mapped == MAP_FAILED)
+        {
+            m_base = nullptr;
+            m_capacity = 0;
+            return false;
+        }
+
+        m_base = static_cast<char *>(mapped);
+        m_capacity = capacity;
+        return true;
+    }
+
+    /**
+     * @brief Reserve disk blocks for the first `capacity` bytes of the file.
+     */
+    bool preallocate(std::size_t capacity)
+    {
+        const auto length = static_cast<off_t>(capacity);
+#if defined(__linux__)
+        if (::fallocate(m_fd, 0, 0, length) == 0)
+            return true;
+#endif
+        // Filesystems without fallocate support still accept a sparse extend
+        return ::ftruncate(m_fd, length) == 0;
+    }
+
+    /**
+     * @brief Unmap, trim the preallocated tail and close the file.
+     *
+     * Assumes m_mapMutex is held exclusively.
+     */
+    void closeLocked()
+    {
+        if (m_base != nullptr)
+        {
+            ::munmap(m_base, m_capacity);
+            m_base = nullptr;
+        }
+        if (m_fd >= 0)
+        {
+            const std::size_t size = m_size.load(std::memory_order_relaxed);
+            if (::ftruncate(m_fd, static_cast<off_t>(size)) != 0)
+            {
+                // Nothing sensible to do; the file keeps its padding
+            }
+            ::close(m_fd);
+            m_fd = -1;
+        }
+        m_capacity = 0;
+        m_size.store(0, std::memory_order_relaxed);
+        m_open.store(false, std::memory_order_release);
+    }
+
+  private:
+    std::size_t m_chunkSize;
+
+    std::shared_mutex m_mapMutex;
+    int m_fd = -1;
+    std::atomic<bool> m_open{false}; ///< written under m_mapMutex
+    char *m_base = nullptr;
+    std::size_t m_capacity = 0;
+    std::atomic<std::size_t> m_size{0};
+};
+
+#endif // ST_HAS_MMAP
+
+} // namespace instrumentation
@@ -9,7 +9,7 @@ static void foo()
 
     volatile int x = 0;
     for (int i = 0; i < 2'000'000; ++i)
-        x += i;
+        x = x + i;
 }
 
 static void bar()
@@ -23,7 +23,7 @@ static void bar()
         ST_PROFILE_SCOPE("bar/inner");
         volatile int y = 0;
         for (int i = 0; i < 1'000'000; ++i)
-            y += i;
+            y = y + i;
     }
 }
 
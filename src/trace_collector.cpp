@@ -0,0 +1,66 @@
+/**
+ * @file trace_collector.cpp
+ * @brief Collector for sessions recorded with the shared memory backend.
+ *
+ * Waits for the segment to appear, formats the records as they are
+ * published and writes the Chrome trace JSON to the output file. Exits
+ * once the session has ended, or the instrumented process has stopped
+ * sending heartbeats, and everything has been written.
+ *
+ * Usage: trace_collector <segment name> <output.json>
+ */
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+
+#include "shared_memory_trace_writer.h"
+
+int main(int argc, char **argv)
+{
+#if ST_HAS_SHARED_MEMORY
+    if (argc != 3)
+    {
+        std::cerr << "Usage: " << argv[0] << " <segment name> <output.json>\n";
+        return 2;
+    }
+    const std::string segment = argv[1];
+    const std::string outputPath = argv[2];
+
+    instrumentation::SharedTraceCollector collector;
+    std::cerr << "Waiting for a session in " << segment << "\n";
+    while (!collector.attach(segment))
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    std::ofstream out(outputPath,
+                      std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!out)
+    {
+        std::cerr << "Cannot write " << outputPath << "\n";
+        return 1;
+    }
+
+    while (!collector.finished())
+    {
+        if (collector.poll(out) == 0)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    const instrumentation::SharedCollectStats stats = collector.stats();
+    std::cerr << outputPath << ": " << stats.records << " records, "
+              << stats.bytes << " bytes";
+    if (stats.droppedRecords > 0)
+    {
+        std::cerr << ", " << stats.droppedRecords << " records ("
+                  << stats.droppedBytes << " bytes) dropped by the producer";
+    }
+    std::cerr << "\n";
+    return 0;
+#else
+    (void)argc;
+    std::cerr << argv[0] << ": POSIX shared memory is not available\n";
+    return 1;
+#endif
+}
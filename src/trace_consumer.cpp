@@ -0,0 +1,71 @@
+/**
+ * @file trace_consumer.cpp
+ * @brief Reference consumer for sessions streamed with the socket backend.
+ *
+ * Listens on a Unix domain socket and writes the Chrome trace JSON of each
+ * session that connects to the output file while it is being recorded.
+ *
+ * Usage: trace_consumer <socket path> <output.json> [--sessions N]
+ *
+ * With several sessions, the second and later ones are written to
+ * `output.1.json`, `output.2.json`, ...
+ */
+
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+#include "rotating_trace_writer.h"
+#include "socket_trace_writer.h"
+
+int main(int argc, char **argv)
+{
+#if ST_HAS_UNIX_SOCKET
+    if (argc != 3 && !(argc == 5 && std::string(argv[3]) == "--sessions"))
+    {
+        std::cerr << "Usage: " << argv[0]
+                  << " <socket path> <output.json> [--sessions N]\n";
+        return 2;
+    }
+    const std::string socketPath = argv[1];
+    const std::string outputPath = argv[2];
+    const long sessions = argc == 5 ? std::strtol(argv[4], nullptr, 10) : 1;
+
+    instrumentation::TraceStreamReceiver receiver;
+    if (!receiver.listen(socketPath))
+    {
+        std::cerr << "Cannot listen on " << socketPath << "\n";
+        return 1;
+    }
+    std::cerr << "Waiting for sessions on " << socketPath << "\n";
+
+    for (long session = 0; sessions <= 0 || session < sessions; ++session)
+    {
+        const std::string path = instrumentation::rotatedPath(
+            outputPath, static_cast<std::size_t>(session));
+        std::ofstream out(path, std::ios::out | std::ios::binary |
+                                    std::ios::trunc);
+        if (!out)
+        {
+            std::cerr << "Cannot write " << path << "\n";
+            return 1;
+        }
+
+        const instrumentation::StreamReceiveStats stats = receiver.receive(out);
+        std::cerr << path << ": " << stats.bytes << " bytes";
+        if (stats.droppedEvents > 0 || stats.droppedBytes > 0)
+        {
+            std::cerr << ", " << stats.droppedEvents << " events ("
+                      << stats.droppedBytes
+                      << " bytes) dropped by the producer";
+        }
+        std::cerr << "\n";
+    }
+    return 0;
+#else
+    (void)argc;
+    std::cerr << argv[0] << ": Unix domain sockets are not available\n";
+    return 1;
+#endif
+}
@@ -0,0 +1,120 @@
+/**
+ * @file trace_critical_path.cpp
+ * @brief Prints which scopes the latency of an operation depends on.
+ *
+ * Computes the critical path of every operation in a trace (see
+ * critical_path.h), prints the scopes that contribute the most to them and
+ * the path of the slowest operation step by step.
+ *
+ * Usage: trace_critical_path <trace.json> [--operation NAME] [--top N]
+ */
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "critical_path.h"
+
+namespace
+{
+std::string shorten(std::string_view name, std::size_t width)
+{
+    if (name.size() <= width)
+        return std::string(name);
+    return std::string(name.substr(0, width - 3)) + "...";
+}
+} // namespace
+
+int main(int argc, char **argv)
+{
+    std::string path;
+    std::string operationName;
+    std::size_t top = 20;
+    bool valid = true;
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string arg = argv[i];
+        if (arg == "--operation" && i + 1 < argc)
+            operationName = argv[++i];
+        else if (arg == "--top" && i + 1 < argc)
+            top = std::strtoull(argv[++i], nullptr, 10);
+        else if (path.empty())
+            path = arg;
+        else
+            valid = false;
+    }
+    if (!valid || path.empty())
+    {
+        std::cerr << "Usage: " << argv[0]
+                  << " <trace.json> [--operation NAME] [--top N]\n";
+        return 2;
+    }
+
+    instrumentation::CriticalPathAnalyzer analyzer;
+    if (!analyzer.load(path))
+    {
+        std::cerr << "Cannot read a trace from " << path << "\n";
+        return 1;
+    }
+    const std::vector<instrumentation::Operation> operations =
+        analyzer.operations(operationName);
+    if (operations.empty())
+    {
+        std::cerr << "No operations found"
+                  << (operationName.empty()
+                          ? " (no top-level slice starts a flow,"
+                            " use --operation)"
+                          : "")
+                  << "\n";
+        return 1;
+    }
+
+    std::vector<instrumentation::CriticalPath> paths;
+    paths.reserve(operations.size());
+    double totalUs = 0;
+    std::size_t slowest = 0;
+    for (const instrumentation::Operation &operation : operations)
+    {
+        paths.push_back(analyzer.criticalPath(operation));
+        const double us = operation.endUs - operation.startUs;
+        totalUs += us;
+        const instrumentation::Operation &worst = operations[slowest];
+        if (us > worst.endUs - worst.startUs)
+            slowest = paths.size() - 1;
+    }
+
+    std::printf("%zu operations, mean %.3f ms\n\n", operations.size(),
+                totalUs / static_cast<double>(operations.size()) / 1000.0);
+    const std::vector<instrumentation::PathContribution> contributions =
+        instrumentation::pathContributions(paths);
+    std::printf("%-40s %12s %8s\n", "Scope on critical path", "Total ms",
+                "Share");
+    for (std::size_t i = 0; i < std::min(top, contributions.size()); ++i)
+    {
+        const instrumentation::PathContribution &entry = contributions[i];
+        std::printf("%-40s %12.3f %7.1f%%\n",
+                    shorten(analyzer.scopeName(entry.scope), 40).c_str(),
+                    entry.us / 1000.0,
+                    totalUs > 0 ? 100.0 * entry.us / totalUs : 0.0);
+    }
+
+    const instrumentation::CriticalPath &worst = paths[slowest];
+    std::printf("\nSlowest: %s at %.0f us, %.3f ms\n",
+                std::string(analyzer.scopeName(worst.operation.name)).c_str(),
+                worst.operation.startUs,
+                (worst.operation.endUs - worst.operation.startUs) / 1000.0);
+    std::printf("%12s %12s  %-20s %s\n", "Start us", "Duration us", "Thread",
+                "Scope");
+    for (const instrumentation::PathSegment &segment : worst.segments)
+    {
+        std::printf("%12.0f %12.0f  %-20s %s\n", segment.startUs,
+                    segment.endUs - segment.startUs,
+                    shorten(analyzer.threadName(segment.thread), 20).c_str(),
+                    std::string(analyzer.scopeName(segment.scope)).c_str());
+    }
+    return 0;
+}
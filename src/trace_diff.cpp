@@ -0,0 +1,122 @@
+/**
+ * @file trace_diff.cpp
+ * @brief Reports the scopes that got significantly slower or faster
+ * between two traces.
+ *
+ * Summarizes both traces, compares every scope (see trace_diff.h) and
+ * prints the regressions and improvements. With `--json` the full
+ * comparison is also written as JSON. The exit status is 3 when there are
+ * regressions, so the tool can gate a CI job.
+ *
+ * Usage: trace_diff <base.json> <candidate.json> [--alpha A]
+ *                   [--min-change PERCENT] [--min-calls N]
+ *                   [--json report.json] [--threads N]
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "trace_diff.h"
+
+int main(int argc, char **argv)
+{
+    std::vector<std::string> paths;
+    std::string jsonPath;
+    instrumentation::DiffOptions options;
+    instrumentation::SummaryOptions summaryOptions;
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string arg = argv[i];
+        if (arg == "--alpha" && i + 1 < argc)
+            options.alpha = std::strtod(argv[++i], nullptr);
+        else if (arg == "--min-change" && i + 1 < argc)
+            options.minChange = std::strtod(argv[++i], nullptr) / 100.0;
+        else if (arg == "--min-calls" && i + 1 < argc)
+            options.minCalls = std::strtoull(argv[++i], nullptr, 10);
+        else if (arg == "--json" && i + 1 < argc)
+            jsonPath = argv[++i];
+        else if (arg == "--threads" && i + 1 < argc)
+            summaryOptions.workers =
+                static_cast<unsigned>(std::strtoul(argv[++i], nullptr, 10));
+        else
+            paths.push_back(arg);
+    }
+    if (paths.size() != 2)
+    {
+        std::cerr << "Usage: " << argv[0]
+                  << " <base.json> <candidate.json> [--alpha A]"
+                     " [--min-change PERCENT] [--min-calls N]"
+                     " [--json report.json] [--threads N]\n";
+        return 2;
+    }
+
+    instrumentation::TraceSummary summaries[2];
+    for (std::size_t i = 0; i < 2; ++i)
+    {
+        if (!instrumentation::summarizeTrace(paths[i], summaries[i],
+                                             summaryOptions))
+        {
+            std::cerr << "Cannot read a trace from " << paths[i] << "\n";
+            return 1;
+        }
+    }
+    const instrumentation::TraceDiff diff =
+        instrumentation::diffSummaries(summaries[0], summaries[1], options);
+
+    if (!jsonPath.empty())
+    {
+        std::ofstream out(jsonPath, std::ios::binary | std::ios::trunc);
+        out << instrumentation::diffToJson(diff);
+        if (!out)
+        {
+            std::cerr << "Cannot write " << jsonPath << "\n";
+            return 1;
+        }
+    }
+
+    // Largest changes first
+    std::vector<const instrumentation::ScopeDiff *> changed;
+    for (const instrumentation::ScopeDiff &scope : diff.scopes)
+    {
+        if (scope.verdict != instrumentation::DiffVerdict::Unchanged)
+            changed.push_back(&scope);
+    }
+    std::stable_sort(changed.begin(), changed.end(),
+                     [](const instrumentation::ScopeDiff *a,
+                        const instrumentation::ScopeDiff *b) {
+                         return std::abs(a->change) > std::abs(b->change);
+                     });
+
+    std::printf("%u regressions, %u improvements\n\n", diff.regressions,
+                diff.improvements);
+    if (!changed.empty())
+    {
+        std::printf("%-12s %-36s %9s %10s %10s %10s %10s %9s\n", "Verdict",
+                    "Scope", "Change", "Mean us", "p50 us", "p99 us", "Calls",
+                    "p");
+    }
+    for (const instrumentation::ScopeDiff *scope : changed)
+    {
+        const instrumentation::ScopeSample &sample =
+            scope->verdict == instrumentation::DiffVerdict::Removed
+                ? scope->base
+                : scope->candidate;
+        const std::string name = scope->name.size() > 36
+                                     ? scope->name.substr(0, 33) + "..."
+                                     : scope->name;
+        std::printf("%-12s %-36s %+8.1f%% %10.1f %10.1f %10.1f %10llu %9.2g\n",
+                    instrumentation::diffVerdictName(scope->verdict),
+                    name.c_str(), 100.0 * scope->change, sample.meanUs,
+                    sample.p50Us, sample.p99Us,
+                    static_cast<unsigned long long>(sample.calls),
+                    scope->pValue);
+    }
+    return diff.regressions > 0 ? 3 : 0;
+}
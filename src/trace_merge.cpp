@@ -0,0 +1,74 @@
+/**
+ * @file trace_merge.cpp
+ * @brief Merges the traces of several processes into one file.
+ *
+ * Aligns the inputs' clocks with their `trace_clock_anchor` events, keeps
+ * the processes apart by rewriting clashing pids and merges the events by
+ * timestamp while streaming. See trace_merge.h.
+ *
+ * Usage: trace_merge -o <merged.json> [--window N] <input>...
+ */
+
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "trace_merge.h"
+
+int main(int argc, char **argv)
+{
+    std::string outputPath;
+    instrumentation::MergeOptions options;
+    std::vector<std::string> inputs;
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string arg = argv[i];
+        if (arg == "-o" && i + 1 < argc)
+            outputPath = argv[++i];
+        else if (arg == "--window" && i + 1 < argc)
+            options.reorderWindow =
+                std::strtoull(argv[++i], nullptr, 10);
+        else
+            inputs.push_back(arg);
+    }
+    if (outputPath.empty() || inputs.empty())
+    {
+        std::cerr << "Usage: " << argv[0]
+                  << " -o <merged.json> [--window N] <input>...\n";
+        return 2;
+    }
+
+    std::ofstream out(outputPath,
+                      std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!out)
+    {
+        std::cerr << "Cannot write " << outputPath << "\n";
+        return 1;
+    }
+
+    const instrumentation::MergeStats stats =
+        instrumentation::mergeTraces(inputs, out, options);
+    out.close();
+
+    std::cerr << outputPath << ": " << stats.events << " events from "
+              << stats.inputs << " traces, aligned on the "
+              << (stats.steadyClock ? "steady" : "wall") << " clock";
+    if (stats.remappedPids > 0)
+        std::cerr << ", " << stats.remappedPids << " pids remapped";
+    std::cerr << "\n";
+    if (stats.unanchored > 0)
+        std::cerr << "warning: " << stats.unanchored
+                  << " traces have no clock anchor and were not shifted\n";
+    if (stats.lateEvents > 0)
+        std::cerr << "warning: " << stats.lateEvents
+                  << " events were out of order; try a larger --window\n";
+    if (stats.failedInputs > 0)
+    {
+        std::cerr << "error: " << stats.failedInputs
+                  << " traces could not be read\n";
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,101 @@
+/**
+ * @file trace_summary.cpp
+ * @brief Prints the scopes of a trace that take the most time.
+ *
+ * Reads the trace in a single pass and prints the top scopes with their
+ * call count, inclusive and self time and duration percentiles. See
+ * trace_summary.h.
+ *
+ * Usage: trace_summary <trace.json> [--top N] [--sort self|inclusive|calls]
+ *                      [--threads N]
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "trace_summary.h"
+
+int main(int argc, char **argv)
+{
+    std::string path;
+    std::string sort = "self";
+    std::size_t top = 20;
+    instrumentation::SummaryOptions options;
+    bool valid = true;
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string arg = argv[i];
+        if (arg == "--top" && i + 1 < argc)
+            top = std::strtoull(argv[++i], nullptr, 10);
+        else if (arg == "--sort" && i + 1 < argc)
+            sort = argv[++i];
+        else if (arg == "--threads" && i + 1 < argc)
+            options.workers =
+                static_cast<unsigned>(std::strtoul(argv[++i], nullptr, 10));
+        else if (path.empty())
+            path = arg;
+        else
+            valid = false;
+    }
+    if (!valid || path.empty() ||
+        (sort != "self" && sort != "inclusive" && sort != "calls"))
+    {
+        std::cerr << "Usage: " << argv[0]
+                  << " <trace.json> [--top N] [--sort self|inclusive|calls]"
+                     " [--threads N]\n";
+        return 2;
+    }
+
+    instrumentation::TraceSummary summary;
+    if (!instrumentation::summarizeTrace(path, summary, options))
+    {
+        std::cerr << "Cannot read a trace from " << path << "\n";
+        return 1;
+    }
+
+    std::vector<const instrumentation::ScopeSummary *> scopes;
+    double totalSelfUs = 0;
+    for (const instrumentation::ScopeSummary &scope : summary.scopes)
+    {
+        if (scope.calls == 0)
+            continue;
+        scopes.push_back(&scope);
+        totalSelfUs += scope.selfUs;
+    }
+    std::sort(scopes.begin(), scopes.end(),
+              [&sort](const instrumentation::ScopeSummary *a,
+                      const instrumentation::ScopeSummary *b) {
+                  if (sort == "inclusive")
+                      return a->inclusiveUs > b->inclusiveUs;
+                  if (sort == "calls")
+                      return a->calls > b->calls;
+                  return a->selfUs > b->selfUs;
+              });
+    if (scopes.size() > top)
+        scopes.resize(top);
+
+    std::printf("%s: %llu events, %llu slices on %u threads, %.3f ms\n\n",
+                path.c_str(), static_cast<unsigned long long>(summary.events),
+                static_cast<unsigned long long>(summary.slices),
+                summary.threads, (summary.endUs - summary.startUs) / 1000.0);
+    std::printf("%-40s %10s %12s %12s %7s %10s %10s %10s\n", "Scope", "Calls",
+                "Incl ms", "Self ms", "Self %", "p50 us", "p90 us", "p99 us");
+    for (const instrumentation::ScopeSummary *scope : scopes)
+    {
+        const std::string name = scope->name.size() > 40
+                                     ? scope->name.substr(0, 37) + "..."
+                                     : scope->name;
+        std::printf("%-40s %10llu %12.3f %12.3f %6.1f%% %10.1f %10.1f %10.1f\n",
+                    name.c_str(), static_cast<unsigned long long>(scope->calls),
+                    scope->inclusiveUs / 1000.0, scope->selfUs / 1000.0,
+                    totalSelfUs > 0 ? 100.0 * scope->selfUs / totalSelfUs : 0.0,
+                    scope->durations.percentile(0.5),
+                    scope->durations.percentile(0.9),
+                    scope->durations.percentile(0.99));
+    }
+    return 0;
+}
@@ -0,0 +1,88 @@
+#include <gtest/gtest.h>
+
+#include <filesystem>
+#include <fstream>
+#include <string>
+
+// Replaces operator new/delete for the whole test binary
+#include "allocation_hooks.h"
+#include "instrumentor.h"
+
+static std::string readFile(const std::filesystem::path &p)
+{
+    std::ifstream in(p, std::ios::in | std::ios::binary);
+    std::string s((std::istreambuf_iterator<char>(in)),
+                  std::istreambuf_iterator<char>());
+    return s;
+}
+
+class AllocationTrackingTest : public ::testing::Test
+{
+  protected:
+    std::filesystem::path outPath{};
+
+    void SetUp() override
+    {
+        outPath = std::filesystem::temp_directory_path() /
+                  "allocation_tracking_test_output.json";
+        std::error_code ec;
+        std::filesystem::remove(outPath, ec);
+        Instrumentor::get().endSession();
+    }
+
+    void TearDown() override
+    {
+        Instrumentor::get().endSession();
+        std::error_code ec;
+        std::filesystem::remove(outPath, ec);
+    }
+};
+
+TEST_F(AllocationTrackingTest, Hooks_CountThreadAllocations)
+{
+    // Arrange
+    const auto before = instrumentation::detail::threadAllocations.total;
+
+    // Act: call the allocation functions directly so they cannot be elided
+    void *block = ::operator new(100);
+    ::operator delete(block);
+
+    // Assert
+    const auto after = instrumentation::detail::threadAllocations.total;
+    EXPECT_EQ(after.allocations - before.allocations, 1u);
+    EXPECT_EQ(after.bytes - before.bytes, 100u);
+    EXPECT_EQ(after.frees - before.frees, 1u);
+}
+
+TEST_F(AllocationTrackingTest, Timer_ReportsAllocationsOfInnermostScope)
+{
+    // Arrange
+    SessionOptions options;
+    options.trackAllocations = true;
+
+    // Act
+    Instrumentor::get().beginSession("Allocations", outPath.string(), options);
+    {
+        InstrumentationTimer outer("Outer");
+        void *own = ::operator new(24);
+        {
+            InstrumentationTimer inner("Inner");
+            void *child = ::operator new(1000);
+            ::operator delete(child);
+        }
+        ::operator delete(own);
+    }
+    Instrumentor::get().endSession();
+
+    // Assert
+    const std::string json = readFile(outPath);
+    EXPECT_NE(json.find("\"name\":\"Inner\",\"ph\":\"X\""), std::string::npos);
+    EXPECT_NE(json.find("\"args\":{\"allocs\":1,\"alloc_bytes\":1000,"
+                        "\"frees\":1}"),
+              std::string::npos);
+    EXPECT_NE(json.find("\"args\":{\"allocs\":1,\"alloc_bytes\":24,"
+                        "\"frees\":1}"),
+              std::string::npos);
+    EXPECT_NE(json.find("\"name\":\"Allocated bytes (tid "),
+              std::string::npos);
+}
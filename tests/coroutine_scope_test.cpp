@@ -0,0 +1,178 @@
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <coroutine>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
+#include "coroutine_scope.h"
+#include "instrumentor.h"
+
+static std::string readFile(const std::filesystem::path &p)
+{
+    std::ifstream in(p, std::ios::in | std::ios::binary);
+    std::string s((std::istreambuf_iterator<char>(in)),
+                  std::istreambuf_iterator<char>());
+    return s;
+}
+
+namespace
+{
+/**
+ * @brief Minimal eagerly started coroutine that destroys itself on
+ * completion.
+ */
+struct Detached
+{
+    struct promise_type
+    {
+        Detached get_return_object()
+        {
+            return {};
+        }
+        std::suspend_never initial_suspend() noexcept
+        {
+            return {};
+        }
+        std::suspend_never final_suspend() noexcept
+        {
+            return {};
+        }
+        void return_void()
+        {
+        }
+        void unhandled_exception()
+        {
+            std::terminate();
+        }
+    };
+};
+
+/**
+ * @brief Resumes the awaiting coroutine on a new thread after a delay.
+ */
+struct ResumeOnNewThread
+{
+    std::thread &thread;
+
+    bool await_ready() const noexcept
+    {
+        return false;
+    }
+    void await_suspend(std::coroutine_handle<> handle)
+    {
+        thread = std::thread([handle] {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            handle.resume();
+        });
+    }
+    void await_resume() const noexcept
+    {
+    }
+};
+
+struct ScopeTotals
+{
+    uint64_t suspendedUs = 0;
+    uint32_t suspensions = 0;
+};
+
+Detached handleRequest(std::thread &worker, ScopeTotals &totals)
+{
+    instrumentation::CoroutineScope scope("HandleRequest");
+    co_await scope.traced(std::suspend_never{});
+    co_await scope.traced(ResumeOnNewThread{worker});
+    totals.suspendedUs = scope.suspendedUs();
+    totals.suspensions = scope.suspensions();
+}
+
+Detached awaitStored(std::thread &worker, ScopeTotals &totals)
+{
+    instrumentation::CoroutineScope scope("AwaitStored");
+    auto awaiter = scope.traced(ResumeOnNewThread{worker});
+    co_await awaiter;
+    totals.suspensions = scope.suspensions();
+}
+} // namespace
+
+class CoroutineScopeTest : public ::testing::Test
+{
+  protected:
+    std::filesystem::path outPath{};
+
+    void SetUp() override
+    {
+        outPath = std::filesystem::temp_directory_path() /
+                  "coroutine_scope_test_output.json";
+        std::error_code ec;
+        std::filesystem::remove(outPath, ec);
+        Instrumentor::get().endSession();
+    }
+
+    void TearDown() override
+    {
+        Instrumentor::get().endSession();
+        std::error_code ec;
+        std::filesystem::remove(outPath, ec);
+    }
+};
+
+TEST_F(CoroutineScopeTest, ResumeOnOtherThread_SplitsActiveAndSuspendedTime)
+{
+    // Arrange
+    std::thread worker;
+    ScopeTotals totals;
+    Instrumentor::get().beginSession("Coroutines", outPath.string());
+
+    // Act
+    handleRequest(worker, totals);
+    worker.join();
+    Instrumentor::get().endSession();
+
+    // Assert: the ready await did not count as a suspension
+    EXPECT_EQ(totals.suspensions, 1u);
+    EXPECT_GE(totals.suspendedUs, 5000u);
+
+    const std::string json = readFile(outPath);
+    const std::string slice = "\"name\":\"HandleRequest\",\"ph\":\"X\"";
+    const size_t first = json.find(slice);
+    ASSERT_NE(first, std::string::npos);
+    EXPECT_NE(json.find(slice, first + 1), std::string::npos);
+    EXPECT_NE(json.find("\"args\":{\"slice\":1}"), std::string::npos);
+    EXPECT_NE(json.find("\"name\":\"Suspended\",\"ph\":\"b\""),
+              std::string::npos);
+    EXPECT_NE(json.find("\"name\":\"Suspended\",\"ph\":\"e\""),
+              std::string::npos);
+    EXPECT_NE(json.find("\"name\":\"HandleRequest\",\"ph\":\"s\""),
+              std::string::npos);
+    EXPECT_NE(json.find("\"name\":\"HandleRequest\",\"ph\":\"f\""),
+              std::string::npos);
+}
+
+TEST_F(CoroutineScopeTest, Traced_HoldsTemporaryAwaiterByValue)
+{
+    // Arrange
+    using Scope = instrumentation::CoroutineScope;
+    std::thread worker;
+    ScopeTotals totals;
+    std::suspend_never lvalue;
+
+    // Act
+    awaitStored(worker, totals);
+    worker.join();
+
+    // Assert
+    static_assert(
+        std::is_same_v<decltype(std::declval<Scope &>().traced(lvalue)),
+                       Scope::TracedAwaiter<std::suspend_never &>>);
+    static_assert(std::is_same_v<
+                  decltype(std::declval<Scope &>().traced(ResumeOnNewThread{
+                      worker})),
+                  Scope::TracedAwaiter<ResumeOnNewThread>>);
+    EXPECT_EQ(totals.suspensions, 1u);
+}
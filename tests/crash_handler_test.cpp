@@ -0,0 +1,149 @@
+#include <gtest/gtest.h>
+
+#include <csignal>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <string>
+
+#include "crash_handler.h"
+#include "instrumentor.h"
+#include "trace_repair.h"
+
+static std::string readFile(const std::filesystem::path &p)
+{
+    std::ifstream in(p, std::ios::in | std::ios::binary);
+    std::string s((std::istreambuf_iterator<char>(in)),
+                  std::istreambuf_iterator<char>());
+    return s;
+}
+
+static int countEvents(const std::string &json)
+{
+    int count = 0;
+    const std::string needle = "\"ph\":\"X\"";
+    size_t pos = 0;
+    while ((pos = json.find(needle, pos)) != std::string::npos)
+    {
+        ++count;
+        pos += needle.size();
+    }
+    return count;
+}
+
+// Runs in the death test child: record events that are still buffered
+// when the process crashes.
+static void recordThenCrash(const std::string &path, SessionOptions options,
+                            bool viaTerminate)
+{
+    instrumentation::installCrashHandlers();
+    Instrumentor::get().beginSession("Crash", path, options);
+    InstrumentationTimer running("Running"); // still open at the crash
+    for (int i = 0; i < 10; ++i)
+    {
+        InstrumentationTimer timer("BeforeCrash");
+    }
+    if (viaTerminate)
+        std::terminate();
+    std::raise(SIGSEGV);
+}
+
+class CrashHandlerTest : public ::testing::Test
+{
+  protected:
+    std::filesystem::path outPath{};
+
+    void SetUp() override
+    {
+        GTEST_FLAG_SET(death_test_style, "threadsafe");
+        outPath = std::filesystem::temp_directory_path() /
+                  "crash_handler_test_trace.json";
+        std::error_code ec;
+        std::filesystem::remove(outPath, ec);
+    }
+
+    void TearDown() override
+    {
+        std::error_code ec;
+        std::filesystem::remove(outPath, ec);
+    }
+};
+
+#if ST_HAS_MMAP
+
+TEST_F(CrashHandlerTest, FatalSignal_FlushesBuffersAndWritesFooter)
+{
+    EXPECT_EXIT(recordThenCrash(outPath.string(), {}, false),
+                ::testing::KilledBySignal(SIGSEGV), "");
+
+    const std::string json = readFile(outPath);
+    EXPECT_EQ(json.rfind("]}"), json.size() - 2) << "File should end with ]}";
+    EXPECT_EQ(countEvents(json), 10);
+}
+
+TEST_F(CrashHandlerTest, FatalSignal_DrainsAsyncMappedWriter)
+{
+    SessionOptions options;
+    options.backend = instrumentation::OutputBackend::MappedFile;
+    options.asyncWrite = true;
+
+    EXPECT_EXIT(recordThenCrash(outPath.string(), options, false),
+                ::testing::KilledBySignal(SIGSEGV), "");
+
+    const std::string json = readFile(outPath);
+    EXPECT_EQ(json.find('\0'), std::string::npos);
+    EXPECT_EQ(json.rfind("]}"), json.size() - 2) << "File should end with ]}";
+    EXPECT_EQ(countEvents(json), 10);
+}
+
+TEST_F(CrashHandlerTest, FatalSignal_EndsOpenBeginEndScopes)
+{
+    SessionOptions options;
+    options.scopeEvents = ScopeEvents::BeginEnd;
+
+    EXPECT_EXIT(recordThenCrash(outPath.string(), options, false),
+                ::testing::KilledBySignal(SIGSEGV), "");
+
+    const std::string json = readFile(outPath);
+    EXPECT_EQ(json.rfind("]}"), json.size() - 2) << "File should end with ]}";
+    EXPECT_NE(json.find("\"name\":\"Running\",\"ph\":\"B\""),
+              std::string::npos);
+    EXPECT_NE(json.find("\"name\":\"Running\",\"ph\":\"E\""),
+              std::string::npos);
+}
+
+TEST_F(CrashHandlerTest, Terminate_FinalizesTrace)
+{
+    EXPECT_EXIT(recordThenCrash(outPath.string(), {}, true),
+                ::testing::KilledBySignal(SIGABRT), "");
+
+    const std::string json = readFile(outPath);
+    EXPECT_EQ(json.rfind("]}"), json.size() - 2) << "File should end with ]}";
+    EXPECT_EQ(countEvents(json), 10);
+}
+
+#endif // ST_HAS_MMAP
+
+TEST(TraceRepairTest, CompleteTrace_IsUnchanged)
+{
+    const std::string json =
+        "{\"otherData\": {},\"traceEvents\":[{\"name\":\"a\"}, {\"name\":"
+        "\"b\"}]}";
+    EXPECT_EQ(instrumentation::repairTrace(json), json);
+}
+
+TEST(TraceRepairTest, TruncatedEvent_IsDroppedAndFooterAdded)
+{
+    const std::string json =
+        "{\"otherData\": {},\"traceEvents\":[{\"name\":\"a}\"}, {\"name\":\"b";
+    EXPECT_EQ(instrumentation::repairTrace(json),
+              "{\"otherData\": {},\"traceEvents\":[{\"name\":\"a}\"}]}");
+}
+
+TEST(TraceRepairTest, PaddingAndEmptyEventList_AreHandled)
+{
+    std::string json = "{\"otherData\": {},\"traceEvents\":[{\"na";
+    json.append(16, '\0');
+    EXPECT_EQ(instrumentation::repairTrace(json),
+              "{\"otherData\": {},\"traceEvents\":[]}");
+}
@@ -0,0 +1,135 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "critical_path.h"
+
+class CriticalPathTest : public ::testing::Test
+{
+  protected:
+    std::filesystem::path outPath{};
+
+    void SetUp() override
+    {
+        outPath =
+            std::filesystem::temp_directory_path() / "critical_path_test.json";
+    }
+
+    void TearDown() override
+    {
+        std::error_code ec;
+        std::filesystem::remove(outPath, ec);
+    }
+};
+
+TEST_F(CriticalPathTest, CriticalPath_FollowsTaskAndNotification)
+{
+    // Arrange: the request enqueues a task at 10 and waits from 12 until
+    // the worker notifies it at 85; the worker picks the task up at 30
+    std::ofstream(outPath)
+        << "{\"otherData\": {},\"traceEvents\":["
+           "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,"
+           "\"args\":{\"name\":\"main\"}}, "
+           "{\"dur\":10,\"name\":\"Prepare\",\"ph\":\"X\",\"pid\":1,"
+           "\"tid\":1,\"ts\":0}, "
+           "{\"cat\":\"flow\",\"id\":\"0x1\",\"name\":\"Task\",\"ph\":\"s\","
+           "\"pid\":1,\"tid\":1,\"ts\":10}, "
+           "{\"cat\":\"flow\",\"id\":\"0x2\",\"name\":\"done\",\"ph\":\"f\","
+           "\"bp\":\"e\",\"pid\":1,\"tid\":1,\"ts\":12}, "
+           "{\"cat\":\"flow\",\"id\":\"0x1\",\"name\":\"Task\",\"ph\":\"f\","
+           "\"bp\":\"e\",\"pid\":1,\"tid\":2,\"ts\":30}, "
+           "{\"dur\":50,\"name\":\"Compute\",\"ph\":\"X\",\"pid\":1,"
+           "\"tid\":2,\"ts\":30}, "
+           "{\"dur\":0,\"name\":\"Notify: done\",\"ph\":\"X\",\"pid\":1,"
+           "\"tid\":2,\"ts\":85}, "
+           "{\"cat\":\"flow\",\"id\":\"0x2\",\"name\":\"done\",\"ph\":\"s\","
+           "\"pid\":1,\"tid\":2,\"ts\":85}, "
+           "{\"dur\":60,\"name\":\"Task\",\"ph\":\"X\",\"pid\":1,\"tid\":2,"
+           "\"ts\":30}, "
+           "{\"dur\":83,\"name\":\"Wait: done\",\"ph\":\"X\",\"pid\":1,"
+           "\"tid\":1,\"ts\":12}, "
+           "{\"dur\":100,\"name\":\"Request\",\"ph\":\"X\",\"pid\":1,"
+           "\"tid\":1,\"ts\":0}"
+           "]}";
+    instrumentation::CriticalPathAnalyzer analyzer;
+    ASSERT_TRUE(analyzer.load(outPath.string()));
+
+    // Act
+    const std::vector<instrumentation::Operation> operations =
+        analyzer.operations();
+    ASSERT_EQ(operations.size(), 1u);
+    const instrumentation::CriticalPath path =
+        analyzer.criticalPath(operations[0]);
+
+    // Assert
+    EXPECT_EQ(analyzer.scopeName(operations[0].name), "Request");
+    EXPECT_EQ(analyzer.threadName(operations[0].thread), "main");
+    std::vector<std::string> steps;
+    double pathUs = 0;
+    for (const instrumentation::PathSegment &segment : path.segments)
+    {
+        steps.emplace_back(analyzer.scopeName(segment.scope));
+        pathUs += segment.endUs - segment.startUs;
+    }
+    const std::vector<std::string> expected = {
+        "Prepare", "(queued)", "Compute", "Task", "Wait: done", "Request"};
+    EXPECT_EQ(steps, expected);
+    EXPECT_DOUBLE_EQ(pathUs, 100);
+
+    const std::vector<instrumentation::PathContribution> contributions =
+        instrumentation::pathContributions({path});
+    ASSERT_FALSE(contributions.empty());
+    EXPECT_EQ(analyzer.scopeName(contributions[0].scope), "Compute");
+    EXPECT_DOUBLE_EQ(contributions[0].us, 50);
+}
+
+TEST_F(CriticalPathTest, CriticalPath_NotifyAllReleasesEveryWaiter)
+{
+    // Arrange: one notify at 50 wakes two waiters; each wait binds the
+    // flow end to its start
+    std::ofstream(outPath)
+        << "{\"otherData\": {},\"traceEvents\":["
+           "{\"cat\":\"flow\",\"id\":\"0x5\",\"name\":\"ready\",\"ph\":\"f\","
+           "\"bp\":\"e\",\"pid\":1,\"tid\":1,\"ts\":10}, "
+           "{\"dur\":42,\"name\":\"Wait: ready\",\"ph\":\"X\",\"pid\":1,"
+           "\"tid\":1,\"ts\":10}, "
+           "{\"dur\":100,\"name\":\"First\",\"ph\":\"X\",\"pid\":1,"
+           "\"tid\":1,\"ts\":0}, "
+           "{\"cat\":\"flow\",\"id\":\"0x5\",\"name\":\"ready\",\"ph\":\"f\","
+           "\"bp\":\"e\",\"pid\":1,\"tid\":2,\"ts\":20}, "
+           "{\"dur\":35,\"name\":\"Wait: ready\",\"ph\":\"X\",\"pid\":1,"
+           "\"tid\":2,\"ts\":20}, "
+           "{\"dur\":100,\"name\":\"Second\",\"ph\":\"X\",\"pid\":1,"
+           "\"tid\":2,\"ts\":0}, "
+           "{\"dur\":60,\"name\":\"Produce\",\"ph\":\"X\",\"pid\":1,"
+           "\"tid\":3,\"ts\":0}, "
+           "{\"dur\":0,\"name\":\"Notify: ready\",\"ph\":\"X\",\"pid\":1,"
+           "\"tid\":3,\"ts\":50}, "
+           "{\"cat\":\"flow\",\"id\":\"0x5\",\"name\":\"ready\",\"ph\":\"s\","
+           "\"pid\":1,\"tid\":3,\"ts\":50}"
+           "]}";
+    instrumentation::CriticalPathAnalyzer analyzer;
+    ASSERT_TRUE(analyzer.load(outPath.string()));
+
+    // Act
+    const std::vector<instrumentation::Operation> operations =
+        analyzer.operations("Second");
+    ASSERT_EQ(operations.size(), 1u);
+    const instrumentation::CriticalPath path =
+        analyzer.criticalPath(operations[0]);
+
+    // Assert: the second waiter was released by the notifier, not by the
+    // first waiter
+    std::vector<std::string> steps;
+    for (const instrumentation::PathSegment &segment : path.segments)
+    {
+        EXPECT_NE(analyzer.threadName(segment.thread), "1");
+        steps.emplace_back(analyzer.scopeName(segment.scope));
+    }
+    EXPECT_NE(std::find(steps.begin(), steps.end(), "Produce"), steps.end());
+    EXPECT_EQ(std::find(steps.begin(), steps.end(), "First"), steps.end());
+}
@@ -1,9 +1,13 @@
 #include <gtest/gtest.h>
 
+#include <algorithm>
+#include <cstring>
 #include <filesystem>
 #include <fstream>
 #include <regex>
+#include <sstream>
 #include <string>
+#include <thread>
 
 #include "instrumentor.h"
 
@@ -130,7 +134,7 @@ TEST_F(InstrumentorTest, NestedTimers_WriteTwoEvents_WithCommaSeparator)
         << "Expected comma+space separator between JSON objects";
 }
 
-TEST_F(InstrumentorTest, WriteProfile_SanitizesDoubleQuotesInName)
+TEST_F(InstrumentorTest, WriteProfile_EscapesDoubleQuotesInName)
 {
     // Arramge & Act
     Instrumentor::get().beginSession("Sanitize", outPath.string());
@@ -142,11 +146,28 @@ TEST_F(InstrumentorTest, WriteProfile_SanitizesDoubleQuotesInName)
     // Assert
     const std::string json = readFile(outPath);
 
-    // The original double quote should not appear inside the name field.
-    // It should be replaced with a single quote.
-    EXPECT_EQ(json.find("NameWith\\\"Quote"),
-              std::string::npos); // shouldn't contain escaped quote
-    EXPECT_NE(json.find("\"name\":\"NameWith'Quote\""), std::string::npos);
+    // The double quote inside the name field must be escaped
+    EXPECT_EQ(json.find("NameWith\"Quote"), std::string::npos);
+    EXPECT_NE(json.find("\"name\":\"NameWith\\\"Quote\""),
+              std::string::npos);
+}
+
+TEST_F(InstrumentorTest, TimerArgs_EscapeBackslashesAndControlCharacters)
+{
+    // Arrange & Act
+    Instrumentor::get().beginSession("Escape", outPath.string());
+    {
+        InstrumentationTimer timer("Tab\tName", "key", "C:\\dir\nline\x01");
+    }
+    Instrumentor::get().endSession();
+
+    // Assert
+    const std::string json = readFile(outPath);
+    EXPECT_NE(json.find("\"name\":\"Tab\\tName\""), std::string::npos);
+    EXPECT_NE(json.find("\"args\":{\"key\":\"C:\\\\dir\\nline\\u0001\"}"),
+              std::string::npos);
+    EXPECT_EQ(json.find('\n'), std::string::npos);
+    EXPECT_EQ(json.find('\x01'), std::string::npos);
 }
 
 TEST_F(InstrumentorTest, EndSession_WhenNotActive_IsNoOpAndDoesNotCreateFile)
@@ -198,3 +219,514 @@ TEST_F(InstrumentorTest, BeginSession_Twice_EndsPreviousAndCreatesNewFile)
     std::filesystem::remove(out1, ec);
     std::filesystem::remove(out2, ec);
 }
+
+static int countOccurrences(const std::string &json, const std::string &needle)
+{
+    int count = 0;
+    size_t pos = 0;
+    while ((pos = json.find(needle, pos)) != std::string::npos)
+    {
+        ++count;
+        pos += needle.size();
+    }
+    return count;
+}
+
+TEST_F(InstrumentorTest, Counter_WritesCounterEventWithValue)
+{
+    // Arrange & Act
+    Instrumentor::get().beginSession("Counter", outPath.string());
+    Instrumentor::get().writeCounter("QueueDepth", 42);
+    Instrumentor::get().writeCounter("HitRate", 0.5);
+    Instrumentor::get().endSession();
+
+    // Assert
+    const std::string json = readFile(outPath);
+    EXPECT_EQ(countOccurrences(json, "\"ph\":\"C\""), 2);
+    EXPECT_NE(json.find("\"name\":\"QueueDepth\""), std::string::npos);
+    EXPECT_NE(json.find("\"args\":{\"value\":42}"), std::string::npos);
+    EXPECT_NE(json.find("\"args\":{\"value\":0.5}"), std::string::npos);
+    EXPECT_EQ(countEvents(json), 0);
+}
+
+TEST_F(InstrumentorTest, Counter_CoalescesUpdatesWithinInterval)
+{
+    // Arrange
+    SessionOptions options;
+    options.counterInterval = std::chrono::seconds(10);
+
+    // Act: the first update is written, the rest only replace the pending
+    // value, which is written when the session ends
+    Instrumentor::get().beginSession("Coalesce", outPath.string(), options);
+    for (int i = 1; i <= 1000; ++i)
+        Instrumentor::get().writeCounter("InFlight", i);
+    Instrumentor::get().endSession();
+
+    // Assert
+    const std::string json = readFile(outPath);
+    EXPECT_EQ(countOccurrences(json, "\"ph\":\"C\""), 2);
+    EXPECT_NE(json.find("\"args\":{\"value\":1}"), std::string::npos);
+    EXPECT_NE(json.find("\"args\":{\"value\":1000}"), std::string::npos);
+}
+
+TEST_F(InstrumentorTest, Instant_WritesScopedMarkers)
+{
+    // Arrange & Act
+    Instrumentor::get().beginSession("Instant", outPath.string());
+    Instrumentor::get().writeInstant("RequestArrived");
+    Instrumentor::get().writeInstant("GC", InstantScope::Process);
+    Instrumentor::get().writeInstant("ConfigReload", InstantScope::Global);
+    Instrumentor::get().endSession();
+
+    // Assert
+    const std::string json = readFile(outPath);
+    EXPECT_EQ(countOccurrences(json, "\"ph\":\"i\""), 3);
+    EXPECT_NE(json.find("\"name\":\"RequestArrived\",\"ph\":\"i\",\"s\":\"t\""),
+              std::string::npos);
+    EXPECT_NE(json.find("\"name\":\"GC\",\"ph\":\"i\",\"s\":\"p\""),
+              std::string::npos);
+    EXPECT_NE(json.find("\"name\":\"ConfigReload\",\"ph\":\"i\",\"s\":\"g\""),
+              std::string::npos);
+    EXPECT_EQ(countEvents(json), 0);
+}
+
+TEST_F(InstrumentorTest, AsyncTimer_MovedAcrossThreads_WritesOneBeginAndEnd)
+{
+    // Arrange & Act
+    Instrumentor::get().beginSession("Async", outPath.string());
+    uint64_t id = 0;
+    {
+        AsyncInstrumentationTimer request("Request");
+        id = request.id();
+        std::thread worker([request = std::move(request)]() mutable {
+            InstrumentationTimer t("Worker");
+            request.step();
+        }); // request ends when the lambda is destroyed on the worker
+        worker.join();
+    }
+    Instrumentor::get().endSession();
+
+    // Assert
+    const std::string json = readFile(outPath);
+    EXPECT_EQ(countOccurrences(json, "\"ph\":\"b\""), 1);
+    EXPECT_EQ(countOccurrences(json, "\"ph\":\"e\""), 1);
+    EXPECT_EQ(countOccurrences(json, "\"ph\":\"s\""), 1);
+    EXPECT_EQ(countOccurrences(json, "\"ph\":\"t\""), 1);
+    EXPECT_EQ(countOccurrences(json, "\"ph\":\"f\""), 1);
+    std::ostringstream idField;
+    idField << "\"id\":\"0x" << std::hex << id << "\"";
+    EXPECT_EQ(countOccurrences(json, idField.str()), 5);
+}
+
+TEST_F(InstrumentorTest, TimerArgs_AreWrittenAsTypedJsonValues)
+{
+    // Arrange
+    const char *key = instrumentation::internString(std::string("user") + "42");
+
+    // Act
+    Instrumentor::get().beginSession("Args", outPath.string());
+    {
+        InstrumentationTimer timer("Request", "id", -7, "bytes", 4096u,
+                                   "ratio", 0.5);
+        timer.arg("key", key);
+    }
+    Instrumentor::get().endSession();
+
+    // Assert
+    const std::string json = readFile(outPath);
+    EXPECT_NE(json.find("\"args\":{\"id\":-7,\"bytes\":4096,\"ratio\":0.5,"
+                        "\"key\":\"user42\"}}"),
+              std::string::npos);
+    EXPECT_EQ(instrumentation::internString("user42"), key);
+}
+
+TEST_F(InstrumentorTest, Timer_CopiesNamesAndStringArgsAtRecordTime)
+{
+    // Arrange
+    SessionOptions options;
+    options.scopeEvents = ScopeEvents::BeginEnd;
+    Instrumentor::get().beginSession("Copies", outPath.string(), options);
+
+    // Act: the strings are overwritten and freed before the trace is written
+    for (int i = 0; i < 2; ++i)
+    {
+        std::string name = "Request " + std::to_string(i);
+        std::string user = "user-" + std::to_string(i) + "-with-a-long-id";
+        {
+            InstrumentationTimer timer(name.c_str(), "user", user.c_str());
+        }
+        name.assign(name.size(), '#');
+        user.assign(user.size(), '#');
+    }
+    {
+        InstrumentationTimer timer(instrumentation::StaticString("Static"));
+    }
+    Instrumentor::get().endSession();
+
+    // Assert
+    const std::string json = readFile(outPath);
+    EXPECT_EQ(json.find('#'), std::string::npos);
+    EXPECT_NE(json.find("\"name\":\"Request 0\",\"ph\":\"B\""),
+              std::string::npos);
+    EXPECT_NE(json.find("\"name\":\"Request 1\",\"ph\":\"E\""),
+              std::string::npos);
+    EXPECT_NE(json.find("\"args\":{\"user\":\"user-1-with-a-long-id\"}"),
+              std::string::npos);
+    EXPECT_NE(json.find("\"name\":\"Static\",\"ph\":\"E\""),
+              std::string::npos);
+}
+
+TEST_F(InstrumentorTest, ThreadName_WritesMetadataWithOsThreadAndProcessIds)
+{
+    // Arrange & Act
+    Instrumentor::get().beginSession("Names", outPath.string());
+    uint32_t workerId = 0;
+    std::thread worker([&workerId] {
+        Instrumentor::get().setThreadName("Worker \"1\"");
+        workerId = instrumentation::detail::currentThreadId();
+        InstrumentationTimer t("Work");
+    });
+    worker.join();
+    Instrumentor::get().endSession();
+
+    // Assert
+    const std::string json = readFile(outPath);
+    const std::string pid =
+        std::to_string(instrumentation::detail::currentProcessId());
+    const std::string tid = std::to_string(workerId);
+    EXPECT_NE(json.find("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" +
+                        pid + ",\"tid\":" + tid +
+                        ",\"args\":{\"name\":\"Worker \\\"1\\\"\"}}"),
+              std::string::npos);
+    EXPECT_NE(json.find("\"pid\":" + pid + ",\"tid\":" + tid + ",\"ts\":"),
+              std::string::npos);
+#if defined(__linux__)
+    EXPECT_EQ(instrumentation::detail::currentThreadId(),
+              static_cast<uint32_t>(::syscall(SYS_gettid)));
+#endif
+}
+
+TEST_F(InstrumentorTest, ThreadContext_IsCachedAndTracksTimerDepth)
+{
+    // Arrange
+    Instrumentor::get().beginSession("Context", outPath.string());
+    instrumentation::detail::ThreadContext &context =
+        Instrumentor::threadContext();
+    const uint32_t depthBefore = context.depth;
+
+    // Act & Assert
+    EXPECT_EQ(&Instrumentor::threadContext(), &context);
+    EXPECT_EQ(context.threadId, instrumentation::detail::currentThreadId());
+    {
+        InstrumentationTimer outer("Outer");
+        InstrumentationTimer inner("Inner");
+        EXPECT_EQ(context.depth, depthBefore + 2);
+        inner.stop();
+        EXPECT_EQ(context.depth, depthBefore + 1);
+    }
+    EXPECT_EQ(context.depth, depthBefore);
+    Instrumentor::get().endSession();
+}
+
+TEST_F(InstrumentorTest, ThreadContext_IsNotCreatedOutsideSession)
+{
+    // Arrange
+    bool created = true;
+
+    // Act
+    std::thread([&created] {
+        {
+            InstrumentationTimer timer("Unrecorded");
+        }
+        created = Instrumentor::existingThreadContext() != nullptr;
+    }).join();
+
+    // Assert
+    EXPECT_FALSE(created);
+}
+
+namespace
+{
+// Destroyed after the recording context of its thread when it is
+// constructed first
+struct TimerAtThreadExit
+{
+    ~TimerAtThreadExit()
+    {
+        InstrumentationTimer timer("AtExit");
+    }
+};
+} // namespace
+
+TEST_F(InstrumentorTest, ThreadContext_IgnoresTimersAfterThreadExitFlush)
+{
+    // Arrange
+    Instrumentor::get().beginSession("Exit", outPath.string());
+
+    // Act
+    std::thread([] {
+        static thread_local TimerAtThreadExit atExit;
+        (void)atExit;
+        InstrumentationTimer timer("BeforeExit");
+    }).join();
+    Instrumentor::get().endSession();
+
+    // Assert
+    const std::string json = readFile(outPath);
+    EXPECT_NE(json.find("\"name\":\"BeforeExit\""), std::string::npos);
+    EXPECT_EQ(json.find("\"name\":\"AtExit\""), std::string::npos);
+}
+
+TEST_F(InstrumentorTest, Timer_StartedBeforeSession_IsNotRecorded)
+{
+    // Arrange
+    InstrumentationTimer early("Early");
+
+    // Act
+    Instrumentor::get().beginSession("Late", outPath.string());
+    early.stop();
+    {
+        InstrumentationTimer inside("Inside");
+    }
+    Instrumentor::get().endSession();
+
+    // Assert
+    const std::string json = readFile(outPath);
+    EXPECT_EQ(json.find("\"name\":\"Early\""), std::string::npos);
+    EXPECT_NE(json.find("\"name\":\"Inside\""), std::string::npos);
+}
+
+TEST_F(InstrumentorTest, Timer_StoppedOnAnotherThread_LeavesStartingContext)
+{
+    // Arrange
+    SessionOptions options;
+    options.compensateOverhead = true;
+    Instrumentor::get().beginSession("Moved", outPath.string(), options);
+    uint32_t startingDepth = 0;
+    uint32_t stoppingDepth = 1;
+
+    // Act
+    std::thread([&startingDepth, &stoppingDepth] {
+        const instrumentation::detail::ThreadContext &context =
+            Instrumentor::threadContext();
+        InstrumentationTimer timer("Moved");
+        std::thread([&timer, &stoppingDepth] {
+            timer.stop();
+            stoppingDepth = Instrumentor::threadContext().depth;
+        }).join();
+        startingDepth = context.depth;
+    }).join();
+    Instrumentor::get().endSession();
+
+    // Assert: neither thread's bookkeeping was changed by the other
+    EXPECT_EQ(startingDepth, 1u);
+    EXPECT_EQ(stoppingDepth, 0u);
+    EXPECT_NE(readFile(outPath).find("\"name\":\"Moved\""),
+              std::string::npos);
+}
+
+TEST_F(InstrumentorTest, BeginEndScopes_MatchPairsAndCloseOpenScopesAtEnd)
+{
+    // Arrange
+    SessionOptions options;
+    options.scopeEvents = ScopeEvents::BeginEnd;
+
+    // Act: the outer scope is still open when the session ends
+    Instrumentor::get().beginSession("BeginEnd", outPath.string(), options);
+    InstrumentationTimer outer("Outer");
+    {
+        InstrumentationTimer inner("Inner", "n", 1);
+    }
+    Instrumentor::get().endSession();
+    outer.stop(); // belongs to the ended session, writes nothing
+
+    // Assert
+    const std::string json = readFile(outPath);
+    EXPECT_EQ(countOccurrences(json, "\"ph\":\"X\""), 0);
+    EXPECT_EQ(countOccurrences(json, "\"ph\":\"B\""), 2);
+    EXPECT_EQ(countOccurrences(json, "\"ph\":\"E\""), 2);
+    const auto outerBegin = json.find("\"name\":\"Outer\",\"ph\":\"B\"");
+    const auto innerEnd = json.find("\"name\":\"Inner\",\"ph\":\"E\"");
+    const auto outerEnd = json.find("\"name\":\"Outer\",\"ph\":\"E\"");
+    ASSERT_NE(outerEnd, std::string::npos);
+    EXPECT_LT(outerBegin, innerEnd);
+    EXPECT_LT(innerEnd, outerEnd);
+    EXPECT_NE(json.find("\"args\":{\"n\":1}"), std::string::npos);
+}
+
+TEST_F(InstrumentorTest, BeginEndScopes_OutOfOrderEnd_ClosesInnerScopesFirst)
+{
+    // Arrange
+    SessionOptions options;
+    options.scopeEvents = ScopeEvents::BeginEnd;
+    Instrumentor::get().beginSession("OutOfOrder", outPath.string(), options);
+    InstrumentationTimer outer("Outer");
+    InstrumentationTimer inner("Inner");
+
+    // Act: the outer scope ends while the inner one is still open
+    outer.stop();
+    inner.stop();
+    Instrumentor::get().endSession();
+
+    // Assert: Inner is ended before Outer and begun again after it
+    const std::string json = readFile(outPath);
+    EXPECT_EQ(countOccurrences(json, "\"ph\":\"B\""), 3);
+    EXPECT_EQ(countOccurrences(json, "\"ph\":\"E\""), 3);
+    const char *expected[] = {"\"name\":\"Outer\",\"ph\":\"B\"",
+                              "\"name\":\"Inner\",\"ph\":\"B\"",
+                              "\"name\":\"Inner\",\"ph\":\"E\"",
+                              "\"name\":\"Outer\",\"ph\":\"E\"",
+                              "\"name\":\"Inner\",\"ph\":\"B\"",
+                              "\"name\":\"Inner\",\"ph\":\"E\""};
+    std::size_t at = 0;
+    for (const char *event : expected)
+    {
+        at = json.find(event, at);
+        ASSERT_NE(at, std::string::npos) << event;
+        ++at;
+    }
+}
+
+TEST_F(InstrumentorTest, CompensateOverhead_SubtractsNestedTimersFromParent)
+{
+    // Arrange
+    SessionOptions options;
+    options.compensateOverhead = true;
+    Instrumentor::get().beginSession("Overhead", outPath.string(), options);
+    const double overheadNs = Instrumentor::get().scopeOverheadNs();
+    constexpr int kChildren = 20000;
+
+    // Act
+    const uint64_t startUs = instrumentation::detail::nowUs();
+    {
+        InstrumentationTimer parent("Parent");
+        for (int i = 0; i < kChildren; ++i)
+            InstrumentationTimer child("Child");
+    }
+    const uint64_t elapsedUs = instrumentation::detail::nowUs() - startUs;
+    Instrumentor::get().endSession();
+
+    // Assert: the parent's compensated duration lost at least the measured
+    // cost of its children
+    EXPECT_GT(overheadNs, 0.0);
+    const std::string json = readFile(outPath);
+    EXPECT_NE(json.find("{\"name\":\"instrumentation_overhead\",\"ph\":\"M\""),
+              std::string::npos);
+    EXPECT_NE(json.find(",\"compensated\":1}"), std::string::npos);
+    const std::size_t parent = json.find("\"name\":\"Parent\"");
+    ASSERT_NE(parent, std::string::npos);
+    const std::size_t compensated =
+        json.find("\"compensated_dur_us\":", parent);
+    ASSERT_NE(compensated, std::string::npos);
+    const double parentUs = std::stod(json.substr(compensated + 21));
+    EXPECT_LE(parentUs + kChildren * overheadNs / 1000.0,
+              static_cast<double>(elapsedUs) + 2.0);
+    EXPECT_EQ(countOccurrences(json, "\"compensated_dur_us\""), 1);
+}
+
+TEST_F(InstrumentorTest, CompensateOverhead_KeepsChildrenInsideParent)
+{
+    for (const ScopeEvents mode :
+         {ScopeEvents::Complete, ScopeEvents::BeginEnd})
+    {
+        // Arrange
+        SessionOptions options;
+        options.compensateOverhead = true;
+        options.scopeEvents = mode;
+        Instrumentor::get().beginSession("Nesting", outPath.string(),
+                                         options);
+
+        // Act
+        {
+            InstrumentationTimer parent("Parent");
+            for (int i = 0; i < 20000; ++i)
+                InstrumentationTimer child("Child");
+        }
+        Instrumentor::get().endSession();
+
+        // Assert: no child ends after its parent
+        const std::string json = readFile(outPath);
+        const auto number = [&json](std::size_t from, const char *key) {
+            const std::size_t at = json.find(key, from);
+            EXPECT_NE(at, std::string::npos) << key;
+            return at == std::string::npos
+                       ? uint64_t{0}
+                       : static_cast<uint64_t>(std::stoull(
+                             json.substr(at + std::strlen(key))));
+        };
+        const auto endOf = [&](std::size_t event) {
+            const std::size_t open = json.rfind('{', event);
+            if (mode == ScopeEvents::BeginEnd)
+                return number(event, "\"ts\":");
+            return number(event, "\"ts\":") + number(open, "\"dur\":");
+        };
+        const char *parentEvent = mode == ScopeEvents::BeginEnd
+                                      ? "\"name\":\"Parent\",\"ph\":\"E\""
+                                      : "\"name\":\"Parent\"";
+        const char *childEvent = mode == ScopeEvents::BeginEnd
+                                     ? "\"name\":\"Child\",\"ph\":\"E\""
+                                     : "\"name\":\"Child\"";
+        const std::size_t parent = json.find(parentEvent);
+        ASSERT_NE(parent, std::string::npos);
+        const uint64_t parentEndUs = endOf(parent);
+        uint64_t lastChildEndUs = 0;
+        int children = 0;
+        for (std::size_t at = json.find(childEvent); at != std::string::npos;
+             at = json.find(childEvent, at + 1), ++children)
+            lastChildEndUs = std::max(lastChildEndUs, endOf(at));
+        EXPECT_EQ(children, 20000);
+        EXPECT_LE(lastChildEndUs, parentEndUs);
+        if (mode == ScopeEvents::BeginEnd)
+        {
+            EXPECT_GT(parent, json.rfind(childEvent));
+        }
+    }
+}
+
+TEST_F(InstrumentorTest, CompensateOverhead_KeepsOrderOfLaterEvents)
+{
+    // Arrange
+    SessionOptions options;
+    options.compensateOverhead = true;
+    Instrumentor::get().beginSession("Ordering", outPath.string(), options);
+    Instrumentor &instrumentor = Instrumentor::get();
+    const uint64_t id = instrumentor.nextAsyncId();
+
+    // Act: a long-lived outer scope accumulates the overhead of many
+    // children before the events that follow them
+    {
+        InstrumentationTimer outer("Outer");
+        for (int i = 0; i < 20000; ++i)
+            InstrumentationTimer child("Child");
+        instrumentor.writeAsyncEvent("Handoff", id, AsyncPhase::FlowStart);
+        {
+            InstrumentationTimer last("Last");
+        }
+        instrumentor.writeInstant("Marker");
+        std::thread([&instrumentor, id] {
+            InstrumentationTimer remote("Remote");
+            instrumentor.writeAsyncEvent("Handoff", id, AsyncPhase::FlowEnd);
+        }).join();
+    }
+    Instrumentor::get().endSession();
+
+    // Assert: timestamps after the children are not moved earlier
+    const std::string json = readFile(outPath);
+    const auto timestamp = [&json](const std::string &needle) {
+        const std::size_t at = json.find(needle);
+        EXPECT_NE(at, std::string::npos) << needle;
+        if (at == std::string::npos)
+            return uint64_t{0};
+        return static_cast<uint64_t>(
+            std::stoull(json.substr(json.find("\"ts\":", at) + 5)));
+    };
+    const uint64_t flowStart = timestamp("\"name\":\"Handoff\",\"ph\":\"s\"");
+    const uint64_t last = timestamp("\"name\":\"Last\"");
+    const uint64_t marker = timestamp("\"name\":\"Marker\"");
+    const uint64_t remote = timestamp("\"name\":\"Remote\"");
+    const uint64_t flowEnd = timestamp("\"name\":\"Handoff\",\"ph\":\"f\"");
+    EXPECT_LE(flowStart, last);
+    EXPECT_LE(last, marker);
+    EXPECT_LE(marker, remote);
+    EXPECT_LE(remote, flowEnd);
+}
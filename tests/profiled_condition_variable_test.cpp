@@ -0,0 +1,146 @@
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "instrumentor.h"
+#include "profiled_condition_variable.h"
+
+static std::string readFile(const std::filesystem::path &p)
+{
+    std::ifstream in(p, std::ios::in | std::ios::binary);
+    std::string s((std::istreambuf_iterator<char>(in)),
+                  std::istreambuf_iterator<char>());
+    return s;
+}
+
+class ProfiledConditionVariableTest : public ::testing::Test
+{
+  protected:
+    std::filesystem::path outPath{};
+
+    void SetUp() override
+    {
+        outPath = std::filesystem::temp_directory_path() /
+                  "profiled_condition_variable_test_output.json";
+        std::error_code ec;
+        std::filesystem::remove(outPath, ec);
+        Instrumentor::get().endSession();
+    }
+
+    void TearDown() override
+    {
+        Instrumentor::get().endSession();
+        std::error_code ec;
+        std::filesystem::remove(outPath, ec);
+    }
+};
+
+TEST_F(ProfiledConditionVariableTest, Notify_LinksNotifierToWaiter)
+{
+    // Arrange
+    instrumentation::ProfiledConditionVariable condition("Queue");
+    std::mutex mutex;
+    bool ready = false;
+    std::atomic<bool> waiting{false};
+    Instrumentor::get().beginSession("Waits", outPath.string());
+
+    // Act
+    std::thread waiter([&] {
+        std::unique_lock<std::mutex> lock(mutex);
+        waiting = true;
+        condition.wait(lock, [&ready] { return ready; });
+    });
+    while (!waiting)
+        std::this_thread::yield();
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        ready = true;
+    }
+    condition.notify_one();
+    waiter.join();
+    Instrumentor::get().endSession();
+
+    // Assert
+    const instrumentation::WaitStats stats = condition.stats();
+    EXPECT_EQ(stats.waits, 1u);
+    EXPECT_EQ(stats.notifies, 1u);
+    EXPECT_EQ(stats.timeouts, 0u);
+    EXPECT_GE(stats.waitUs, 10000u);
+    EXPECT_LE(stats.maxWakeLatencyUs, stats.waitUs);
+
+    const std::string json = readFile(outPath);
+    EXPECT_NE(json.find("\"name\":\"Wait: Queue\""), std::string::npos);
+    EXPECT_NE(json.find("\"name\":\"Notify: Queue\""), std::string::npos);
+    EXPECT_NE(json.find("\"args\":{\"wake_latency_us\":"), std::string::npos);
+    EXPECT_NE(json.find("\"name\":\"Queue\",\"ph\":\"s\""), std::string::npos);
+    EXPECT_NE(json.find("\"name\":\"Queue\",\"ph\":\"f\""), std::string::npos);
+}
+
+TEST_F(ProfiledConditionVariableTest, Notify_WithoutWaiters_StartsNoFlow)
+{
+    // Arrange
+    instrumentation::ProfiledConditionVariable condition("Empty");
+    Instrumentor::get().beginSession("Waits", outPath.string());
+
+    // Act
+    condition.notify_one();
+    condition.notify_all();
+    Instrumentor::get().endSession();
+
+    // Assert
+    EXPECT_EQ(condition.stats().notifies, 2u);
+    const std::string json = readFile(outPath);
+    EXPECT_EQ(json.find("\"name\":\"Notify: Empty\""), std::string::npos);
+    EXPECT_EQ(json.find("\"name\":\"Empty\",\"ph\":\"s\""),
+              std::string::npos);
+}
+
+TEST_F(ProfiledConditionVariableTest, WaitFor_CountsTimeout)
+{
+    // Arrange
+    instrumentation::ProfiledConditionVariableAny condition("Idle");
+    instrumentation::ProfiledMutex mutex("IdleMutex");
+    std::unique_lock<instrumentation::ProfiledMutex> lock(mutex);
+
+    // Act
+    const bool satisfied = condition.wait_for(
+        lock, std::chrono::milliseconds(5), [] { return false; });
+
+    // Assert
+    EXPECT_FALSE(satisfied);
+    const instrumentation::WaitStats stats = condition.stats();
+    EXPECT_EQ(stats.waits, 1u);
+    EXPECT_EQ(stats.timeouts, 1u);
+    EXPECT_EQ(stats.notifies, 0u);
+}
+
+TEST_F(ProfiledConditionVariableTest, ProfiledWait_RecordsBlockedFuture)
+{
+    // Arrange
+    std::promise<int> promise;
+    std::future<int> future = promise.get_future();
+    Instrumentor::get().beginSession("Futures", outPath.string());
+
+    // Act
+    std::thread producer([&promise] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        promise.set_value(42);
+    });
+    instrumentation::profiledWait(future, "Wait: result");
+    const int value = future.get();
+    producer.join();
+    Instrumentor::get().endSession();
+
+    // Assert
+    EXPECT_EQ(value, 42);
+    EXPECT_NE(readFile(outPath).find("\"name\":\"Wait: result\""),
+              std::string::npos);
+}
@@ -0,0 +1,159 @@
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+
+#include "instrumentor.h"
+#include "profiled_mutex.h"
+
+static std::string readFile(const std::filesystem::path &p)
+{
+    std::ifstream in(p, std::ios::in | std::ios::binary);
+    std::string s((std::istreambuf_iterator<char>(in)),
+                  std::istreambuf_iterator<char>());
+    return s;
+}
+
+class ProfiledMutexTest : public ::testing::Test
+{
+  protected:
+    std::filesystem::path outPath{};
+
+    void SetUp() override
+    {
+        outPath = std::filesystem::temp_directory_path() /
+                  "profiled_mutex_test_output.json";
+        std::error_code ec;
+        std::filesystem::remove(outPath, ec);
+        Instrumentor::get().endSession();
+    }
+
+    void TearDown() override
+    {
+        Instrumentor::get().endSession();
+        std::error_code ec;
+        std::filesystem::remove(outPath, ec);
+    }
+};
+
+TEST_F(ProfiledMutexTest, UncontendedLock_CountsAcquisitionsOnly)
+{
+    // Arrange
+    instrumentation::ProfiledMutex mutex("Quiet");
+
+    // Act
+    for (int i = 0; i < 3; ++i)
+    {
+        std::lock_guard<instrumentation::ProfiledMutex> lock(mutex);
+    }
+
+    // Assert
+    const instrumentation::LockStats stats = mutex.stats();
+    EXPECT_EQ(stats.acquisitions, 3u);
+    EXPECT_EQ(stats.contentions, 0u);
+    EXPECT_EQ(stats.waitUs, 0u);
+}
+
+TEST_F(ProfiledMutexTest, ContendedLock_RecordsWaitSpanWithOwner)
+{
+    // Arrange
+    instrumentation::ProfiledMutex mutex("Busy", true);
+    Instrumentor::get().beginSession("Locks", outPath.string());
+
+    // Act: hold the lock while another thread tries to take it
+    mutex.lock();
+    std::atomic<bool> started{false};
+    std::thread waiter([&mutex, &started] {
+        started = true;
+        std::lock_guard<instrumentation::ProfiledMutex> lock(mutex);
+    });
+    while (!started)
+        std::this_thread::yield();
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    mutex.unlock();
+    waiter.join();
+    Instrumentor::get().endSession();
+
+    // Assert
+    const instrumentation::LockStats stats = mutex.stats();
+    EXPECT_EQ(stats.acquisitions, 2u);
+    EXPECT_EQ(stats.contentions, 1u);
+    EXPECT_GE(stats.maxWaitUs, 10000u);
+    EXPECT_GE(stats.holdUs, 10000u); // the wait ends just after the hold
+
+    const std::string json = readFile(outPath);
+    const std::string owner =
+        std::to_string(Instrumentor::threadContext().threadId);
+    EXPECT_NE(json.find("\"name\":\"Wait: Busy\""), std::string::npos);
+    EXPECT_NE(json.find("\"args\":{\"owner\":" + owner + "}"),
+              std::string::npos);
+    EXPECT_NE(json.find("\"name\":\"Hold: Busy\""), std::string::npos);
+    EXPECT_NE(json.find("\"name\":\"Contentions: Busy\""), std::string::npos);
+}
+
+TEST_F(ProfiledMutexTest, SharedMutex_ReadersDoNotContend)
+{
+    // Arrange
+    instrumentation::ProfiledSharedMutex mutex("Readers");
+
+    // Act
+    {
+        std::shared_lock<instrumentation::ProfiledSharedMutex> first(mutex);
+        std::thread reader([&mutex] {
+            std::shared_lock<instrumentation::ProfiledSharedMutex> second(
+                mutex);
+        });
+        reader.join();
+    }
+    {
+        std::unique_lock<instrumentation::ProfiledSharedMutex> writer(mutex);
+    }
+
+    // Assert
+    const instrumentation::LockStats stats = mutex.stats();
+    EXPECT_EQ(stats.acquisitions, 3u);
+    EXPECT_EQ(stats.contentions, 0u);
+}
+
+TEST_F(ProfiledMutexTest, ContendedLock_RecordsHoldOfEveryOwnerThatBlocked)
+{
+    // Arrange
+    instrumentation::ProfiledMutex mutex("Queue", true);
+    Instrumentor::get().beginSession("Locks", outPath.string());
+
+    // Act: two threads block on the lock; the first to get it holds it
+    // while the second is still waiting
+    mutex.lock();
+    std::atomic<int> started{0};
+    const auto waiter = [&mutex, &started] {
+        ++started;
+        std::lock_guard<instrumentation::ProfiledMutex> lock(mutex);
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    };
+    std::thread first(waiter);
+    std::thread second(waiter);
+    while (started < 2)
+        std::this_thread::yield();
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    mutex.unlock();
+    first.join();
+    second.join();
+    Instrumentor::get().endSession();
+
+    // Assert: the holds of this thread and of the first waiter blocked
+    // someone; the last owner did not
+    const std::string json = readFile(outPath);
+    std::size_t holds = 0;
+    for (std::size_t at = json.find("\"name\":\"Hold: Queue\"");
+         at != std::string::npos;
+         at = json.find("\"name\":\"Hold: Queue\"", at + 1))
+        ++holds;
+    EXPECT_EQ(mutex.stats().contentions, 2u);
+    EXPECT_EQ(holds, 2u);
+}
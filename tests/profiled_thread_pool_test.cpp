@@ -0,0 +1,91 @@
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <thread>
+
+#include "instrumentor.h"
+#include "profiled_thread_pool.h"
+
+static std::string readFile(const std::filesystem::path &p)
+{
+    std::ifstream in(p, std::ios::in | std::ios::binary);
+    std::string s((std::istreambuf_iterator<char>(in)),
+                  std::istreambuf_iterator<char>());
+    return s;
+}
+
+class ProfiledThreadPoolTest : public ::testing::Test
+{
+  protected:
+    std::filesystem::path outPath{};
+
+    void SetUp() override
+    {
+        outPath = std::filesystem::temp_directory_path() /
+                  "profiled_thread_pool_test_output.json";
+        std::error_code ec;
+        std::filesystem::remove(outPath, ec);
+        Instrumentor::get().endSession();
+    }
+
+    void TearDown() override
+    {
+        Instrumentor::get().endSession();
+        std::error_code ec;
+        std::filesystem::remove(outPath, ec);
+    }
+};
+
+TEST_F(ProfiledThreadPoolTest, Tasks_RecordQueueWaitAndDepth)
+{
+    // Arrange
+    std::atomic<int> done{0};
+    Instrumentor::get().beginSession("Pool", outPath.string());
+
+    // Act
+    {
+        instrumentation::ProfiledThreadPool pool(2, "pool");
+        for (int i = 0; i < 8; ++i)
+            pool.submit("Work", [&done] { ++done; });
+        pool.wait();
+
+        // Assert
+        const instrumentation::ThreadPoolStats stats = pool.stats();
+        EXPECT_EQ(stats.tasks, 8u);
+    }
+    Instrumentor::get().endSession();
+
+    EXPECT_EQ(done.load(), 8);
+    const std::string json = readFile(outPath);
+    EXPECT_NE(json.find("\"name\":\"Work\",\"ph\":\"X\""), std::string::npos);
+    EXPECT_NE(json.find("\"args\":{\"queue_us\":"), std::string::npos);
+    EXPECT_NE(json.find("\"name\":\"Work\",\"ph\":\"s\""), std::string::npos);
+    EXPECT_NE(json.find("\"name\":\"Work\",\"ph\":\"f\""), std::string::npos);
+    EXPECT_NE(json.find("\"name\":\"Queue depth: pool worker 0\""),
+              std::string::npos);
+    EXPECT_NE(json.find("\"name\":\"pool worker 1\""), std::string::npos);
+    EXPECT_NE(json.find("\"name\":\"Idle\""), std::string::npos);
+}
+
+TEST_F(ProfiledThreadPoolTest, BusyWorker_HasSubtasksStolen)
+{
+    // Arrange
+    instrumentation::ProfiledThreadPool pool(2);
+
+    // Act: a task queues subtasks on its own worker and then blocks it
+    pool.submit("Parent", [&pool] {
+        for (int i = 0; i < 4; ++i)
+            pool.submit("Child", [] {});
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    });
+    pool.wait();
+
+    // Assert
+    const instrumentation::ThreadPoolStats stats = pool.stats();
+    EXPECT_EQ(stats.tasks, 5u);
+    EXPECT_GE(stats.steals, 1u);
+}
@@ -0,0 +1,172 @@
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#include <sys/wait.h>
+
+#include "instrumentor.h"
+#include "shared_memory_trace_writer.h"
+
+#if ST_HAS_SHARED_MEMORY
+
+class SharedMemoryTraceWriterTest : public ::testing::Test
+{
+  protected:
+    std::string segment{};
+
+    void SetUp() override
+    {
+        segment = "/st_trace_test_" +
+                  std::to_string(instrumentation::detail::currentProcessId());
+        Instrumentor::get().endSession();
+    }
+
+    void TearDown() override
+    {
+        Instrumentor::get().endSession();
+        ::shm_unlink(segment.c_str());
+    }
+
+    std::string collect(instrumentation::SharedCollectStats &stats)
+    {
+        instrumentation::SharedTraceCollector collector;
+        EXPECT_TRUE(collector.attach(segment));
+        std::ostringstream out;
+        while (!collector.finished())
+            collector.poll(out);
+        stats = collector.stats();
+        return out.str();
+    }
+};
+
+TEST_F(SharedMemoryTraceWriterTest, Collector_FormatsRecordsWithTheirStrings)
+{
+    // Arrange
+    SessionOptions options;
+    options.backend = instrumentation::OutputBackend::SharedMemory;
+    const char *route = instrumentation::internString("/orders");
+
+    // Act
+    Instrumentor::get().beginSession("Shared", segment, options);
+    {
+        InstrumentationTimer timer("Handle", "route", route, "items", 3);
+    }
+    Instrumentor::get().writeInstant("Ready");
+    Instrumentor::get().endSession();
+
+    instrumentation::SharedCollectStats stats;
+    const std::string json = collect(stats);
+
+    // Assert
+    EXPECT_EQ(json.rfind("{\"otherData\"", 0), 0u);
+    EXPECT_NE(json.find("\"name\":\"Handle\",\"ph\":\"X\""),
+              std::string::npos);
+    EXPECT_NE(json.find("\"args\":{\"route\":\"/orders\",\"items\":3}"),
+              std::string::npos);
+    EXPECT_NE(json.find("\"name\":\"Ready\""), std::string::npos);
+    EXPECT_TRUE(json.ends_with("]}"));
+    EXPECT_GE(stats.records, 2u);
+    EXPECT_EQ(stats.droppedRecords, 0u);
+    EXPECT_EQ(json.find("Dropped events"), std::string::npos);
+}
+
+TEST_F(SharedMemoryTraceWriterTest, FullRing_DropsBlocksWithoutBlocking)
+{
+    // Arrange
+    instrumentation::SharedMemoryTraceWriter writer("{\"traceEvents\":[{}", 0,
+                                                    0, 1024);
+    ASSERT_TRUE(writer.open(segment));
+    std::string block;
+    instrumentation::detail::appendRecord(
+        block, {instrumentation::detail::RecordKind::Instant, 't', 0, 1, 5, 0,
+                "Tick"});
+
+    // Act: nothing drains the ring
+    for (int i = 0; i < 100; ++i)
+        writer.write(block.data(), block.size());
+    writer.close();
+
+    instrumentation::SharedCollectStats stats;
+    const std::string json = collect(stats);
+
+    // Assert
+    EXPECT_GT(stats.records, 0u);
+    EXPECT_EQ(stats.records + stats.droppedRecords, 100u);
+    EXPECT_EQ(stats.droppedBytes, stats.droppedRecords * block.size());
+    EXPECT_NE(json.find("\"name\":\"Tick\""), std::string::npos);
+    const std::string args =
+        "\"args\":{\"events\":" + std::to_string(stats.droppedRecords) +
+        ",\"bytes\":" + std::to_string(stats.droppedBytes) + "}}]}";
+    EXPECT_NE(json.find(",{\"name\":\"Dropped events\",\"ph\":\"i\""),
+              std::string::npos);
+    EXPECT_TRUE(json.ends_with(args));
+}
+
+TEST_F(SharedMemoryTraceWriterTest, IdleProducer_StaysAliveThroughHeartbeat)
+{
+    // Arrange
+    instrumentation::SharedMemoryTraceWriter writer("{\"traceEvents\":[{}", 0,
+                                                    0, 1024);
+    ASSERT_TRUE(writer.open(segment));
+    instrumentation::SharedTraceCollector collector(
+        std::chrono::milliseconds(300));
+    ASSERT_TRUE(collector.attach(segment));
+    std::ostringstream out;
+
+    // Act: the producer writes nothing for longer than the timeout
+    const auto deadline =
+        std::chrono::steady_clock::now() + std::chrono::milliseconds(900);
+    while (std::chrono::steady_clock::now() < deadline &&
+           !collector.finished())
+    {
+        collector.poll(out);
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    const bool finishedWhileOpen = collector.finished();
+    writer.close();
+    collector.poll(out);
+
+    // Assert
+    EXPECT_FALSE(finishedWhileOpen);
+    EXPECT_TRUE(collector.finished());
+    EXPECT_TRUE(out.str().ends_with("]}"));
+}
+
+TEST_F(SharedMemoryTraceWriterTest, ExitedProducer_IsDetectedByHeartbeat)
+{
+    // Arrange: a child process opens the segment and exits without closing
+    const pid_t child = ::fork();
+    ASSERT_GE(child, 0);
+    if (child == 0)
+    {
+        instrumentation::SharedMemoryTraceWriter writer(
+            "{\"traceEvents\":[{}", 0, 0, 1024);
+        ::_exit(writer.open(segment) ? 0 : 1);
+    }
+    int status = 0;
+    ASSERT_EQ(::waitpid(child, &status, 0), child);
+    ASSERT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    instrumentation::SharedTraceCollector collector(
+        std::chrono::milliseconds(200));
+    ASSERT_TRUE(collector.attach(segment));
+    std::ostringstream out;
+
+    // Act
+    const auto deadline =
+        std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (std::chrono::steady_clock::now() < deadline &&
+           !collector.finished())
+    {
+        collector.poll(out);
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    // Assert
+    EXPECT_TRUE(collector.finished());
+    EXPECT_EQ(out.str(), "{\"traceEvents\":[{}]}");
+}
+
+#endif // ST_HAS_SHARED_MEMORY
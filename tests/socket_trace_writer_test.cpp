@@ -0,0 +1,93 @@
+#include <gtest/gtest.h>
+
+#include <filesystem>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#include "instrumentor.h"
+#include "socket_trace_writer.h"
+
+#if ST_HAS_UNIX_SOCKET
+
+class SocketTraceWriterTest : public ::testing::Test
+{
+  protected:
+    std::filesystem::path socketPath{};
+
+    void SetUp() override
+    {
+        socketPath = std::filesystem::temp_directory_path() /
+                     "socket_trace_writer_test.sock";
+        Instrumentor::get().endSession();
+    }
+
+    void TearDown() override
+    {
+        Instrumentor::get().endSession();
+        std::error_code ec;
+        std::filesystem::remove(socketPath, ec);
+    }
+};
+
+TEST_F(SocketTraceWriterTest, Session_StreamsCompleteTraceToReceiver)
+{
+    // Arrange
+    instrumentation::TraceStreamReceiver receiver;
+    ASSERT_TRUE(receiver.listen(socketPath.string()));
+    std::ostringstream out;
+    instrumentation::StreamReceiveStats stats;
+    std::thread consumer([&] { stats = receiver.receive(out); });
+
+    SessionOptions options;
+    options.backend = instrumentation::OutputBackend::Socket;
+    options.compression = instrumentation::Compression::Gzip;
+
+    // Act
+    Instrumentor::get().beginSession("Live", socketPath.string(), options);
+    {
+        InstrumentationTimer timer("Streamed");
+    }
+    Instrumentor::get().endSession();
+    consumer.join();
+
+    // Assert: compression does not apply to a stream
+    const std::string json = out.str();
+    EXPECT_EQ(json.rfind("{\"otherData\"", 0), 0u);
+    EXPECT_NE(json.find("\"name\":\"Streamed\""), std::string::npos);
+    EXPECT_TRUE(json.ends_with("]}"));
+    EXPECT_EQ(stats.bytes, json.size());
+    EXPECT_EQ(stats.droppedEvents, 0u);
+}
+
+TEST_F(SocketTraceWriterTest, SlowConsumer_DropsAndReportsBlocks)
+{
+    // Arrange
+    instrumentation::TraceStreamReceiver receiver;
+    ASSERT_TRUE(receiver.listen(socketPath.string()));
+    instrumentation::SocketTraceWriter writer(0, 64 * 1024);
+    ASSERT_TRUE(writer.open(socketPath.string()));
+    const std::string block =
+        ",{\"ph\":\"X\",\"pad\":\"" + std::string(32 * 1024, 'x') + "\"}";
+
+    // Act: nothing is read until the socket and the queue are full
+    writer.write("[{}", 3);
+    for (int i = 0; i < 200; ++i)
+        writer.write(block.data(), block.size());
+
+    std::ostringstream out;
+    instrumentation::StreamReceiveStats stats;
+    std::thread consumer([&] { stats = receiver.receive(out); });
+    writer.close();
+    consumer.join();
+
+    // Assert
+    EXPECT_GT(writer.droppedEvents(), 0u);
+    EXPECT_EQ(stats.droppedEvents, writer.droppedEvents());
+    EXPECT_EQ(stats.droppedBytes, writer.droppedBytes());
+    EXPECT_NE(out.str().find("\"name\":\"Dropped events\""),
+              std::string::npos);
+    EXPECT_TRUE(out.str().ends_with("]}"));
+}
+
+#endif // ST_HAS_UNIX_SOCKET
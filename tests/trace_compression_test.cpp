@@ -0,0 +1,130 @@
+#include <gtest/gtest.h>
+
+#include <filesystem>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "instrumentor.h"
+#include "trace_compression.h"
+
+static int countOccurrences(const std::string &haystack,
+                            const std::string &needle)
+{
+    int count = 0;
+    size_t pos = 0;
+    while ((pos = haystack.find(needle, pos)) != std::string::npos)
+    {
+        ++count;
+        pos += needle.size();
+    }
+    return count;
+}
+
+class TraceCompressionTest : public ::testing::Test
+{
+  protected:
+    std::filesystem::path outPath{};
+
+    void SetUp() override
+    {
+        outPath = std::filesystem::temp_directory_path() /
+                  "trace_compression_test.json";
+        removeOutputs();
+        Instrumentor::get().endSession();
+    }
+
+    void TearDown() override
+    {
+        Instrumentor::get().endSession();
+        removeOutputs();
+    }
+
+    void removeOutputs()
+    {
+        std::error_code ec;
+        std::filesystem::remove(outPath, ec);
+        std::filesystem::remove(outPath.string() + ".gz", ec);
+        std::filesystem::remove(outPath.string() + ".zst", ec);
+    }
+};
+
+TEST_F(TraceCompressionTest, AvailableCompression_NoneStaysNone)
+{
+    EXPECT_EQ(instrumentation::availableCompression(
+                  instrumentation::Compression::None),
+              instrumentation::Compression::None);
+    EXPECT_STREQ(instrumentation::compressionExtension(
+                     instrumentation::Compression::None),
+                 "");
+}
+
+#if defined(ST_HAVE_ZLIB)
+
+static std::string readGzipFile(const std::filesystem::path &p)
+{
+    std::string out;
+    gzFile file = gzopen(p.string().c_str(), "rb");
+    if (file == nullptr)
+        return out;
+    char chunk[4096];
+    int n = 0;
+    while ((n = gzread(file, chunk, sizeof(chunk))) > 0)
+        out.append(chunk, static_cast<size_t>(n));
+    gzclose(file);
+    return out;
+}
+
+TEST_F(TraceCompressionTest, GzipSession_WritesDecompressibleTrace)
+{
+    // Arrange
+    SessionOptions options;
+    options.compression = instrumentation::Compression::Gzip;
+    options.bufferSize = 1024;
+
+    // Act
+    Instrumentor::get().beginSession("Gzip", outPath.string(), options);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 3; ++t)
+    {
+        threads.emplace_back([] {
+            for (int i = 0; i < 100; ++i)
+            {
+                InstrumentationTimer timer("CompressedScope");
+            }
+        });
+    }
+    for (auto &t : threads)
+        t.join();
+    Instrumentor::get().endSession();
+
+    // Assert: extension appended, uncompressed file not created
+    const std::filesystem::path gzPath = outPath.string() + ".gz";
+    ASSERT_TRUE(std::filesystem::exists(gzPath));
+    EXPECT_FALSE(std::filesystem::exists(outPath));
+
+    const std::string json = readGzipFile(gzPath);
+    EXPECT_EQ(json.rfind("{\"otherData\": {},\"traceEvents\":[", 0), 0u);
+    EXPECT_EQ(json.rfind("]}"), json.size() - 2) << "File should end with ]}";
+    EXPECT_EQ(countOccurrences(json, "\"ph\":\"X\""), 300);
+    EXPECT_LT(std::filesystem::file_size(gzPath), json.size());
+}
+
+TEST_F(TraceCompressionTest, GzipSession_DoesNotDuplicateExtension)
+{
+    // Arrange
+    SessionOptions options;
+    options.compression = instrumentation::Compression::Gzip;
+    const std::filesystem::path gzPath = outPath.string() + ".gz";
+
+    // Act
+    Instrumentor::get().beginSession("GzipExt", gzPath.string(), options);
+    Instrumentor::get().endSession();
+
+    // Assert
+    EXPECT_TRUE(std::filesystem::exists(gzPath));
+    EXPECT_NE(readGzipFile(gzPath).find("\"traceEvents\""),
+              std::string::npos);
+}
+
+#endif // ST_HAVE_ZLIB
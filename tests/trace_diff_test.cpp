@@ -0,0 +1,138 @@
+#include <gtest/gtest.h>
+
+#include <string>
+
+#include "trace_diff.h"
+
+class TraceDiffTest : public ::testing::Test
+{
+  protected:
+    static void addScope(instrumentation::TraceSummary &summary,
+                         const std::string &name, double firstUs,
+                         int calls, double childUs = 0)
+    {
+        instrumentation::ScopeSummary scope;
+        scope.name = name;
+        for (int i = 0; i < calls; ++i)
+        {
+            const double us = firstUs + i % 10;
+            scope.durations.add(us);
+            scope.selfDurations.add(us - childUs);
+            scope.inclusiveUs += us;
+            scope.selfUs += us - childUs;
+        }
+        scope.calls = static_cast<uint64_t>(calls);
+        summary.scopes.push_back(std::move(scope));
+    }
+};
+
+TEST_F(TraceDiffTest, DiffSummaries_ClassifiesScopes)
+{
+    // Arrange
+    instrumentation::TraceSummary base;
+    instrumentation::TraceSummary candidate;
+    addScope(base, "Slower", 100, 200);
+    addScope(candidate, "Slower", 130, 200);
+    addScope(base, "Faster", 100, 200);
+    addScope(candidate, "Faster", 50, 200);
+    addScope(base, "Same", 100, 200);
+    addScope(candidate, "Same", 100, 200);
+    addScope(base, "Rare", 100, 3);
+    addScope(candidate, "Rare", 900, 3);
+    addScope(base, "Gone", 10, 5);
+    addScope(candidate, "New", 10, 5);
+
+    // Act
+    const instrumentation::TraceDiff diff =
+        instrumentation::diffSummaries(base, candidate);
+
+    // Assert
+    ASSERT_EQ(diff.scopes.size(), 6u);
+    EXPECT_EQ(diff.regressions, 1u);
+    EXPECT_EQ(diff.improvements, 1u);
+    EXPECT_EQ(diff.scopes[0].verdict, instrumentation::DiffVerdict::Regression);
+    EXPECT_NEAR(diff.scopes[0].change, 0.29, 0.01);
+    EXPECT_LT(diff.scopes[0].pValue, 0.001);
+    EXPECT_EQ(diff.scopes[1].verdict,
+              instrumentation::DiffVerdict::Improvement);
+    EXPECT_EQ(diff.scopes[2].verdict, instrumentation::DiffVerdict::Unchanged);
+    EXPECT_GT(diff.scopes[2].pValue, 0.5);
+    EXPECT_EQ(diff.scopes[3].verdict, instrumentation::DiffVerdict::Unchanged);
+    EXPECT_EQ(diff.scopes[4].verdict, instrumentation::DiffVerdict::Removed);
+    EXPECT_EQ(diff.scopes[5].verdict, instrumentation::DiffVerdict::Added);
+    EXPECT_EQ(diff.scopes[5].name, "New");
+
+    const std::string json = instrumentation::diffToJson(diff);
+    EXPECT_EQ(json.rfind("{\"regressions\":1,\"improvements\":1,", 0), 0u);
+    EXPECT_NE(json.find("{\"name\":\"Slower\",\"verdict\":\"regression\""),
+              std::string::npos);
+}
+
+TEST_F(TraceDiffTest, DiffSummaries_JudgesSelfTimeAndCallCount)
+{
+    // Arrange: the inclusive durations of both scopes stay the same
+    instrumentation::TraceSummary base;
+    instrumentation::TraceSummary candidate;
+    addScope(base, "MoreSelf", 100, 200, 60);
+    addScope(candidate, "MoreSelf", 100, 200, 20);
+    addScope(base, "MoreCalls", 100, 200);
+    addScope(candidate, "MoreCalls", 100, 400);
+
+    // Act
+    const instrumentation::TraceDiff diff =
+        instrumentation::diffSummaries(base, candidate);
+
+    // Assert
+    ASSERT_EQ(diff.scopes.size(), 2u);
+    EXPECT_EQ(diff.regressions, 2u);
+    EXPECT_GT(diff.scopes[0].pValue, 0.5);
+    EXPECT_LT(diff.scopes[0].selfPValue, 0.001);
+    EXPECT_EQ(diff.scopes[0].verdict, instrumentation::DiffVerdict::Regression);
+    EXPECT_NEAR(diff.scopes[1].callsChange, 1.0, 1e-9);
+    EXPECT_LT(diff.scopes[1].callsPValue, 0.001);
+    EXPECT_EQ(diff.scopes[1].verdict, instrumentation::DiffVerdict::Regression);
+}
+
+TEST_F(TraceDiffTest, DiffSummaries_TakesDirectionFromRankTest)
+{
+    // Arrange: most calls got faster, but one outlier raises the mean
+    instrumentation::TraceSummary base;
+    instrumentation::TraceSummary candidate;
+    addScope(base, "Outlier", 100, 200);
+    addScope(candidate, "Outlier", 80, 199);
+    instrumentation::ScopeSummary &scope = candidate.scopes.back();
+    scope.durations.add(100000);
+    scope.selfDurations.add(100000);
+    scope.inclusiveUs += 100000;
+    scope.selfUs += 100000;
+    ++scope.calls;
+
+    // Act
+    const instrumentation::TraceDiff diff =
+        instrumentation::diffSummaries(base, candidate);
+
+    // Assert
+    ASSERT_EQ(diff.scopes.size(), 1u);
+    EXPECT_GT(diff.scopes[0].change, 0);
+    EXPECT_LT(diff.scopes[0].pValue, 0.001);
+    EXPECT_NE(diff.scopes[0].verdict,
+              instrumentation::DiffVerdict::Regression);
+    EXPECT_EQ(diff.regressions, 0u);
+}
+
+TEST_F(TraceDiffTest, DiffToJson_EscapesNames)
+{
+    // Arrange
+    instrumentation::TraceSummary base;
+    instrumentation::TraceSummary candidate;
+    addScope(base, "say \"hi\"\n", 10, 5);
+    addScope(candidate, "say \"hi\"\n", 10, 5);
+
+    // Act
+    const std::string json = instrumentation::diffToJson(
+        instrumentation::diffSummaries(base, candidate));
+
+    // Assert
+    EXPECT_NE(json.find("{\"name\":\"say \\\"hi\\\"\\n\","),
+              std::string::npos);
+}
@@ -0,0 +1,145 @@
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "instrumentor.h"
+#include "trace_merge.h"
+
+static void writeFile(const std::filesystem::path &p, const std::string &text)
+{
+    std::ofstream out(p, std::ios::binary | std::ios::trunc);
+    out << text;
+}
+
+class TraceMergeTest : public ::testing::Test
+{
+  protected:
+    std::filesystem::path firstPath{};
+    std::filesystem::path secondPath{};
+
+    void SetUp() override
+    {
+        const std::filesystem::path dir =
+            std::filesystem::temp_directory_path();
+        firstPath = dir / "trace_merge_test_a.json";
+        secondPath = dir / "trace_merge_test_b.json";
+        Instrumentor::get().endSession();
+    }
+
+    void TearDown() override
+    {
+        Instrumentor::get().endSession();
+        std::error_code ec;
+        std::filesystem::remove(firstPath, ec);
+        std::filesystem::remove(secondPath, ec);
+    }
+};
+
+TEST_F(TraceMergeTest, MergeTraces_SortsAndShiftsByClockAnchor)
+{
+    // Arrange: b starts 3us after a; a's events are out of order
+    writeFile(firstPath,
+              "{\"otherData\": {},\"traceEvents\":["
+              "{\"name\":\"trace_clock_anchor\",\"ph\":\"M\",\"pid\":7,"
+              "\"tid\":0,\"args\":{\"host\":\"h\",\"steady_us\":1000,"
+              "\"wall_us\":50}}, "
+              "{\"name\":\"A5\",\"ph\":\"X\",\"pid\":7,\"tid\":1,\"ts\":5}, "
+              "{\"name\":\"A1\",\"ph\":\"b\",\"id\":\"0x1\",\"pid\":7,"
+              "\"tid\":1,\"ts\":1}]}");
+    writeFile(secondPath,
+              "{\"otherData\": {},\"traceEvents\":["
+              "{\"name\":\"trace_clock_anchor\",\"ph\":\"M\",\"pid\":7,"
+              "\"tid\":0,\"args\":{\"host\":\"h\",\"steady_us\":1003,"
+              "\"wall_us\":10}}, "
+              "{\"name\":\"B0\",\"ph\":\"X\",\"pid\":7,\"tid\":1,\"ts\":0}]}");
+    std::ostringstream out;
+
+    // Act
+    const instrumentation::MergeStats stats = instrumentation::mergeTraces(
+        {firstPath.string(), secondPath.string()}, out);
+    const std::string json = out.str();
+
+    // Assert
+    EXPECT_EQ(stats.events, 3u);
+    EXPECT_EQ(stats.lateEvents, 0u);
+    EXPECT_EQ(stats.remappedPids, 1u);
+    EXPECT_TRUE(stats.steadyClock);
+    EXPECT_EQ(json.find("trace_clock_anchor"), std::string::npos);
+
+    const size_t a1 = json.find("\"A1\"");
+    const size_t b0 = json.find("\"B0\"");
+    const size_t a5 = json.find("\"A5\"");
+    ASSERT_NE(a1, std::string::npos);
+    ASSERT_NE(b0, std::string::npos);
+    ASSERT_NE(a5, std::string::npos);
+    EXPECT_LT(a1, b0);
+    EXPECT_LT(b0, a5);
+    EXPECT_NE(json.find("\"pid\":10000000,\"tid\":1,\"ts\":3}"),
+              std::string::npos);
+    EXPECT_NE(json.find("\"id\":\"0x1000000000001\""), std::string::npos);
+    EXPECT_EQ(json.substr(json.size() - 2), "]}");
+}
+
+TEST_F(TraceMergeTest, MergeTraces_AlignsRecordedSessions)
+{
+    // Arrange: two sessions of this process, one after the other
+    Instrumentor::get().beginSession("First", firstPath.string());
+    {
+        InstrumentationTimer timer("FirstWork");
+    }
+    Instrumentor::get().endSession();
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    Instrumentor::get().beginSession("Second", secondPath.string());
+    {
+        InstrumentationTimer timer("SecondWork");
+    }
+    Instrumentor::get().endSession();
+    std::ostringstream out;
+
+    // Act: inputs in reverse order
+    const instrumentation::MergeStats stats = instrumentation::mergeTraces(
+        {secondPath.string(), firstPath.string()}, out);
+    const std::string json = out.str();
+
+    // Assert
+    EXPECT_EQ(stats.inputs, 2u);
+    EXPECT_EQ(stats.unanchored, 0u);
+    EXPECT_TRUE(stats.steadyClock);
+    EXPECT_EQ(stats.remappedPids, 1u);
+    const size_t first = json.find("\"FirstWork\"");
+    const size_t second = json.find("\"SecondWork\"");
+    ASSERT_NE(first, std::string::npos);
+    ASSERT_NE(second, std::string::npos);
+    EXPECT_LT(first, second);
+}
+
+TEST_F(TraceMergeTest, MergeTraces_MetadataMidFile_IsNotLate)
+{
+    // Arrange: a thread_name event after timed events, with a small window
+    writeFile(firstPath,
+              "{\"otherData\": {},\"traceEvents\":["
+              "{\"name\":\"A1\",\"ph\":\"X\",\"pid\":7,\"tid\":1,\"ts\":1}, "
+              "{\"name\":\"A2\",\"ph\":\"X\",\"pid\":7,\"tid\":1,\"ts\":2}, "
+              "{\"name\":\"A3\",\"ph\":\"X\",\"pid\":7,\"tid\":1,\"ts\":3}, "
+              "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":7,\"tid\":2,"
+              "\"args\":{\"name\":\"worker\"}}, "
+              "{\"name\":\"A4\",\"ph\":\"X\",\"pid\":7,\"tid\":2,\"ts\":4}]}");
+    instrumentation::MergeOptions options;
+    options.reorderWindow = 1;
+    std::ostringstream out;
+
+    // Act
+    const instrumentation::MergeStats stats = instrumentation::mergeTraces(
+        {firstPath.string()}, out, options);
+
+    // Assert
+    EXPECT_EQ(stats.events, 5u);
+    EXPECT_EQ(stats.lateEvents, 0u);
+    EXPECT_NE(out.str().find("\"worker\""), std::string::npos);
+}
@@ -0,0 +1,120 @@
+#include <gtest/gtest.h>
+
+#include <filesystem>
+#include <fstream>
+#include <string>
+
+#include "instrumentor.h"
+#include "trace_parser.h"
+
+class TraceParserTest : public ::testing::Test
+{
+  protected:
+    std::filesystem::path outPath{};
+
+    void SetUp() override
+    {
+        outPath =
+            std::filesystem::temp_directory_path() / "trace_parser_test.json";
+        Instrumentor::get().endSession();
+    }
+
+    void TearDown() override
+    {
+        Instrumentor::get().endSession();
+        std::error_code ec;
+        std::filesystem::remove(outPath, ec);
+    }
+};
+
+TEST_F(TraceParserTest, ParseEvent_ReadsFieldsAroundNestedValues)
+{
+    // Arrange: quotes and brackets inside strings and args
+    const std::string text =
+        "{\"name\":\"a\\\"b}\",\"args\":{\"k\":[1,{\"x\":\"]\"}]},"
+        "\"ph\":\"i\",\"s\":\"t\",\"ts\":1.5,\"pid\":3,\"tid\":4,"
+        "\"id\":\"0x2a\",\"cat\":\"instant\"}";
+    instrumentation::TraceEvent event;
+
+    // Act
+    const bool parsed = instrumentation::parseEvent(text, event);
+
+    // Assert
+    ASSERT_TRUE(parsed);
+    EXPECT_EQ(event.name, "a\\\"b}");
+    EXPECT_EQ(event.args, "{\"k\":[1,{\"x\":\"]\"}]}");
+    EXPECT_EQ(event.phase, 'i');
+    EXPECT_EQ(event.scope, 't');
+    EXPECT_TRUE(event.hasTs);
+    EXPECT_DOUBLE_EQ(event.ts, 1.5);
+    EXPECT_FALSE(event.hasDur);
+    EXPECT_EQ(event.pid, 3u);
+    EXPECT_EQ(event.tid, 4u);
+    EXPECT_EQ(event.id, "0x2a");
+    EXPECT_EQ(event.cat, "instant");
+    EXPECT_FALSE(instrumentation::parseEvent("{\"name\":\"cut", event));
+}
+
+TEST_F(TraceParserTest, Parser_StreamsRecordedSessionInSmallChunks)
+{
+    // Arrange
+    Instrumentor::get().beginSession("Parser", outPath.string());
+    for (int i = 0; i < 100; ++i)
+    {
+        InstrumentationTimer timer("Work", "index", i);
+    }
+    Instrumentor::get().writeInstant("Done");
+    Instrumentor::get().endSession();
+
+    // Act: a chunk size that splits most events
+    instrumentation::TraceParser parser(7);
+    ASSERT_TRUE(parser.open(outPath.string()));
+    int work = 0;
+    int instants = 0;
+    int metadata = 0;
+    instrumentation::TraceEvent event;
+    while (parser.next(event))
+    {
+        if (event.phase == 'X' && event.name == "Work")
+        {
+            ++work;
+            EXPECT_TRUE(event.hasDur);
+            EXPECT_TRUE(event.hasTs);
+            EXPECT_FALSE(
+                instrumentation::findField(event.args, "index").empty());
+        }
+        else if (event.phase == 'i')
+        {
+            ++instants;
+        }
+        else if (event.phase == 'M')
+        {
+            ++metadata;
+        }
+    }
+    const int64_t pushed = instrumentation::parseTrace(
+        outPath.string(), [](const instrumentation::TraceEvent &) {});
+
+    // Assert
+    EXPECT_EQ(work, 100);
+    EXPECT_EQ(instants, 1);
+    EXPECT_GE(metadata, 2); // process name and clock anchor
+    EXPECT_EQ(parser.malformed(), 0u);
+    EXPECT_EQ(pushed, static_cast<int64_t>(parser.events()));
+}
+
+TEST(TraceParserUnescapeTest, Unescape_DecodesJsonEscapes)
+{
+    // Arrange
+    const std::string_view raw = "plain";
+    std::string storage;
+
+    // Act
+    const std::string_view plain = instrumentation::unescape(raw, storage);
+    const std::string decoded(instrumentation::unescape(
+        "a\\\"b\\\\c\\nd\\u0001\\u00e9\\ud83d\\ude00\\u12", storage));
+
+    // Assert
+    EXPECT_EQ(plain.data(), raw.data());
+    EXPECT_EQ(decoded, "a\"b\\c\nd\x01\xc3\xa9\xf0\x9f\x98\x80\\u12");
+}
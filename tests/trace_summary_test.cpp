@@ -0,0 +1,119 @@
+#include <gtest/gtest.h>
+
+#include <filesystem>
+#include <fstream>
+#include <string>
+
+#include "trace_summary.h"
+
+static const instrumentation::ScopeSummary *
+findScope(const instrumentation::TraceSummary &summary,
+          const std::string &name)
+{
+    for (const instrumentation::ScopeSummary &scope : summary.scopes)
+    {
+        if (scope.name == name)
+            return &scope;
+    }
+    return nullptr;
+}
+
+class TraceSummaryTest : public ::testing::Test
+{
+  protected:
+    std::filesystem::path outPath{};
+
+    void SetUp() override
+    {
+        outPath =
+            std::filesystem::temp_directory_path() / "trace_summary_test.json";
+    }
+
+    void TearDown() override
+    {
+        std::error_code ec;
+        std::filesystem::remove(outPath, ec);
+    }
+};
+
+TEST_F(TraceSummaryTest, Summarize_SubtractsDirectChildrenFromSelfTime)
+{
+    // Arrange: slices in the order they end, as Instrumentor writes them
+    std::ofstream(outPath)
+        << "{\"otherData\": {},\"traceEvents\":["
+           "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0}, "
+           "{\"dur\":20,\"name\":\"Child\",\"ph\":\"X\",\"pid\":1,\"tid\":1,"
+           "\"ts\":10}, "
+           "{\"dur\":10,\"name\":\"Child\",\"ph\":\"X\",\"pid\":1,\"tid\":1,"
+           "\"ts\":40}, "
+           "{\"dur\":100,\"name\":\"Parent\",\"ph\":\"X\",\"pid\":1,"
+           "\"tid\":1,\"ts\":0}, "
+           "{\"name\":\"Outer\",\"ph\":\"B\",\"pid\":1,\"tid\":2,\"ts\":0}, "
+           "{\"dur\":5,\"name\":\"Child\",\"ph\":\"X\",\"pid\":1,\"tid\":2,"
+           "\"ts\":5}, "
+           "{\"name\":\"Outer\",\"ph\":\"E\",\"pid\":1,\"tid\":2,\"ts\":50}"
+           "]}";
+    instrumentation::SummaryOptions options;
+    options.workers = 2;
+    instrumentation::TraceSummary summary;
+
+    // Act
+    const bool ok =
+        instrumentation::summarizeTrace(outPath.string(), summary, options);
+
+    // Assert
+    ASSERT_TRUE(ok);
+    EXPECT_EQ(summary.events, 7u);
+    EXPECT_EQ(summary.slices, 5u);
+    EXPECT_EQ(summary.threads, 2u);
+    const instrumentation::ScopeSummary *parent = findScope(summary, "Parent");
+    const instrumentation::ScopeSummary *child = findScope(summary, "Child");
+    const instrumentation::ScopeSummary *outer = findScope(summary, "Outer");
+    ASSERT_NE(parent, nullptr);
+    ASSERT_NE(child, nullptr);
+    ASSERT_NE(outer, nullptr);
+    EXPECT_DOUBLE_EQ(parent->selfUs, 70);
+    EXPECT_EQ(child->calls, 3u);
+    EXPECT_DOUBLE_EQ(child->inclusiveUs, 35);
+    EXPECT_DOUBLE_EQ(child->selfUs, 35);
+    EXPECT_EQ(outer->calls, 1u);
+    EXPECT_DOUBLE_EQ(outer->inclusiveUs, 50);
+    EXPECT_DOUBLE_EQ(outer->selfUs, 45);
+}
+
+TEST_F(TraceSummaryTest, Summarize_ReportsUnescapedNames)
+{
+    // Arrange: the same name once through an escape
+    std::ofstream(outPath)
+        << "{\"otherData\": {},\"traceEvents\":["
+           "{\"dur\":1,\"name\":\"say \\\"hi\\\"\",\"ph\":\"X\",\"pid\":1,"
+           "\"tid\":1,\"ts\":0}, "
+           "{\"dur\":1,\"name\":\"say \\u0022hi\\u0022\",\"ph\":\"X\","
+           "\"pid\":1,\"tid\":1,\"ts\":2}]}";
+    instrumentation::TraceSummary summary;
+
+    // Act
+    const bool ok = instrumentation::summarizeTrace(outPath.string(), summary);
+
+    // Assert
+    ASSERT_TRUE(ok);
+    ASSERT_EQ(summary.scopes.size(), 1u);
+    EXPECT_EQ(summary.scopes[0].name, "say \"hi\"");
+    EXPECT_EQ(summary.scopes[0].calls, 2u);
+}
+
+TEST_F(TraceSummaryTest, Histogram_PercentilesWithinBucketResolution)
+{
+    // Arrange
+    instrumentation::DurationHistogram histogram;
+
+    // Act
+    for (int us = 1; us <= 10000; ++us)
+        histogram.add(us);
+
+    // Assert
+    EXPECT_EQ(histogram.count(), 10000u);
+    EXPECT_NEAR(histogram.percentile(0.5), 5000, 5000 * 0.04);
+    EXPECT_NEAR(histogram.percentile(0.99), 9900, 9900 * 0.04);
+    EXPECT_EQ(instrumentation::DurationHistogram{}.percentile(0.5), 0);
+}
@@ -0,0 +1,377 @@
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "instrumentor.h"
+#include "io_uring_trace_writer.h"
+#include "rotating_trace_writer.h"
+#include "trace_writer.h"
+
+static std::string readFile(const std::filesystem::path &p)
+{
+    std::ifstream in(p, std::ios::in | std::ios::binary);
+    std::string s((std::istreambuf_iterator<char>(in)),
+                  std::istreambuf_iterator<char>());
+    return s;
+}
+
+static int countOccurrences(const std::string &haystack,
+                            const std::string &needle)
+{
+    int count = 0;
+    size_t pos = 0;
+    while ((pos = haystack.find(needle, pos)) != std::string::npos)
+    {
+        ++count;
+        pos += needle.size();
+    }
+    return count;
+}
+
+namespace
+{
+/**
+ * @brief Writer whose writes wait until `released` is ready.
+ */
+struct StalledWriter final : instrumentation::TraceWriter
+{
+    explicit StalledWriter(std::shared_future<void> released)
+        : released(std::move(released))
+    {
+    }
+
+    bool open(const std::string &) override
+    {
+        return true;
+    }
+
+    void write(const char *, std::size_t size) override
+    {
+        released.wait();
+        written += size;
+    }
+
+    void close() override
+    {
+    }
+
+    bool isOpen() const override
+    {
+        return true;
+    }
+
+    std::shared_future<void> released;
+    std::size_t written = 0;
+};
+} // namespace
+
+class TraceWriterTest : public ::testing::Test
+{
+  protected:
+    std::filesystem::path outPath{};
+
+    void SetUp() override
+    {
+        outPath = std::filesystem::temp_directory_path() /
+                  "trace_writer_test_output.json";
+        std::error_code ec;
+        std::filesystem::remove(outPath, ec);
+        Instrumentor::get().endSession();
+    }
+
+    void TearDown() override
+    {
+        Instrumentor::get().endSession();
+        std::error_code ec;
+        std::filesystem::remove(outPath, ec);
+    }
+};
+
+#if ST_HAS_MMAP
+
+TEST_F(TraceWriterTest, MappedWriter_GrowsAcrossChunksAndTrimsFile)
+{
+    // Arrange
+    instrumentation::MappedTraceWriter writer(4096);
+    ASSERT_TRUE(writer.open(outPath.string()));
+
+    // Act: write well past the first chunk
+    std::string expected;
+    const std::string line = "0123456789abcdef";
+    for (int i = 0; i < 1000; ++i)
+    {
+        writer.write(line.data(), line.size());
+        expected += line;
+    }
+    writer.close();
+
+    // Assert
+    EXPECT_EQ(std::filesystem::file_size(outPath), expected.size());
+    EXPECT_EQ(readFile(outPath), expected);
+}
+
+TEST_F(TraceWriterTest, MappedWriter_ConcurrentWritesAreNotLost)
+{
+    // Arrange
+    instrumentation::MappedTraceWriter writer(8192);
+    ASSERT_TRUE(writer.open(outPath.string()));
+
+    // Act
+    std::vector<std::thread> threads;
+    for (char c = 'a'; c < 'e'; ++c)
+    {
+        threads.emplace_back([&writer, c] {
+            const std::string block(100, c);
+            for (int i = 0; i < 200; ++i)
+                writer.write(block.data(), block.size());
+        });
+    }
+    for (auto &t : threads)
+        t.join();
+    writer.close();
+
+    // Assert: every block landed intact
+    const std::string contents = readFile(outPath);
+    ASSERT_EQ(contents.size(), 4u * 200u * 100u);
+    for (char c = 'a'; c < 'e'; ++c)
+        EXPECT_EQ(countOccurrences(contents, std::string(100, c)), 200);
+}
+
+#endif // ST_HAS_MMAP
+
+TEST_F(TraceWriterTest, MappedBackend_SessionProducesCompleteTrace)
+{
+    // Arrange
+    SessionOptions options;
+    options.backend = instrumentation::OutputBackend::MappedFile;
+    options.bufferSize = 256; // force several block hand-overs
+
+    // Act
+    Instrumentor::get().beginSession("Mapped", outPath.string(), options);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t)
+    {
+        threads.emplace_back([] {
+            for (int i = 0; i < 50; ++i)
+            {
+                InstrumentationTimer timer("MappedScope");
+            }
+        });
+    }
+    for (auto &t : threads)
+        t.join();
+    Instrumentor::get().endSession();
+
+    // Assert
+    const std::string json = readFile(outPath);
+    EXPECT_EQ(json.rfind("{\"otherData\": {},\"traceEvents\":[", 0), 0u);
+    EXPECT_EQ(json.rfind("]}"), json.size() - 2) << "File should end with ]}";
+    EXPECT_EQ(countOccurrences(json, "\"ph\":\"X\""), 200);
+    EXPECT_EQ(json.find('\0'), std::string::npos);
+}
+
+#if ST_HAS_IO_URING
+
+TEST_F(TraceWriterTest, IoUringWriter_WritesAllBuffersInOrder)
+{
+    // Arrange: small buffers so several writes are in flight
+    instrumentation::IoUringTraceWriter writer(false, 4096, 4);
+    if (!writer.open(outPath.string()))
+        GTEST_SKIP() << "io_uring is not available in this environment";
+
+    // Act
+    std::string expected;
+    for (int i = 0; i < 5000; ++i)
+    {
+        const std::string line = std::to_string(i) + ",";
+        writer.write(line.data(), line.size());
+        expected += line;
+    }
+    writer.close();
+
+    // Assert
+    EXPECT_EQ(readFile(outPath), expected);
+}
+
+TEST_F(TraceWriterTest, IoUringWriter_DirectIoTrimsPaddedTail)
+{
+    // Arrange
+    instrumentation::IoUringTraceWriter writer(true, 8192, 2);
+    if (!writer.open(outPath.string()))
+        GTEST_SKIP() << "io_uring is not available in this environment";
+
+    // Act: length deliberately not a multiple of the alignment
+    const std::string payload(10000, 'x');
+    writer.write(payload.data(), payload.size());
+    writer.close();
+
+    // Assert
+    EXPECT_EQ(std::filesystem::file_size(outPath), payload.size());
+    EXPECT_EQ(readFile(outPath), payload);
+}
+
+#endif // ST_HAS_IO_URING
+
+TEST_F(TraceWriterTest, IoUringBackend_SessionProducesCompleteTrace)
+{
+    // Arrange: falls back to the stream writer where io_uring is unavailable
+    SessionOptions options;
+    options.backend = instrumentation::OutputBackend::IoUring;
+    options.bufferSize = 512;
+
+    // Act
+    Instrumentor::get().beginSession("IoUring", outPath.string(), options);
+    for (int i = 0; i < 100; ++i)
+    {
+        InstrumentationTimer timer("UringScope");
+    }
+    Instrumentor::get().endSession();
+
+    // Assert
+    const std::string json = readFile(outPath);
+    EXPECT_EQ(json.rfind("]}"), json.size() - 2) << "File should end with ]}";
+    EXPECT_EQ(countOccurrences(json, "\"ph\":\"X\""), 100);
+}
+
+TEST_F(TraceWriterTest, AsyncWriter_DrainsQueueOnClose)
+{
+    // Arrange: tiny queue bound so producers have to wait for the writer
+    instrumentation::AsyncTraceWriter writer(
+        std::make_unique<instrumentation::StreamTraceWriter>(), 64,
+        instrumentation::QueueFullPolicy::Wait);
+    ASSERT_TRUE(writer.open(outPath.string()));
+
+    // Act
+    std::string expected;
+    for (int i = 0; i < 1000; ++i)
+    {
+        const std::string line = std::to_string(i) + ";";
+        writer.write(line.data(), line.size());
+        expected += line;
+    }
+    writer.close();
+
+    // Assert
+    EXPECT_EQ(readFile(outPath), expected);
+}
+
+TEST_F(TraceWriterTest, AsyncWriter_DropsBlocksWhenQueueIsFull)
+{
+    // Arrange: the inner writer stalls until released
+    std::promise<void> release;
+    auto inner = std::make_unique<StalledWriter>(release.get_future().share());
+    const StalledWriter &stalled = *inner;
+    instrumentation::AsyncTraceWriter writer(
+        std::move(inner), 64, instrumentation::QueueFullPolicy::Drop);
+    writer.setDropReport([](uint64_t blocks, uint64_t bytes) {
+        return std::to_string(blocks) + "/" + std::to_string(bytes);
+    });
+    ASSERT_TRUE(writer.open(outPath.string()));
+    const std::string block(100, 'x');
+
+    // Act: the first block fills the queue on its own
+    for (int i = 0; i < 10; ++i)
+        writer.write(block.data(), block.size());
+    release.set_value();
+    writer.close();
+
+    // Assert
+    EXPECT_EQ(writer.droppedBlocks(), 9u);
+    EXPECT_EQ(writer.droppedBytes(), 900u);
+    EXPECT_EQ(stalled.written, 100u + std::string("9/900").size());
+    EXPECT_FALSE(writer.isOpen());
+}
+
+TEST_F(TraceWriterTest, RotatedPath_InsertsIndexBeforeJsonExtension)
+{
+    EXPECT_EQ(instrumentation::rotatedPath("trace.json", 0), "trace.json");
+    EXPECT_EQ(instrumentation::rotatedPath("trace.json", 3), "trace.3.json");
+    EXPECT_EQ(instrumentation::rotatedPath("out/trace.json.gz", 1),
+              "out/trace.1.json.gz");
+    EXPECT_EQ(instrumentation::rotatedPath("trace", 2), "trace.2");
+}
+
+TEST_F(TraceWriterTest, Rotation_SplitsSessionIntoCompleteFiles)
+{
+    // Arrange
+    SessionOptions options;
+    options.bufferSize = 512;
+    options.rotation.maxBytes = 2048;
+
+    // Act
+    Instrumentor::get().beginSession("Rotating", outPath.string(), options);
+    for (int i = 0; i < 200; ++i)
+    {
+        InstrumentationTimer timer("RotatedScope");
+    }
+    Instrumentor::get().endSession();
+
+    // Assert: every file is a complete trace and no event is lost
+    int totalEvents = 0;
+    std::size_t files = 0;
+    for (;; ++files)
+    {
+        const std::filesystem::path path =
+            instrumentation::rotatedPath(outPath.string(), files);
+        if (!std::filesystem::exists(path))
+            break;
+        const std::string json = readFile(path);
+        EXPECT_EQ(json.rfind("{\"otherData\": {},\"traceEvents\":[", 0), 0u);
+        EXPECT_EQ(json.rfind("]}"), json.size() - 2);
+        totalEvents += countOccurrences(json, "\"ph\":\"X\"");
+        if (files > 0)
+            std::filesystem::remove(path);
+    }
+    EXPECT_GT(files, 2u);
+    EXPECT_EQ(totalEvents, 200);
+}
+
+TEST_F(TraceWriterTest, Rotation_AfterDuration_CarriesThreadNamesAndScopes)
+{
+    // Arrange: every record is handed to the writer on its own
+    SessionOptions options;
+    options.bufferSize = 1;
+    options.scopeEvents = ScopeEvents::BeginEnd;
+    options.rotation.maxDuration = std::chrono::seconds(1);
+
+    // Act: the scope is still open when the first file expires
+    Instrumentor::get().beginSession("Rotating", outPath.string(), options);
+    Instrumentor::get().setThreadName("Main");
+    {
+        InstrumentationTimer outer("Outer");
+        std::this_thread::sleep_for(std::chrono::milliseconds(1100));
+        InstrumentationTimer inner("Inner");
+    }
+    Instrumentor::get().endSession();
+
+    // Assert: each file names the thread and balances its own scopes
+    std::vector<std::string> files;
+    for (std::size_t i = 0;; ++i)
+    {
+        const std::filesystem::path path =
+            instrumentation::rotatedPath(outPath.string(), i);
+        if (!std::filesystem::exists(path))
+            break;
+        files.push_back(readFile(path));
+        if (i > 0)
+            std::filesystem::remove(path);
+    }
+    ASSERT_EQ(files.size(), 2u);
+    for (const std::string &json : files)
+    {
+        EXPECT_EQ(countOccurrences(json, "\"args\":{\"name\":\"Main\"}"), 1);
+        EXPECT_EQ(countOccurrences(json, "\"name\":\"Outer\",\"ph\":\"B\""),
+                  1);
+        EXPECT_EQ(countOccurrences(json, "\"name\":\"Outer\",\"ph\":\"E\""),
+                  1);
+        EXPECT_EQ(json.rfind("]}"), json.size() - 2);
+    }
+    EXPECT_EQ(files[0].find("Inner"), std::string::npos);
+    EXPECT_EQ(countOccurrences(files[1], "\"name\":\"Inner\""), 2);
+}